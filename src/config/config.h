@@ -26,9 +26,18 @@
  * Syncing time with an NTP server
  */
 #define NTP_TIME_SYNC_ENABLED true
-#define NTP_SERVER "pool.ntp.org"
-#define NTP_OFFSET_SECONDS 3600
-#define NTP_UPDATE_INTERVAL_MS (5 * 60 * 1000)
+#define NTP_SERVERS "0.pool.ntp.org,1.pool.ntp.org,2.pool.ntp.org"	// all queried every round, "host,host"
+#define NTP_TIMEZONE "CET-1CEST,M3.5.0,M10.5.0/3"	// POSIX TZ of the local time in logs, the clock itself is UTC
+#define NTP_MIN_POLL_S 64					// poll interval while the drift estimate settles
+#define NTP_MAX_POLL_S 1024					// poll interval once rounds land within NTP_STABLE_US
+#define NTP_RETRY_S 16						// poll interval while no server answers
+#define NTP_BURST 4							// requests per server and round, the fastest answer counts
+#define NTP_BURST_GAP_MS 2000
+#define NTP_TIMEOUT_MS 1000
+#define NTP_STABLE_US 1000					// prediction error below which the poll interval doubles
+#define NTP_AGREE_US 5000					// servers further from the median (beyond their own error) are ignored
+#define CLOCK_STEP_THRESHOLD_MS 128			// larger NTP corrections step the clock, smaller ones are slewed
+#define CLOCK_SLEW_MAX_PPM 500				// slew rate, 1 second takes 2000 seconds to correct
 
 
 /**
@@ -44,9 +53,9 @@
 #define MIN_AP_PASSWORD_SIZE 8
 #define SSID_MAX_LEN 32
 #define PASS_MAX_LEN 64
-#define WIFICHECK_INTERVAL 1000L
-#define CONFIG_FILENAME F("/wifi_cred.dat")
-#define LAST_PARAMS_FILENAME F("/wifi_last_params.dat")
+#define WIFICHECK_INTERVAL 1000L			// wifi task heartbeat, reconnection is event driven
+#define CONFIG_FILENAME "/wifi_cred.dat"				// ConfigStore records, see configStore.h
+#define LAST_PARAMS_FILENAME "/wifi_last_params.dat"
 #define USING_CORS_FEATURE false
 #define USE_DHCP_IP true
 #define USE_CONFIGURABLE_DNS true
@@ -74,6 +83,58 @@
 
 #define WIFI_MULTI_CONNECT_WAITING_MS 500L
 
+//
+// reconnection after a lost link: jittered exponential backoff between attempts
+//
+
+#define WIFI_BACKOFF_MIN_MS 1000			// delay after the first failed attempt
+#define WIFI_BACKOFF_MAX_MS 30000			// backoff limit, attempts never stop
+#define WIFI_BACKOFF_SCAN_MAX_MS 3000		// limit while the AP is missing or full, catches flapping routers
+#define WIFI_FAST_RETRIES 2					// same BSSID attempts before scanning
+
+//
+// roaming to a stronger access point of the connected SSID
+//
+
+#define ROAM_ENABLED 0						// set to 1 where several APs share the SSID
+#define ROAM_CHANNELS ((1 << 1) | (1 << 6) | (1 << 11))	// always scanned, channels seen in full scans are added
+#define ROAM_SCAN_INTERVAL_S 300			// background scan interval
+#define ROAM_SCAN_INTERVAL_WEAK_S 60		// background scan interval while the signal is weak
+#define ROAM_RSSI_WEAK_DBM -72				// average RSSI below which the signal is weak
+#define ROAM_HYSTERESIS_DB 8				// a candidate has to be this much stronger than the average
+#define ROAM_MIN_INTERVAL_S 600				// minimal time between roams
+#define ROAM_SCAN_DWELL_MS 80				// time spent on each scanned channel
+#define ROAM_RSSI_SAMPLE_S 10				// RSSI history interval
+#define ROAM_RSSI_HISTORY 60				// RSSI history length
+#define ROAM_EVENT_HISTORY 16				// roam events kept for /diag/wifi
+
+//
+// multi SSID connect: learned channels are scanned first, candidates ranked by RSSI, success rate and connect time
+//
+
+#define WIFI_CREDENTIALS_MAX 8				// stored networks, each config portal run adds or updates NUM_WIFI_CREDENTIALS
+#define WIFI_SCAN_DWELL_MS 120				// active scan time per channel
+#define WIFI_CONNECT_CANDIDATES 2			// candidates tried per scan
+#define WIFI_RANK_SUCCESS_DB 20.0f			// score of a 100% success rate, in dB of RSSI
+#define WIFI_RANK_CONNECT_DB_PER_S 4.0f		// score penalty per second of average connect time
+#define WIFI_HISTORY_FILENAME "/wifi_history.dat"
+
+//
+// WiFi power save (utils/powerSave.h), the profile can be changed at runtime via /power?profile=<name>
+//
+
+#define POWER_SAVE_PROFILE 0				// default profile: 0 latency (radio always on, as before profiles existed), 1 balanced, 2 power
+#define POWER_SAVE_BOOST_LEASE_MS 10000		// OTA and upload boosts end this long after the last progress
+#define POWER_SAVE_PROBE_INTERVAL_S 30		// gateway round trip interval, not inbound latency (tools/power_probe.py)
+#define POWER_SAVE_PROBE_TIMEOUT_MS 1000	// a probe without reply in this time counts as lost
+
+//
+// warm reboots reuse the last BSSID, channel and DHCP lease kept in RTC memory
+//
+
+#define WIFI_RTC_FAST_PATH 1				// set to 0 to always read SPIFFS and run DHCP
+#define WIFI_RTC_LEASE_MARGIN_S 60			// stop using a cached lease this long before its renewal time
+
 //
 // debug uart speed
 //
@@ -106,6 +167,7 @@
 
 #define BRIGHTNESS_MIN	10	// LED brightness (min) - range <0;100>
 #define BRIGHTNESS		100	// LED brightness (default) - range <0;100>
+#define BRIGHTNESS_MAX	100	// LED brightness (max)
 
 // altitude in meters
 #define ALTITUDE	134
@@ -145,4 +207,165 @@
 #else
 #define ARDUINO_RUNNING_CORE 1
 #endif
-#endif
\ No newline at end of file
+#endif
+
+//
+// Static web assets (gzipped, served from the "www" flash partition)
+//
+
+#define WEB_ASSETS_PARTITION	"www"
+#define WEB_ASSETS_SUBTYPE		0x40
+#define WEB_ASSETS_MAX			32
+#define WEB_ASSETS_MAX_AGE		31536000	// cache lifetime of non-html assets (seconds)
+
+//
+// HTTP admission control
+//
+
+#define HTTP_MAX_INFLIGHT				8			// requests processed at once (all clients)
+#define HTTP_MAX_INFLIGHT_PER_CLIENT	2			// requests processed at once (per remote IP)
+#define HTTP_RATE_LIMIT_RPS				5			// sustained requests per second per remote IP
+#define HTTP_RATE_LIMIT_BURST			10			// token bucket size per remote IP
+#define HTTP_RATE_LIMIT_CLIENTS			16			// number of tracked remote IPs
+#define HTTP_LOW_HEAP_ENTER				(24 * 1024)	// free heap below which only cached /get is served
+#define HTTP_LOW_HEAP_LEAVE				(32 * 1024)	// free heap above which normal service resumes
+#define HTTP_RETRY_AFTER_S				10			// Retry-After value for rejected requests
+
+//
+// Sensor sample stream
+//
+
+#define SENSOR_MAX_LISTENERS	8		// max number of sensorSubscribe() listeners
+
+//
+// Sample history (RAM ring buffer, PSRAM is used when available)
+//
+
+#define HISTORY_CAPACITY			8640	// samples kept with PSRAM (24 hours at 10 s)
+#define HISTORY_CAPACITY_NO_PSRAM	360		// samples kept without PSRAM (1 hour at 10 s, 5.6 KB of internal heap)
+
+//
+// Boot phase timeline (/diag/boot), kept in RTC memory across reboots
+//
+
+#define BOOT_TRACE_HISTORY			4		// boots kept, including the current one
+
+//
+// MQTT publisher
+//
+
+#define MQTT_ENABLED			0					// set to 1 to publish samples over MQTT
+#define MQTT_HOST				"mqtt.local"
+#define MQTT_PORT				1883
+#define MQTT_USER				""					// empty = no authentication
+#define MQTT_PASSWORD			""
+#define MQTT_TOPIC_PREFIX		"vindriktning"		// topics are <prefix>/<hostname>/<channel>
+#define MQTT_QOS				1					// 0, 1 or 2
+#define MQTT_BATCH_SIZE			0					// 0 = one message per channel, N = batches of N samples to <prefix>/<hostname>/samples
+#define MQTT_RAM_QUEUE			64					// samples kept in RAM while offline
+#define MQTT_SPOOL_FILENAME		"/mqtt_spool.dat"	// samples spilled to flash when the RAM queue is full
+#define MQTT_SPOOL_POS_FILENAME	"/mqtt_spool.pos"	// number of spooled samples already published
+#define MQTT_SPOOL_MAX_SAMPLES	4096
+#define MQTT_RECONNECT_MS		5000
+
+//
+// InfluxDB line protocol writer
+//
+
+#define INFLUX_ENABLED				0		// set to 1 to push samples to InfluxDB
+#define INFLUX_URL					"http://influx.local:8086/api/v2/write?org=home&bucket=vindriktning&precision=ms"	// v1: http://host:8086/write?db=vindriktning&precision=ms
+#define INFLUX_TOKEN				""		// empty = no Authorization header
+#define INFLUX_MEASUREMENT			"vindriktning"
+#define INFLUX_BATCH_SIZE			30		// samples per write request
+#define INFLUX_BATCH_INTERVAL_S		300		// write a partial batch after this many seconds
+#define INFLUX_GZIP					1		// gzip request bodies
+#define INFLUX_SPILL_SAMPLES		256		// samples kept in RAM while writes fail, oldest are dropped
+#define INFLUX_BACKOFF_MIN_MS		2000	// first retry delay, doubles with every failure
+#define INFLUX_BACKOFF_MAX_MS		300000
+#define INFLUX_HTTP_TIMEOUT_MS		5000
+
+//
+// CoAP read endpoint (coap://<device>/get, CBOR or JSON, Observe supported)
+//
+
+#define COAP_ENABLED				0		// set to 1 to serve the /get snapshot over CoAP
+#define COAP_PORT					5683
+#define COAP_MAX_OBSERVERS			8
+#define COAP_OBSERVE_CON_INTERVAL	30		// every Nth notification is confirmable and retransmitted until acknowledged, observers that never acknowledge are dropped
+
+//
+// Multicast telemetry beacons (see utils/beacon.h for the datagram layout)
+//
+
+#define BEACON_ENABLED			0					// set to 1 to multicast every sensor cycle
+#define BEACON_GROUP			239, 255, 77, 77	// multicast group
+#define BEACON_PORT				47777
+#define BEACON_KEY				"vindriktning"		// HMAC-SHA256 key shared with the collector, change it!
+
+//
+// Latest reading in the mDNS TXT records of the _http._tcp service
+//
+
+#define MDNS_TXT_ENABLED			0		// set to 1 to advertise the latest reading
+#define MDNS_TXT_MIN_INTERVAL_MS	60000	// every update is announced, keep it slow
+
+//
+// Fleet aggregator (/fleet and /fleet/events on this unit merge all peers)
+//
+
+#define FLEET_ENABLED				0		// set to 1 on the unit acting as aggregator
+#define FLEET_MAX_PEERS				16
+#define FLEET_MAX_INFLIGHT			4		// concurrent peer requests
+#define FLEET_POLL_INTERVAL_MS		10000	// peer snapshot refresh
+#define FLEET_BROWSE_INTERVAL_MS	60000	// mDNS peer discovery
+#define FLEET_FETCH_TIMEOUT_S		3
+#define FLEET_STATIC_PEERS			""		// extra peers not announced over mDNS, "ip:port,ip:port"
+#define FLEET_EVENTS_BOOST_MS		(3 * FLEET_POLL_INTERVAL_MS)	// power save boost while /fleet/events has subscribers
+
+//
+// Modbus TCP server (register map in tasks/modbusTask.h)
+//
+
+#define MODBUS_ENABLED				0		// set to 1 to expose the sensors to building management systems
+#define MODBUS_PORT					502
+#define MODBUS_MAX_CLIENTS			4
+#define MODBUS_IDLE_TIMEOUT_S		60		// connections without requests are closed
+
+//
+// HTTPS listener for the read-only API (/get, /rssi, /metrics), see tasks/tlsTask.h
+//
+
+#define TLS_ENABLED					0		// set to 1 where plaintext HTTP is not allowed
+#define TLS_PORT					443
+#define TLS_CERT_FILE				"/tls_cert.pem"	// SPIFFS, a self-signed one is generated when missing
+#define TLS_KEY_FILE				"/tls_key.pem"
+#define TLS_SESSION_CACHE_SIZE		8		// cached session IDs, at least the number of pollers
+#define TLS_SESSION_TIMEOUT_S		86400	// lifetime of cached sessions and tickets
+#define TLS_TIMEOUT_MS				3000	// handshake / keep-alive idle timeout, ends early when others connect
+
+//
+// Logging (LOG_ERROR/LOG_WARNING/LOG_INFO/LOG_DEBUG), see utils/logRing.h and utils/logRecord.h
+//
+
+#define LOG_RING_SIZE				8192	// bytes, power of two, messages beyond it are dropped and counted
+#define LOG_DRAIN_INTERVAL_MS		50		// drain task wakeup without new messages
+#define LOG_HISTORY_SIZE			4096	// bytes of recent records kept for /log and /log.bin
+#define LOG_SERIAL_SINK				1		// 0: format only while a telnet client is connected
+
+// compiled in levels: 0 off, 1 error, 2 warning, 3 info, 4 debug
+#define LOG_LEVEL					3
+#define LOG_LEVEL_MAIN				LOG_LEVEL
+#define LOG_LEVEL_WIFI				LOG_LEVEL
+#define LOG_LEVEL_NTP				LOG_LEVEL
+#define LOG_LEVEL_SENSOR			LOG_LEVEL
+#define LOG_LEVEL_SERVER			4		// per request messages, enabled at runtime
+#define LOG_LEVEL_OTA				LOG_LEVEL
+#define LOG_LEVEL_MQTT				LOG_LEVEL
+#define LOG_LEVEL_INFLUX			LOG_LEVEL
+#define LOG_LEVEL_COAP				LOG_LEVEL
+#define LOG_LEVEL_FLEET				LOG_LEVEL
+#define LOG_LEVEL_MODBUS			LOG_LEVEL
+#define LOG_LEVEL_TLS				LOG_LEVEL
+#define LOG_LEVEL_DISPLAY			LOG_LEVEL
+#define LOG_LEVEL_POWER				LOG_LEVEL
+#define LOG_RUNTIME_LEVEL			3		// initial runtime level of every module, /log/level changes it
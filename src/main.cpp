@@ -5,30 +5,61 @@
 #include "utils/SerialAndTelnetInit.h"
 #include "utils/watchdog.h"
 #include "utils/display.h"
+#include "utils/metrics.h"
+#include "utils/history.h"
+#include "utils/beacon.h"
+#include "utils/mdnsTxt.h"
+#include "utils/bootTrace.h"
+#include "utils/powerSave.h"
 #include "tasks/wifiTask.h"
 #include "tasks/ntpTask.h"
 #include "tasks/otaTask.h"
 #include "tasks/sensorTask.h"
 #include "tasks/serverTask.h"
+#include "tasks/mqttTask.h"
+#include "tasks/influxTask.h"
+#include "tasks/coapTask.h"
+#include "tasks/fleetTask.h"
+#include "tasks/modbusTask.h"
+#include "tasks/tlsTask.h"
 
 void setup()
 {
+	// start the boot timeline first so it covers everything below
+	bootTraceInit();
+
 	//
 	// make sure wifi is initialized before calling anything else
 	//
 
 	WiFi.mode(WIFI_OFF);
 	WiFi.mode(WIFI_MODE_STA);
-	WiFi.setSleep(false);
 
-	// init serial/telnet
+	// init serial/telnet and the log drain task
 	SerialAndTelnetInit::init();
+	logInit();
+
+	// init metrics registry
+	metricsInit();
+
+	// apply the stored WiFi power save profile
+	powerSaveInit();
+
+	// init sample history
+	historyInit();
+
+	// init multicast beacons
+	beaconInit();
+
+	// init mDNS TXT readings
+	mdnsTxtInit();
 
 	// init watchdog
 	watchdogInit();
 
 	// initialize display
 	Display::instance();
+	bootTraceMark(eBootPhaseDisplay);
 
 	//
 	// start sensor task
@@ -74,6 +105,7 @@ void setup()
 	//
 
 	wifiWaitForConnection();
+	bootTraceMark(eBootPhaseConnectedSeen);
 
 	//
 	// now start the server task and NTP task
@@ -103,6 +135,97 @@ void setup()
 	);
 #endif
 
+#if (MQTT_ENABLED == 1)
+	//
+	// publish samples over MQTT
+	//
+
+	xTaskCreatePinnedToCore(
+		mqttTask,
+		"mqttTask",		 // Task name
+		8192,			 // Stack size (bytes)
+		NULL,			 // Parameter
+		1,				 // Task priority
+		NULL,			 // Task handle
+		ARDUINO_RUNNING_CORE);
+#endif
+
+#if (INFLUX_ENABLED == 1)
+	//
+	// push samples to InfluxDB
+	//
+
+	xTaskCreatePinnedToCore(
+		influxTask,
+		"influxTask",	 // Task name
+		8192,			 // Stack size (bytes)
+		NULL,			 // Parameter
+		1,				 // Task priority
+		NULL,			 // Task handle
+		ARDUINO_RUNNING_CORE);
+#endif
+
+#if (COAP_ENABLED == 1)
+	//
+	// CoAP read endpoint
+	//
+
+	xTaskCreatePinnedToCore(
+		coapTask,
+		"coapTask",		 // Task name
+		6144,			 // Stack size (bytes)
+		NULL,			 // Parameter
+		1,				 // Task priority
+		NULL,			 // Task handle
+		ARDUINO_RUNNING_CORE);
+#endif
+
+#if (FLEET_ENABLED == 1)
+	//
+	// fleet aggregator
+	//
+
+	xTaskCreatePinnedToCore(
+		fleetTask,
+		"fleetTask",	 // Task name
+		8192,			 // Stack size (bytes)
+		NULL,			 // Parameter
+		1,				 // Task priority
+		NULL,			 // Task handle
+		ARDUINO_RUNNING_CORE);
+#endif
+
+#if (MODBUS_ENABLED == 1)
+	//
+	// Modbus TCP server
+	//
+
+	xTaskCreatePinnedToCore(
+		modbusTask,
+		"modbusTask",	 // Task name
+		4096,			 // Stack size (bytes)
+		NULL,			 // Parameter
+		1,				 // Task priority
+		NULL,			 // Task handle
+		ARDUINO_RUNNING_CORE);
+#endif
+
+#if (TLS_ENABLED == 1)
+	//
+	// HTTPS listener
+	//
+
+	xTaskCreatePinnedToCore(
+		tlsTask,
+		"tlsTask",		 // Task name
+		12288,			 // Stack size (bytes)
+		NULL,			 // Parameter
+		1,				 // Task priority
+		NULL,			 // Task handle
+		ARDUINO_RUNNING_CORE);
+#endif
+
+	bootTraceMark(eBootPhaseSetupDone);
 }
 
 void loop()
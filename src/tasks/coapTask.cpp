@@ -0,0 +1,651 @@
+#define LOG_MODULE eLogModuleCoap
+
+#include <Arduino.h>
+#include <AsyncUDP.h>
+#include <ArduinoJson.h>
+
+#include "config.h"
+#include "utils.h"
+#include "metrics.h"
+#include "snapshot.h"
+#include "cbor.h"
+
+#include "coapTask.h"
+#include "sensorTask.h"
+#include "wifiTask.h"
+
+#if (COAP_ENABLED == 1)
+
+#define COAP_VERSION				1
+#define COAP_MAX_TOKEN				8
+#define COAP_MESSAGE_SIZE			512
+#define COAP_DOCUMENT_SIZE			512
+#define COAP_PAYLOAD_MARKER			0xff
+#define COAP_MAX_AGE_S				10		// one sensor cycle
+
+// transmission parameters (RFC 7252, 4.8)
+#define COAP_ACK_TIMEOUT_MS			2000
+#define COAP_ACK_RANDOM_FACTOR_PCT	150
+#define COAP_MAX_RETRANSMIT			4
+
+// message types
+#define COAP_TYPE_CON				0
+#define COAP_TYPE_NON				1
+#define COAP_TYPE_ACK				2
+#define COAP_TYPE_RST				3
+
+// codes (class << 5 | detail)
+#define COAP_CODE_EMPTY				0x00
+#define COAP_CODE_GET				0x01
+#define COAP_CODE_CONTENT			0x45	// 2.05
+#define COAP_CODE_BAD_OPTION		0x82	// 4.02
+#define COAP_CODE_NOT_FOUND			0x84	// 4.04
+#define COAP_CODE_NOT_ALLOWED		0x85	// 4.05
+#define COAP_CODE_NOT_ACCEPTABLE	0x86	// 4.06
+
+// options
+#define COAP_OPTION_OBSERVE			6
+#define COAP_OPTION_URI_PATH		11
+#define COAP_OPTION_CONTENT_FORMAT	12
+#define COAP_OPTION_MAX_AGE			14
+#define COAP_OPTION_ACCEPT			17
+
+// content formats
+#define COAP_FORMAT_LINK			40
+#define COAP_FORMAT_JSON			50
+#define COAP_FORMAT_CBOR			60
+#define COAP_FORMAT_NONE			0xffff
+
+#define COAP_WELL_KNOWN_CORE		"</get>;ct=\"60 50\";obs;rt=\"vindriktning.sensors\""
+
+//
+// CoAP (RFC 7252) read endpoint with Observe (RFC 7641)
+//
+// GET coap://<device>/get returns the /get snapshot in a single datagram,
+// CBOR by default or JSON with Accept: 50. Observers are notified after
+// every sensor cycle. Every COAP_OBSERVE_CON_INTERVAL-th notification is
+// confirmable and retransmitted with exponential backoff (RFC 7252, 4.2),
+// one at a time per observer; an observer that acknowledges none of the
+// transmissions is dropped (RFC 7641, 4.5).
+//
+
+class CoapTaskCtx {
+private:
+	AsyncUDP m_udp;
+	TaskHandle_t m_task;
+	SemaphoreHandle_t m_mutex;
+	uint16_t m_nextMid;
+	uint32_t m_observeSeq;
+
+	struct Request {
+		uint8_t m_type;
+		uint8_t m_code;
+		uint16_t m_mid;
+		uint8_t m_token[COAP_MAX_TOKEN];
+		uint8_t m_tokenLen;
+		char m_path[32];
+		int32_t m_observe;		// -1 = not present
+		uint16_t m_accept;		// COAP_FORMAT_NONE = not present
+		bool m_badOption;		// unknown critical option
+	};
+
+	struct Observer {
+		bool m_used;
+		uint32_t m_ip;			// IPv4, kept as integer so the table stays POD
+		uint16_t m_port;
+		uint8_t m_token[COAP_MAX_TOKEN];
+		uint8_t m_tokenLen;
+		uint16_t m_format;
+		uint16_t m_conMid;		// MID of the last confirmable notification
+		bool m_conPending;		// ... which has not been acknowledged yet
+		uint8_t m_conRetransmits;
+		uint32_t m_conTimeoutMs;	// current retransmission timeout, doubles every time
+		uint32_t m_conDeadlineMs;	// millis() of the next retransmission
+		uint32_t m_notifications;
+	} m_observers[COAP_MAX_OBSERVERS];
+
+	//
+	// message encoding
+	//
+
+	class Message {
+	private:
+		uint8_t m_buf[COAP_MESSAGE_SIZE];
+		size_t m_len;
+		uint16_t m_lastOption;
+
+	public:
+		Message(const uint8_t &type, const uint8_t &code, const uint16_t &mid, const uint8_t *token, const uint8_t &tokenLen)
+			: m_len(4 + tokenLen)
+			, m_lastOption(0)
+		{
+			m_buf[0] = (COAP_VERSION << 6) | (type << 4) | tokenLen;
+			m_buf[1] = code;
+			m_buf[2] = mid >> 8;
+			m_buf[3] = mid & 0xff;
+			memcpy(m_buf + 4, token, tokenLen);
+		}
+
+		// options have to be added in ascending order
+		void option(const uint16_t &number, const uint8_t *value, const size_t &len)
+		{
+			uint16_t delta = number - m_lastOption;
+			m_lastOption = number;
+
+			uint8_t *header = m_buf + m_len++;
+			*header = 0;
+
+			// delta and length nibbles with 1 or 2 extension bytes
+			uint16_t fields[2] = { delta, (uint16_t)len };
+			for (int i = 0; i < 2; i++) {
+				uint8_t nibble;
+				if (fields[i] < 13) {
+					nibble = fields[i];
+				} else if (fields[i] < 269) {
+					nibble = 13;
+					m_buf[m_len++] = fields[i] - 13;
+				} else {
+					nibble = 14;
+					m_buf[m_len++] = (fields[i] - 269) >> 8;
+					m_buf[m_len++] = (fields[i] - 269) & 0xff;
+				}
+				*header |= nibble << (i ? 0 : 4);
+			}
+
+			memcpy(m_buf + m_len, value, len);
+			m_len += len;
+		}
+
+		void option(const uint16_t &number, uint32_t value)
+		{
+			// unsigned integers use the minimal number of bytes
+			uint8_t buf[4];
+			size_t len = 0;
+			for (int shift = 24; shift >= 0; shift -= 8) {
+				if (len || (value >> shift) & 0xff) {
+					buf[len++] = (value >> shift) & 0xff;
+				}
+			}
+			option(number, buf, len);
+		}
+
+		// returns buffer for the payload
+		uint8_t *payload(size_t &maxLen)
+		{
+			m_buf[m_len++] = COAP_PAYLOAD_MARKER;
+			maxLen = sizeof(m_buf) - m_len;
+			return m_buf + m_len;
+		}
+
+		void commit(const size_t &payloadLen)
+		{
+			// an empty payload must not have the marker
+			if (payloadLen) {
+				m_len += payloadLen;
+			} else {
+				m_len--;
+			}
+		}
+
+		const uint8_t *data() const { return m_buf; }
+		size_t length() const { return m_len; }
+	};
+
+	// used from both the UDP callback and the task
+	uint16_t nextMid()
+	{
+		return __atomic_fetch_add(&m_nextMid, 1, __ATOMIC_RELAXED);
+	}
+
+	//
+	// message decoding
+	//
+
+	bool parse(const uint8_t *data, const size_t &len, Request &request)
+	{
+		if (len < 4 || (data[0] >> 6) != COAP_VERSION) {
+			return false;
+		}
+
+		request.m_type = (data[0] >> 4) & 0x03;
+		request.m_tokenLen = data[0] & 0x0f;
+		request.m_code = data[1];
+		request.m_mid = (data[2] << 8) | data[3];
+		request.m_path[0] = 0;
+		request.m_observe = -1;
+		request.m_accept = COAP_FORMAT_NONE;
+		request.m_badOption = false;
+
+		if (request.m_tokenLen > COAP_MAX_TOKEN || 4 + request.m_tokenLen > len) {
+			return false;
+		}
+		memcpy(request.m_token, data + 4, request.m_tokenLen);
+
+		size_t pos = 4 + request.m_tokenLen;
+		uint16_t number = 0;
+		size_t pathLen = 0;
+
+		while (pos < len && data[pos] != COAP_PAYLOAD_MARKER) {
+			uint32_t fields[2] = { (uint32_t)data[pos] >> 4, (uint32_t)data[pos] & 0x0f };
+			pos++;
+
+			for (int i = 0; i < 2; i++) {
+				if (fields[i] == 13) {
+					if (pos + 1 > len) {
+						return false;
+					}
+					fields[i] = data[pos] + 13;
+					pos += 1;
+				} else if (fields[i] == 14) {
+					if (pos + 2 > len) {
+						return false;
+					}
+					fields[i] = ((data[pos] << 8) | data[pos + 1]) + 269;
+					pos += 2;
+				} else if (fields[i] == 15) {
+					return false;
+				}
+			}
+
+			number += fields[0];
+			const uint8_t *value = data + pos;
+			size_t valueLen = fields[1];
+			if (pos + valueLen > len) {
+				return false;
+			}
+			pos += valueLen;
+
+			uint32_t uintValue = 0;
+			for (size_t i = 0; i < valueLen && i < 4; i++) {
+				uintValue = (uintValue << 8) | value[i];
+			}
+
+			switch (number) {
+			case COAP_OPTION_URI_PATH:
+				// segments are joined with '/'
+				if (pathLen + valueLen + 2 > sizeof(request.m_path)) {
+					return false;
+				}
+				if (pathLen) {
+					request.m_path[pathLen++] = '/';
+				}
+				memcpy(request.m_path + pathLen, value, valueLen);
+				pathLen += valueLen;
+				request.m_path[pathLen] = 0;
+				break;
+			case COAP_OPTION_OBSERVE:
+				request.m_observe = uintValue;
+				break;
+			case COAP_OPTION_ACCEPT:
+				request.m_accept = uintValue;
+				break;
+			default:
+				// unknown critical (odd) options must be rejected
+				if (number & 1) {
+					request.m_badOption = true;
+				}
+				break;
+			}
+		}
+
+		return true;
+	}
+
+	//
+	// payloads
+	//
+
+	size_t snapshot(const uint16_t &format, uint8_t *buffer, const size_t &maxLen)
+	{
+		StaticJsonDocument<COAP_DOCUMENT_SIZE> doc;
+		snapshotSensors(doc);
+
+		if (format == COAP_FORMAT_JSON) {
+			return serializeJson(doc, (char *)buffer, maxLen);
+		}
+		return serializeCbor(doc, buffer, maxLen);
+	}
+
+	//
+	// observers
+	//
+
+	bool observe(const uint32_t &ip, const uint16_t &port, const Request &request, const uint16_t &format)
+	{
+		bool ret = false;
+		if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+			Observer *slot = NULL;
+			for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+				Observer &observer = m_observers[i];
+
+				// re-registration replaces the existing entry
+				if (observer.m_used && observer.m_ip == ip && observer.m_port == port
+					&& observer.m_tokenLen == request.m_tokenLen && !memcmp(observer.m_token, request.m_token, request.m_tokenLen)) {
+					slot = &observer;
+					break;
+				}
+				if (!observer.m_used && !slot) {
+					slot = &observer;
+				}
+			}
+
+			if (slot) {
+				memset((void *)slot, 0, sizeof(*slot));
+				slot->m_used = true;
+				slot->m_ip = ip;
+				slot->m_port = port;
+				memcpy(slot->m_token, request.m_token, request.m_tokenLen);
+				slot->m_tokenLen = request.m_tokenLen;
+				slot->m_format = format;
+				ret = true;
+			}
+			updateObserverCount();
+			xSemaphoreGive(m_mutex);
+		}
+		return ret;
+	}
+
+	void forget(const uint32_t &ip, const uint16_t &port, const uint8_t *token, const uint8_t &tokenLen)
+	{
+		if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+			for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+				Observer &observer = m_observers[i];
+				if (observer.m_used && observer.m_ip == ip && observer.m_port == port
+					&& observer.m_tokenLen == tokenLen && !memcmp(observer.m_token, token, tokenLen)) {
+					observer.m_used = false;
+				}
+			}
+			updateObserverCount();
+			xSemaphoreGive(m_mutex);
+		}
+	}
+
+	// ACK / RST of a confirmable notification
+	void notificationReply(const uint32_t &ip, const uint16_t &port, const uint8_t &type, const uint16_t &mid)
+	{
+		if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+			for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+				Observer &observer = m_observers[i];
+				if (observer.m_used && observer.m_ip == ip && observer.m_port == port && observer.m_conMid == mid) {
+					if (type == COAP_TYPE_RST) {
+						// client is no longer interested
+						observer.m_used = false;
+					} else {
+						observer.m_conPending = false;
+					}
+				}
+			}
+			updateObserverCount();
+			xSemaphoreGive(m_mutex);
+		}
+	}
+
+	// must be called with the mutex held
+	void updateObserverCount()
+	{
+		uint32_t count = 0;
+		for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+			count += m_observers[i].m_used ? 1 : 0;
+		}
+		metricsSet(eMetricsCoapObservers, count);
+	}
+
+	void sendNotification(const Observer &observer, const bool &confirmable, const uint16_t &mid, uint8_t *cbor, size_t &cborLen, uint8_t *json, size_t &jsonLen)
+	{
+		Message message(confirmable ? COAP_TYPE_CON : COAP_TYPE_NON, COAP_CODE_CONTENT, mid, observer.m_token, observer.m_tokenLen);
+		message.option(COAP_OPTION_OBSERVE, m_observeSeq);
+		message.option(COAP_OPTION_CONTENT_FORMAT, observer.m_format);
+		message.option(COAP_OPTION_MAX_AGE, COAP_MAX_AGE_S);
+
+		// payloads are built once per format and call
+		size_t maxLen;
+		uint8_t *payload = message.payload(maxLen);
+		if (observer.m_format == COAP_FORMAT_JSON) {
+			jsonLen = jsonLen ? jsonLen : snapshot(COAP_FORMAT_JSON, json, COAP_DOCUMENT_SIZE);
+			memcpy(payload, json, (jsonLen < maxLen) ? jsonLen : 0);
+			message.commit((jsonLen < maxLen) ? jsonLen : 0);
+		} else {
+			cborLen = cborLen ? cborLen : snapshot(COAP_FORMAT_CBOR, cbor, COAP_DOCUMENT_SIZE);
+			memcpy(payload, cbor, (cborLen < maxLen) ? cborLen : 0);
+			message.commit((cborLen < maxLen) ? cborLen : 0);
+		}
+
+		m_udp.writeTo(message.data(), message.length(), IPAddress(observer.m_ip), observer.m_port);
+	}
+
+	void notify()
+	{
+		m_observeSeq = (m_observeSeq + 1) & 0xffffff;
+
+		uint8_t cbor[COAP_DOCUMENT_SIZE];
+		uint8_t json[COAP_DOCUMENT_SIZE];
+		size_t cborLen = 0;
+		size_t jsonLen = 0;
+
+		if (xSemaphoreTake(m_mutex, portMAX_DELAY) != pdTRUE) {
+			return;
+		}
+		Observer observers[COAP_MAX_OBSERVERS];
+		bool confirmable[COAP_MAX_OBSERVERS] = {};
+		for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+			Observer &observer = m_observers[i];
+			if (!observer.m_used) {
+				continue;
+			}
+
+			// every Nth notification is confirmable, unless the last one is still being retransmitted
+			observer.m_notifications++;
+			if ((observer.m_notifications % COAP_OBSERVE_CON_INTERVAL) == 0 && !observer.m_conPending) {
+				observer.m_conPending = true;
+				observer.m_conMid = nextMid();
+				observer.m_conRetransmits = 0;
+				observer.m_conTimeoutMs = COAP_ACK_TIMEOUT_MS + esp_random() % (COAP_ACK_TIMEOUT_MS * (COAP_ACK_RANDOM_FACTOR_PCT - 100) / 100);
+				observer.m_conDeadlineMs = millis() + observer.m_conTimeoutMs;
+				confirmable[i] = true;
+			}
+		}
+		memcpy((void *)observers, (void *)m_observers, sizeof(observers));
+		xSemaphoreGive(m_mutex);
+
+		// sent outside of the lock
+		for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+			if (observers[i].m_used) {
+				sendNotification(observers[i], confirmable[i], confirmable[i] ? observers[i].m_conMid : nextMid(), cbor, cborLen, json, jsonLen);
+				metricsIncrement(eMetricsCoapNotifications);
+			}
+		}
+	}
+
+	// resends unacknowledged confirmable notifications, with the current
+	// state and the same MID, so the ACK of any copy matches
+	void retransmit()
+	{
+		uint8_t cbor[COAP_DOCUMENT_SIZE];
+		uint8_t json[COAP_DOCUMENT_SIZE];
+		size_t cborLen = 0;
+		size_t jsonLen = 0;
+
+		if (xSemaphoreTake(m_mutex, portMAX_DELAY) != pdTRUE) {
+			return;
+		}
+		uint32_t now = millis();
+		Observer observers[COAP_MAX_OBSERVERS];
+		bool due[COAP_MAX_OBSERVERS] = {};
+		for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+			Observer &observer = m_observers[i];
+			if (!observer.m_used || !observer.m_conPending || (int32_t)(now - observer.m_conDeadlineMs) < 0) {
+				continue;
+			}
+
+			if (observer.m_conRetransmits >= COAP_MAX_RETRANSMIT) {
+				LOG_PRINTF("[CoAP] observer %s:%u stopped responding\n", IPAddress(observer.m_ip).toString().c_str(), observer.m_port);
+				observer.m_used = false;
+				continue;
+			}
+
+			observer.m_conRetransmits++;
+			observer.m_conTimeoutMs *= 2;
+			observer.m_conDeadlineMs = now + observer.m_conTimeoutMs;
+			due[i] = true;
+		}
+		memcpy((void *)observers, (void *)m_observers, sizeof(observers));
+		updateObserverCount();
+		xSemaphoreGive(m_mutex);
+
+		for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+			if (due[i]) {
+				sendNotification(observers[i], true, observers[i].m_conMid, cbor, cborLen, json, jsonLen);
+				metricsIncrement(eMetricsCoapRetransmits);
+			}
+		}
+	}
+
+	// time until the next retransmission is due
+	TickType_t retransmitWait()
+	{
+		TickType_t wait = portMAX_DELAY;
+		if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+			uint32_t now = millis();
+			for (int i = 0; i < COAP_MAX_OBSERVERS; i++) {
+				Observer &observer = m_observers[i];
+				if (observer.m_used && observer.m_conPending) {
+					int32_t remaining = observer.m_conDeadlineMs - now;
+					TickType_t ticks = (remaining > 0) ? pdMS_TO_TICKS(remaining) : 0;
+					wait = (ticks < wait) ? ticks : wait;
+				}
+			}
+			xSemaphoreGive(m_mutex);
+		}
+		return wait;
+	}
+
+	//
+	// request handling
+	//
+
+	void handlePacket(AsyncUDPPacket &packet)
+	{
+		int64_t startUs = esp_timer_get_time();
+
+		Request request;
+		if (!parse(packet.data(), packet.length(), request)) {
+			return;
+		}
+
+		// replies to our confirmable notifications
+		if (request.m_type == COAP_TYPE_ACK || request.m_type == COAP_TYPE_RST) {
+			notificationReply((uint32_t)packet.remoteIP(), packet.remotePort(), request.m_type, request.m_mid);
+			return;
+		}
+
+		// empty CON is a ping, answered with RST
+		if (request.m_code == COAP_CODE_EMPTY) {
+			if (request.m_type == COAP_TYPE_CON) {
+				Message reply(COAP_TYPE_RST, COAP_CODE_EMPTY, request.m_mid, NULL, 0);
+				packet.write(reply.data(), reply.length());
+			}
+			return;
+		}
+
+		metricsIncrement(eMetricsCoapRequests);
+
+		uint8_t code = COAP_CODE_CONTENT;
+		uint16_t format = COAP_FORMAT_NONE;
+
+		if (request.m_badOption) {
+			code = COAP_CODE_BAD_OPTION;
+		} else if (request.m_code != COAP_CODE_GET) {
+			code = COAP_CODE_NOT_ALLOWED;
+		} else if (!strcmp(request.m_path, "get")) {
+			format = (request.m_accept == COAP_FORMAT_NONE) ? COAP_FORMAT_CBOR : request.m_accept;
+			if (format != COAP_FORMAT_CBOR && format != COAP_FORMAT_JSON) {
+				code = COAP_CODE_NOT_ACCEPTABLE;
+			}
+		} else if (!strcmp(request.m_path, ".well-known/core")) {
+			format = COAP_FORMAT_LINK;
+		} else {
+			code = COAP_CODE_NOT_FOUND;
+		}
+
+		// confirmable requests get a piggybacked response
+		bool confirmable = (request.m_type == COAP_TYPE_CON);
+		Message reply(confirmable ? COAP_TYPE_ACK : COAP_TYPE_NON, code,
+			confirmable ? request.m_mid : nextMid(), request.m_token, request.m_tokenLen);
+
+		if (code == COAP_CODE_CONTENT) {
+			size_t maxLen;
+			uint8_t *payload;
+
+			if (format == COAP_FORMAT_LINK) {
+				reply.option(COAP_OPTION_CONTENT_FORMAT, format);
+				payload = reply.payload(maxLen);
+				size_t len = strlen(COAP_WELL_KNOWN_CORE);
+				memcpy(payload, COAP_WELL_KNOWN_CORE, len);
+				reply.commit(len);
+			} else {
+				if (request.m_observe == 0 && observe((uint32_t)packet.remoteIP(), packet.remotePort(), request, format)) {
+					reply.option(COAP_OPTION_OBSERVE, m_observeSeq);
+				} else if (request.m_observe == 1) {
+					forget((uint32_t)packet.remoteIP(), packet.remotePort(), request.m_token, request.m_tokenLen);
+				}
+				reply.option(COAP_OPTION_CONTENT_FORMAT, format);
+				reply.option(COAP_OPTION_MAX_AGE, COAP_MAX_AGE_S);
+				payload = reply.payload(maxLen);
+				reply.commit(snapshot(format, payload, maxLen));
+			}
+		}
+
+		packet.write(reply.data(), reply.length());
+		metricsObserve(eMetricsCoapRequestTime, esp_timer_get_time() - startUs);
+	}
+
+public:
+	CoapTaskCtx()
+	{
+		m_task = NULL;
+		m_mutex = xSemaphoreCreateMutex();
+		m_nextMid = esp_random();
+		m_observeSeq = 0;
+		memset((void *)m_observers, 0, sizeof(m_observers));
+	}
+
+	void task()
+	{
+		m_task = xTaskGetCurrentTaskHandle();
+
+		if (!m_udp.listen(COAP_PORT)) {
+			LOG_PRINTF("[CoAP] unable to listen on port %d\n", COAP_PORT);
+			vTaskDelete(NULL);
+			return;
+		}
+		LOG_PRINTF("[CoAP] listening on port %d\n", COAP_PORT);
+
+		m_udp.onPacket([this](AsyncUDPPacket &packet) {
+			handlePacket(packet);
+		});
+
+		// wake up after every sensor cycle
+		sensorSubscribe([this](const SensorSample &sample) {
+			xTaskNotifyGive(m_task);
+		});
+
+		while (1) {
+			if (ulTaskNotifyTake(pdTRUE, retransmitWait())) {
+				notify();
+			}
+			retransmit();
+		}
+	}
+};
+
+static CoapTaskCtx g_ctx;
+
+void coapTask(void *pvParameters __attribute__((unused)))
+{
+	// wait until the network is connected
+	wifiWaitForConnection();
+
+	g_ctx.task();
+}
+
+#endif // COAP_ENABLED
@@ -0,0 +1,3 @@
+#pragma once
+
+void coapTask(void *pvParameters __attribute__((unused)));
@@ -0,0 +1,481 @@
+#define LOG_MODULE eLogModuleFleet
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ArduinoJson.h>
+#include <ESPmDNS.h>
+
+#include "WiFi.h"
+#include "config.h"
+#include "utils.h"
+#include "metrics.h"
+#include "snapshot.h"
+#include "powerSave.h"
+
+#include "fleetTask.h"
+#include "wifiTask.h"
+#include "ntpTask.h"
+
+#if (FLEET_ENABLED == 1)
+
+#define FLEET_HOST_LEN			32
+#define FLEET_BODY_MAX			384
+#define FLEET_RESPONSE_MAX		768
+#define FLEET_SELF_BUFFER_SIZE	512
+
+//
+// Fleet aggregator: browses mDNS for other units, fetches their /get
+// snapshots with a bounded number of concurrent requests and keeps a
+// merged view served as /fleet and pushed to /fleet/events.
+//
+
+class FleetTaskCtx {
+private:
+	struct Peer {
+		bool m_used;
+		char m_host[FLEET_HOST_LEN];
+		uint32_t m_ip;
+		uint16_t m_port;
+		bool m_static;			// from FLEET_STATIC_PEERS, never dropped
+		bool m_seen;			// present in the last mDNS browse
+		bool m_ok;				// last fetch succeeded
+		uint64_t m_updatedMs;	// compensatedMillis() of the last successful fetch
+		char m_body[FLEET_BODY_MAX];
+	};
+
+	// One request per peer slot, callbacks run in the AsyncTCP task and
+	// keep a pointer to it, so slots never move. The client belongs to the
+	// AsyncTCP task once connecting: it is deleted in its onDisconnect(),
+	// the last callback, which then hands the result to the fleet task
+	// through m_results. m_client is only used by the fleet task, as the
+	// in flight marker, and cleared when the result arrives.
+	struct Fetch {
+		FleetTaskCtx *m_ctx;
+		int m_index;
+		AsyncClient *m_client;
+		bool m_failed;			// error or timeout seen, written by the AsyncTCP task
+		char m_response[FLEET_RESPONSE_MAX];
+		size_t m_len;
+	};
+
+	struct Result {
+		int m_index;
+		bool m_ok;
+	};
+
+	Peer m_peers[FLEET_MAX_PEERS];
+	Fetch m_fetches[FLEET_MAX_PEERS];
+
+	// completed fetches, at most one per peer slot
+	QueueHandle_t m_results;
+
+	// requests in flight, only touched by the fleet task
+	uint32_t m_inFlight;
+
+	// guards m_json and m_events
+	SemaphoreHandle_t m_mutex;
+	String m_json;
+	AsyncEventSource *m_events;
+
+	uint32_t m_lastBrowseMs;
+
+	//
+	// peer discovery
+	//
+
+	int findPeer(const uint32_t &ip, const uint16_t &port)
+	{
+		for (int i = 0; i < FLEET_MAX_PEERS; i++) {
+			if (m_peers[i].m_used && m_peers[i].m_ip == ip && m_peers[i].m_port == port) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	int addPeer(const char *host, const uint32_t &ip, const uint16_t &port, const bool &isStatic)
+	{
+		int index = findPeer(ip, port);
+		if (index < 0) {
+			// free slot without a request still in flight
+			for (int i = 0; i < FLEET_MAX_PEERS && index < 0; i++) {
+				if (!m_peers[i].m_used && !m_fetches[i].m_client) {
+					index = i;
+				}
+			}
+			if (index < 0) {
+				return -1;
+			}
+			memset((void *)&m_peers[index], 0, sizeof(Peer));
+			m_peers[index].m_used = true;
+			m_peers[index].m_ip = ip;
+			m_peers[index].m_port = port;
+		}
+
+		Peer &peer = m_peers[index];
+		strncpy(peer.m_host, host, FLEET_HOST_LEN - 1);
+		peer.m_static = isStatic;
+		peer.m_seen = true;
+		return index;
+	}
+
+	int peerCount()
+	{
+		int count = 0;
+		for (int i = 0; i < FLEET_MAX_PEERS; i++) {
+			count += m_peers[i].m_used ? 1 : 0;
+		}
+		return count;
+	}
+
+	void addStaticPeers()
+	{
+		// "ip:port,ip:port,..."
+		String list = FLEET_STATIC_PEERS;
+		int start = 0;
+		while (start < (int)list.length()) {
+			int end = list.indexOf(',', start);
+			end = (end < 0) ? list.length() : end;
+			String entry = list.substring(start, end);
+			entry.trim();
+
+			int colon = entry.indexOf(':');
+			IPAddress ip;
+			if (ip.fromString(colon < 0 ? entry : entry.substring(0, colon))) {
+				addPeer(entry.c_str(), ip, (colon < 0) ? 80 : entry.substring(colon + 1).toInt(), true);
+			}
+			start = end + 1;
+		}
+	}
+
+	void browse()
+	{
+		m_lastBrowseMs = millis();
+
+		for (int i = 0; i < FLEET_MAX_PEERS; i++) {
+			m_peers[i].m_seen = false;
+		}
+
+		int count = MDNS.queryService("http", "tcp");
+		uint32_t self = WiFi.localIP();
+		for (int i = 0; i < count; i++) {
+			String host = MDNS.hostname(i);
+			if (!host.substring(0, strlen(HOST_NAME_BASE)).equalsIgnoreCase(HOST_NAME_BASE) || (uint32_t)MDNS.IP(i) == self) {
+				continue;
+			}
+			addPeer(host.c_str(), MDNS.IP(i), MDNS.port(i), false);
+		}
+		addStaticPeers();
+
+		// forget peers that went away
+		for (int i = 0; i < FLEET_MAX_PEERS; i++) {
+			if (m_peers[i].m_used && !m_peers[i].m_seen && !m_peers[i].m_static) {
+				m_peers[i].m_used = false;
+			}
+		}
+
+		LOG_PRINTF("[Fleet] %d peers\n", peerCount());
+	}
+
+	//
+	// fetching
+	//
+
+	bool start(const int &index)
+	{
+		Fetch &fetch = m_fetches[index];
+		Peer &peer = m_peers[index];
+
+		fetch.m_ctx = this;
+		fetch.m_index = index;
+		fetch.m_failed = false;
+		fetch.m_len = 0;
+		AsyncClient *client = new AsyncClient();
+		if (!client) {
+			return false;
+		}
+
+		client->setRxTimeout(FLEET_FETCH_TIMEOUT_S);
+
+		client->onConnect([](void *arg, AsyncClient *client) {
+			const char request[] = "GET /get HTTP/1.0\r\nAccept: application/json\r\nConnection: close\r\n\r\n";
+			client->write(request, sizeof(request) - 1);
+		}, &fetch);
+
+		client->onData([](void *arg, AsyncClient *client, void *data, size_t len) {
+			Fetch *fetch = (Fetch *)arg;
+			size_t room = sizeof(fetch->m_response) - 1 - fetch->m_len;
+			len = (len > room) ? room : len;
+			memcpy(fetch->m_response + fetch->m_len, data, len);
+			fetch->m_len += len;
+		}, &fetch);
+
+		client->onError([](void *arg, AsyncClient *client, int8_t error) {
+			Fetch *fetch = (Fetch *)arg;
+			fetch->m_failed = true;
+		}, &fetch);
+
+		client->onTimeout([](void *arg, AsyncClient *client, uint32_t time) {
+			Fetch *fetch = (Fetch *)arg;
+			fetch->m_failed = true;
+			client->close(true);
+		}, &fetch);
+
+		// called once for every connection that got going, also after errors
+		// and timeouts, and nothing touches the client afterwards
+		client->onDisconnect([](void *arg, AsyncClient *client) {
+			Fetch *fetch = (Fetch *)arg;
+			delete client;
+
+			Result result = { fetch->m_index, !fetch->m_failed };
+			xQueueSend(fetch->m_ctx->m_results, &result, 0);
+		}, &fetch);
+
+		fetch.m_client = client;
+		if (!client->connect(IPAddress(peer.m_ip), peer.m_port)) {
+			// no callbacks when the connection could not be started
+			delete client;
+			fetch.m_client = NULL;
+			return false;
+		}
+		return true;
+	}
+
+	// takes the body out of a completed fetch
+	void complete(const Result &result)
+	{
+		Fetch &fetch = m_fetches[result.m_index];
+		Peer &peer = m_peers[result.m_index];
+
+		fetch.m_client = NULL;
+		m_inFlight--;
+
+		fetch.m_response[fetch.m_len] = 0;
+		char *body = strstr(fetch.m_response, "\r\n\r\n");
+		bool ok = result.m_ok && !strncmp(fetch.m_response, "HTTP/1.", 7) && !strncmp(fetch.m_response + 8, " 200", 4) && body;
+
+		if (ok) {
+			body += 4;
+			if (strlen(body) < sizeof(peer.m_body)) {
+				strcpy(peer.m_body, body);
+				peer.m_updatedMs = compensatedMillis();
+			} else {
+				ok = false;
+			}
+		}
+
+		peer.m_ok = ok;
+		metricsIncrement(ok ? eMetricsFleetFetches : eMetricsFleetFetchFailures);
+	}
+
+	// waits for one result until the deadline (millis()), false on timeout
+	bool collect(const uint32_t &deadlineMs)
+	{
+		int32_t remaining = deadlineMs - millis();
+		Result result;
+		if (xQueueReceive(m_results, &result, pdMS_TO_TICKS(remaining > 0 ? remaining : 0)) != pdTRUE) {
+			return false;
+		}
+		complete(result);
+		return true;
+	}
+
+	void sweep()
+	{
+		int64_t startUs = esp_timer_get_time();
+		uint32_t deadlineMs = millis() + FLEET_FETCH_TIMEOUT_S * 1000 * 2;
+
+		// results that arrived after the last sweep gave up on them
+		while (m_inFlight && collect(millis())) {
+		}
+
+		// launch requests, at most FLEET_MAX_INFLIGHT at once
+		for (int i = 0; i < FLEET_MAX_PEERS; i++) {
+			// previous request to this peer still hangs around
+			if (!m_peers[i].m_used || m_fetches[i].m_client) {
+				continue;
+			}
+
+			bool slot = true;
+			while (m_inFlight >= FLEET_MAX_INFLIGHT && (slot = collect(deadlineMs))) {
+			}
+			if (!slot) {
+				break;
+			}
+
+			if (start(i)) {
+				m_inFlight++;
+			} else {
+				m_peers[i].m_ok = false;
+				metricsIncrement(eMetricsFleetFetchFailures);
+			}
+		}
+
+		// wait until all requests finished, stragglers are collected next time
+		while (m_inFlight && collect(deadlineMs)) {
+		}
+
+		metricsObserve(eMetricsFleetSweepTime, esp_timer_get_time() - startUs);
+		metricsSet(eMetricsFleetPeers, peerCount());
+	}
+
+	//
+	// merged view
+	//
+
+	void publish()
+	{
+		uint64_t now = compensatedMillis();
+
+		DynamicJsonDocument doc(JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(FLEET_MAX_PEERS + 1) + (FLEET_MAX_PEERS + 1) * JSON_OBJECT_SIZE(5) + 64);
+		doc["generatedMs"] = now;
+		JsonArray peers = doc.createNestedArray("peers");
+
+		// this unit first
+		char self[FLEET_SELF_BUFFER_SIZE];
+		{
+			StaticJsonDocument<FLEET_SELF_BUFFER_SIZE> selfDoc;
+			snapshotSensors(selfDoc);
+			serializeJson(selfDoc, self, sizeof(self));
+		}
+		String host = wifiHostName();
+		String ip = WiFi.localIP().toString();
+
+		JsonObject obj = peers.createNestedObject();
+		obj["host"] = host.c_str();
+		obj["ip"] = ip.c_str();
+		obj["ok"] = true;
+		obj["ageMs"] = 0;
+		obj["data"] = serialized((const char *)self);
+
+		String addresses[FLEET_MAX_PEERS];
+		for (int i = 0; i < FLEET_MAX_PEERS; i++) {
+			Peer &peer = m_peers[i];
+			if (!peer.m_used) {
+				continue;
+			}
+			addresses[i] = IPAddress(peer.m_ip).toString() + ":" + String(peer.m_port);
+
+			obj = peers.createNestedObject();
+			obj["host"] = (const char *)peer.m_host;
+			obj["ip"] = addresses[i].c_str();
+			obj["ok"] = peer.m_ok;
+			if (peer.m_updatedMs) {
+				obj["ageMs"] = now - peer.m_updatedMs;
+				obj["data"] = serialized((const char *)peer.m_body);
+			}
+		}
+
+		String json;
+		serializeJson(doc, json);
+
+		if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+			m_json = json;
+			bool subscribed = m_events && m_events->count();
+			if (subscribed) {
+				m_events->send(m_json.c_str(), "fleet", millis());
+			}
+			xSemaphoreGive(m_mutex);
+
+			// the boost is renewed while anybody listens
+			powerSaveBoost(ePowerSaveBoostEvents, subscribed ? FLEET_EVENTS_BOOST_MS : 0);
+		}
+	}
+
+public:
+	FleetTaskCtx()
+	{
+		memset((void *)m_peers, 0, sizeof(m_peers));
+		memset((void *)m_fetches, 0, sizeof(m_fetches));
+		m_results = xQueueCreate(FLEET_MAX_PEERS, sizeof(Result));
+		m_inFlight = 0;
+		m_mutex = xSemaphoreCreateMutex();
+		m_events = NULL;
+		m_lastBrowseMs = 0;
+	}
+
+	void attach(AsyncWebServer *server)
+	{
+		// the stream does not keep an admission slot: AsyncEventSource
+		// deletes the request, and with it the slot, when the stream starts
+		AsyncEventSource *events = new AsyncEventSource("/fleet/events");
+
+		// new subscribers get the current view right away
+		events->onConnect([this](AsyncEventSourceClient *client) {
+			// subscribers get updates without the power save delay
+			powerSaveBoost(ePowerSaveBoostEvents, FLEET_EVENTS_BOOST_MS);
+
+			String json = this->json();
+			client->send(json.c_str(), "fleet", millis());
+		});
+		server->addHandler(events);
+
+		if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+			m_events = events;
+			xSemaphoreGive(m_mutex);
+		}
+	}
+
+	void detach()
+	{
+		// the server deletes its handlers on reset()
+		if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+			m_events = NULL;
+			xSemaphoreGive(m_mutex);
+		}
+	}
+
+	String json()
+	{
+		String json = "{}";
+		if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+			if (m_json.length()) {
+				json = m_json;
+			}
+			xSemaphoreGive(m_mutex);
+		}
+		return json;
+	}
+
+	void task()
+	{
+		while (1) {
+			// mDNS browsing takes seconds, so it runs less often than the polling
+			if (!m_lastBrowseMs || (millis() - m_lastBrowseMs) >= FLEET_BROWSE_INTERVAL_MS) {
+				browse();
+			}
+
+			sweep();
+			publish();
+
+			longDelay(FLEET_POLL_INTERVAL_MS);
+		}
+	}
+};
+
+static FleetTaskCtx g_ctx;
+
+void fleetTask(void *pvParameters __attribute__((unused)))
+{
+	// wait until the network is connected
+	wifiWaitForConnection();
+
+	g_ctx.task();
+}
+
+void fleetAttach(AsyncWebServer *server)
+{
+	g_ctx.attach(server);
+}
+
+void fleetDetach()
+{
+	g_ctx.detach();
+}
+
+String fleetJson()
+{
+	return g_ctx.json();
+}
+
+#endif // FLEET_ENABLED
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+void fleetTask(void *pvParameters __attribute__((unused)));
+
+// registers the /fleet/events SSE feed, fleetDetach() has to be called
+// before the server handlers are reset
+void fleetAttach(AsyncWebServer *server);
+void fleetDetach();
+
+// merged view of all peers (JSON), as served by /fleet
+String fleetJson();
@@ -0,0 +1,285 @@
+#define LOG_MODULE eLogModuleInflux
+
+#include <Arduino.h>
+#include <HTTPClient.h>
+
+#include "config.h"
+#include "utils.h"
+#include "metrics.h"
+#include "gzip.h"
+
+#include "influxTask.h"
+#include "sensorTask.h"
+#include "wifiTask.h"
+
+#if (INFLUX_ENABLED == 1)
+
+#define INFLUX_INCOMING_QUEUE		8
+#define INFLUX_LINE_MAX				192
+#define INFLUX_BODY_SIZE			(INFLUX_BATCH_SIZE * INFLUX_LINE_MAX)
+#define INFLUX_MIN_VALID_TIME_MS	1577836800000ULL	// 2020-01-01, anything older means NTP has not synced yet
+
+//
+// InfluxDB line protocol writer context
+//
+// samples flow: sensor listener -> incoming queue -> spill buffer -> batch -> HTTP POST
+//
+
+class InfluxTaskCtx {
+private:
+	HTTPClient m_http;
+
+	// samples posted by the sensor task
+	QueueHandle_t m_incoming;
+
+	// samples waiting for a successful write (oldest first)
+	SensorSample m_pending[INFLUX_SPILL_SAMPLES];
+	uint32_t m_pendingHead;
+	uint32_t m_pendingCount;
+
+	// batching and retry state
+	uint32_t m_batchStartMs;
+	uint32_t m_backoffMs;
+	uint32_t m_nextAttemptMs;
+
+	String m_host;
+
+	char m_body[INFLUX_BODY_SIZE];
+#if (INFLUX_GZIP == 1)
+	uint8_t m_gzip[INFLUX_BODY_SIZE + 64];
+#endif
+
+public:
+	InfluxTaskCtx()
+	{
+		m_incoming = xQueueCreate(INFLUX_INCOMING_QUEUE, sizeof(SensorSample));
+		m_pendingHead = 0;
+		m_pendingCount = 0;
+		m_batchStartMs = 0;
+		m_backoffMs = 0;
+		m_nextAttemptMs = 0;
+	}
+
+	void init()
+	{
+		m_host = wifiHostName();
+
+		m_http.setReuse(true);
+		m_http.setTimeout(INFLUX_HTTP_TIMEOUT_MS);
+
+		sensorSubscribe([this](const SensorSample &sample) {
+			if (xQueueSend(m_incoming, &sample, 0) != pdTRUE) {
+				metricsIncrement(eMetricsInfluxDropped);
+			}
+		});
+	}
+
+	//
+	// queueing
+	//
+
+	void push(const SensorSample &sample)
+	{
+		// without a valid wall clock the point would land in 1970
+		if (sample.m_timestampMs < INFLUX_MIN_VALID_TIME_MS) {
+			metricsIncrement(eMetricsInfluxDropped);
+			return;
+		}
+
+		// spill buffer is full, drop the oldest sample
+		if (m_pendingCount == INFLUX_SPILL_SAMPLES) {
+			m_pendingHead = (m_pendingHead + 1) % INFLUX_SPILL_SAMPLES;
+			m_pendingCount--;
+			metricsIncrement(eMetricsInfluxDropped);
+		}
+
+		if (!m_pendingCount) {
+			m_batchStartMs = millis();
+		}
+
+		m_pending[(m_pendingHead + m_pendingCount) % INFLUX_SPILL_SAMPLES] = sample;
+		m_pendingCount++;
+	}
+
+	void pop(const uint32_t &count)
+	{
+		m_pendingHead = (m_pendingHead + count) % INFLUX_SPILL_SAMPLES;
+		m_pendingCount -= count;
+		m_batchStartMs = millis();
+	}
+
+	//
+	// line protocol
+	//
+
+	size_t formatLine(char *buf, const size_t &maxLen, const SensorSample &sample)
+	{
+		int len = snprintf(buf, maxLen, INFLUX_MEASUREMENT ",host=%s pm2_5=%ui"
+#if (USE_CO2_SENSOR == 1)
+			",co2=%ui,temperature=%.2f,humidity=%.2f"
+#elif (USE_ENV_SENSOR == 1)
+			",temperature=%.2f,humidity=%.2f,pressure=%.2f"
+#endif
+			" %llu\n",
+			m_host.c_str(), sample.m_pm2_5,
+#if (USE_CO2_SENSOR == 1)
+			sample.m_co2, sample.m_temperature, sample.m_humidity,
+#elif (USE_ENV_SENSOR == 1)
+			sample.m_temperature, sample.m_humidity, sample.m_pressure,
+#endif
+			sample.m_timestampMs);
+
+		return (len > 0 && (size_t)len < maxLen) ? len : 0;
+	}
+
+	size_t formatBatch(const uint32_t &count)
+	{
+		size_t len = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			len += formatLine(m_body + len, sizeof(m_body) - len, m_pending[(m_pendingHead + i) % INFLUX_SPILL_SAMPLES]);
+		}
+		return len;
+	}
+
+	//
+	// writing
+	//
+
+	// returns HTTP status code or negative HTTPClient error
+	int post(const uint8_t *body, const size_t &len, const bool &gzipped)
+	{
+		m_http.begin(INFLUX_URL);
+		m_http.addHeader("Content-Type", "text/plain; charset=utf-8");
+		if (gzipped) {
+			m_http.addHeader("Content-Encoding", "gzip");
+		}
+		if (INFLUX_TOKEN[0]) {
+			m_http.addHeader("Authorization", "Token " INFLUX_TOKEN);
+		}
+
+		int64_t startUs = esp_timer_get_time();
+		int code = m_http.POST((uint8_t *)body, len);
+		metricsObserve(eMetricsInfluxWriteLatency, esp_timer_get_time() - startUs);
+		m_http.end();
+
+		return code;
+	}
+
+	void retryLater()
+	{
+		// exponential backoff with up to 25 % jitter, so a fleet does not retry in lockstep
+		m_backoffMs = m_backoffMs ? m_backoffMs * 2 : INFLUX_BACKOFF_MIN_MS;
+		if (m_backoffMs > INFLUX_BACKOFF_MAX_MS) {
+			m_backoffMs = INFLUX_BACKOFF_MAX_MS;
+		}
+		m_nextAttemptMs = millis() + m_backoffMs + esp_random() % (m_backoffMs / 4 + 1);
+		LOG_PRINTF("[Influx] retrying in %u ms\n", m_nextAttemptMs - millis());
+	}
+
+	bool write()
+	{
+		uint32_t count = (m_pendingCount > INFLUX_BATCH_SIZE) ? INFLUX_BATCH_SIZE : m_pendingCount;
+		size_t len = formatBatch(count);
+
+		const uint8_t *body = (const uint8_t *)m_body;
+		bool gzipped = false;
+#if (INFLUX_GZIP == 1)
+		size_t compressed = gzipCompress((const uint8_t *)m_body, len, m_gzip, sizeof(m_gzip));
+		if (compressed && compressed < len) {
+			body = m_gzip;
+			len = compressed;
+			gzipped = true;
+		}
+#endif
+
+		metricsIncrement(eMetricsInfluxRequests);
+		int code = post(body, len, gzipped);
+
+		if (code >= 200 && code < 300) {
+			metricsIncrement(eMetricsInfluxSamplesSent, count);
+			metricsIncrement(eMetricsInfluxBytesSent, len);
+			m_backoffMs = 0;
+			pop(count);
+			return true;
+		}
+
+		metricsIncrement(eMetricsInfluxFailures);
+		LOG_PRINTF("[Influx] write of %u samples failed (%d)\n", count, code);
+
+		if (code >= 400 && code < 500 && code != 408 && code != 429) {
+			// the server refused the data itself, resending won't help
+			metricsIncrement(eMetricsInfluxDropped, count);
+			m_backoffMs = 0;
+			pop(count);
+			return false;
+		}
+
+		retryLater();
+		return false;
+	}
+
+	bool due()
+	{
+		if (!m_pendingCount || !wifiIsConnected()) {
+			return false;
+		}
+
+		if (m_backoffMs && (int32_t)(millis() - m_nextAttemptMs) < 0) {
+			return false;
+		}
+
+		return m_pendingCount >= INFLUX_BATCH_SIZE || (millis() - m_batchStartMs) >= INFLUX_BATCH_INTERVAL_S * 1000;
+	}
+
+	// time until the next batch deadline or retry
+	TickType_t timeout()
+	{
+		if (!m_pendingCount) {
+			return portMAX_DELAY;
+		}
+
+		uint32_t now = millis();
+		uint32_t deadline = m_backoffMs ? m_nextAttemptMs : m_batchStartMs + INFLUX_BATCH_INTERVAL_S * 1000;
+		int32_t remaining = deadline - now;
+
+		// also covers waiting for WiFi to come back
+		if (remaining <= 0) {
+			remaining = INFLUX_BACKOFF_MIN_MS;
+		}
+		return pdMS_TO_TICKS(remaining);
+	}
+
+	void task()
+	{
+		init();
+
+		while (1) {
+			// sleep until a sample arrives (or a batch / retry is due)
+			SensorSample sample;
+			if (xQueueReceive(m_incoming, &sample, timeout()) == pdTRUE) {
+				push(sample);
+				while (xQueueReceive(m_incoming, &sample, 0) == pdTRUE) {
+					push(sample);
+				}
+			}
+
+			// drain the backlog batch by batch while writes succeed
+			while (due() && write()) {
+			}
+
+			metricsSet(eMetricsInfluxSpillDepth, m_pendingCount);
+		}
+	}
+};
+
+static InfluxTaskCtx g_ctx;
+
+void influxTask(void *pvParameters __attribute__((unused)))
+{
+	// wait until the network is connected
+	wifiWaitForConnection();
+
+	g_ctx.task();
+}
+
+#endif // INFLUX_ENABLED
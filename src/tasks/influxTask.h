@@ -0,0 +1,3 @@
+#pragma once
+
+void influxTask(void *pvParameters __attribute__((unused)));
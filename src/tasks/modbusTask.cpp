@@ -0,0 +1,455 @@
+#define LOG_MODULE eLogModuleModbus
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+
+#include "config.h"
+#include "utils.h"
+#include "metrics.h"
+#include "display.h"
+
+#include "modbusTask.h"
+#include "sensorTask.h"
+#include "ntpTask.h"
+#include "wifiTask.h"
+
+#if (MODBUS_ENABLED == 1)
+
+#define MODBUS_MBAP_SIZE			7		// transaction, protocol, length, unit
+#define MODBUS_MAX_ADU				260
+#define MODBUS_MAX_READ				125		// registers per read request
+#define MODBUS_MAX_WRITE			123		// registers per write request
+#define MODBUS_WRITE_QUEUE			8
+
+// function codes
+#define MODBUS_READ_HOLDING			0x03
+#define MODBUS_READ_INPUT			0x04
+#define MODBUS_WRITE_SINGLE			0x06
+#define MODBUS_WRITE_MULTIPLE		0x10
+
+// exception codes
+#define MODBUS_ILLEGAL_FUNCTION		0x01
+#define MODBUS_ILLEGAL_ADDRESS		0x02
+#define MODBUS_ILLEGAL_VALUE		0x03
+#define MODBUS_SERVER_BUSY			0x06
+
+// channel bits of the channels register
+#define MODBUS_CHANNEL_PM2_5		(1 << 0)
+#define MODBUS_CHANNEL_CO2			(1 << 1)
+#define MODBUS_CHANNEL_TEMPERATURE	(1 << 2)
+#define MODBUS_CHANNEL_HUMIDITY		(1 << 3)
+#define MODBUS_CHANNEL_PRESSURE		(1 << 4)
+
+// register map, see modbusTask.h
+enum ModbusInputRegister {
+	eModbusInputPm2_5,
+	eModbusInputCo2,
+	eModbusInputTemperature,
+	eModbusInputHumidity,
+	eModbusInputPressure,
+	eModbusInputSequenceHigh,
+	eModbusInputSequenceLow,
+	eModbusInputAge,
+	eModbusInputChannels,
+	eModbusInputCount
+};
+
+enum ModbusHoldingRegister {
+	eModbusHoldingFan,
+	eModbusHoldingLedBrightness,
+	eModbusHoldingCount
+};
+
+//
+// Modbus TCP server
+//
+// Reads are answered straight from the AsyncTCP callback using the
+// lock-free sensor snapshot. Writes are handed to the task, since both
+// setters store to flash and setLedBrightness() fades the LEDs.
+//
+
+class ModbusTaskCtx {
+private:
+	AsyncServer m_server;
+	QueueHandle_t m_writes;
+
+	struct Write {
+		uint16_t m_register;
+		uint16_t m_value;
+	};
+
+	// connections are only touched from AsyncTCP callbacks, which all
+	// run in the AsyncTCP task, so they need no locking
+	struct Connection {
+		ModbusTaskCtx *m_ctx;
+		bool m_used;
+		bool m_closing;
+		AsyncClient *m_client;
+		uint8_t m_buf[MODBUS_MAX_ADU];
+		size_t m_len;
+	} m_connections[MODBUS_MAX_CLIENTS];
+
+	static uint16_t get16(const uint8_t *data)
+	{
+		return (data[0] << 8) | data[1];
+	}
+
+	static void put16(uint8_t *data, const uint16_t &value)
+	{
+		data[0] = value >> 8;
+		data[1] = value & 0xff;
+	}
+
+	static uint16_t scaled(const float &value, const float &scale, const int32_t &min, const int32_t &max)
+	{
+		int32_t ret = lroundf(value * scale);
+		return (uint16_t)((ret < min) ? min : ((ret > max) ? max : ret));
+	}
+
+	//
+	// registers
+	//
+
+	void inputRegisters(uint16_t *regs)
+	{
+		memset(regs, 0, eModbusInputCount * sizeof(uint16_t));
+
+		SensorSample sample;
+		if (!sensorSnapshot(sample)) {
+			return;
+		}
+
+		regs[eModbusInputPm2_5] = sample.m_pm2_5;
+		regs[eModbusInputCo2] = sample.m_co2;
+		regs[eModbusInputTemperature] = scaled(sample.m_temperature, 100, INT16_MIN, INT16_MAX);
+		regs[eModbusInputHumidity] = scaled(sample.m_humidity, 100, 0, UINT16_MAX);
+		regs[eModbusInputPressure] = scaled(sample.m_pressure, 100, 0, UINT16_MAX);
+		regs[eModbusInputSequenceHigh] = sample.m_sequence >> 16;
+		regs[eModbusInputSequenceLow] = sample.m_sequence & 0xffff;
+
+		uint64_t now = compensatedMillis();
+		uint64_t age = (now > sample.m_timestampMs) ? (now - sample.m_timestampMs) / 1000 : 0;
+		regs[eModbusInputAge] = (age > UINT16_MAX) ? UINT16_MAX : age;
+
+		regs[eModbusInputChannels] = MODBUS_CHANNEL_PM2_5;
+#if (USE_CO2_SENSOR == 1)
+		regs[eModbusInputChannels] |= MODBUS_CHANNEL_CO2 | MODBUS_CHANNEL_TEMPERATURE | MODBUS_CHANNEL_HUMIDITY;
+#elif (USE_ENV_SENSOR == 1)
+		regs[eModbusInputChannels] |= MODBUS_CHANNEL_TEMPERATURE | MODBUS_CHANNEL_HUMIDITY | MODBUS_CHANNEL_PRESSURE;
+#endif
+	}
+
+	void holdingRegisters(uint16_t *regs)
+	{
+		regs[eModbusHoldingFan] = sensorFanEnabled() ? 1 : 0;
+		regs[eModbusHoldingLedBrightness] = Display::instance().ledBrightness();
+	}
+
+	// validates and queues all values or none of them, returns exception code
+	uint8_t write(const uint16_t &address, const uint16_t *values, const uint16_t &count)
+	{
+		if ((uint32_t)address + count > eModbusHoldingCount) {
+			return MODBUS_ILLEGAL_ADDRESS;
+		}
+
+		for (uint16_t i = 0; i < count; i++) {
+			uint16_t reg = address + i;
+			if ((reg == eModbusHoldingFan && values[i] > 1) || (reg == eModbusHoldingLedBrightness && values[i] > BRIGHTNESS_MAX)) {
+				return MODBUS_ILLEGAL_VALUE;
+			}
+		}
+
+		// the AsyncTCP task is the only producer, so the space can't shrink below
+		if (uxQueueSpacesAvailable(m_writes) < count) {
+			return MODBUS_SERVER_BUSY;
+		}
+
+		for (uint16_t i = 0; i < count; i++) {
+			Write write = { (uint16_t)(address + i), values[i] };
+			xQueueSend(m_writes, &write, 0);
+		}
+		return 0;
+	}
+
+	void apply(const Write &write)
+	{
+		switch (write.m_register) {
+		case eModbusHoldingFan:
+			if (sensorFanEnabled() != (write.m_value != 0)) {
+				sensorFanMode(write.m_value != 0);
+			}
+			break;
+		case eModbusHoldingLedBrightness:
+			Display::instance().setLedBrightness(write.m_value);
+			break;
+		}
+	}
+
+	//
+	// protocol
+	//
+
+	// request is a complete ADU, returns length of the reply ADU
+	size_t process(const uint8_t *request, const size_t &len, uint8_t *reply)
+	{
+		const uint8_t *pdu = request + MODBUS_MBAP_SIZE;
+		size_t pduLen = len - MODBUS_MBAP_SIZE;
+		uint8_t *out = reply + MODBUS_MBAP_SIZE;
+		size_t outLen = 0;
+		uint8_t function = pdu[0];
+		uint8_t exception = 0;
+
+		metricsIncrement(eMetricsModbusRequests);
+
+		switch (function) {
+		case MODBUS_READ_HOLDING:
+		case MODBUS_READ_INPUT: {
+			if (pduLen != 5) {
+				exception = MODBUS_ILLEGAL_VALUE;
+				break;
+			}
+
+			uint16_t address = get16(pdu + 1);
+			uint16_t count = get16(pdu + 3);
+			uint16_t regs[MODBUS_MAX_READ];
+			size_t available = (function == MODBUS_READ_INPUT) ? (size_t)eModbusInputCount : (size_t)eModbusHoldingCount;
+
+			if (count < 1 || count > MODBUS_MAX_READ) {
+				exception = MODBUS_ILLEGAL_VALUE;
+			} else if ((uint32_t)address + count > available) {
+				exception = MODBUS_ILLEGAL_ADDRESS;
+			} else {
+				if (function == MODBUS_READ_INPUT) {
+					inputRegisters(regs);
+				} else {
+					holdingRegisters(regs);
+				}
+
+				out[0] = function;
+				out[1] = count * 2;
+				for (uint16_t i = 0; i < count; i++) {
+					put16(out + 2 + i * 2, regs[address + i]);
+				}
+				outLen = 2 + count * 2;
+			}
+			break;
+		}
+
+		case MODBUS_WRITE_SINGLE: {
+			if (pduLen != 5) {
+				exception = MODBUS_ILLEGAL_VALUE;
+				break;
+			}
+
+			uint16_t value = get16(pdu + 3);
+			exception = write(get16(pdu + 1), &value, 1);
+			if (!exception) {
+				// the reply echoes the request
+				memcpy(out, pdu, 5);
+				outLen = 5;
+			}
+			break;
+		}
+
+		case MODBUS_WRITE_MULTIPLE: {
+			uint16_t count = (pduLen >= 6) ? get16(pdu + 3) : 0;
+			if (count < 1 || count > MODBUS_MAX_WRITE || pdu[5] != count * 2 || pduLen != 6 + (size_t)count * 2) {
+				exception = MODBUS_ILLEGAL_VALUE;
+				break;
+			}
+
+			uint16_t values[MODBUS_MAX_WRITE];
+			for (uint16_t i = 0; i < count; i++) {
+				values[i] = get16(pdu + 6 + i * 2);
+			}
+			exception = write(get16(pdu + 1), values, count);
+			if (!exception) {
+				// function, address, count
+				memcpy(out, pdu, 5);
+				outLen = 5;
+			}
+			break;
+		}
+
+		default:
+			exception = MODBUS_ILLEGAL_FUNCTION;
+			break;
+		}
+
+		if (exception) {
+			out[0] = function | 0x80;
+			out[1] = exception;
+			outLen = 2;
+			metricsIncrement(eMetricsModbusExceptions);
+		}
+
+		// transaction and protocol id are echoed, length covers unit id + PDU
+		memcpy(reply, request, 4);
+		put16(reply + 4, outLen + 1);
+		reply[6] = request[6];
+
+		return MODBUS_MBAP_SIZE + outLen;
+	}
+
+	// handles all complete requests in the buffer, stops early when the
+	// send buffer is full (resumed from onAck)
+	void processFrames(Connection &conn)
+	{
+		size_t pos = 0;
+		while (!conn.m_closing && conn.m_len - pos >= MODBUS_MBAP_SIZE) {
+			const uint8_t *adu = conn.m_buf + pos;
+			uint16_t length = get16(adu + 4);
+
+			// there is no way to find the next frame after garbage
+			if (get16(adu + 2) != 0 || length < 2 || length > MODBUS_MAX_ADU - 6) {
+				LOG_PRINTF("[Modbus] invalid frame from %s, closing\n", conn.m_client->remoteIP().toString().c_str());
+				close(conn);
+				return;
+			}
+
+			size_t frameLen = 6 + length;
+			if (conn.m_len - pos < frameLen) {
+				break;
+			}
+
+			// any reply has to fit, the request is handled once there is room
+			if (conn.m_client->space() < MODBUS_MAX_ADU) {
+				break;
+			}
+
+			uint8_t reply[MODBUS_MAX_ADU];
+			size_t replyLen = process(adu, frameLen, reply);
+			conn.m_client->write((const char *)reply, replyLen);
+			pos += frameLen;
+		}
+
+		memmove(conn.m_buf, conn.m_buf + pos, conn.m_len - pos);
+		conn.m_len -= pos;
+	}
+
+	void receive(Connection &conn, const uint8_t *data, size_t len)
+	{
+		while (len && !conn.m_closing) {
+			size_t chunk = sizeof(conn.m_buf) - conn.m_len;
+			chunk = (len < chunk) ? len : chunk;
+			memcpy(conn.m_buf + conn.m_len, data, chunk);
+			conn.m_len += chunk;
+			data += chunk;
+			len -= chunk;
+
+			processFrames(conn);
+
+			if (len && conn.m_len == sizeof(conn.m_buf)) {
+				// client keeps sending without reading the replies
+				LOG_PRINTF("[Modbus] %s is not reading replies, closing\n", conn.m_client->remoteIP().toString().c_str());
+				close(conn);
+			}
+		}
+	}
+
+	// safe inside callbacks, the client is deleted in onDisconnect
+	void close(Connection &conn)
+	{
+		conn.m_closing = true;
+		conn.m_len = 0;
+		conn.m_client->close();
+	}
+
+	void updateClientCount()
+	{
+		uint32_t count = 0;
+		for (int i = 0; i < MODBUS_MAX_CLIENTS; i++) {
+			count += m_connections[i].m_used ? 1 : 0;
+		}
+		metricsSet(eMetricsModbusClients, count);
+	}
+
+	void accept(AsyncClient *client)
+	{
+		Connection *conn = NULL;
+		for (int i = 0; i < MODBUS_MAX_CLIENTS; i++) {
+			if (!m_connections[i].m_used) {
+				conn = &m_connections[i];
+				break;
+			}
+		}
+
+		if (!conn) {
+			LOG_PRINTF("[Modbus] too many clients, rejecting %s\n", client->remoteIP().toString().c_str());
+			client->onDisconnect([](void *arg, AsyncClient *client) {
+				delete client;
+			}, NULL);
+			client->close(true);
+			return;
+		}
+
+		conn->m_ctx = this;
+		conn->m_used = true;
+		conn->m_closing = false;
+		conn->m_client = client;
+		conn->m_len = 0;
+		updateClientCount();
+
+		client->setNoDelay(true);
+		client->setRxTimeout(MODBUS_IDLE_TIMEOUT_S);
+
+		client->onData([](void *arg, AsyncClient *client, void *data, size_t len) {
+			Connection *conn = (Connection *)arg;
+			conn->m_ctx->receive(*conn, (const uint8_t *)data, len);
+		}, conn);
+
+		client->onAck([](void *arg, AsyncClient *client, size_t len, uint32_t time) {
+			Connection *conn = (Connection *)arg;
+			conn->m_ctx->processFrames(*conn);
+		}, conn);
+
+		client->onTimeout([](void *arg, AsyncClient *client, uint32_t time) {
+			client->close(true);
+		}, conn);
+
+		client->onDisconnect([](void *arg, AsyncClient *client) {
+			Connection *conn = (Connection *)arg;
+			conn->m_used = false;
+			conn->m_client = NULL;
+			conn->m_ctx->updateClientCount();
+			delete client;
+		}, conn);
+	}
+
+public:
+	ModbusTaskCtx()
+		: m_server(MODBUS_PORT)
+	{
+		m_writes = xQueueCreate(MODBUS_WRITE_QUEUE, sizeof(Write));
+		memset((void *)m_connections, 0, sizeof(m_connections));
+	}
+
+	void task()
+	{
+		m_server.onClient([](void *arg, AsyncClient *client) {
+			((ModbusTaskCtx *)arg)->accept(client);
+		}, this);
+		m_server.setNoDelay(true);
+		m_server.begin();
+		LOG_PRINTF("[Modbus] listening on port %d\n", MODBUS_PORT);
+
+		while (1) {
+			Write write;
+			if (xQueueReceive(m_writes, &write, portMAX_DELAY) == pdTRUE) {
+				apply(write);
+			}
+		}
+	}
+};
+
+static ModbusTaskCtx g_ctx;
+
+void modbusTask(void *pvParameters __attribute__((unused)))
+{
+	// wait until the network is connected
+	wifiWaitForConnection();
+
+	g_ctx.task();
+}
+
+#endif // MODBUS_ENABLED
@@ -0,0 +1,24 @@
+#pragma once
+
+//
+// Modbus TCP server (MODBUS_ENABLED), any unit id is accepted
+//
+// input registers (function 0x04), read only:
+//   0  PM2.5				ug/m3
+//   1  CO2					ppm
+//   2  temperature			0.01 C, signed
+//   3  humidity			0.01 %
+//   4  pressure			0.01 kPa
+//   5  sample sequence		high word
+//   6  sample sequence		low word
+//   7  sample age			s, 0xffff if older
+//   8  channels			bit 0 PM2.5, 1 CO2, 2 temperature, 3 humidity, 4 pressure, 0 = no sample yet
+//
+// holding registers (functions 0x03, 0x06, 0x10):
+//   0  fan					0 = off, 1 = on
+//   1  LED brightness		0 - 100
+//
+// channels not present in the build read as 0
+//
+
+void modbusTask(void *pvParameters __attribute__((unused)));
@@ -0,0 +1,430 @@
+#define LOG_MODULE eLogModuleMqtt
+
+#include <Arduino.h>
+#include <AsyncMqttClient.h>
+#include <ArduinoJson.h>
+#include <SPIFFS.h>
+
+#include "config.h"
+#include "utils.h"
+#include "metrics.h"
+
+#include "mqttTask.h"
+#include "sensorTask.h"
+#include "wifiTask.h"
+
+#if (MQTT_ENABLED == 1)
+
+#define MQTT_INCOMING_QUEUE		8
+#define MQTT_MAX_INFLIGHT		8
+#define MQTT_BATCH_MAX			((MQTT_BATCH_SIZE > 0) ? MQTT_BATCH_SIZE : 1)
+#define MQTT_PAYLOAD_SIZE		(MQTT_BATCH_MAX * 160 + 16)
+
+//
+// MQTT publisher context
+//
+// samples flow: sensor listener -> incoming queue -> RAM queue -> (flash spool) -> broker
+//
+
+class MqttTaskCtx {
+private:
+	AsyncMqttClient m_client;
+
+	// samples posted by the sensor task
+	QueueHandle_t m_incoming;
+
+	// samples waiting for publishing (oldest first)
+	SensorSample m_pending[MQTT_RAM_QUEUE];
+	uint32_t m_pendingHead;
+	uint32_t m_pendingCount;
+
+	// samples spilled to flash, m_spoolRead samples have already been published
+	// (m_spoolRead is kept in MQTT_SPOOL_POS_FILENAME across reboots)
+	uint32_t m_spoolRead;
+	uint32_t m_spoolCount;
+
+	// channels of the oldest sample already published, so a failed
+	// publish resumes with the next channel instead of repeating them
+	uint32_t m_channelsSent;
+	uint64_t m_partialTimestampMs;
+	uint32_t m_partialSequence;
+
+	// unacknowledged publishes, used to measure latency
+	struct InFlight {
+		uint16_t m_packetId;
+		int64_t m_startUs;
+	} m_inFlight[MQTT_MAX_INFLIGHT];
+	SemaphoreHandle_t m_mutex;
+
+	String m_clientId;
+	String m_topicBase;
+	String m_statusTopic;
+	uint32_t m_lastConnectMs;
+
+	char m_payload[MQTT_PAYLOAD_SIZE];
+
+public:
+	MqttTaskCtx()
+	{
+		m_incoming = xQueueCreate(MQTT_INCOMING_QUEUE, sizeof(SensorSample));
+		m_mutex = xSemaphoreCreateMutex();
+		m_pendingHead = 0;
+		m_pendingCount = 0;
+		m_spoolRead = 0;
+		m_spoolCount = 0;
+		m_channelsSent = 0;
+		m_partialTimestampMs = 0;
+		m_partialSequence = 0;
+		m_lastConnectMs = 0;
+		memset((void *)m_inFlight, 0, sizeof(m_inFlight));
+	}
+
+	void init()
+	{
+		m_clientId = wifiHostName();
+		m_topicBase = String(MQTT_TOPIC_PREFIX) + "/" + m_clientId;
+		m_statusTopic = m_topicBase + "/status";
+
+		m_client.setServer(MQTT_HOST, MQTT_PORT);
+		m_client.setClientId(m_clientId.c_str());
+		if (MQTT_USER[0]) {
+			m_client.setCredentials(MQTT_USER, MQTT_PASSWORD);
+		}
+		m_client.setWill(m_statusTopic.c_str(), 1, true, "offline");
+
+		m_client.onConnect([this](bool sessionPresent) {
+			LOG_PRINTF("[MQTT] connected to %s:%d\n", MQTT_HOST, MQTT_PORT);
+			m_client.publish(m_statusTopic.c_str(), 1, true, "online");
+		});
+
+		m_client.onDisconnect([](AsyncMqttClientDisconnectReason reason) {
+			LOG_PRINTF("[MQTT] disconnected (%d)\n", (int)reason);
+		});
+
+		m_client.onPublish([this](uint16_t packetId) {
+			acknowledged(packetId);
+		});
+
+		// resume samples spooled before the last reboot
+		File file = SPIFFS.open(MQTT_SPOOL_FILENAME, "r");
+		if (file) {
+			m_spoolCount = file.size() / sizeof(SensorSample);
+			file.close();
+			m_spoolRead = loadSpoolRead();
+			LOG_PRINTF("[MQTT] %u spooled samples found, %u already published\n", m_spoolCount, m_spoolRead);
+		}
+
+		sensorSubscribe([this](const SensorSample &sample) {
+			if (xQueueSend(m_incoming, &sample, 0) != pdTRUE) {
+				metricsIncrement(eMetricsMqttDropped);
+			}
+		});
+	}
+
+	//
+	// latency tracking
+	//
+
+	void track(const uint16_t &packetId, const int64_t &startUs)
+	{
+		if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+			// overwrite the oldest slot if all are used
+			int slot = 0;
+			for (int i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+				if (!m_inFlight[i].m_packetId) {
+					slot = i;
+					break;
+				}
+				if (m_inFlight[i].m_startUs < m_inFlight[slot].m_startUs) {
+					slot = i;
+				}
+			}
+			m_inFlight[slot].m_packetId = packetId;
+			m_inFlight[slot].m_startUs = startUs;
+			xSemaphoreGive(m_mutex);
+		}
+	}
+
+	void acknowledged(const uint16_t &packetId)
+	{
+		if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+			for (int i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+				if (m_inFlight[i].m_packetId == packetId) {
+					metricsObserve(eMetricsMqttPublishLatency, esp_timer_get_time() - m_inFlight[i].m_startUs);
+					m_inFlight[i].m_packetId = 0;
+					break;
+				}
+			}
+			xSemaphoreGive(m_mutex);
+		}
+	}
+
+	//
+	// publishing
+	//
+
+	bool publish(const String &topic, const char *payload, const size_t &len)
+	{
+		int64_t startUs = esp_timer_get_time();
+		uint16_t packetId = m_client.publish(topic.c_str(), MQTT_QOS, false, payload, len);
+		if (!packetId) {
+			return false;
+		}
+
+		// QoS 0 is never acknowledged, measure just the hand over
+		if (MQTT_QOS == 0) {
+			metricsObserve(eMetricsMqttPublishLatency, esp_timer_get_time() - startUs);
+		} else {
+			track(packetId, startUs);
+		}
+		return true;
+	}
+
+	void fillSample(JsonObject obj, const SensorSample &sample)
+	{
+		obj["t"] = sample.m_timestampMs;
+		obj["seq"] = sample.m_sequence;
+		obj["pm2_5"] = sample.m_pm2_5;
+#if (USE_CO2_SENSOR == 1)
+		obj["co2"] = sample.m_co2;
+		obj["temperature"] = sample.m_temperature;
+		obj["humidity"] = sample.m_humidity;
+#elif (USE_ENV_SENSOR == 1)
+		obj["temperature"] = sample.m_temperature;
+		obj["humidity"] = sample.m_humidity;
+		obj["pressure"] = sample.m_pressure;
+#endif
+	}
+
+	bool publishChannel(const char *channel, const SensorSample &sample, const float &value)
+	{
+		int len = snprintf(m_payload, sizeof(m_payload), "{\"t\":%llu,\"seq\":%u,\"v\":%.2f}", sample.m_timestampMs, sample.m_sequence, value);
+		return publish(m_topicBase + "/" + channel, m_payload, len);
+	}
+
+	// one message per channel
+	bool publishSample(const SensorSample &sample)
+	{
+		struct Channel {
+			const char *m_name;
+			float m_value;
+		} channels[] = {
+			{ "pm2_5", (float)sample.m_pm2_5 },
+#if (USE_CO2_SENSOR == 1)
+			{ "co2", (float)sample.m_co2 },
+			{ "temperature", sample.m_temperature },
+			{ "humidity", sample.m_humidity },
+#elif (USE_ENV_SENSOR == 1)
+			{ "temperature", sample.m_temperature },
+			{ "humidity", sample.m_humidity },
+			{ "pressure", sample.m_pressure },
+#endif
+		};
+
+		// a different sample than the one that failed part way starts over
+		if (sample.m_timestampMs != m_partialTimestampMs || sample.m_sequence != m_partialSequence) {
+			m_channelsSent = 0;
+			m_partialTimestampMs = sample.m_timestampMs;
+			m_partialSequence = sample.m_sequence;
+		}
+
+		while (m_channelsSent < sizeof(channels) / sizeof(channels[0])) {
+			if (!publishChannel(channels[m_channelsSent].m_name, sample, channels[m_channelsSent].m_value)) {
+				return false;
+			}
+			m_channelsSent++;
+		}
+
+		m_channelsSent = 0;
+		m_partialTimestampMs = 0;
+		m_partialSequence = 0;
+		metricsIncrement(eMetricsMqttPublished);
+		return true;
+	}
+
+	// JSON array of samples in one message
+	bool publishBatch(const SensorSample *samples, const uint32_t &count)
+	{
+		DynamicJsonDocument doc(JSON_ARRAY_SIZE(count) + count * JSON_OBJECT_SIZE(7));
+		JsonArray array = doc.to<JsonArray>();
+		for (uint32_t i = 0; i < count; i++) {
+			fillSample(array.createNestedObject(), samples[i]);
+		}
+
+		size_t len = serializeJson(doc, m_payload, sizeof(m_payload));
+		if (!publish(m_topicBase + "/samples", m_payload, len)) {
+			return false;
+		}
+
+		metricsIncrement(eMetricsMqttPublished, count);
+		return true;
+	}
+
+	bool publishSamples(const SensorSample *samples, const uint32_t &count)
+	{
+		return (MQTT_BATCH_SIZE > 0) ? publishBatch(samples, count) : publishSample(samples[0]);
+	}
+
+	//
+	// queueing
+	//
+
+	uint32_t loadSpoolRead()
+	{
+		uint32_t read = 0;
+		File file = SPIFFS.open(MQTT_SPOOL_POS_FILENAME, "r");
+		if (file) {
+			if (file.read((uint8_t *)&read, sizeof(read)) != sizeof(read) || read > m_spoolCount) {
+				read = 0;
+			}
+			file.close();
+		}
+		return read;
+	}
+
+	void storeSpoolRead()
+	{
+		File file = SPIFFS.open(MQTT_SPOOL_POS_FILENAME, "w");
+		if (file) {
+			file.write((const uint8_t *)&m_spoolRead, sizeof(m_spoolRead));
+			file.close();
+		}
+	}
+
+	void spool(const SensorSample &sample)
+	{
+		if (m_spoolCount >= MQTT_SPOOL_MAX_SAMPLES) {
+			metricsIncrement(eMetricsMqttDropped);
+			return;
+		}
+
+		File file = SPIFFS.open(MQTT_SPOOL_FILENAME, "a");
+		if (file && file.write((const uint8_t *)&sample, sizeof(sample)) == sizeof(sample)) {
+			m_spoolCount++;
+		} else {
+			metricsIncrement(eMetricsMqttDropped);
+		}
+		file.close();
+	}
+
+	void push(const SensorSample &sample)
+	{
+		// RAM queue is full, move the oldest sample to flash
+		if (m_pendingCount == MQTT_RAM_QUEUE) {
+			spool(m_pending[m_pendingHead]);
+			m_pendingHead = (m_pendingHead + 1) % MQTT_RAM_QUEUE;
+			m_pendingCount--;
+		}
+
+		m_pending[(m_pendingHead + m_pendingCount) % MQTT_RAM_QUEUE] = sample;
+		m_pendingCount++;
+	}
+
+	void flushSpool()
+	{
+		File file = SPIFFS.open(MQTT_SPOOL_FILENAME, "r");
+		if (!file) {
+			SPIFFS.remove(MQTT_SPOOL_POS_FILENAME);
+			m_spoolCount = m_spoolRead = 0;
+			return;
+		}
+
+		uint32_t spoolRead = m_spoolRead;
+		while (m_spoolRead < m_spoolCount && m_client.connected()) {
+			SensorSample samples[MQTT_BATCH_MAX];
+			uint32_t count = m_spoolCount - m_spoolRead;
+			count = (count > MQTT_BATCH_MAX) ? MQTT_BATCH_MAX : count;
+
+			file.seek(m_spoolRead * sizeof(SensorSample));
+			if (file.read((uint8_t *)samples, count * sizeof(SensorSample)) != count * sizeof(SensorSample)) {
+				// truncated spool, drop it
+				m_spoolRead = m_spoolCount;
+				break;
+			}
+
+			if (!publishSamples(samples, count)) {
+				break;
+			}
+			m_spoolRead += (MQTT_BATCH_SIZE > 0) ? count : 1;
+		}
+		file.close();
+
+		// everything has been sent
+		if (m_spoolRead >= m_spoolCount) {
+			SPIFFS.remove(MQTT_SPOOL_FILENAME);
+			SPIFFS.remove(MQTT_SPOOL_POS_FILENAME);
+			m_spoolCount = m_spoolRead = 0;
+		} else if (m_spoolRead != spoolRead) {
+			// once per pass, not per sample, to spare the flash
+			storeSpoolRead();
+		}
+	}
+
+	void flush()
+	{
+		// oldest samples are in flash
+		if (m_spoolCount) {
+			flushSpool();
+			if (m_spoolCount) {
+				return;
+			}
+		}
+
+		// batches wait until they are full, single samples go right away
+		while (m_pendingCount && m_pendingCount >= (uint32_t)MQTT_BATCH_MAX && m_client.connected()) {
+			SensorSample samples[MQTT_BATCH_MAX];
+			for (uint32_t i = 0; i < MQTT_BATCH_MAX; i++) {
+				samples[i] = m_pending[(m_pendingHead + i) % MQTT_RAM_QUEUE];
+			}
+
+			if (!publishSamples(samples, MQTT_BATCH_MAX)) {
+				break;
+			}
+
+			uint32_t published = (MQTT_BATCH_SIZE > 0) ? MQTT_BATCH_MAX : 1;
+			m_pendingHead = (m_pendingHead + published) % MQTT_RAM_QUEUE;
+			m_pendingCount -= published;
+		}
+	}
+
+	void task()
+	{
+		init();
+
+		while (1) {
+			// sleep until a sample arrives (or it is time to retry the connection)
+			SensorSample sample;
+			if (xQueueReceive(m_incoming, &sample, pdMS_TO_TICKS(MQTT_RECONNECT_MS)) == pdTRUE) {
+				push(sample);
+				while (xQueueReceive(m_incoming, &sample, 0) == pdTRUE) {
+					push(sample);
+				}
+			}
+
+			if (!m_client.connected()) {
+				if (wifiIsConnected() && (millis() - m_lastConnectMs) > MQTT_RECONNECT_MS) {
+					m_lastConnectMs = millis();
+					LOG_PRINTF("[MQTT] connecting to %s:%d\n", MQTT_HOST, MQTT_PORT);
+					m_client.connect();
+				}
+			} else {
+				flush();
+			}
+
+			metricsSet(eMetricsMqttQueueDepth, m_pendingCount);
+			metricsSet(eMetricsMqttSpoolDepth, m_spoolCount - m_spoolRead);
+		}
+	}
+};
+
+static MqttTaskCtx g_ctx;
+
+void mqttTask(void *pvParameters __attribute__((unused)))
+{
+	// wait until the network is connected
+	wifiWaitForConnection();
+
+	g_ctx.task();
+}
+
+#endif // MQTT_ENABLED
@@ -0,0 +1,3 @@
+#pragma once
+
+void mqttTask(void *pvParameters __attribute__((unused)));
@@ -1,57 +1,244 @@
+#define LOG_MODULE eLogModuleNtp
+
 #include <Arduino.h>
-#include <WiFiUdp.h>
-#include <NTPClient.h>
+#include <WiFi.h>
+#include <lwip/sockets.h>
+#include <time.h>
+#include <vector>
 #include "utils.h"
 #include "config.h"
 #include "ntpTask.h"
+#include "bootTrace.h"
+#include "metrics.h"
+#include "sntpClient.h"
+#include "wallClock.h"
 #include "../tasks/wifiTask.h"
 
-static WiFiUDP ntpUDP;
+#define NTP_PORT 123
+
+struct NtpServer {
+	String m_host;
+	uint32_t m_ip;			// resolved every round, 0 if the lookup failed
+};
+
+static SemaphoreHandle_t g_mutex = NULL;
+static SntpClient *g_client = NULL;
+static std::vector<NtpServer> g_servers;
+static int g_socket = -1;
+
+static void parseServers()
+{
+	// "host,host,..."
+	String list = NTP_SERVERS;
+	int start = 0;
+	while (start < (int)list.length()) {
+		int end = list.indexOf(',', start);
+		end = (end < 0) ? list.length() : end;
+		String host = list.substring(start, end);
+		host.trim();
+		if (host.length()) {
+			g_servers.push_back(NtpServer{host, 0});
+		}
+		start = end + 1;
+	}
+}
+
+static bool openSocket()
+{
+	if (g_socket >= 0) {
+		return true;
+	}
+
+	g_socket = socket(AF_INET, SOCK_DGRAM, 0);
+	if (g_socket < 0) {
+		LOG_PRINTF("[NTP] Unable to open UDP socket (%d)\n", errno);
+		return false;
+	}
+
+	struct timeval timeout = { 0, 100000 };
+	setsockopt(g_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	return true;
+}
+
+// one request to a server, the answer (if any) goes to the client
+static void exchange(const size_t &server)
+{
+	uint8_t packet[SNTP_PACKET_LEN];
+
+	// late answers to requests that already timed out
+	while (recv(g_socket, packet, sizeof(packet), MSG_DONTWAIT) > 0) {
+	}
+
+	struct sockaddr_in to;
+	memset(&to, 0, sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_port = htons(NTP_PORT);
+	to.sin_addr.s_addr = g_servers[server].m_ip;
+
+	if (xSemaphoreTake(g_mutex, portMAX_DELAY) != pdTRUE) {
+		return;
+	}
+	g_client->request(server, clockMonotonicUs(), packet);
+	xSemaphoreGive(g_mutex);
+
+	int64_t startUs = clockMonotonicUs();
+	if (sendto(g_socket, packet, sizeof(packet), 0, (struct sockaddr *)&to, sizeof(to)) != sizeof(packet)) {
+		return;
+	}
+
+	while (clockMonotonicUs() - startUs < NTP_TIMEOUT_MS * 1000LL) {
+		uint8_t reply[SNTP_PACKET_LEN];
+		struct sockaddr_in from;
+		socklen_t fromLen = sizeof(from);
+		int len = recvfrom(g_socket, reply, sizeof(reply), 0, (struct sockaddr *)&from, &fromLen);
+		int64_t nowUs = clockMonotonicUs();
+		if (len <= 0 || from.sin_addr.s_addr != to.sin_addr.s_addr) {
+			continue;
+		}
+
+		bool accepted = false;
+		if (xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
+			accepted = g_client->response(server, reply, len, nowUs);
+			xSemaphoreGive(g_mutex);
+		}
+		if (accepted) {
+			return;
+		}
+	}
+}
+
+static bool pollRound(SntpClient::Estimate &estimate)
+{
+	// pool names rotate, resolve them every round
+	for (NtpServer &server : g_servers) {
+		IPAddress ip;
+		server.m_ip = WiFi.hostByName(server.m_host.c_str(), ip) ? (uint32_t)ip : 0;
+	}
+
+	if (xSemaphoreTake(g_mutex, portMAX_DELAY) != pdTRUE) {
+		return false;
+	}
+	g_client->startRound();
+	xSemaphoreGive(g_mutex);
+
+	// interleaved bursts, the client keeps the sample with the shortest round trip per server
+	for (int burst = 0; burst < NTP_BURST; burst++) {
+		for (size_t i = 0; i < g_servers.size(); i++) {
+			if (g_servers[i].m_ip) {
+				exchange(i);
+			}
+		}
+		if (burst + 1 < NTP_BURST) {
+			delay(NTP_BURST_GAP_MS);
+		}
+	}
 
-// TODO: this does not take timezones into account! Only UTC for now.
-static NTPClient timeClient(ntpUDP, NTP_SERVER, NTP_OFFSET_SECONDS, NTP_UPDATE_INTERVAL_MS);
-static SemaphoreHandle_t g_mutex = xSemaphoreCreateMutex();
-static unsigned long g_lastEpochTime = 0;
-static uint32_t g_lastEpochMillis = 0;
+	bool result = false;
+	if (xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
+		result = g_client->finishRound(clockMonotonicUs(), estimate);
+		xSemaphoreGive(g_mutex);
+	}
+	return result;
+}
 
 void fetchTimeFromNTP(void * parameter)
 {
+	// the wall clock is UTC, the time zone applies to the local time in logs
+	setenv("TZ", NTP_TIMEZONE, 1);
+	tzset();
+
+	parseServers();
+	SntpClient::Config config = {
+		NTP_MIN_POLL_S,
+		NTP_MAX_POLL_S,
+		CLOCK_STEP_THRESHOLD_MS * 1000LL,
+		NTP_STABLE_US,
+		NTP_AGREE_US,
+		CLOCK_SLEW_MAX_PPM
+	};
+	g_client = new SntpClient(config, g_servers.size());
+	g_mutex = xSemaphoreCreateMutex();
+
 	// wait until the network is connected
 	wifiWaitForConnection();
 
 	while (1) {
-		LOG_PRINTF("[NTP] Updating...\n");
-		timeClient.update();
+		uint32_t waitS = NTP_RETRY_S;
+		SntpClient::Estimate estimate;
 
-		// atomically update last epoch time and millis() reference
-		if (xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
-			g_lastEpochTime = timeClient.getEpochTime();
-			g_lastEpochMillis = millis();
-			xSemaphoreGive(g_mutex);
-		}
+		if (openSocket() && pollRound(estimate)) {
+			// correction relative to the wall clock at the time of the estimate
+			int64_t correctionUs = estimate.m_epochUs - (clockEpochUs() - (clockMonotonicUs() - estimate.m_monotonicUs));
+			bool stepped = clockSync(estimate.m_epochUs, estimate.m_monotonicUs, estimate.m_ratePpb);
+			bootTraceMark(eBootPhaseNtpSynced);
+
+			SntpClient::Status status = {};
+			if (xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
+				g_client->status(status);
+				xSemaphoreGive(g_mutex);
+			}
+			waitS = status.m_pollS;
 
-		String timestring = timeClient.getFormattedTime();
-		short tIndex = timestring.indexOf("T");
-		LOG_PRINTF("NTP time: %s\n", timestring.substring(tIndex + 1, timestring.length() -3).c_str());
+			metricsSet(eMetricsNtpOffset, correctionUs / 1e6);
+			metricsSet(eMetricsNtpUncertainty, estimate.m_uncertaintyUs / 1e6);
+			metricsSet(eMetricsNtpDrift, status.m_driftPpm);
+			metricsSet(eMetricsNtpPollInterval, waitS);
 
-		// Sleep for a minute before checking again
-		longDelay(NTP_UPDATE_INTERVAL_MS);
+			LOG_PRINTF("[NTP] %s %.3f ms, uncertainty %.3f ms, drift %.2f ppm, next in %u s\n",
+				stepped ? "Stepped" : "Slewing", correctionUs / 1000.0, estimate.m_uncertaintyUs / 1000.0, status.m_driftPpm, waitS);
+		} else {
+			LOG_PRINTF("[NTP] No server answered, retrying in %u s\n", waitS);
+		}
+
+		longDelay(waitS * 1000);
 	}
 }
 
 uint64_t compensatedMillis()
 {
-	unsigned long lastEpochTime = 0;
-	uint32_t lastEpochMillis;
+	return clockEpochMs();
+}
 
-	if (xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
-		lastEpochTime = g_lastEpochTime;
-		lastEpochMillis = g_lastEpochMillis;
-		xSemaphoreGive(g_mutex);
+void ntpTimeJson(JsonDocument &doc)
+{
+	uint64_t epochMs = clockEpochMs();
+	doc["synced"] = clockSynced();
+	doc["epochMs"] = epochMs;
+	doc["localTime"] = epochToTimeStr(epochMs);
+	doc["timezone"] = NTP_TIMEZONE;
+
+	if (!g_mutex || xSemaphoreTake(g_mutex, portMAX_DELAY) != pdTRUE) {
+		return;
+	}
 
-		// conversion
-		return (uint64_t)lastEpochTime * 1000 + (millis() - lastEpochMillis);
-	} else {
-		return 0;
+	SntpClient::Status status;
+	g_client->status(status);
+	doc["pollS"] = status.m_pollS;
+	doc["driftPpm"] = status.m_driftPpm;
+	doc["jitterUs"] = status.m_jitterUs;
+	doc["uncertaintyUs"] = status.m_uncertaintyUs;
+	doc["lastErrorUs"] = status.m_lastErrorUs;
+	doc["rounds"] = status.m_rounds;
+	if (status.m_synced) {
+		doc["lastUpdateS"] = (clockMonotonicUs() - status.m_lastUpdateUs) / 1000000;
 	}
+
+	// offsets relative to the combined estimate of the last round
+	JsonArray servers = doc.createNestedArray("servers");
+	for (size_t i = 0; i < g_servers.size(); i++) {
+		const SntpClient::ServerStatus &server = g_client->server(i);
+		JsonObject obj = servers.createNestedObject();
+		obj["host"] = g_servers[i].m_host;
+		obj["ip"] = IPAddress(g_servers[i].m_ip).toString();
+		obj["reach"] = server.m_reach;
+		obj["used"] = server.m_used;
+		if (server.m_stratum) {
+			obj["stratum"] = server.m_stratum;
+			obj["offsetUs"] = server.m_offsetUs;
+			obj["delayUs"] = server.m_delayUs;
+			obj["distanceUs"] = server.m_distanceUs;
+		}
+	}
+
+	xSemaphoreGive(g_mutex);
 }
@@ -1,8 +1,15 @@
 #pragma once
 
+#include <ArduinoJson.h>
+
 //
 // task to handle NTP
 //
 
 void fetchTimeFromNTP(void *pvParameters __attribute__((unused)));
+
+// wall clock in milliseconds (uptime until the first NTP update), wait-free, see wallClock.h
 uint64_t compensatedMillis();
+
+// clock estimate and the state of every configured server
+void ntpTimeJson(JsonDocument &doc);
@@ -1,9 +1,12 @@
+#define LOG_MODULE eLogModuleOta
+
 #include <Arduino.h>
 #include <ArduinoOTA.h>
 #include "otaTask.h"
 
 #include "utils.h"
 #include "watchdog.h"
+#include "powerSave.h"
 #include "wifiTask.h"
 
 void otaTask(void * parameter)
@@ -26,9 +29,13 @@ void otaTask(void * parameter)
 
 			// NOTE: if updating SPIFFS this would be the place to unmount SPIFFS using SPIFFS.end()
 			LOG_PRINTF("Start updating %s\n", type.c_str());
+
+			// keep the radio awake for the transfer
+			powerSaveBoost(ePowerSaveBoostOta, POWER_SAVE_BOOST_LEASE_MS);
 		})
 		.onEnd([](){
 			LOG_PRINTF("\nEnd");
+			powerSaveBoost(ePowerSaveBoostOta, 0);
 		})
 		.onProgress([](unsigned int progress, unsigned int total) {
 			static int lastProgressPercent = -1;
@@ -38,8 +45,10 @@ void otaTask(void * parameter)
 				LOG_PRINTF("Progress: %u%%\r", progressPercent);
 			}
 			watchdogReset();
+			powerSaveBoost(ePowerSaveBoostOta, POWER_SAVE_BOOST_LEASE_MS);
 		})
 		.onError([](ota_error_t error) {
+			powerSaveBoost(ePowerSaveBoostOta, 0);
 			LOG_PRINTF("Error[%u]: ", error);
 			if (error == OTA_AUTH_ERROR) LOG_PRINTF("Auth Failed\n");
 			else if (error == OTA_BEGIN_ERROR) LOG_PRINTF("Begin Failed\n");
@@ -1,3 +1,5 @@
+#define LOG_MODULE eLogModuleSensor
+
 #include <Arduino.h>
 #include <Adafruit_NeoPixel.h>
 #include <SensirionI2CScd4x.h>
@@ -12,6 +14,9 @@
 #include "watchdog.h"
 #include "hsvToRgb.h"
 #include "display.h"
+#include "metrics.h"
+#include "bootTrace.h"
+#include "../tasks/ntpTask.h"
 
 #if (USE_CO2_SENSOR == 1)
 #include "scd4xHelper.h"
@@ -23,6 +28,9 @@
 
 #define CLAMP(min, max, val) ((val < min) ? min : ((val > max) ? max : val))
 
+// published samples kept for lock-free readers
+#define SENSOR_SNAPSHOTS 4
+
 //
 // sensor task context
 //
@@ -53,6 +61,19 @@ private:
 	uint16_t m_pm2_5;
 	bool m_fanEnabled;
 
+	// sample listeners (append only, count is updated after the slot is filled)
+	SensorListener m_listeners[SENSOR_MAX_LISTENERS];
+	volatile int m_listenerCount;
+	uint32_t m_sequence;
+
+	// Last published samples for lock-free readers, a ring with a generation
+	// counter like WallClock: the writer fills the slot of the next
+	// generation and then publishes it, so a reader that preempted the
+	// writer mid-update still copies a complete sample and never waits.
+	// 0 = nothing published yet.
+	uint32_t m_snapshotGeneration;
+	SensorSample m_snapshots[SENSOR_SNAPSHOTS];
+
 public:
 	Context()
 	{
@@ -69,6 +90,10 @@ public:
 #endif
 		m_pm2_5 = 0;
 		m_fanEnabled = true;
+		m_listenerCount = 0;
+		m_sequence = 0;
+		m_snapshotGeneration = 0;
+		memset((void *)m_snapshots, 0, sizeof(m_snapshots));
 
 		// create semaphore for watchdog
 		m_mutex = xSemaphoreCreateMutex();
@@ -86,7 +111,7 @@ public:
 
 		// init pressure sensor
 		if (!m_qmp6988.init()) {
-			LOG_PRINTF("QMP6988 sensor failed to initialize!\n");
+			LOG_ERROR("QMP6988 sensor failed to initialize!\n");
 		}
 #endif
 
@@ -120,7 +145,8 @@ public:
 			pm2_5 = m_pm2_5;
 			return true;
 		} else {
-			LOG_PRINTF("Measurement failed!\n");
+			LOG_ERROR("Measurement failed!\n");
+			metricsIncrement(eMetricsSensorFailures);
 			Display::instance().alert(PM_LED);
 			pm2_5 = 0;
 			return false;
@@ -136,6 +162,61 @@ public:
 		}
 	}
 
+	bool subscribe(SensorListener listener)
+	{
+		bool ret = false;
+		executeAtomically([&]{
+			if (m_listenerCount < SENSOR_MAX_LISTENERS) {
+				m_listeners[m_listenerCount] = listener;
+				m_listenerCount = m_listenerCount + 1;
+				ret = true;
+			}
+		});
+		return ret;
+	}
+
+	void publish(SensorSample &sample)
+	{
+		// listeners are called without holding the mutex,
+		// so they can't block readers of lastSensorData()
+		sample.m_sequence = m_sequence++;
+
+		// the sensor task is the only writer
+		uint32_t generation = m_snapshotGeneration + 1;
+		m_snapshots[generation % SENSOR_SNAPSHOTS] = sample;
+		__atomic_store_n(&m_snapshotGeneration, generation, __ATOMIC_RELEASE);
+		bootTraceMark(eBootPhaseFirstSample);
+
+		int count = m_listenerCount;
+		for (int i = 0; i < count; i++) {
+			m_listeners[i](sample);
+		}
+	}
+
+	bool snapshot(SensorSample &sample)
+	{
+		// never blocks and never takes the mutex, the copy only has to be
+		// repeated if the writer reused its slot meanwhile, which takes
+		// SENSOR_SNAPSHOTS - 1 sensor cycles during a single copy
+		while (1) {
+			uint32_t generation = __atomic_load_n(&m_snapshotGeneration, __ATOMIC_ACQUIRE);
+			if (!generation) {
+				return false;
+			}
+
+			sample = m_snapshots[generation % SENSOR_SNAPSHOTS];
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&m_snapshotGeneration, __ATOMIC_RELAXED) - generation < SENSOR_SNAPSHOTS - 1) {
+				return true;
+			}
+		}
+	}
+
+	bool fanEnabled()
+	{
+		return __atomic_load_n(&m_fanEnabled, __ATOMIC_RELAXED);
+	}
+
 	void sensorFanMode(const bool &enabled)
 	{
 		executeAtomically([&]{
@@ -160,6 +241,7 @@ public:
 			co2 = m_co2;
 			return true;
 		} else {
+			metricsIncrement(eMetricsSensorFailures);
 			Display::instance().alert(CO2_LED);
 			temperature = 0;
 			humidity = 0;
@@ -196,6 +278,7 @@ public:
 			return true;
 		} else {
 			LOG_PRINTF("Failed to read temperature/humidity data!\n");
+			metricsIncrement(eMetricsSensorFailures);
 			temperature = 0;
 			humidity = 0;
 			return false;
@@ -242,9 +325,11 @@ void sensorTask(void * parameter)
 
 	// init context
 	g_ctx.init();
+	bootTraceMark(eBootPhaseSensorInit);
 
 	// give 10 seconds for initial measurement
 	delay(10000);
+	bootTraceMark(eBootPhaseSensorWarmedUp);
 
 	while (1) {
 
@@ -254,8 +339,10 @@ void sensorTask(void * parameter)
 
 		// pm2.5 sensor
 		uint16_t pm2_5 = 0;
+		int64_t readStartUs = esp_timer_get_time();
 		while (!g_ctx.readPm25(pm2_5)) {
 			delay(1000);
+			readStartUs = esp_timer_get_time();
 		}
 
 #if (USE_CO2_SENSOR == 1)
@@ -272,6 +359,8 @@ void sensorTask(void * parameter)
 		g_ctx.readEnv(temperature, humidity, pressure);
 #endif
 
+		metricsObserve(eMetricsSensorReadTime, esp_timer_get_time() - readStartUs);
+
 		//
 		// show PM readings on the led
 		//
@@ -377,6 +466,26 @@ void sensorTask(void * parameter)
 
 		Display::instance().fadeColors(pmColor, humColor, co2Color, 16);
 
+		//
+		// notify listeners about the new sample
+		//
+
+		{
+			SensorSample sample = {};
+			sample.m_timestampMs = compensatedMillis();
+			sample.m_pm2_5 = pm2_5;
+#if (USE_CO2_SENSOR == 1)
+			sample.m_co2 = co2;
+			sample.m_temperature = temperature;
+			sample.m_humidity = humidity;
+#elif (USE_ENV_SENSOR == 1)
+			sample.m_temperature = temperature;
+			sample.m_humidity = humidity;
+			sample.m_pressure = pressure;
+#endif
+			g_ctx.publish(sample);
+		}
+
 		//
 		// wait 10 seconds and read data again
 		//
@@ -390,6 +499,21 @@ void sensorFanMode(const bool &enabled)
 	g_ctx.sensorFanMode(enabled);
 }
 
+bool sensorFanEnabled()
+{
+	return g_ctx.fanEnabled();
+}
+
+bool sensorSubscribe(SensorListener listener)
+{
+	return g_ctx.subscribe(listener);
+}
+
+bool sensorSnapshot(SensorSample &sample)
+{
+	return g_ctx.snapshot(sample);
+}
+
 #if (USE_CO2_SENSOR == 1)
 bool lastSensorData(uint16_t &pm2_5, float &temperature, float &humidity, uint16_t &co2)
 {
@@ -1,7 +1,33 @@
 #pragma once
 
+#include <functional>
+
+//
+// one completed sensor cycle (channels not present in the build are zero)
+//
+
+struct SensorSample {
+	uint64_t m_timestampMs;	// compensatedMillis() at the end of the cycle
+	uint32_t m_sequence;	// cycle counter since boot
+	uint16_t m_pm2_5;		// ug/m3
+	uint16_t m_co2;			// ppm
+	float m_temperature;	// C
+	float m_humidity;		// %
+	float m_pressure;		// kPa
+};
+
+typedef std::function<void(const SensorSample &sample)> SensorListener;
+
 void sensorTask(void *pvParameters __attribute__((unused)));
 void sensorFanMode(const bool &enabled);
+bool sensorFanEnabled();
+
+// listeners are called from the sensor task after each cycle, keep them short
+bool sensorSubscribe(SensorListener listener);
+
+// last published sample without locking, safe to call from any context
+// (returns false until the first cycle has completed)
+bool sensorSnapshot(SensorSample &sample);
 #if (USE_CO2_SENSOR == 1)
 bool lastSensorData(uint16_t &pm2_5, float &temperature, float &humidity, uint16_t &co2);
 #elif (USE_ENV_SENSOR == 1)
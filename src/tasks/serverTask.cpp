@@ -1,32 +1,63 @@
+#define LOG_MODULE eLogModuleServer
+
 #include <Arduino.h>
 
 #include <ESPAsyncWebserver.h>
 #include <AsyncElegantOTA.h>
 #include <ArduinoJson.h>
 #include <ESPmDNS.h>
+#include <Update.h>
 
 #include "WiFi.h"
 #include "config.h"
 #include "utils.h"
 #include "watchdog.h"
 #include "display.h"
+#include "metrics.h"
+#include "webAssets.h"
+#include "admission.h"
+#include "history.h"
+#include "snapshot.h"
+#include "cbor.h"
+#include "accept.h"
+#include "bootTrace.h"
+#include "powerSave.h"
 
 #include "wifiTask.h"
 #include "sensorTask.h"
 #include "serverTask.h"
 #include "ntpTask.h"
+#include "fleetTask.h"
+#include "logRing.h"
 
 #define OUTPUT_JSON_BUFFER_SIZE 512
+#define BOOT_TRACE_JSON_SIZE 2048
+#define WIFI_DIAG_JSON_SIZE 6144
+#define POWER_SAVE_JSON_SIZE 1024
+#define NTP_JSON_SIZE 1536
+#define LOG_LEVELS_JSON_SIZE 2048
+
+// server task control events
+#define SERVER_EVENT_WIFI_RECONFIGURE	BIT0
+#define SERVER_EVENT_WIFI_RESET			BIT1
+#define SERVER_EVENT_ALL				(SERVER_EVENT_WIFI_RECONFIGURE | SERVER_EVENT_WIFI_RESET)
 
 class ServerTaskCtx {
 private:
-	bool m_wifiReconfigureRequested;
-	bool m_wifiResetRequested;
+	// requests posted from AsyncTCP callbacks, the task sleeps until one is set
+	EventGroupHandle_t m_events;
+
+	// request admission / load shedding
+	AdmissionControl m_admission;
+
+	// last /get body, served as is in low heap mode
+	char m_getCache[OUTPUT_JSON_BUFFER_SIZE];
+	size_t m_getCacheLen;
 public:
 	ServerTaskCtx()
 	{
-		m_wifiReconfigureRequested = false;
-		m_wifiResetRequested = false;
+		m_events = xEventGroupCreate();
+		m_getCacheLen = 0;
 	}
 
 	//
@@ -35,7 +66,14 @@ public:
 
 	void indexHandler(AsyncWebServerRequest *request)
 	{
-		LOG_PRINTF("%s(%d): request from %s\n", __FUNCTION__, __LINE__, request->client()->remoteIP().toString().c_str());
+		LOG_DEBUG("%s(%d): request from %s\n", __FUNCTION__, __LINE__, request->client()->remoteIP().toString().c_str());
+
+		// prefer the static app from the web assets partition if available
+		const WebAsset *asset = webAssetsFind("/index.html");
+		if (asset) {
+			webAssetsSend(request, asset);
+			return;
+		}
 
 		String body =
 		"<!DOCTYPE html>\n"
@@ -118,7 +156,21 @@ public:
 	#else
 		"Click <a href=\"/get\">here</a> to retrieve PM2.5 readings<br>"
 	#endif
-		"Click <a href=\"/rssi\">here</a> to get RSSI<br><br>"
+		"Click <a href=\"/rssi\">here</a> to get RSSI<br>"
+		"Click <a href=\"/metrics\">here</a> to get Prometheus metrics<br>"
+		"Click <a href=\"/history\">here</a> to download sample history (CSV)<br>"
+		"Click <a href=\"/diag/boot\">here</a> to get the boot timeline<br><br>"
+		"Click <a href=\"/diag/wifi\">here</a> to get the WiFi signal and roaming history<br>"
+		"Click <a href=\"/diag/power\">here</a> to get the WiFi power save profile and gateway round trips<br>"
+		"Click <a href=\"/diag/time\">here</a> to get the NTP clock estimate and servers<br><br>"
+
+		"Click <a href=\"/log\">here</a> to get the recent log messages<br>"
+		"Click <a href=\"/log.bin\">here</a> to download them for tools/log_decode<br>"
+		"Click <a href=\"/log/level\">here</a> to get the log levels, /log/level?module=wifi&level=debug changes one<br><br>"
+
+		"Click <a href=\"/power?profile=latency\">here</a> to keep the WiFi radio always on<br>"
+		"Click <a href=\"/power?profile=balanced\">here</a> to let the WiFi radio sleep between DTIM beacons<br>"
+		"Click <a href=\"/power?profile=power\">here</a> to let the WiFi radio sleep longest<br><br>"
 
 		"Click <a href=\"/fan?value=on\">here</a> to turn on the Fan<br>"
 		"Click <a href=\"/fan?value=off\">here</a> to turn off the Fan<br><br>"
@@ -143,82 +195,189 @@ public:
 		request->send(200, "text/html", body);
 	}
 
-	void getHandler(AsyncWebServerRequest *request)
-	{
-		LOG_PRINTF("%s(%d): request from %s\n", __FUNCTION__, __LINE__, request->client()->remoteIP().toString().c_str());
-		StaticJsonDocument<OUTPUT_JSON_BUFFER_SIZE> doc;
+	//
+	// JSON documents are also available as CBOR or MessagePack,
+	// selected by the Accept header
+	//
 
-		uint16_t pm2_5 = 0;
-	#if (USE_CO2_SENSOR == 1)
-		float temperature = 0;
-		float humidity = 0;
-		uint16_t co2 = 0;
-		if (lastSensorData(pm2_5, temperature, humidity, co2)) {
-			doc["co2"] = co2;
-			doc["temperature"] = temperature;
-			doc["humidity"] = humidity;
-			doc["pm2_5"] = pm2_5;
-		} else {
-			doc["co2"] = 0;
-			doc["temperature"] = 0;
-			doc["humidity"] = 0;
-			doc["pm2_5"] = 0;
+	enum Encoding {
+		eEncodingJson,
+		eEncodingCbor,
+		eEncodingMsgPack
+	};
+
+	Encoding negotiate(AsyncWebServerRequest *request)
+	{
+		static const char *const types[] = { "application/json", "application/cbor", "application/msgpack", "application/x-msgpack" };
+
+		// JSON also when nothing offered is acceptable
+		String accept = request->hasHeader("Accept") ? request->header("Accept") : "";
+		switch (acceptNegotiate(accept.c_str(), types, sizeof(types) / sizeof(types[0]))) {
+		case 1:
+			return eEncodingCbor;
+		case 2:
+		case 3:
+			return eEncodingMsgPack;
+		default:
+			return eEncodingJson;
 		}
-	#elif (USE_ENV_SENSOR == 1)
-		float temperature = 0;
-		float humidity = 0;
-		float pressure = 0;
-		if (lastSensorData(pm2_5, temperature, humidity, pressure)) {
-			doc["pressure"] = pressure;
-			doc["temperature"] = temperature;
-			doc["humidity"] = humidity;
-			doc["pm2_5"] = pm2_5;
-		} else {
-			doc["pressure"] = 0;
-			doc["temperature"] = 0;
-			doc["humidity"] = 0;
-			doc["pm2_5"] = 0;
+	}
+
+	// the body is copied into the response (binary bodies contain zeros,
+	// so they can't go through String)
+	void sendDocument(AsyncWebServerRequest *request, const Encoding &encoding, const char *buffer, const size_t &len)
+	{
+		static const char *const contentTypes[] = { "application/json", "application/cbor", "application/msgpack" };
+
+		AsyncResponseStream *stream = request->beginResponseStream(contentTypes[encoding], len);
+		stream->write((const uint8_t *)buffer, len);
+		stream->addHeader("Vary", "Accept");
+		request->send(stream);
+	}
+
+	size_t serializeDocument(const JsonDocument &doc, const Encoding &encoding, char *buffer, const size_t &maxLen)
+	{
+		switch (encoding) {
+		case eEncodingCbor:
+			return serializeCbor(doc, (uint8_t *)buffer, maxLen);
+		case eEncodingMsgPack:
+			return serializeMsgPack(doc, buffer, maxLen);
+		default:
+			return serializeJson(doc, buffer, maxLen);
 		}
-	#else
-		if (lastSensorData(pm2_5)) {
-			doc["pm2_5"] = pm2_5;
-		} else {
-			doc["pm2_5"] = 0;
+	}
+
+	void getHandler(AsyncWebServerRequest *request)
+	{
+		LOG_DEBUG("%s(%d): request from %s\n", __FUNCTION__, __LINE__, request->client()->remoteIP().toString().c_str());
+
+		Encoding encoding = negotiate(request);
+
+		// under heap pressure send the cached body without building a new one,
+		// copied because the next request rewrites the cache while this one is sent
+		if (encoding == eEncodingJson && m_getCacheLen && m_admission.lowHeap()) {
+			sendDocument(request, encoding, m_getCache, m_getCacheLen);
+			return;
 		}
-	#endif
 
-		// add time parameter
-		uint64_t currTimeMs = compensatedMillis();
-		doc["currTimeMs"] = currTimeMs;
-		doc["currTime"] = msToTimeStr(currTimeMs);
-		doc["watchdogTimeToReset"] = msToTimeStr(watchdogTimeToReset());
+		StaticJsonDocument<OUTPUT_JSON_BUFFER_SIZE> doc;
+		snapshotSensors(doc);
 
 		char buffer[OUTPUT_JSON_BUFFER_SIZE];
-		serializeJson(doc, buffer, sizeof(buffer));
+		size_t len = serializeDocument(doc, encoding, buffer, sizeof(buffer));
 
-		AsyncWebServerResponse *response = request->beginResponse(200, "application/json", buffer);
-		request->send(response);
+		// refresh cache for low heap mode
+		if (encoding == eEncodingJson) {
+			memcpy(m_getCache, buffer, len);
+			m_getCacheLen = len;
+		}
+
+		sendDocument(request, encoding, buffer, len);
+		bootTraceMark(eBootPhaseFirstServed);
 	}
 
 	void rssiHandler(AsyncWebServerRequest *request)
 	{
 		StaticJsonDocument<OUTPUT_JSON_BUFFER_SIZE> doc;
+		snapshotRssi(doc);
 
-		// print the received signal strength:
-		long rssi = WiFi.RSSI();
-		LOG_PRINTF("signal strength (RSSI): %d dBm\n", rssi);
+		Encoding encoding = negotiate(request);
+		char buffer[OUTPUT_JSON_BUFFER_SIZE];
+		size_t len = serializeDocument(doc, encoding, buffer, sizeof(buffer));
+		sendDocument(request, encoding, buffer, len);
+	}
 
-		doc["rssi"] = rssi;
+	void bootHandler(AsyncWebServerRequest *request)
+	{
+		DynamicJsonDocument doc(BOOT_TRACE_JSON_SIZE);
+		bootTraceJson(doc);
 
-		// add time parameter
-		uint64_t currTimeMs = compensatedMillis();
-		doc["currTimeMs"] = currTimeMs;
-		doc["currTime"] = msToTimeStr(currTimeMs);
-		doc["watchdogTimeToReset"] = msToTimeStr(watchdogTimeToReset());
+		String body;
+		serializeJson(doc, body);
+		request->send(200, "application/json", body);
+	}
 
-		char buffer[OUTPUT_JSON_BUFFER_SIZE];
-		serializeJson(doc, buffer, sizeof(buffer));
-		request->send(200, "application/json", buffer);
+	void wifiDiagHandler(AsyncWebServerRequest *request)
+	{
+		DynamicJsonDocument doc(WIFI_DIAG_JSON_SIZE);
+		wifiDiagJson(doc);
+
+		String body;
+		serializeJson(doc, body);
+		request->send(200, "application/json", body);
+	}
+
+	void powerDiagHandler(AsyncWebServerRequest *request)
+	{
+		DynamicJsonDocument doc(POWER_SAVE_JSON_SIZE);
+		powerSaveJson(doc);
+
+		String body;
+		serializeJson(doc, body);
+		request->send(200, "application/json", body);
+	}
+
+	void timeDiagHandler(AsyncWebServerRequest *request)
+	{
+		DynamicJsonDocument doc(NTP_JSON_SIZE);
+		ntpTimeJson(doc);
+
+		String body;
+		serializeJson(doc, body);
+		request->send(200, "application/json", body);
+	}
+
+	void logHandler(AsyncWebServerRequest *request)
+	{
+		AsyncResponseStream *stream = request->beginResponseStream("text/plain");
+		logHistoryText(*stream);
+		request->send(stream);
+	}
+
+	void logDumpHandler(AsyncWebServerRequest *request)
+	{
+		AsyncResponseStream *stream = request->beginResponseStream("application/octet-stream");
+		stream->addHeader("Content-Disposition", "attachment; filename=\"log.bin\"");
+		logHistoryDump(*stream);
+		request->send(stream);
+	}
+
+	void logLevelHandler(AsyncWebServerRequest *request)
+	{
+		// runtime levels only, they are back to LOG_RUNTIME_LEVEL after a restart
+		if (request->hasParam("module") || request->hasParam("level")) {
+			LogModule module;
+			LogLevel level;
+			if (!request->hasParam("module") || !request->hasParam("level")
+				|| !logModuleFromName(request->getParam("module")->value().c_str(), module)
+				|| !logLevelFromName(request->getParam("level")->value().c_str(), level)) {
+				request->send(404, "text/plain", "Not found");
+				return;
+			}
+			LOG_PRINTF("Log level of %s set to %s\n", logModuleName(module), logLevelName(level));
+			logSetLevel(module, level);
+			request->redirect("/log/level");
+			return;
+		}
+
+		DynamicJsonDocument doc(LOG_LEVELS_JSON_SIZE);
+		logLevelsJson(doc);
+
+		String body;
+		serializeJson(doc, body);
+		request->send(200, "application/json", body);
+	}
+
+	void powerHandler(AsyncWebServerRequest *request)
+	{
+		PowerSaveProfile profile;
+		if (request->hasParam("profile") && powerSaveFromName(request->getParam("profile")->value().c_str(), profile)) {
+			LOG_PRINTF("Power save profile selected: %s\n", powerSaveName(profile));
+			powerSaveSelect(profile);
+			request->redirect("/diag/power");
+		} else {
+			request->send(404, "text/plain", "Not found");
+		}
 	}
 
 	void reconfigureWifiHandler(AsyncWebServerRequest *request)
@@ -231,7 +390,7 @@ public:
 		"WiFi reconfiguration initiated"
 		"</body>";
 		request->send(200, "text/html", body);
-		m_wifiReconfigureRequested = true;
+		xEventGroupSetBits(m_events, SERVER_EVENT_WIFI_RECONFIGURE);
 	}
 
 	void resetWifi(AsyncWebServerRequest *request)
@@ -249,7 +408,7 @@ public:
 		delay(100);
 
 		// now reset
-		m_wifiResetRequested = true;
+		xEventGroupSetBits(m_events, SERVER_EVENT_WIFI_RESET);
 	}
 
 	void rebootHandler(AsyncWebServerRequest *request)
@@ -287,7 +446,7 @@ public:
 
 		if (request->hasParam("value")) {
 			String value = request->getParam("value")->value().c_str();
-			LOG_PRINTF("FAN value: %d\n", value.c_str());
+			LOG_PRINTF("FAN value: %s\n", value.c_str());
 			if (value == "on") {
 				sensorFanMode(true);
 			} else {
@@ -299,6 +458,115 @@ public:
 		}
 	}
 
+	void metricsHandler(AsyncWebServerRequest *request)
+	{
+		// take snapshot first so all chunks of the response are consistent
+		MetricsSnapshot snapshot;
+		metricsSnapshot(snapshot);
+
+		// dry run to calculate the content length
+		MetricsWriter counter(NULL, 0, 0);
+		metricsRender(snapshot, counter);
+
+		AsyncWebServerResponse *response = request->beginResponse("text/plain; version=0.0.4", counter.position(), [snapshot](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+			MetricsWriter writer((char *)buffer, maxLen, index);
+			metricsRender(snapshot, writer);
+			return writer.written();
+		});
+		request->send(response);
+	}
+
+	//
+	// history export
+	//  /history?from=<s>&to=<s>&step=<n>&format=csv|ndjson|bin
+	// format may also be negotiated via Accept header, single byte
+	// ranges are supported so interrupted downloads can be resumed
+	//
+
+	void historyHandler(AsyncWebServerRequest *request)
+	{
+		LOG_DEBUG("%s(%d): request from %s\n", __FUNCTION__, __LINE__, request->client()->remoteIP().toString().c_str());
+
+		uint32_t from = request->hasParam("from") ? strtoul(request->getParam("from")->value().c_str(), NULL, 10) : 0;
+		uint32_t to = request->hasParam("to") ? strtoul(request->getParam("to")->value().c_str(), NULL, 10) : compensatedMillis() / 1000;
+		uint32_t step = request->hasParam("step") ? strtoul(request->getParam("step")->value().c_str(), NULL, 10) : 1;
+		step = (step < 1) ? 1 : ((step > 65535) ? 65535 : step);
+
+		// explicit format parameter wins over Accept header, CSV if nothing fits
+		static const char *const types[] = { "text/csv", "application/x-ndjson", "application/octet-stream" };
+		String format = request->hasParam("format") ? request->getParam("format")->value() : "";
+		String accept = request->hasHeader("Accept") ? request->header("Accept") : "";
+		int negotiated = format.length() ? -1 : acceptNegotiate(accept.c_str(), types, sizeof(types) / sizeof(types[0]));
+		HistoryExport::Format exportFormat = HistoryExport::eFormatCsv;
+		if (format == "ndjson" || negotiated == 1) {
+			exportFormat = HistoryExport::eFormatNdjson;
+		} else if (format == "bin" || negotiated == 2) {
+			exportFormat = HistoryExport::eFormatBinary;
+		}
+
+		uint32_t firstSeq;
+		uint32_t count = historyRange(from, to, firstSeq);
+		HistoryExport stream(exportFormat, historyGet, firstSeq, count, step);
+		size_t total = stream.length();
+		char etag[48];
+		stream.etag(etag, sizeof(etag));
+
+		if (!total) {
+			request->send(200, stream.contentType(), "");
+			return;
+		}
+
+		// single byte range, ignored if If-Range does not match
+		size_t start = 0;
+		size_t end = total - 1;
+		bool partial = false;
+
+		if (request->hasHeader("Range") && (!request->hasHeader("If-Range") || request->header("If-Range") == etag)) {
+			String range = request->header("Range");
+			if (range.startsWith("bytes=") && range.indexOf(',') < 0) {
+				int dash = range.indexOf('-');
+				String first = range.substring(6, dash);
+				String last = range.substring(dash + 1);
+
+				if (dash < 0 || (!first.length() && !last.length())) {
+					// malformed, serve everything
+				} else if (!first.length()) {
+					// suffix range
+					size_t suffix = strtoul(last.c_str(), NULL, 10);
+					start = (suffix >= total) ? 0 : total - suffix;
+					partial = true;
+				} else {
+					start = strtoul(first.c_str(), NULL, 10);
+					if (last.length()) {
+						size_t rangeEnd = strtoul(last.c_str(), NULL, 10);
+						end = (rangeEnd < end) ? rangeEnd : end;
+					}
+					partial = true;
+				}
+
+				if (partial && (start >= total || start > end)) {
+					AsyncWebServerResponse *response = request->beginResponse(416);
+					response->addHeader("Content-Range", "bytes */" + String(total));
+					request->send(response);
+					return;
+				}
+			}
+		}
+
+		AsyncWebServerResponse *response = request->beginResponse(stream.contentType(), end - start + 1, [stream, start](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+			return stream.read(buffer, maxLen, start + index);
+		});
+
+		if (partial) {
+			response->setCode(206);
+			response->addHeader("Content-Range", "bytes " + String(start) + "-" + String(end) + "/" + String(total));
+		}
+		response->addHeader("Accept-Ranges", "bytes");
+		response->addHeader("ETag", etag);
+		response->addHeader("Vary", "Accept");
+		request->send(response);
+	}
+
 	#if DEBUG_LEDS
 	void ledColorHandler(AsyncWebServerRequest *request)
 	{
@@ -315,11 +583,28 @@ public:
 	}
 	#endif
 
+	//
+	// registers GET handler wrapped with request accounting
+	//
+
+	void on(AsyncWebServer *server, const char *uri, ArRequestHandlerFunction handler)
+	{
+		server->on(uri, HTTP_GET, [=](AsyncWebServerRequest *request){
+			int64_t startUs = esp_timer_get_time();
+			metricsIncrement(eMetricsHttpRequests);
+			handler(request);
+			metricsObserve(eMetricsHttpLatency, esp_timer_get_time() - startUs);
+		});
+	}
+
 	void task()
 	{
 		AsyncWebServer *server = wifiGetHttpServer();
 		bool shallInitServer = true;
 
+		// map static web assets
+		webAssetsInit();
+
 		while (1) {
 
 			//
@@ -329,75 +614,150 @@ public:
 			if (shallInitServer) {
 				shallInitServer = false;
 
-				server->on("/", HTTP_GET, [=](AsyncWebServerRequest *request){
+				// admission control has to go first so it sees all requests
+				server->addHandler(new AdmissionHandler(m_admission));
+
+				on(server, "/", [=](AsyncWebServerRequest *request){
 					indexHandler(request);
 				});
 
-				server->on("/index", HTTP_GET, [=](AsyncWebServerRequest *request){
+				on(server, "/index", [=](AsyncWebServerRequest *request){
 					indexHandler(request);
 				});
 
-				server->on("/get", HTTP_GET, [=](AsyncWebServerRequest *request){
+				on(server, "/get", [=](AsyncWebServerRequest *request){
 					getHandler(request);
 				});
 
-				server->on("/rssi", HTTP_GET, [=](AsyncWebServerRequest *request){
+				on(server, "/rssi", [=](AsyncWebServerRequest *request){
 					rssiHandler(request);
 				});
 
-				server->on("/led", HTTP_GET, [=](AsyncWebServerRequest *request){
+				on(server, "/led", [=](AsyncWebServerRequest *request){
 					ledHandler(request);
 				});
 
-				server->on("/fan", HTTP_GET, [=](AsyncWebServerRequest *request){
+				on(server, "/fan", [=](AsyncWebServerRequest *request){
 					fanHandler(request);
 				});
 
 #if DEBUG_LEDS
-				server->on("/ledColor", HTTP_GET, [=](AsyncWebServerRequest *request){
+				on(server, "/ledColor", [=](AsyncWebServerRequest *request){
 					ledColorHandler(request);
 				});
 #endif
 
-				server->on("/reconfigureWifi", HTTP_GET, [=](AsyncWebServerRequest *request){
+				on(server, "/metrics", [=](AsyncWebServerRequest *request){
+					metricsHandler(request);
+				});
+
+				on(server, "/history", [=](AsyncWebServerRequest *request){
+					historyHandler(request);
+				});
+
+				on(server, "/diag/boot", [=](AsyncWebServerRequest *request){
+					bootHandler(request);
+				});
+
+				on(server, "/diag/wifi", [=](AsyncWebServerRequest *request){
+					wifiDiagHandler(request);
+				});
+
+				on(server, "/diag/power", [=](AsyncWebServerRequest *request){
+					powerDiagHandler(request);
+				});
+
+				on(server, "/diag/time", [=](AsyncWebServerRequest *request){
+					timeDiagHandler(request);
+				});
+
+				// before "/log", which also matches everything below "/log/"
+				on(server, "/log/level", [=](AsyncWebServerRequest *request){
+					logLevelHandler(request);
+				});
+
+				on(server, "/log", [=](AsyncWebServerRequest *request){
+					logHandler(request);
+				});
+
+				on(server, "/log.bin", [=](AsyncWebServerRequest *request){
+					logDumpHandler(request);
+				});
+
+				on(server, "/power", [=](AsyncWebServerRequest *request){
+					powerHandler(request);
+				});
+
+#if (FLEET_ENABLED == 1)
+				// "/fleet/events" first, "/fleet" also matches everything below
+				// "/fleet/" and would answer the event stream requests
+				fleetAttach(server);
+
+				on(server, "/fleet", [=](AsyncWebServerRequest *request){
+					request->send(200, "application/json", fleetJson());
+				});
+#endif
+
+				on(server, "/reconfigureWifi", [=](AsyncWebServerRequest *request){
 					reconfigureWifiHandler(request);
 				});
 
-				server->on("/resetWifi", HTTP_GET, [=](AsyncWebServerRequest *request){
+				on(server, "/resetWifi", [=](AsyncWebServerRequest *request){
 					resetWifi(request);
 				});
 
-				server->on("/reboot", HTTP_GET, [=](AsyncWebServerRequest *request){
+				on(server, "/reboot", [=](AsyncWebServerRequest *request){
 					rebootHandler(request);
 				});
 
+				// static web assets
+				for (size_t i = 0; i < webAssetsCount(); i++) {
+					const WebAsset *asset = webAssetsAt(i);
+					on(server, asset->m_path, [=](AsyncWebServerRequest *request){
+						webAssetsSend(request, asset);
+					});
+				}
+
 				server->onNotFound([=](AsyncWebServerRequest *request){
 					request->send(404, "text/plain", "Not found");
 				});
 
-				// start webserver based OTA support
+				// start webserver based OTA support, the radio stays awake while the upload progresses
 				AsyncElegantOTA.begin(server);
+				Update.onProgress([](size_t progress, size_t total) {
+					powerSaveBoost(ePowerSaveBoostUpload, POWER_SAVE_BOOST_LEASE_MS);
+				});
 
 				// start webserver
 				server->begin();
+				bootTraceMark(eBootPhaseServerStarted);
 
 				if (!MDNS.begin(wifiHostName().c_str())) {
-					LOG_PRINTF("Error starting MDNS responder!\n");
+					LOG_ERROR("Error starting MDNS responder!\n");
 				}
 
 				// Add service to MDNS-SD so our webserver can be located
 				MDNS.addService("http", "tcp", 80);
 			}
 
+			//
+			// sleep until some request arrives
+			//
+
+			EventBits_t events = xEventGroupWaitBits(m_events, SERVER_EVENT_ALL, pdTRUE, pdFALSE, portMAX_DELAY);
+			metricsIncrement(eMetricsServerTaskWakeups);
+
 			//
 			// handle wifi reconfigure request
 			//
 
-			if (m_wifiReconfigureRequested) {
-				m_wifiReconfigureRequested = false;
+			if (events & SERVER_EVENT_WIFI_RECONFIGURE) {
 				LOG_PRINTF("WiFi reconfiguration requested\n");
 
 				// reset server handlers
+#if (FLEET_ENABLED == 1)
+				fleetDetach();
+#endif
 				server->reset();
 
 				// init wifi reconfiguration
@@ -411,11 +771,13 @@ public:
 			// handle wifi reset request
 			//
 
-			if (m_wifiResetRequested) {
-				m_wifiResetRequested = false;
+			if (events & SERVER_EVENT_WIFI_RESET) {
 				LOG_PRINTF("WiFi reset requested\n");
 
 				// reset server handlers
+#if (FLEET_ENABLED == 1)
+				fleetDetach();
+#endif
 				server->reset();
 
 				// init wifi reset
@@ -424,8 +786,6 @@ public:
 				// and now we have to re-init the server again
 				shallInitServer = true;
 			}
-
-			delay(100);
 		}
 	}
 
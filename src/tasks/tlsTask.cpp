@@ -0,0 +1,559 @@
+#define LOG_MODULE eLogModuleTls
+
+#include <Arduino.h>
+#include <SPIFFS.h>
+#include <ArduinoJson.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/ssl_cache.h>
+#include <mbedtls/ssl_ticket.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/x509_crt.h>
+#include <mbedtls/pk.h>
+#include <mbedtls/ecp.h>
+#include <mbedtls/error.h>
+#include <lwip/sockets.h>
+
+#include "config.h"
+#include "utils.h"
+#include "metrics.h"
+#include "snapshot.h"
+
+#include "tlsTask.h"
+#include "wifiTask.h"
+
+#if (TLS_ENABLED == 1)
+
+#define TLS_REQUEST_SIZE		1024	// request line + headers
+#define TLS_DOCUMENT_SIZE		512
+#define TLS_PEM_SIZE			1024	// generated certificate / key
+#define TLS_CHUNK_SIZE			1024	// /metrics is rendered in chunks of this size
+
+//
+// HTTPS listener
+//
+// Connections are served one at a time. Keep-alive is only kept while no
+// other client is waiting to be accepted, so an idle connection can't hold
+// off other pollers for TLS_TIMEOUT_MS. A full handshake
+// costs an ECDHE key exchange plus an ECDSA signature, a resumed one (session
+// ticket or session ID from the cache) only symmetric crypto, so pollers
+// reconnecting within TLS_SESSION_TIMEOUT_S stay cheap.
+//
+
+class TlsTaskCtx {
+private:
+	mbedtls_entropy_context m_entropy;
+	mbedtls_ctr_drbg_context m_drbg;
+	mbedtls_x509_crt m_cert;
+	mbedtls_pk_context m_key;
+	mbedtls_ssl_config m_conf;
+	mbedtls_ssl_context m_ssl;
+	mbedtls_net_context m_listen;
+	mbedtls_net_context m_client;
+#if defined(MBEDTLS_SSL_CACHE_C)
+	mbedtls_ssl_cache_context m_cache;
+#endif
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+	mbedtls_ssl_ticket_context m_ticket;
+#endif
+
+	// set by the resumption callbacks during a handshake
+	bool m_resumed;
+
+	static void logError(const char *what, const int &ret)
+	{
+		char error[80];
+		mbedtls_strerror(ret, error, sizeof(error));
+		LOG_PRINTF("[TLS] %s failed: %s (-0x%04x)\n", what, error, -ret);
+	}
+
+	//
+	// resumption callbacks, wrapped to tell full and resumed handshakes apart
+	//
+
+#if defined(MBEDTLS_SSL_CACHE_C)
+	static int cacheGet(void *data, mbedtls_ssl_session *session)
+	{
+		TlsTaskCtx *ctx = (TlsTaskCtx *)data;
+		int ret = mbedtls_ssl_cache_get(&ctx->m_cache, session);
+		ctx->m_resumed |= (ret == 0);
+		return ret;
+	}
+
+	static int cacheSet(void *data, const mbedtls_ssl_session *session)
+	{
+		return mbedtls_ssl_cache_set(&((TlsTaskCtx *)data)->m_cache, session);
+	}
+#endif
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+	static int ticketWrite(void *data, const mbedtls_ssl_session *session, unsigned char *start, const unsigned char *end, size_t *len, uint32_t *lifetime)
+	{
+		return mbedtls_ssl_ticket_write(&((TlsTaskCtx *)data)->m_ticket, session, start, end, len, lifetime);
+	}
+
+	static int ticketParse(void *data, mbedtls_ssl_session *session, unsigned char *buf, size_t len)
+	{
+		TlsTaskCtx *ctx = (TlsTaskCtx *)data;
+		int ret = mbedtls_ssl_ticket_parse(&ctx->m_ticket, session, buf, len);
+		ctx->m_resumed |= (ret == 0);
+		return ret;
+	}
+#endif
+
+	//
+	// credentials
+	//
+
+	// returns zero terminated file contents (len includes the zero, as the
+	// PEM parsers expect), the caller has to free it, NULL on errors
+	unsigned char *readFile(const char *path, size_t &len)
+	{
+		File file = SPIFFS.open(path, "r");
+		if (!file) {
+			return NULL;
+		}
+
+		size_t size = file.size();
+		unsigned char *buf = (unsigned char *)malloc(size + 1);
+		if (buf) {
+			// a failing read returns -1 (as size_t), short reads are errors too
+			int ret = (int)file.read(buf, size);
+			if (ret < 0 || (size_t)ret != size) {
+				memset(buf, 0, size + 1);
+				free(buf);
+				buf = NULL;
+			} else {
+				len = size;
+				buf[len++] = 0;
+			}
+		}
+		file.close();
+		return buf;
+	}
+
+	bool writeFile(const char *path, const unsigned char *data)
+	{
+		File file = SPIFFS.open(path, "w");
+		if (!file) {
+			return false;
+		}
+		size_t len = strlen((const char *)data);
+		bool ret = file.write(data, len) == len;
+		file.close();
+		return ret;
+	}
+
+	bool generateCredentials()
+	{
+		LOG_PRINTF("[TLS] generating self-signed certificate for %s\n", wifiHostName().c_str());
+
+		mbedtls_pk_context key;
+		mbedtls_x509write_cert crt;
+		mbedtls_mpi serial;
+		mbedtls_pk_init(&key);
+		mbedtls_x509write_crt_init(&crt);
+		mbedtls_mpi_init(&serial);
+
+		unsigned char certPem[TLS_PEM_SIZE];
+		unsigned char keyPem[TLS_PEM_SIZE];
+
+		char subject[64];
+		snprintf(subject, sizeof(subject), "CN=%s", wifiHostName().c_str());
+
+		// positive random serial
+		uint8_t serialBytes[8];
+		esp_fill_random(serialBytes, sizeof(serialBytes));
+		serialBytes[0] &= 0x7f;
+
+		int ret = mbedtls_pk_setup(&key, mbedtls_pk_info_from_type(MBEDTLS_PK_ECKEY));
+		if (!ret) {
+			ret = mbedtls_ecp_gen_key(MBEDTLS_ECP_DP_SECP256R1, mbedtls_pk_ec(key), mbedtls_ctr_drbg_random, &m_drbg);
+		}
+		if (!ret) {
+			ret = mbedtls_mpi_read_binary(&serial, serialBytes, sizeof(serialBytes));
+		}
+		if (!ret) {
+			mbedtls_x509write_crt_set_version(&crt, MBEDTLS_X509_CRT_VERSION_3);
+			mbedtls_x509write_crt_set_md_alg(&crt, MBEDTLS_MD_SHA256);
+			mbedtls_x509write_crt_set_subject_key(&crt, &key);
+			mbedtls_x509write_crt_set_issuer_key(&crt, &key);
+			ret = mbedtls_x509write_crt_set_subject_name(&crt, subject);
+		}
+		if (!ret) {
+			ret = mbedtls_x509write_crt_set_issuer_name(&crt, subject);
+		}
+		if (!ret) {
+			ret = mbedtls_x509write_crt_set_serial(&crt, &serial);
+		}
+		if (!ret) {
+			ret = mbedtls_x509write_crt_set_validity(&crt, "20240101000000", "20491231235959");
+		}
+		if (!ret) {
+			ret = mbedtls_x509write_crt_set_basic_constraints(&crt, 0, -1);
+		}
+		if (!ret) {
+			ret = mbedtls_x509write_crt_pem(&crt, certPem, sizeof(certPem), mbedtls_ctr_drbg_random, &m_drbg);
+		}
+		if (!ret) {
+			ret = mbedtls_pk_write_key_pem(&key, keyPem, sizeof(keyPem));
+		}
+
+		mbedtls_mpi_free(&serial);
+		mbedtls_x509write_crt_free(&crt);
+		mbedtls_pk_free(&key);
+
+		if (ret) {
+			logError("certificate generation", ret);
+			return false;
+		}
+
+		if (!writeFile(TLS_CERT_FILE, certPem) || !writeFile(TLS_KEY_FILE, keyPem)) {
+			LOG_PRINTF("[TLS] unable to store the certificate\n");
+			return false;
+		}
+		return true;
+	}
+
+	bool loadCredentials()
+	{
+		if (!SPIFFS.exists(TLS_CERT_FILE) || !SPIFFS.exists(TLS_KEY_FILE)) {
+			if (!generateCredentials()) {
+				return false;
+			}
+		}
+
+		size_t certLen = 0;
+		size_t keyLen = 0;
+		unsigned char *cert = readFile(TLS_CERT_FILE, certLen);
+		unsigned char *key = readFile(TLS_KEY_FILE, keyLen);
+
+		int ret = (cert && key) ? 0 : MBEDTLS_ERR_X509_FILE_IO_ERROR;
+		if (!ret) {
+			ret = mbedtls_x509_crt_parse(&m_cert, cert, certLen);
+		}
+		if (!ret) {
+			ret = mbedtls_pk_parse_key(&m_key, key, keyLen, NULL, 0);
+		}
+
+		free(cert);
+		if (key) {
+			// don't leave the private key lying around in the heap
+			memset(key, 0, keyLen);
+			free(key);
+		}
+
+		if (ret) {
+			logError("loading " TLS_CERT_FILE " / " TLS_KEY_FILE, ret);
+			return false;
+		}
+		return true;
+	}
+
+	bool init()
+	{
+		const char personalization[] = "vindriktning-tls";
+		int ret = mbedtls_ctr_drbg_seed(&m_drbg, mbedtls_entropy_func, &m_entropy, (const unsigned char *)personalization, sizeof(personalization) - 1);
+		if (ret) {
+			logError("seeding", ret);
+			return false;
+		}
+
+		if (!loadCredentials()) {
+			return false;
+		}
+
+		ret = mbedtls_ssl_config_defaults(&m_conf, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+		if (!ret) {
+			ret = mbedtls_ssl_conf_own_cert(&m_conf, &m_cert, &m_key);
+		}
+		if (ret) {
+			logError("configuration", ret);
+			return false;
+		}
+
+		mbedtls_ssl_conf_rng(&m_conf, mbedtls_ctr_drbg_random, &m_drbg);
+
+		// bounds handshakes and keep-alive idle time
+		mbedtls_ssl_conf_read_timeout(&m_conf, TLS_TIMEOUT_MS);
+
+#if defined(MBEDTLS_SSL_CACHE_C)
+		// session IDs, one entry per poller
+		mbedtls_ssl_cache_set_max_entries(&m_cache, TLS_SESSION_CACHE_SIZE);
+		mbedtls_ssl_cache_set_timeout(&m_cache, TLS_SESSION_TIMEOUT_S);
+		mbedtls_ssl_conf_session_cache(&m_conf, this, cacheGet, cacheSet);
+#endif
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+		// tickets keep the session state on the client, so they don't count
+		// against the cache (keys are rotated every TLS_SESSION_TIMEOUT_S)
+		ret = mbedtls_ssl_ticket_setup(&m_ticket, mbedtls_ctr_drbg_random, &m_drbg, MBEDTLS_CIPHER_AES_128_GCM, TLS_SESSION_TIMEOUT_S);
+		if (ret) {
+			logError("ticket setup", ret);
+		} else {
+			mbedtls_ssl_conf_session_tickets_cb(&m_conf, ticketWrite, ticketParse, this);
+		}
+#endif
+
+		ret = mbedtls_ssl_setup(&m_ssl, &m_conf);
+		if (ret) {
+			logError("setup", ret);
+			return false;
+		}
+		return true;
+	}
+
+	//
+	// connection handling
+	//
+
+	bool handshake()
+	{
+		m_resumed = false;
+		int64_t startUs = esp_timer_get_time();
+
+		int ret;
+		while ((ret = mbedtls_ssl_handshake(&m_ssl)) != 0) {
+			if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+				logError("handshake", ret);
+				metricsIncrement(eMetricsTlsHandshakeFailures);
+				return false;
+			}
+		}
+
+		metricsObserve(m_resumed ? eMetricsTlsHandshakeResumedTime : eMetricsTlsHandshakeFullTime, esp_timer_get_time() - startUs);
+		return true;
+	}
+
+	bool send(const char *data, size_t len)
+	{
+		while (len) {
+			int ret = mbedtls_ssl_write(&m_ssl, (const unsigned char *)data, len);
+			if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+				continue;
+			}
+			if (ret <= 0) {
+				return false;
+			}
+			data += ret;
+			len -= ret;
+		}
+		return true;
+	}
+
+	// a client is waiting in the accept queue
+	bool othersWaiting()
+	{
+		return mbedtls_net_poll(&m_listen, MBEDTLS_NET_POLL_READ, 0) > 0;
+	}
+
+	// waits for the next request on a kept-alive connection, false after
+	// TLS_TIMEOUT_MS or as soon as another client connects
+	bool waitNextRequest()
+	{
+		// pipelined request already decrypted
+		if (mbedtls_ssl_get_bytes_avail(&m_ssl)) {
+			return true;
+		}
+
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(m_client.fd, &fds);
+		FD_SET(m_listen.fd, &fds);
+		struct timeval timeout = { TLS_TIMEOUT_MS / 1000, (TLS_TIMEOUT_MS % 1000) * 1000 };
+		if (select(((m_client.fd > m_listen.fd) ? m_client.fd : m_listen.fd) + 1, &fds, NULL, NULL, &timeout) <= 0) {
+			return false;
+		}
+		return !FD_ISSET(m_listen.fd, &fds);
+	}
+
+	// reads one request head, false when the connection is done (closed,
+	// idle timeout, error or oversized request)
+	bool readRequest(char *buf, const size_t &maxLen)
+	{
+		size_t len = 0;
+		while (len < maxLen - 1) {
+			int ret = mbedtls_ssl_read(&m_ssl, (unsigned char *)buf + len, maxLen - 1 - len);
+			if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+				continue;
+			}
+			if (ret <= 0) {
+				return false;
+			}
+			len += ret;
+			buf[len] = 0;
+			if (strstr(buf, "\r\n\r\n")) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool sendHeaders(const int &status, const char *reason, const char *contentType, const size_t &contentLength, const bool &keepAlive)
+	{
+		char headers[192];
+		int len = snprintf(headers, sizeof(headers), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %u\r\nConnection: %s\r\n\r\n",
+			status, reason, contentType, contentLength, keepAlive ? "keep-alive" : "close");
+		return send(headers, len);
+	}
+
+	bool sendError(const int &status, const char *reason, const bool &keepAlive)
+	{
+		return sendHeaders(status, reason, "text/plain", strlen(reason), keepAlive) && send(reason, strlen(reason));
+	}
+
+	bool sendJson(void (*build)(JsonDocument &doc), const bool &keepAlive)
+	{
+		StaticJsonDocument<TLS_DOCUMENT_SIZE> doc;
+		build(doc);
+
+		char body[TLS_DOCUMENT_SIZE];
+		size_t len = serializeJson(doc, body, sizeof(body));
+		return sendHeaders(200, "OK", "application/json", len, keepAlive) && send(body, len);
+	}
+
+	bool sendMetrics(const bool &keepAlive)
+	{
+		// same approach as the plain HTTP handler: snapshot, dry run for
+		// the length, then render window by window
+		MetricsSnapshot snapshot;
+		metricsSnapshot(snapshot);
+
+		MetricsWriter counter(NULL, 0, 0);
+		metricsRender(snapshot, counter);
+		size_t total = counter.position();
+
+		if (!sendHeaders(200, "OK", "text/plain; version=0.0.4", total, keepAlive)) {
+			return false;
+		}
+
+		char chunk[TLS_CHUNK_SIZE];
+		for (size_t offset = 0; offset < total; ) {
+			MetricsWriter writer(chunk, sizeof(chunk), offset);
+			metricsRender(snapshot, writer);
+			if (!writer.written() || !send(chunk, writer.written())) {
+				return false;
+			}
+			offset += writer.written();
+		}
+		return true;
+	}
+
+	void serve()
+	{
+		char request[TLS_REQUEST_SIZE];
+		bool keepAlive = true;
+
+		while (keepAlive && readRequest(request, sizeof(request))) {
+			int64_t startUs = esp_timer_get_time();
+			metricsIncrement(eMetricsHttpRequests);
+
+			char method[8];
+			char path[64];
+			if (sscanf(request, "%7s %63s", method, path) != 2) {
+				sendError(400, "Bad Request", false);
+				break;
+			}
+
+			// ignore the query string
+			char *query = strchr(path, '?');
+			if (query) {
+				*query = 0;
+			}
+
+			// close right after the response when someone else is waiting
+			keepAlive = strstr(request, " HTTP/1.1\r\n") && !strcasestr(request, "\r\nConnection: close") && !othersWaiting();
+
+			bool ok;
+			if (strcmp(method, "GET")) {
+				ok = sendError(405, "Method Not Allowed", keepAlive);
+			} else if (!strcmp(path, "/get")) {
+				ok = sendJson(snapshotSensors, keepAlive);
+			} else if (!strcmp(path, "/rssi")) {
+				ok = sendJson(snapshotRssi, keepAlive);
+			} else if (!strcmp(path, "/metrics")) {
+				ok = sendMetrics(keepAlive);
+			} else {
+				ok = sendError(404, "Not Found", keepAlive);
+			}
+
+			metricsObserve(eMetricsHttpLatency, esp_timer_get_time() - startUs);
+			if (!ok || (keepAlive && !waitNextRequest())) {
+				break;
+			}
+		}
+	}
+
+public:
+	TlsTaskCtx()
+	{
+		mbedtls_entropy_init(&m_entropy);
+		mbedtls_ctr_drbg_init(&m_drbg);
+		mbedtls_x509_crt_init(&m_cert);
+		mbedtls_pk_init(&m_key);
+		mbedtls_ssl_config_init(&m_conf);
+		mbedtls_ssl_init(&m_ssl);
+		mbedtls_net_init(&m_listen);
+		mbedtls_net_init(&m_client);
+#if defined(MBEDTLS_SSL_CACHE_C)
+		mbedtls_ssl_cache_init(&m_cache);
+#endif
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+		mbedtls_ssl_ticket_init(&m_ticket);
+#endif
+		m_resumed = false;
+	}
+
+	void task()
+	{
+		// normally mounted by the wifi task already
+		SPIFFS.begin(true);
+
+		if (!init()) {
+			LOG_PRINTF("[TLS] disabled\n");
+			vTaskDelete(NULL);
+			return;
+		}
+
+		char port[8];
+		snprintf(port, sizeof(port), "%d", TLS_PORT);
+		int ret = mbedtls_net_bind(&m_listen, NULL, port, MBEDTLS_NET_PROTO_TCP);
+		if (ret) {
+			logError("bind", ret);
+			vTaskDelete(NULL);
+			return;
+		}
+		LOG_PRINTF("[TLS] listening on port %d\n", TLS_PORT);
+
+		while (1) {
+			ret = mbedtls_net_accept(&m_listen, &m_client, NULL, 0, NULL);
+			if (ret) {
+				logError("accept", ret);
+				delay(100);
+				continue;
+			}
+
+			mbedtls_ssl_session_reset(&m_ssl);
+			mbedtls_ssl_set_bio(&m_ssl, &m_client, mbedtls_net_send, NULL, mbedtls_net_recv_timeout);
+
+			if (handshake()) {
+				serve();
+				mbedtls_ssl_close_notify(&m_ssl);
+			}
+			mbedtls_net_free(&m_client);
+		}
+	}
+};
+
+static TlsTaskCtx g_ctx;
+
+void tlsTask(void *pvParameters __attribute__((unused)))
+{
+	// wait until the network is connected
+	wifiWaitForConnection();
+
+	g_ctx.task();
+}
+
+#endif // TLS_ENABLED
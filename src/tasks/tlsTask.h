@@ -0,0 +1,11 @@
+#pragma once
+
+//
+// HTTPS listener (TLS_ENABLED) for the read-only API: /get, /rssi, /metrics
+//
+// The certificate and key are read from SPIFFS (TLS_CERT_FILE, TLS_KEY_FILE).
+// When they are missing, a self-signed P-256 certificate for the host name
+// is generated once and stored there.
+//
+
+void tlsTask(void *pvParameters __attribute__((unused)));
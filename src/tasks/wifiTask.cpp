@@ -1,3 +1,5 @@
+#define LOG_MODULE eLogModuleWifi
+
 #include <Arduino.h>
 #include "config.h"
 #include "utils.h"
@@ -12,6 +14,13 @@
 #include "hsvToRgb.h"
 #include "driver/adc.h"
 #include "WiFiMultiSSID.h"
+#include "metrics.h"
+#include "wifiRtc.h"
+#include "wifiReconnect.h"
+#include "wifiRoam.h"
+#include "bootTrace.h"
+#include "configStore.h"
+#include "powerSave.h"
 
 #include <ESPAsync_WiFiManager.h>
 #include <ESP_DoubleResetDetector.h>
@@ -24,22 +33,51 @@
 
 #define MAX(a, b) ((a) > (b)) ? (a) : (b)
 
+// wifi task control events
+#define WIFI_EVENT_RECONFIGURE_REQUEST	BIT0
+#define WIFI_EVENT_RESET_REQUEST		BIT1
+#define WIFI_EVENT_RECONFIGURE_DONE		BIT2
+#define WIFI_EVENT_RESET_DONE			BIT3
+#define WIFI_EVENT_CONNECTED			BIT4
+#define WIFI_EVENT_DISCONNECTED			BIT5
+#define WIFI_EVENT_REQUESTS				(WIFI_EVENT_RECONFIGURE_REQUEST | WIFI_EVENT_RESET_REQUEST)
+
 typedef struct {
-	// stored wifi credentials
-	WiFiMultiSSID::Credentials m_credentials[NUM_WIFI_CREDENTIALS];
 	// configured host name
 	char m_hostName[HOST_NAME_LEN];
 	// force access point mode flag
 	bool m_forceAp;
-	// structure checksum
-	uint16_t m_checksum;
 } WiFiManagerConfig;
 
+// payload layout versions of the config, last params and history records
+#define WIFI_CONFIG_VERSION			2	// WiFiManagerConfig, WiFi_STA_IPConfig, credentials count (uint8_t), credentials
+#define WIFI_LAST_PARAMS_VERSION	1	// WiFiMultiSSID::LastParams
+#define WIFI_HISTORY_VERSION		1	// WiFiSelector::serialize()
+
+// config layout version 1, credentials fixed at build time
+typedef struct {
+	WiFiMultiSSID::Credentials m_credentials[NUM_WIFI_CREDENTIALS];
+	char m_hostName[HOST_NAME_LEN];
+	bool m_forceAp;
+} WiFiManagerConfigV1;
+
+// config file written before ConfigStore records, migrated to version 1
+typedef struct {
+	WiFiMultiSSID::Credentials m_credentials[NUM_WIFI_CREDENTIALS];
+	char m_hostName[HOST_NAME_LEN];
+	bool m_forceAp;
+	// byte sum of the fields above
+	uint16_t m_checksum;
+} WiFiManagerConfigLegacy;
+
 class WiFiContext {
 public:
 	// persistent wifi configuration data
 	WiFiManagerConfig m_managerConfig;
 
+	// stored wifi credentials, most recently configured first
+	std::vector<WiFiMultiSSID::Credentials> m_credentials;
+
 	AsyncWebServer m_httpServer;
 
 	// client mode IP configuration
@@ -48,6 +86,12 @@ public:
 	// last connection params
 	WiFiMultiSSID::LastParams m_lastWiFiParams;
 
+	// config and last params files
+	FsConfigStorage m_storage;
+	ConfigStore m_configStore;
+	ConfigStore m_lastParamsStore;
+	ConfigStore m_historyStore;
+
 	// multi SSID wifi connection helper
 	WiFiMultiSSID m_wifiMulti;
 
@@ -70,10 +114,33 @@ public:
 	#endif
 
 	wifi_event_id_t m_wifiEventId;
+	wifi_event_id_t m_disconnectEventId;
+
+	// reason of the last disconnect reported by the driver
+	volatile uint8_t m_disconnectReason;
+
+	// decides when and how to reconnect
+	WiFiReconnect m_reconnect;
+
+	// background scans for a stronger access point of the same SSID
+	WiFiRoam m_roam;
+
+	// last params were restored from RTC memory instead of SPIFFS
+	bool m_rtcParams;
 
-	volatile bool m_shallReconfigure;
-	volatile bool m_shallReset;
-	volatile bool m_connected;
+	// set once the first connection after boot is established
+	bool m_bootConnected;
+
+	// cached DHCP lease in use instead of DHCP until its renewal time
+	bool m_leaseActive;
+	uint32_t m_leaseStartMs;
+	uint32_t m_leaseRemainingMs;
+
+	// DHCP is running, store its lease once bound
+	bool m_leasePending;
+
+	// requests, completion and connection state signalling
+	EventGroupHandle_t m_events;
 
 	static WiFiContext &instance()
 	{
@@ -86,13 +153,24 @@ public:
 
 	WiFiContext()
 		: m_httpServer(HTTP_PORT)
+		, m_storage(SPIFFS)
+		, m_configStore(m_storage, CONFIG_FILENAME)
+		, m_lastParamsStore(m_storage, LAST_PARAMS_FILENAME)
+		, m_historyStore(m_storage, WIFI_HISTORY_FILENAME)
+		, m_reconnect(WiFiReconnect::Config{WIFI_BACKOFF_MIN_MS, WIFI_BACKOFF_MAX_MS, WIFI_BACKOFF_SCAN_MAX_MS, WIFI_FAST_RETRIES}, esp_random())
 	{
 		m_ssid = String(HOST_NAME_BASE) + String("-") + String((uint32_t)ESP.getEfuseMac(), HEX);
 		m_drd = NULL;
-		m_shallReconfigure = false;
-		m_shallReset = false;
-		m_connected = false;
 		m_wifiEventId = 0;
+		m_disconnectEventId = 0;
+		m_disconnectReason = 0;
+		m_rtcParams = false;
+		m_bootConnected = false;
+		m_leaseActive = false;
+		m_leaseStartMs = 0;
+		m_leaseRemainingMs = 0;
+		m_leasePending = false;
+		m_events = xEventGroupCreate();
 
 		// default client mode config
 		m_clientConfig._sta_static_ip = IPAddress(0, 0, 0, 0);
@@ -121,10 +199,41 @@ public:
 
 	void displayCredentials()
 	{
-		for (uint8_t i = 0; i < NUM_WIFI_CREDENTIALS; i++) {
+		for (uint8_t i = 0; i < m_credentials.size(); i++) {
 			LOG_PRINTF("Credentials #%d:\n", i);
-			LOG_PRINTF("SSID: %s\n", m_managerConfig.m_credentials[i].m_ssid[0] ? m_managerConfig.m_credentials[i].m_ssid : "<empty>");
-			LOG_PRINTF("PASS: %s\n", PASSWORD_STR(m_managerConfig.m_credentials[i].m_password));
+			LOG_PRINTF("SSID: %s\n", m_credentials[i].m_ssid);
+			LOG_PRINTF("PASS: %s\n", PASSWORD_STR(m_credentials[i].m_password));
+		}
+	}
+
+	const WiFiMultiSSID::Credentials *findCredentials(const char *ssid)
+	{
+		for (const WiFiMultiSSID::Credentials &credentials : m_credentials) {
+			if (!strcmp(credentials.m_ssid, ssid)) {
+				return &credentials;
+			}
+		}
+		return NULL;
+	}
+
+	// adds or updates credentials from the config portal, the newest go first
+	void updateCredentials(const String &ssid, const String &password)
+	{
+		WiFiMultiSSID::Credentials credentials;
+		strncpy(credentials.m_ssid, ssid.c_str(), sizeof(credentials.m_ssid) - 1);
+		strncpy(credentials.m_password, password.c_str(), sizeof(credentials.m_password) - 1);
+
+		const WiFiMultiSSID::Credentials *previous = findCredentials(credentials.m_ssid);
+		LOG_PRINTF("Updating WiFi credentials:\n");
+		LOG_PRINTF("SSID: %s%s\n", credentials.m_ssid, previous ? "" : " (new)");
+		LOG_PRINTF("PASS: %s -> %s\n\n", PASSWORD_STR(previous ? previous->m_password : ""), PASSWORD_STR(credentials.m_password));
+		if (previous) {
+			m_credentials.erase(m_credentials.begin() + (previous - m_credentials.data()));
+		}
+
+		m_credentials.insert(m_credentials.begin(), credentials);
+		if (m_credentials.size() > WIFI_CREDENTIALS_MAX) {
+			m_credentials.resize(WIFI_CREDENTIALS_MAX);
 		}
 	}
 
@@ -137,11 +246,8 @@ public:
 		LOG_PRINTF("CHAN : %d\n", params.m_channel);
 	}
 
-	uint8_t connectMultiWiFi()
+	void applyClientConfig()
 	{
-		uint8_t status;
-		LOG_PRINTF("Connecting to WiFi\n");
-
 		//
 		// Set static IP, Gateway, Subnetmask, DNS1 and DNS2
 		//
@@ -152,140 +258,418 @@ public:
 			m_clientConfig._sta_static_sn,
 			m_clientConfig._sta_static_dns1,
 			m_clientConfig._sta_static_dns2);
+	}
 
-		// first try to connect quickly using previous parameters
-		status = m_wifiMulti.fastReconnect(
-			m_lastWiFiParams,
-			[=] {
-				// periodically reset watchdog
-				watchdogReset();
-			},
-			WIFI_RETRIES,
-			WIFI_TIMEOUT);
+	// on the first connection after a warm boot, reuse the DHCP lease from RTC memory
+	bool applyCachedLease()
+	{
+		#if (WIFI_RTC_FAST_PATH == 1)
+		WifiRtcLease lease;
+		uint32_t remainingS;
 
-		// if the fast reconnect failed, do a full featured connect with scan:
-		if (status != WL_CONNECTED) {
-			// attempt connection to all specified WiFi networks, with maximum of WIFI_RETRIES retries
-			status = m_wifiMulti.connect(
+		if (m_bootConnected || (uint32_t)m_clientConfig._sta_static_ip || m_lastWiFiParams.m_channel <= 0) {
+			return false;
+		}
+
+		if (!wifiRtcLoadLease(m_lastWiFiParams.m_credentials.m_ssid, lease, remainingS)) {
+			return false;
+		}
+
+		LOG_PRINTF("Using cached DHCP lease %s for %u s\n", IPAddress(lease.m_ip).toString().c_str(), remainingS);
+		WiFi.config(IPAddress(lease.m_ip), IPAddress(lease.m_gateway), IPAddress(lease.m_netmask), IPAddress(lease.m_dns1), IPAddress(lease.m_dns2));
+
+		m_leaseStartMs = millis();
+		m_leaseRemainingMs = std::min(remainingS, UINT32_MAX / 1000) * 1000;
+		return true;
+		#else
+		return false;
+		#endif
+	}
+
+	// store the current DHCP lease in RTC memory
+	bool wifiSaveLease()
+	{
+		WifiRtcLease lease;
+
+		lease.m_leaseS = wifiRtcDhcpLeaseS();
+		if (!lease.m_leaseS) {
+			return false;
+		}
+
+		lease.m_ip = WiFi.localIP();
+		lease.m_gateway = WiFi.gatewayIP();
+		lease.m_netmask = WiFi.subnetMask();
+		lease.m_dns1 = WiFi.dnsIP(0);
+		lease.m_dns2 = WiFi.dnsIP(1);
+		wifiRtcSaveLease(lease);
+
+		LOG_PRINTF("DHCP lease %s for %u s stored\n", WiFi.localIP().toString().c_str(), lease.m_leaseS);
+		return true;
+	}
+
+	void wifiCheckLease()
+	{
+		// the cached lease is only used until its renewal time, then DHCP takes over
+		if (m_leaseActive && (millis() - m_leaseStartMs) >= m_leaseRemainingMs) {
+			LOG_PRINTF("Cached DHCP lease is due for renewal, starting DHCP\n");
+			m_leaseActive = false;
+			m_leasePending = true;
+			wifiRtcInvalidateLease();
+			applyClientConfig();
+		}
+
+		if (m_leasePending && WiFi.status() == WL_CONNECTED && wifiSaveLease()) {
+			m_leasePending = false;
+		}
+	}
+
+	// boot timeline: how long it took to get connected and how much the RTC data saved
+	void reportBootConnect(const uint8_t &path)
+	{
+		uint32_t connectMs = millis();
+
+		metricsSet(eMetricsWifiBootConnectTime, connectMs / 1000.0);
+		metricsSet(eMetricsWifiBootFastPath, path);
+
+		if (!path) {
+			wifiRtcSetSlowConnectMs(connectMs);
+		} else {
+			uint32_t slowConnectMs = wifiRtcSlowConnectMs();
+			if (slowConnectMs) {
+				metricsSet(eMetricsWifiBootSavedTime, ((float)slowConnectMs - connectMs) / 1000.0);
+			}
+		}
+
+		LOG_PRINTF("Boot to connected: %u ms, fast path %d\n", connectMs, path);
+	}
+
+	uint8_t connectMultiWiFi(const bool &fast = true, const bool &scan = true, const uint32_t &retries = WIFI_RETRIES)
+	{
+		uint8_t status = WL_DISCONNECTED;
+		LOG_PRINTF("Connecting to WiFi\n");
+
+		bool cachedLease = applyCachedLease();
+		if (!cachedLease) {
+			applyClientConfig();
+		}
+
+		// first try to connect quickly using previous parameters
+		if (fast) {
+			status = m_wifiMulti.fastReconnect(
+				m_lastWiFiParams,
 				[=] {
 					// periodically reset watchdog
 					watchdogReset();
 				},
-				WIFI_RETRIES,
+				retries,
 				WIFI_TIMEOUT);
+		}
+
+		bool fastConnected = (status == WL_CONNECTED);
+
+		// if the fast reconnect failed, do a full featured connect with scan:
+		if (status != WL_CONNECTED) {
+			// the network changed, the cached lease is of no use
+			if (cachedLease) {
+				cachedLease = false;
+				wifiRtcInvalidateLease();
+				applyClientConfig();
+			}
+
+			// attempt connection to all specified WiFi networks, with maximum of retries retries
+			if (scan) {
+				status = m_wifiMulti.connect(
+					[=] {
+						// periodically reset watchdog
+						watchdogReset();
+					},
+					retries,
+					WIFI_TIMEOUT);
+			}
 
 			if (status == WL_CONNECTED) {
 				LOG_PRINTF("WiFi connected\n");
 				LOG_PRINTF("SSID: %s, RSSI = %d\n", WiFi.SSID().c_str(), WiFi.RSSI());
 				LOG_PRINTF("Channel: %d, IP address: %s\n", WiFi.channel(), WiFi.localIP().toString().c_str());
 			} else {
-				LOG_PRINTF("WiFi connection failed, rebooting...\n");
-				delay(5000);
-				// To avoid unnecessary DRD
-				m_drd->stop();
-				// now restart
-				ESP.restart();
+				// no reboot, the reconnection policy schedules the next attempt
+				LOG_PRINTF("WiFi connection failed (%d)\n", status);
+				return status;
 			}
 		}
+
+		m_leaseActive = cachedLease;
+		m_leasePending = !cachedLease && !(uint32_t)m_clientConfig._sta_static_ip;
+
+		if (!m_bootConnected) {
+			m_bootConnected = true;
+			bootTraceMark(eBootPhaseWifiConnected);
+			reportBootConnect(!fastConnected || !m_rtcParams ? 0 : (cachedLease ? 2 : 1));
+		}
 		return status;
 	}
 
-	void wifiReconnectIfNeeded()
+	// reports the result of a connection attempt to the reconnection policy
+	void finishAttempt(const uint8_t &status)
+	{
+		// disconnect events raised by the attempt itself are accounted here
+		xEventGroupClearBits(m_events, WIFI_EVENT_DISCONNECTED);
+
+		uint8_t reason = m_disconnectReason;
+		if (!reason && status == WL_NO_SSID_AVAIL) {
+			reason = WIFI_REASON_NO_AP_FOUND;
+		}
+
+		m_reconnect.attemptFinished(status == WL_CONNECTED, reason, millis());
+		m_disconnectReason = 0;
+
+		if (status != WL_CONNECTED) {
+			LOG_PRINTF("Next WiFi attempt in %u ms (reason %d, %u failures)\n", m_reconnect.msToNextAttempt(millis()), reason, m_reconnect.failures());
+		}
+	}
+
+	void wifiHandleConnection(const EventBits_t &events)
 	{
-		if ((WiFi.status() != WL_CONNECTED)) {
+		// the link was lost (the status check covers a missed event)
+		if (m_reconnect.connected() && ((events & WIFI_EVENT_DISCONNECTED) || WiFi.status() != WL_CONNECTED)) {
+			uint8_t reason = m_disconnectReason;
+			m_disconnectReason = 0;
+
 			// clear connection status
-			m_connected = false;
+			setConnected(false);
 
-			LOG_PRINTF("\nWiFi lost. Call connectMultiWiFi in loop\n");
-			connectMultiWiFi();
+			LOG_PRINTF("\nWiFi lost, reason %d\n", reason);
+			metricsIncrement(eMetricsWifiDisconnects);
+			metricsSet(eMetricsWifiLastDisconnectReason, reason);
+			m_reconnect.disconnected(reason, millis());
+		}
+
+		WiFiReconnect::Action action = m_reconnect.poll(millis());
+		if (action == WiFiReconnect::eActionNone) {
+			return;
+		}
+
+		LOG_PRINTF("WiFi reconnect attempt: %s\n", WiFiReconnect::actionName(action));
+		metricsIncrement(eMetricsWifiReconnects);
+
+		uint8_t status = connectMultiWiFi(action == WiFiReconnect::eActionFast, action == WiFiReconnect::eActionScan, 1);
+		finishAttempt(status);
+
+		if (status == WL_CONNECTED) {
+			metricsSet(eMetricsWifiLastOutageTime, m_reconnect.lastOutageMs() / 1000.0);
 
 			// notify waiting tasks that we are successfully connected
-			m_connected = true;
+			setConnected(true);
 		}
 	}
 
-	void wifiCheckStatus()
+	void wifiCheckRoaming()
 	{
-		static ulong checkwifi_timeout = 0;
-		static ulong current_millis;
+		if (!ROAM_ENABLED || !m_reconnect.connected() || !connected()) {
+			return;
+		}
 
-		current_millis = millis();
+		WiFiRoam::Candidate candidate;
+		if (!m_roam.poll(millis(), ROAM_CHANNELS | m_wifiMulti.knownChannels(), candidate)) {
+			return;
+		}
 
-		// Check WiFi every WIFICHECK_INTERVAL (1) seconds.
-		if ((current_millis > checkwifi_timeout) || (checkwifi_timeout == 0)) {
-			wifiReconnectIfNeeded();
-			checkwifi_timeout = current_millis + WIFICHECK_INTERVAL;
+		// the password comes with the last params of the current connection
+		if (WiFi.SSID() != m_lastWiFiParams.m_credentials.m_ssid) {
+			return;
+		}
+
+		WiFiMultiSSID::LastParams previous = m_lastWiFiParams;
+		WiFiMultiSSID::LastParams params = m_lastWiFiParams;
+		memcpy(params.m_bssid, candidate.m_bssid, sizeof(params.m_bssid));
+		params.m_channel = candidate.m_channel;
+
+		LOG_PRINTF("WiFi roaming to channel %d, %d dBm\n", candidate.m_channel, candidate.m_rssi);
+		setConnected(false);
+
+		WiFi.disconnect(false, false);
+		for (uint32_t i = 0; i < 100 && WiFi.status() == WL_CONNECTED; i++) {
+			delay(10);
+		}
+
+		auto periodicCb = [=] {
+			// periodically reset watchdog
+			watchdogReset();
+		};
+
+		// the new BSSID is saved by onStationConnected()
+		uint8_t status = m_wifiMulti.fastReconnect(params, periodicCb, 1, WIFI_TIMEOUT);
+		bool success = (status == WL_CONNECTED);
+		if (!success) {
+			LOG_PRINTF("WiFi roaming failed (%d), back to the previous access point\n", status);
+			metricsIncrement(eMetricsWifiRoamFailures);
+			status = m_wifiMulti.fastReconnect(previous, periodicCb, 1, WIFI_TIMEOUT);
+		} else {
+			metricsIncrement(eMetricsWifiRoams);
+		}
+		m_roam.roamed(candidate, success, millis());
+
+		// the disconnect was intended, a failure to get back is up to the reconnection policy
+		xEventGroupClearBits(m_events, WIFI_EVENT_DISCONNECTED);
+		m_disconnectReason = 0;
+
+		if (status == WL_CONNECTED) {
+			// DHCP ran again, keep its new lease
+			m_leasePending = !m_leaseActive && !(uint32_t)m_clientConfig._sta_static_ip;
+			setConnected(true);
 		}
 	}
 
-	int calcChecksum(uint8_t *address, uint16_t sizeToCalc)
+	void diagJson(JsonDocument &doc)
 	{
-		uint16_t checkSum = 0;
-		for (uint16_t index = 0; index < sizeToCalc; index++) {
-			checkSum += *(((byte *)address) + index);
+		m_roam.json(doc);
+		doc["roamingEnabled"] = ROAM_ENABLED;
+	}
+
+	// converts older config layouts to the current one, returns false if unusable
+	bool migrateConfig(ConfigStore::Record &record)
+	{
+		if (record.m_version == 0) {
+			// raw structs protected by a byte sum
+			WiFiManagerConfigLegacy legacy;
+			if (record.m_payload.size() != sizeof(legacy) + sizeof(m_clientConfig)) {
+				return false;
+			}
+			memcpy(&legacy, record.m_payload.data(), sizeof(legacy));
+
+			uint16_t checkSum = 0;
+			for (size_t i = 0; i < offsetof(WiFiManagerConfigLegacy, m_checksum); i++) {
+				checkSum += record.m_payload[i];
+			}
+			if (legacy.m_checksum != checkSum) {
+				return false;
+			}
+
+			WiFiManagerConfigV1 config;
+			memcpy(config.m_credentials, legacy.m_credentials, sizeof(config.m_credentials));
+			memcpy(config.m_hostName, legacy.m_hostName, sizeof(config.m_hostName));
+			config.m_forceAp = legacy.m_forceAp;
+
+			std::vector<uint8_t> payload((uint8_t *)&config, (uint8_t *)&config + sizeof(config));
+			payload.insert(payload.end(), record.m_payload.begin() + sizeof(legacy), record.m_payload.end());
+			record.m_payload.swap(payload);
+			record.m_version = 1;
 		}
-		return checkSum;
+
+		if (record.m_version == 1) {
+			// credentials array sized at build time, empty entries included
+			WiFiManagerConfigV1 v1;
+			if (record.m_payload.size() != sizeof(v1) + sizeof(m_clientConfig)) {
+				return false;
+			}
+			memcpy(&v1, record.m_payload.data(), sizeof(v1));
+
+			WiFiManagerConfig config;
+			memcpy(config.m_hostName, v1.m_hostName, sizeof(config.m_hostName));
+			config.m_forceAp = v1.m_forceAp;
+
+			std::vector<uint8_t> payload((uint8_t *)&config, (uint8_t *)&config + sizeof(config));
+			payload.insert(payload.end(), record.m_payload.begin() + sizeof(v1), record.m_payload.end());
+			payload.push_back(0);
+			for (uint8_t i = 0; i < NUM_WIFI_CREDENTIALS; i++) {
+				if (v1.m_credentials[i].m_ssid[0]) {
+					payload.insert(payload.end(), (uint8_t *)&v1.m_credentials[i], (uint8_t *)&v1.m_credentials[i] + sizeof(v1.m_credentials[i]));
+					payload[sizeof(config) + sizeof(m_clientConfig)]++;
+				}
+			}
+			record.m_payload.swap(payload);
+			record.m_version = 2;
+		}
+
+		return record.m_version == WIFI_CONFIG_VERSION;
 	}
 
 	bool wifiLoadConfiguration()
 	{
-		File file = SPIFFS.open(CONFIG_FILENAME, "r");
 		LOG_PRINTF("Loading config...\n");
 
 		memset((void *)&m_managerConfig, 0, sizeof(m_managerConfig));
 		memset((void *)&m_clientConfig, 0, sizeof(m_clientConfig));
+		m_credentials.clear();
 
-		if (file) {
-			file.readBytes((char *)&m_managerConfig, sizeof(m_managerConfig));
-			file.readBytes((char *)&m_clientConfig, sizeof(m_clientConfig));
-			file.close();
+		ConfigStore::Record record;
+		ConfigStore::Result result = m_configStore.load(record);
+		if (result != ConfigStore::eResultOk && result != ConfigStore::eResultLegacy) {
+			LOG_PRINTF("Loading of config failed (%s)!\n", ConfigStore::resultName(result));
+			return false;
+		}
 
-			if (m_managerConfig.m_checksum != calcChecksum((uint8_t *)&m_managerConfig, sizeof(m_managerConfig) - sizeof(m_managerConfig.m_checksum))) {
-				LOG_PRINTF("Config checksum failed!\n");
-				return false;
-			} else {
-				LOG_PRINTF("Config loaded correctly\n");
-			}
+		uint16_t version = record.m_version;
+		if (!migrateConfig(record)) {
+			LOG_PRINTF("Config version %u not supported!\n", version);
+			return false;
+		}
 
-			displayClientConfig();
-			displayCredentials();
-			return true;
-		} else {
-			LOG_PRINTF("Loading of config failed!\n");
+		const size_t fixedSize = sizeof(m_managerConfig) + sizeof(m_clientConfig);
+		const uint8_t *payload = record.m_payload.data();
+		if (record.m_payload.size() <= fixedSize || payload[fixedSize] > WIFI_CREDENTIALS_MAX || record.m_payload.size() != fixedSize + 1 + payload[fixedSize] * sizeof(WiFiMultiSSID::Credentials)) {
+			LOG_PRINTF("Config size %u invalid!\n", record.m_payload.size());
 			return false;
 		}
+
+		memcpy(&m_managerConfig, payload, sizeof(m_managerConfig));
+		memcpy(&m_clientConfig, payload + sizeof(m_managerConfig), sizeof(m_clientConfig));
+		m_credentials.resize(payload[fixedSize]);
+		memcpy(m_credentials.data(), payload + fixedSize + 1, m_credentials.size() * sizeof(WiFiMultiSSID::Credentials));
+		LOG_PRINTF("Config loaded correctly\n");
+
+		// store the current layout right away
+		if (version != WIFI_CONFIG_VERSION) {
+			LOG_PRINTF("Config migrated from version %u\n", version);
+			wifiSaveConfiguration();
+		}
+
+		displayClientConfig();
+		displayCredentials();
+		return true;
 	}
 
 	bool wifiLoadLastParams()
 	{
-		File file = SPIFFS.open(LAST_PARAMS_FILENAME, "r");
 		LOG_PRINTF("Loading last params...\n");
 
 		memset((void *)&m_lastWiFiParams, 0, sizeof(m_lastWiFiParams));
 
-		if (file) {
-			file.readBytes((char *)&m_lastWiFiParams, sizeof(m_lastWiFiParams));
-			file.close();
-			LOG_PRINTF("Last params loading succeeded\n");
-
-			// sometimes it can happen that last params don't contain any password
-			// (this can happen when the connection is completed before the AP wizard finishes)
-			// In that case try to fill the password by matching the SSID:
-			if (!m_lastWiFiParams.m_credentials.m_password[0]) {
-				for (uint8_t i = 0; i < NUM_WIFI_CREDENTIALS; i++) {
-					if (String(m_managerConfig.m_credentials[i].m_ssid) == String(m_lastWiFiParams.m_credentials.m_ssid)) {
-						strcpy(m_lastWiFiParams.m_credentials.m_password, m_managerConfig.m_credentials[i].m_password);
-						break;
-					}
-				}
-			}
+		// the legacy file holds the same layout without a record header
+		ConfigStore::Record record;
+		ConfigStore::Result result = m_lastParamsStore.load(record);
+		if ((result != ConfigStore::eResultOk && result != ConfigStore::eResultLegacy) || record.m_version > WIFI_LAST_PARAMS_VERSION || record.m_payload.size() != sizeof(m_lastWiFiParams)) {
+			LOG_PRINTF("Last params loading failed (%s)!\n", ConfigStore::resultName(result));
+			return false;
+		}
+
+		memcpy(&m_lastWiFiParams, record.m_payload.data(), sizeof(m_lastWiFiParams));
+		LOG_PRINTF("Last params loading succeeded\n");
+
+		// sometimes it can happen that last params don't contain any password
+		// (this can happen when the connection is completed before the AP wizard finishes)
+		// In that case try to fill the password by matching the SSID:
+		const WiFiMultiSSID::Credentials *credentials = findCredentials(m_lastWiFiParams.m_credentials.m_ssid);
+		if (!m_lastWiFiParams.m_credentials.m_password[0] && credentials) {
+			strcpy(m_lastWiFiParams.m_credentials.m_password, credentials->m_password);
+		}
+
+		displayLastWifiParams(m_lastWiFiParams);
+		return true;
+	}
 
+	bool loadLastParams()
+	{
+		#if (WIFI_RTC_FAST_PATH == 1)
+		// after a warm boot the last params are still in RTC memory
+		m_rtcParams = wifiRtcLoadParams(m_lastWiFiParams);
+		if (m_rtcParams) {
+			LOG_PRINTF("Last params restored from RTC memory\n");
 			displayLastWifiParams(m_lastWiFiParams);
 			return true;
-		} else {
-			LOG_PRINTF("Last params loading failed!\n");
-			return false;
 		}
+		#endif
+		return wifiLoadLastParams();
 	}
 
 	void wifiEraseConfiguration()
@@ -293,6 +677,7 @@ public:
 		LOG_PRINTF("Erasing config...\n");
 		memset((void *)&m_managerConfig, 0, sizeof(m_managerConfig));
 		memset((void *)&m_clientConfig, 0, sizeof(m_clientConfig));
+		m_credentials.clear();
 		wifiSaveConfiguration();
 
 		LOG_PRINTF("Erasing last params...\n");
@@ -302,32 +687,57 @@ public:
 
 	void wifiSaveConfiguration()
 	{
-		File file = SPIFFS.open(CONFIG_FILENAME, "w");
 		LOG_PRINTF("Saving config...\n");
 
-		if (file) {
-			m_managerConfig.m_checksum = calcChecksum((uint8_t *)&m_managerConfig, sizeof(m_managerConfig) - sizeof(m_managerConfig.m_checksum));
-			file.write((uint8_t *)&m_managerConfig, sizeof(m_managerConfig));
+		displayClientConfig();
+		displayCredentials();
 
-			displayClientConfig();
-			displayCredentials();
+		std::vector<uint8_t> payload((uint8_t *)&m_managerConfig, (uint8_t *)&m_managerConfig + sizeof(m_managerConfig));
+		payload.insert(payload.end(), (uint8_t *)&m_clientConfig, (uint8_t *)&m_clientConfig + sizeof(m_clientConfig));
+		payload.push_back(m_credentials.size());
+		payload.insert(payload.end(), (uint8_t *)m_credentials.data(), (uint8_t *)(m_credentials.data() + m_credentials.size()));
 
-			file.write((uint8_t *)&m_clientConfig, sizeof(m_clientConfig));
-			file.close();
+		if (m_configStore.save(WIFI_CONFIG_VERSION, payload.data(), payload.size())) {
 			LOG_PRINTF("Config saved successfully\n");
 		} else {
 			LOG_PRINTF("Failed to save config!\n");
 		}
 	}
 
+	void wifiLoadHistory()
+	{
+		ConfigStore::Record record;
+		if (m_historyStore.load(record) == ConfigStore::eResultOk && record.m_version == WIFI_HISTORY_VERSION && m_wifiMulti.selector().deserialize(record.m_payload)) {
+			LOG_PRINTF("WiFi history loaded, known channels 0x%04x\n", m_wifiMulti.knownChannels());
+		}
+	}
+
+	// the history changes after scans and connections, not written during outages
+	void wifiSaveHistory()
+	{
+		if (!m_wifiMulti.selector().dirty() || !connected()) {
+			return;
+		}
+
+		std::vector<uint8_t> payload;
+		m_wifiMulti.selector().serialize(payload);
+		if (!m_historyStore.save(WIFI_HISTORY_VERSION, payload.data(), payload.size())) {
+			LOG_PRINTF("Failed to save WiFi history!\n");
+		}
+	}
+
 	void wifiSaveLastParams()
 	{
-		File file = SPIFFS.open(LAST_PARAMS_FILENAME, "w");
+		// keep the RTC copy in sync, cleared params invalidate it
+		if (m_lastWiFiParams.m_credentials.m_ssid[0]) {
+			wifiRtcSaveParams(m_lastWiFiParams);
+		} else {
+			wifiRtcInvalidate();
+		}
+
 		LOG_PRINTF("Saving last params...\n");
 
-		if (file) {
-			file.write((uint8_t *)&m_lastWiFiParams, sizeof(m_lastWiFiParams));
-			file.close();
+		if (m_lastParamsStore.save(WIFI_LAST_PARAMS_VERSION, (const uint8_t *)&m_lastWiFiParams, sizeof(m_lastWiFiParams))) {
 			LOG_PRINTF("Last params saved successfully\n");
 		} else {
 			LOG_PRINTF("Failed to save last params!\n");
@@ -343,11 +753,9 @@ public:
 		memcpy(lastParams.m_credentials.m_ssid, info.connected.ssid, MAX(info.connected.ssid_len, sizeof(lastParams.m_credentials.m_ssid) - 1));
 
 		// look for password - find a match for given SSID in our AP configuration
-		for (uint8_t i = 0; i < NUM_WIFI_CREDENTIALS; i++) {
-			if (String(m_managerConfig.m_credentials[i].m_ssid) == String(lastParams.m_credentials.m_ssid)) {
-				strcpy(lastParams.m_credentials.m_password, m_managerConfig.m_credentials[i].m_password);
-				break;
-			}
+		const WiFiMultiSSID::Credentials *credentials = findCredentials(lastParams.m_credentials.m_ssid);
+		if (credentials) {
+			strcpy(lastParams.m_credentials.m_password, credentials->m_password);
 		}
 
 		// copy bssid
@@ -366,6 +774,8 @@ public:
 			wifiSaveLastParams();	
 		} else {
 			LOG_PRINTF("Got the same WiFi params again\n");
+			// after power-on the RTC copy is empty
+			wifiRtcSaveParams(m_lastWiFiParams);
 		}
 
 		displayLastWifiParams(lastParams);
@@ -375,6 +785,9 @@ public:
 	{
 		LOG_PRINTF("Starting Wifi Manager using SPIFFS on %s %s %s\n", ARDUINO_BOARD, ESP_ASYNC_WIFIMANAGER_VERSION, ESP_DOUBLE_RESET_DETECTOR_VERSION);
 
+		// reconnection is handled by the wifi task, not by the WiFi library
+		WiFi.setAutoReconnect(false);
+
 		// disable watchdgog as formatting may take a long time
 		watchdogEnable(false);
 		if (!SPIFFS.begin(true)) {
@@ -393,18 +806,24 @@ public:
 		}
 		// re-enable watchdog
 		watchdogEnable(true);
+		bootTraceMark(eBootPhaseSpiffsMounted);
+
+		// the file listing is skipped on warm boots to get connected sooner
+		WiFiMultiSSID::LastParams rtcParams;
+		if (!WIFI_RTC_FAST_PATH || !wifiRtcLoadParams(rtcParams)) {
+			File root = SPIFFS.open("/");
+			File file = root.openNextFile();
+
+			while (file) {
+				String fileName = file.name();
+				size_t fileSize = file.size();
+				LOG_PRINTF("FS File: %s, size: %f kB\n", fileName.c_str(), fileSize / 1024.0);
+				file = root.openNextFile();
+			}
 
-		File root = SPIFFS.open("/");
-		File file = root.openNextFile();
-
-		while (file) {
-			String fileName = file.name();
-			size_t fileSize = file.size();
-			LOG_PRINTF("FS File: %s, size: %f kB\n", fileName.c_str(), fileSize / 1024.0);
-			file = root.openNextFile();
+			LOG_PRINTF("\n");
 		}
-
-		LOG_PRINTF("\n");
+		bootTraceMark(eBootPhaseFsListed);
 
 		m_drd = new DoubleResetDetector(DRD_TIMEOUT, DRD_ADDRESS);
 
@@ -417,7 +836,7 @@ public:
 
 	void wifiStartManager()
 	{
-		m_connected = false;
+		setConnected(false);
 
 		bool shallRunAccessPoint = false;
 
@@ -426,7 +845,7 @@ public:
 		//
 
 		bool configDataLoaded = false;
-		if (wifiLoadConfiguration() && wifiLoadLastParams()) {
+		if (wifiLoadConfiguration() && loadLastParams()) {
 			configDataLoaded = true;
 			LOG_PRINTF("Got stored WiFiMultiSSID::Credentials. Timeout 120s for Config Portal\n");
 		} else {
@@ -434,6 +853,7 @@ public:
 			LOG_PRINTF("Open Config Portal without Timeout: No stored WiFiMultiSSID::Credentials.\n");
 			shallRunAccessPoint = true;
 		}
+		bootTraceMark(eBootPhaseConfigLoaded);
 
 		//
 		// set default host name if explicit hostname was provided
@@ -482,7 +902,7 @@ public:
 		}
 
 		// if we don't have valid credentials, force AP too
-		if (!m_managerConfig.m_credentials->m_ssid[0]) {
+		if (m_credentials.empty()) {
 			LOG_PRINTF("No valid WiFi credentials stored, AP forced\n");
 			shallRunAccessPoint = true;
 		}
@@ -493,6 +913,7 @@ public:
 			LOG_PRINTF("Open Config Portal without Timeout: Double Reset Detected\n");
 			shallRunAccessPoint = true;
 		}
+		bootTraceMark(eBootPhaseDrdChecked);
 
 		ESPAsync_WMParameter customHostName("hostName",  "host name", m_managerConfig.m_hostName,  HOST_NAME_LEN);
 		manager.addParameter(&customHostName);
@@ -507,6 +928,20 @@ public:
 				SYSTEM_EVENT_STA_CONNECTED);
 		}
 
+		// disconnects wake up the wifi task, which reconnects based on the reason
+		if (!m_disconnectEventId) {
+			m_disconnectEventId = WiFi.onEvent(
+				[](system_event_id_t event, system_event_info_t info) -> void {
+					WiFiContext &ctx = WiFiContext::instance();
+					// our own disconnects after a failed attempt must not hide its real reason
+					if (info.disconnected.reason != WIFI_REASON_ASSOC_LEAVE || !ctx.m_disconnectReason) {
+						ctx.m_disconnectReason = info.disconnected.reason;
+					}
+					xEventGroupSetBits(ctx.m_events, WIFI_EVENT_DISCONNECTED);
+				},
+				SYSTEM_EVENT_STA_DISCONNECTED);
+		}
+
 		//
 		// shall we run AccesPoint?
 		//
@@ -521,7 +956,7 @@ public:
 			wifiSaveLastParams();
 
 			#if USE_CUSTOM_AP_IP
-			LOG_PRINTF("Starting configuration portal @%s\n", m_apIpAddress);
+			LOG_PRINTF("Starting configuration portal @%s\n", m_apIpAddress.toString().c_str());
 			#else
 			LOG_PRINTF("Starting configuration portal @%s\n", "192.168.4.1");
 			#endif
@@ -539,25 +974,11 @@ public:
 				}
 			});
 
-			// copy WiFi configuration from manager to our local structures
+			// add the networks entered in the portal to our local structures
 			for (uint8_t i = 0; i < NUM_WIFI_CREDENTIALS; i++) {
 				String tempSSID = manager.getSSID(i);
-				String tempPW = manager.getPW(i);
-
 				if (tempSSID.length()) {
-					LOG_PRINTF("Updating WiFi credentials %d:\n", i);
-					LOG_PRINTF("SSID: %s -> %s\n", m_managerConfig.m_credentials[i].m_ssid[0] ? m_managerConfig.m_credentials[i].m_ssid : "<empty>", tempSSID.length() ? tempSSID.c_str() : "<empty>");
-					LOG_PRINTF("PASS: %s -> %s\n\n", PASSWORD_STR(m_managerConfig.m_credentials[i].m_password), PASSWORD_STR(tempPW.c_str()));
-
-					if (strlen(tempSSID.c_str()) < sizeof(m_managerConfig.m_credentials[i].m_ssid) - 1)
-						strcpy(m_managerConfig.m_credentials[i].m_ssid, tempSSID.c_str());
-					else
-						strncpy(m_managerConfig.m_credentials[i].m_ssid, tempSSID.c_str(), sizeof(m_managerConfig.m_credentials[i].m_ssid) - 1);
-
-					if (strlen(tempPW.c_str()) < sizeof(m_managerConfig.m_credentials[i].m_password) - 1)
-						strcpy(m_managerConfig.m_credentials[i].m_password, tempPW.c_str());
-					else
-						strncpy(m_managerConfig.m_credentials[i].m_password, tempPW.c_str(), sizeof(m_managerConfig.m_credentials[i].m_password) - 1);
+					updateCredentials(tempSSID, manager.getPW(i));
 				} else {
 					LOG_PRINTF("No new credentials configured at position %d\n", i);
 				}
@@ -585,20 +1006,22 @@ public:
 
 		if (!configDataLoaded) {
 			wifiLoadConfiguration();
-			wifiLoadLastParams();
+			loadLastParams();
 		}
 
 		//
 		// add all configured access points
 		//
 
-		for (uint8_t i = 0; i < NUM_WIFI_CREDENTIALS; i++) {
+		m_wifiMulti.clearAPs();
+		for (const WiFiMultiSSID::Credentials &credentials : m_credentials) {
 			// Don't permit NULL SSID and password len < MIN_AP_PASSWORD_SIZE (8)
-			if ((String(m_managerConfig.m_credentials[i].m_ssid) != "") && (strlen(m_managerConfig.m_credentials[i].m_password) >= MIN_AP_PASSWORD_SIZE)) {
-				LOG_PRINTF("* Add SSID = %s, pw = %s\n", m_managerConfig.m_credentials[i].m_ssid, PASSWORD_STR(m_managerConfig.m_credentials[i].m_password));
-				m_wifiMulti.addAP(m_managerConfig.m_credentials[i].m_ssid, m_managerConfig.m_credentials[i].m_password);
+			if (credentials.m_ssid[0] && (strlen(credentials.m_password) >= MIN_AP_PASSWORD_SIZE)) {
+				LOG_PRINTF("* Add SSID = %s, pw = %s\n", credentials.m_ssid, PASSWORD_STR(credentials.m_password));
+				m_wifiMulti.addAP(credentials.m_ssid, credentials.m_password);
 			}
 		}
+		wifiLoadHistory();
 
 		//
 		// connect to configured WiFi network
@@ -606,11 +1029,16 @@ public:
 
 		unsigned long startedAt = millis();
 
+		m_disconnectReason = 0;
+
 		if (WiFi.status() != WL_CONNECTED) {
 			LOG_PRINTF("ConnectMultiWiFi in setup\n");
 			connectMultiWiFi();
 		}
 
+		// if this failed, the wifi task loop keeps retrying
+		finishAttempt(WiFi.status());
+
 		LOG_PRINTF("After waiting %f secs more in setup(), connection result is \n", (float)(millis() - startedAt) / 1000);
 
 		// we can stop double reset detector
@@ -620,40 +1048,51 @@ public:
 
 		if (WiFi.status() == WL_CONNECTED) {
 			// from now on we are connected
-			m_connected = true;
+			setConnected(true);
 			LOG_PRINTF("Connected. Local IP: %s\n", WiFi.localIP().toString().c_str());
 		}
 		else {
-			LOG_PRINTF(manager.getStatus(WiFi.status()));
+			LOG_WARNING("%s\n", manager.getStatus(WiFi.status()).c_str());
+		}
+	}
+
+	void setConnected(const bool &connected)
+	{
+		if (connected) {
+			xEventGroupSetBits(m_events, WIFI_EVENT_CONNECTED);
+		} else {
+			xEventGroupClearBits(m_events, WIFI_EVENT_CONNECTED);
 		}
 	}
 
 	bool connected()
 	{
-		return m_connected;
+		return (xEventGroupGetBits(m_events) & WIFI_EVENT_CONNECTED) != 0;
 	}
 
-	// initiate reconfiguration and wait until it is finished
-	bool reconfigure()
+	void waitForConnection()
 	{
-		m_shallReconfigure = true;
+		xEventGroupWaitBits(m_events, WIFI_EVENT_CONNECTED, pdFALSE, pdTRUE, portMAX_DELAY);
+	}
 
-		// wait until reconfiguration is finished
-		while (m_shallReconfigure) {
-			delay(100);
-		}
+	// post request to the wifi task and sleep until it is finished
+	bool request(const EventBits_t &requestBit, const EventBits_t &doneBit)
+	{
+		xEventGroupClearBits(m_events, doneBit);
+		xEventGroupSetBits(m_events, requestBit);
+		xEventGroupWaitBits(m_events, doneBit, pdTRUE, pdTRUE, portMAX_DELAY);
 		return true;
 	}
 
-	bool reset()
+	// initiate reconfiguration and wait until it is finished
+	bool reconfigure()
 	{
-		m_shallReset = true;
+		return request(WIFI_EVENT_RECONFIGURE_REQUEST, WIFI_EVENT_RECONFIGURE_DONE);
+	}
 
-		// wait until reset is finished
-		while (m_shallReset) {
-			delay(100);
-		}
-		return true;
+	bool reset()
+	{
+		return request(WIFI_EVENT_RESET_REQUEST, WIFI_EVENT_RESET_DONE);
 	}
 
 	AsyncWebServer *httpServer()
@@ -665,13 +1104,22 @@ public:
 	{
 		while (1) {
 
+			//
+			// sleep until a request or a disconnect arrives, the next reconnect
+			// attempt is due or the watchdog has to be fed
+			//
+
+			uint32_t waitMs = std::min((uint32_t)WIFICHECK_INTERVAL, m_reconnect.msToNextAttempt(millis()));
+			EventBits_t events = xEventGroupWaitBits(m_events, WIFI_EVENT_REQUESTS | WIFI_EVENT_DISCONNECTED, pdTRUE, pdFALSE, pdMS_TO_TICKS(waitMs));
+			metricsIncrement(eMetricsWifiTaskWakeups);
+
 			watchdogReset();
 
 			//
 			// if wifi reconfiguration was requested, execute it on this thread
 			//
 
-			if (m_shallReconfigure) {
+			if (events & WIFI_EVENT_RECONFIGURE_REQUEST) {
 				LOG_PRINTF("WiFi reconfiguration initiated!\n");
 
 				// force ap in settings
@@ -692,10 +1140,10 @@ public:
 				wifiStartManager();
 #endif
 				LOG_PRINTF("WiFi reconfiguration finished\n");
-				m_shallReconfigure = false;
+				xEventGroupSetBits(m_events, WIFI_EVENT_RECONFIGURE_DONE);
 			}
 
-			if (m_shallReset) {
+			if (events & WIFI_EVENT_RESET_REQUEST) {
 				LOG_PRINTF("WiFi reset initiated!\n");
 
 				// erase settings
@@ -715,7 +1163,7 @@ public:
 				wifiStartManager();
 #endif
 				LOG_PRINTF("WiFi reset finished\n");
-				m_shallReset = false;
+				xEventGroupSetBits(m_events, WIFI_EVENT_RESET_DONE);
 			}
 
 			// Call the double reset detector loop method every so often,
@@ -726,8 +1174,11 @@ public:
 				m_drd->loop();
 			}
 
-			wifiCheckStatus();
-			delay(100);
+			wifiHandleConnection(events);
+			wifiCheckRoaming();
+			wifiCheckLease();
+			wifiSaveHistory();
+			powerSavePoll(connected() ? (uint32_t)WiFi.gatewayIP() : 0);
 		}
 	}
 };
@@ -758,9 +1209,7 @@ bool wifiIsConnected()
 
 void wifiWaitForConnection()
 {
-	while (!wifiIsConnected()) {
-		delay(500);
-	}
+	WiFiContext::instance().waitForConnection();
 }
 
 AsyncWebServer *wifiGetHttpServer()
@@ -768,6 +1217,11 @@ AsyncWebServer *wifiGetHttpServer()
 	return WiFiContext::instance().httpServer();
 }
 
+void wifiDiagJson(JsonDocument &doc)
+{
+	WiFiContext::instance().diagJson(doc);
+}
+
 String wifiHostName()
 {
 	const char *hostName = WiFi.getHostname();
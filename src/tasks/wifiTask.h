@@ -2,6 +2,7 @@
 
 #include <WiFi.h>
 #include <ESPAsyncWebServer.h>
+#include <ArduinoJson.h>
 
 void wifiTask(void *pvParameters __attribute__((unused)));
 bool wifiReconfigure();
@@ -9,5 +10,6 @@ bool wifiReset();
 bool wifiIsConnected();
 void wifiWaitForConnection();
 AsyncWebServer *wifiGetHttpServer();
+void wifiDiagJson(JsonDocument &doc);
 String wifiHostName();
 
@@ -1,9 +1,14 @@
+#define LOG_MODULE eLogModuleWifi
+
 #include "WiFiMultiSSID.h"
 #include <limits.h>
 #include <string.h>
 #include "utils.h"
+#include "bootTrace.h"
+#include "wifiScan.h"
 
 WiFiMultiSSID::WiFiMultiSSID()
+	: m_selector(WiFiSelector::Config{WIFI_RANK_SUCCESS_DB, WIFI_RANK_CONNECT_DB_PER_S})
 {
 }
 
@@ -38,9 +43,22 @@ bool WiFiMultiSSID::addAP(const char *ssid, const char *passphrase)
 
 	m_apList.push_back(newAP);
 	LOG_PRINTF("[WIFI][m_apListAdd] add SSID: %s\n", newAP.m_ssid);
+
+	std::vector<std::string> ssids;
+	for (const Credentials &entry : m_apList) {
+		ssids.push_back(entry.m_ssid);
+	}
+	m_selector.setNetworks(ssids);
 	return true;
 }
 
+void WiFiMultiSSID::clearAPs()
+{
+	// the history in RAM goes along, reload it after adding the new list
+	m_apList.clear();
+	m_selector.setNetworks(std::vector<std::string>());
+}
+
 uint8_t WiFiMultiSSID::fastReconnect(const WiFiMultiSSID::LastParams &params, std::function<void(void)> periodicCb, uint32_t retries, uint32_t timeout)
 {
 	if (!params.m_credentials.m_ssid[0] || !params.m_credentials.m_password[0] || !params.m_bssid[0]) {
@@ -89,6 +107,11 @@ uint8_t WiFiMultiSSID::fastReconnect(const WiFiMultiSSID::LastParams &params, st
 			status = WiFi.status();
 		}
 
+		// AP not found says nothing about the network
+		if (status != WL_NO_SSID_AVAIL) {
+			m_selector.attemptFinished(params.m_credentials.m_ssid, params.m_bssid, params.m_channel, status == WL_CONNECTED, millis() - startTime);
+		}
+
 		switch (status) {
 		case WL_CONNECTED:
 			LOG_PRINTF("[WIFI] Connecting done.\n");
@@ -145,123 +168,99 @@ uint8_t WiFiMultiSSID::connect(std::function<void(void)> periodicCb, uint32_t re
 	}
 
 	//
-	// asynchronous scan for wifi networks
+	// the learned channels first, all of them if that found nothing usable
 	//
 
-	uint32_t startMillis = millis();
-	LOG_PRINTF("[WIFI]: Initiating scan (timeout = %d ms)\n", timeout);
-	int16_t scanResult = WiFi.scanNetworks(true, false, false);
-	LOG_PRINTF("[WIFI]: scanNetworks() returned %d\n", scanResult);
-
-	// polling wait until it finishes.
-	// we will ignore WIFI_SCAN_FAILED erros as it may be incorrectly
-	// triggered even when the scan is about to finish fine 
-	while ((millis() - startMillis) < timeout) {
-		scanResult = WiFi.scanComplete();
-		if (scanResult >= 0) {
-			// we got some results
-			LOG_PRINTF("[WIFI]: scan finished, num results = %d\n", scanResult);
-			break;
-		}
+	std::vector<WiFiSelector::Candidate> tried;
+	bootTraceMark(eBootPhaseScanStarted);
 
-		// let's check first if we have been connected in the meantime
-		// (this can happen, there is a race condition between scan and connect)
-		if (WiFi.status() == WL_CONNECTED) {
-			LOG_PRINTF("[WIFI] connected in the meantime!\n");
-			return WL_CONNECTED;
+	uint16_t channels = m_selector.channels();
+	if (channels) {
+		status = scanAndConnect(channels, tried, periodicCb, retries, timeout);
+		if (status == WL_CONNECTED) {
+			return status;
 		}
+	}
 
-		// call periodic callback
-		if (periodicCb) {
-			periodicCb();
-		}
-		delay(100);
-	};
+	return scanAndConnect(WIFI_ALL_CHANNELS, tried, periodicCb, retries, timeout);
+}
+
+uint8_t WiFiMultiSSID::scanAndConnect(const uint16_t &channels, std::vector<WiFiSelector::Candidate> &tried, std::function<void(void)> periodicCb, uint32_t retries, uint32_t timeout)
+{
+	uint32_t startMillis = millis();
+	LOG_PRINTF("[WIFI]: Initiating scan of %s channels (0x%04x)\n", channels == WIFI_ALL_CHANNELS ? "all" : "known", channels);
+
+	std::vector<WiFiScanEntry> scan;
+	bool scanOk = wifiScan(channels, NULL, WIFI_SCAN_DWELL_MS, scan, periodicCb);
+	bootTraceMark(eBootPhaseScanDone);
 
-	// if we are still scanning, leave with error (it means that timeout has expired)
-	if (scanResult == WIFI_SCAN_RUNNING) {
-		// scan is running
-		LOG_PRINTF("[WIFI]: scan is still running, timeout expired!\n");
+	// let's check first if we have been connected in the meantime
+	// (this can happen, there is a race condition between scan and connect)
+	if (WiFi.status() == WL_CONNECTED) {
+		LOG_PRINTF("[WIFI] connected in the meantime!\n");
+		return WL_CONNECTED;
+	}
+
+	if (!scanOk && scan.empty()) {
+		LOG_PRINTF("[WIFI] scan failed\n");
 		return WL_NO_SSID_AVAIL;
-	} else if (scanResult < 0) {
-		// we had some other error...
-		if (WiFi.status() == WL_CONNECTED) {
-			LOG_PRINTF("[WIFI] connected in the meantime!\n");
-			return WL_CONNECTED;
+	}
+
+	LOG_PRINTF("[WIFI] scan done in %u ms, %u networks found\n", (uint32_t)(millis() - startMillis), scan.size());
+
+	m_selector.scanned(scan, channels);
+
+	std::vector<WiFiSelector::Candidate> candidates;
+	m_selector.rank(scan, candidates);
+
+	for (uint32_t i = 0; i < scan.size(); i++) {
+		const WiFiScanEntry &entry = scan[i];
+		bool known = false;
+		for (const WiFiSelector::Candidate &candidate : candidates) {
+			known = known || !memcmp(candidate.m_bssid, entry.m_bssid, sizeof(entry.m_bssid));
 		}
 
-		LOG_PRINTF("[WIFI] scan failed\n");
-		return scanResult;
-	} else if (scanResult >= 0) {
-		// scan done analyze
-		Credentials bestNetwork;
-		int bestNetworkDb = INT_MIN;
-		uint8_t bestBSSID[6];
-		int32_t bestChannel = 0;
-
-		LOG_PRINTF("[WIFI] scan done\n");
-
-		if (scanResult == 0) {
-			LOG_PRINTF("[WIFI] no networks found\n");
-		} else {
-			LOG_PRINTF("[WIFI] %d networks found\n", scanResult);
-
-			for (int8_t i = 0; i < scanResult; ++i) {
-				String ssid_scan;
-				int32_t rssi_scan;
-				uint8_t sec_scan;
-				uint8_t *BSSID_scan;
-				int32_t chan_scan;
-
-				WiFi.getNetworkInfo(i, ssid_scan, sec_scan, rssi_scan, BSSID_scan, chan_scan);
-
-				bool known = false;
-				for (uint32_t x = 0; x < m_apList.size(); x++) {
-					Credentials entry = m_apList[x];
-
-					if (ssid_scan == entry.m_ssid) {
-						// SSID match
-						known = true;
-
-						if (rssi_scan > bestNetworkDb) {
-							// best network
-							if (sec_scan == WIFI_AUTH_OPEN || entry.m_password) {
-								// check for passphrase if not open wlan
-								bestNetworkDb = rssi_scan;
-								bestChannel = chan_scan;
-								memcpy((void *)&bestNetwork, (void *)&entry, sizeof(bestNetwork));
-								memcpy((void *)&bestBSSID, (void *)BSSID_scan, sizeof(bestBSSID));
-							}
-						}
-						break;
-					}
-				}
-
-				if (known) {
-					LOG_PRINTF("[WIFI]  --->   %02d: [%d][%02X:%02X:%02X:%02X:%02X:%02X] %s (%d) %c\n", i, chan_scan, BSSID_scan[0], BSSID_scan[1], BSSID_scan[2], BSSID_scan[3], BSSID_scan[4], BSSID_scan[5], ssid_scan.c_str(), rssi_scan, (sec_scan == WIFI_AUTH_OPEN) ? ' ' : '*');
-				} else {
-					LOG_PRINTF("[WIFI] 	   %02d: [%d][%02X:%02X:%02X:%02X:%02X:%02X] %s (%d) %c\n", i, chan_scan, BSSID_scan[0], BSSID_scan[1], BSSID_scan[2], BSSID_scan[3], BSSID_scan[4], BSSID_scan[5], ssid_scan.c_str(), rssi_scan, (sec_scan == WIFI_AUTH_OPEN) ? ' ' : '*');
-				}
-			}
+		LOG_PRINTF("[WIFI] %s %02d: [%d][%02X:%02X:%02X:%02X:%02X:%02X] %s (%d)\n", known ? " ---> " : "      ", i, entry.m_channel, entry.m_bssid[0], entry.m_bssid[1], entry.m_bssid[2], entry.m_bssid[3], entry.m_bssid[4], entry.m_bssid[5], entry.m_ssid, entry.m_rssi);
+	}
+
+	//
+	// try the best candidates not tried yet
+	//
+
+	uint8_t status = WL_NO_SSID_AVAIL;
+	uint32_t attempts = 0;
+	for (const WiFiSelector::Candidate &candidate : candidates) {
+		if (attempts >= WIFI_CONNECT_CANDIDATES) {
+			break;
 		}
 
-		// clean up ram
-		WiFi.scanDelete();
+		bool done = false;
+		for (const WiFiSelector::Candidate &previous : tried) {
+			done = done || !memcmp(previous.m_bssid, candidate.m_bssid, sizeof(candidate.m_bssid));
+		}
+		if (done) {
+			continue;
+		}
+		tried.push_back(candidate);
+		attempts++;
 
-		// did we find a ssid we have been looking for?
-		if (bestNetwork.m_ssid[0]) {
+		const Credentials &entry = m_apList[candidate.m_network];
+		LOG_PRINTF("[WIFI] candidate %s channel %d, %d dBm, score %.1f\n", entry.m_ssid, candidate.m_channel, candidate.m_rssi, candidate.m_score);
 
-			WiFiMultiSSID::LastParams params;
-			strcpy(params.m_credentials.m_ssid, bestNetwork.m_ssid);
-			strcpy(params.m_credentials.m_password, bestNetwork.m_password);
-			memcpy(params.m_bssid, bestBSSID, sizeof(bestBSSID));
-			params.m_channel = bestChannel;
+		WiFiMultiSSID::LastParams params;
+		strcpy(params.m_credentials.m_ssid, entry.m_ssid);
+		strcpy(params.m_credentials.m_password, entry.m_password);
+		memcpy(params.m_bssid, candidate.m_bssid, sizeof(params.m_bssid));
+		params.m_channel = candidate.m_channel;
 
-			status = fastReconnect(params, periodicCb, retries, timeout);
-		} else {
-			LOG_PRINTF("[WIFI] no matching wifi found!\n");
+		status = fastReconnect(params, periodicCb, retries, timeout);
+		if (status == WL_CONNECTED) {
+			return status;
 		}
 	}
 
+	if (!attempts) {
+		LOG_PRINTF("[WIFI] no matching wifi found!\n");
+	}
 	return status;
 }
@@ -4,6 +4,7 @@
 #include <vector>
 #include <functional>
 #include "config.h"
+#include "wifiSelector.h"
 
 //
 // WiFiMulti alternative with many improvements
@@ -27,10 +28,20 @@ public:
 	~WiFiMultiSSID();
 
 	bool addAP(const char *ssid, const char *passphrase = NULL);
+	void clearAPs();
 
 	uint8_t fastReconnect(const WiFiMultiSSID::LastParams &params, std::function<void(void)> periodicCb = 0, uint32_t retries = 1, uint32_t timeout = 5000);
 	uint8_t connect(std::function<void(void)> periodicCb = 0, uint32_t retries = 1, uint32_t timeout = 5000);
 
+	// bit per channel on which a configured SSID was seen
+	uint16_t knownChannels() const { return m_selector.channels(); }
+
+	// learned channels and connection statistics, persisted by the caller
+	WiFiSelector &selector() { return m_selector; }
+
 private:
+	uint8_t scanAndConnect(const uint16_t &channels, std::vector<WiFiSelector::Candidate> &tried, std::function<void(void)> periodicCb, uint32_t retries, uint32_t timeout);
+
 	std::vector<Credentials> m_apList;
+	WiFiSelector m_selector;
 };
@@ -0,0 +1,125 @@
+#include "accept.h"
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+// specificity of a matching range, 0 = no match
+#define ACCEPT_MATCH_NONE		0
+#define ACCEPT_MATCH_ANY		1	// */*
+#define ACCEPT_MATCH_TYPE		2	// type/*
+#define ACCEPT_MATCH_EXACT		3	// type/subtype
+
+static bool isSpace(const char &c)
+{
+	return c == ' ' || c == '\t';
+}
+
+// "0", "0.5", "1.000", ... -> thousandths, invalid values count as 1
+static uint16_t parseQuality(const char *value, const char *end)
+{
+	if (value >= end || (*value != '0' && *value != '1')) {
+		return ACCEPT_Q_MAX;
+	}
+
+	uint32_t q = (*value++ - '0') * ACCEPT_Q_MAX;
+	if (value < end && *value == '.') {
+		value++;
+		for (uint32_t scale = ACCEPT_Q_MAX / 10; value < end && isdigit((unsigned char)*value); value++, scale /= 10) {
+			q += (*value - '0') * scale;
+		}
+	}
+
+	return (q > ACCEPT_Q_MAX) ? ACCEPT_Q_MAX : q;
+}
+
+static int matchRange(const char *range, const size_t &rangeLen, const char *type)
+{
+	size_t typeLen = strlen(type);
+	const char *slash = strchr(type, '/');
+	size_t majorLen = slash ? slash - type : typeLen;
+
+	if (rangeLen == 3 && !strncmp(range, "*/*", 3)) {
+		return ACCEPT_MATCH_ANY;
+	}
+	if (rangeLen == majorLen + 2 && !strncasecmp(range, type, majorLen + 1) && range[majorLen + 1] == '*') {
+		return ACCEPT_MATCH_TYPE;
+	}
+	if (rangeLen == typeLen && !strncasecmp(range, type, typeLen)) {
+		return ACCEPT_MATCH_EXACT;
+	}
+	return ACCEPT_MATCH_NONE;
+}
+
+// quality and specificity of the most specific range matching 'type'
+static uint16_t match(const char *accept, const char *type, int &specificity)
+{
+	uint16_t quality = 0;
+	specificity = ACCEPT_MATCH_NONE;
+
+	const char *pos = accept;
+	while (*pos) {
+		// one media range up to the next comma
+		const char *end = strchr(pos, ',');
+		end = end ? end : pos + strlen(pos);
+
+		while (pos < end && isSpace(*pos)) {
+			pos++;
+		}
+		const char *rangeEnd = pos;
+		while (rangeEnd < end && *rangeEnd != ';' && !isSpace(*rangeEnd)) {
+			rangeEnd++;
+		}
+
+		int rangeSpecificity = matchRange(pos, rangeEnd - pos, type);
+		if (rangeSpecificity > specificity) {
+			// parameters, only q is used
+			uint16_t rangeQuality = ACCEPT_Q_MAX;
+			const char *param = rangeEnd;
+			while ((param = (const char *)memchr(param, ';', end - param)) != NULL) {
+				param++;
+				while (param < end && isSpace(*param)) {
+					param++;
+				}
+				if (end - param >= 2 && (*param == 'q' || *param == 'Q') && param[1] == '=') {
+					rangeQuality = parseQuality(param + 2, end);
+				}
+			}
+
+			specificity = rangeSpecificity;
+			quality = rangeQuality;
+		}
+
+		pos = *end ? end + 1 : end;
+	}
+
+	return quality;
+}
+
+uint16_t acceptQuality(const char *accept, const char *type)
+{
+	int specificity;
+	return match(accept, type, specificity);
+}
+
+int acceptNegotiate(const char *accept, const char *const *types, const size_t &count)
+{
+	if (!accept || !*accept) {
+		return count ? 0 : -1;
+	}
+
+	int best = -1;
+	uint16_t bestQuality = 0;
+	int bestSpecificity = ACCEPT_MATCH_NONE;
+
+	for (size_t i = 0; i < count; i++) {
+		int specificity;
+		uint16_t quality = match(accept, types[i], specificity);
+		if (quality > bestQuality || (quality && quality == bestQuality && specificity > bestSpecificity)) {
+			best = i;
+			bestQuality = quality;
+			bestSpecificity = specificity;
+		}
+	}
+
+	return best;
+}
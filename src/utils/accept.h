@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// HTTP Accept header negotiation (RFC 9110, 12.5.1)
+//
+// Media ranges are compared as whole type/subtype tokens, case
+// insensitive, so "application/cbor-seq" does not match
+// "application/cbor". The most specific range matching a type gives its
+// quality (type/subtype over type/* over */*), q=0 excludes it.
+// No platform dependencies, tools/accept_check runs the same code on the
+// host.
+//
+
+#define ACCEPT_Q_MAX	1000	// qualities are kept in thousandths
+
+// quality of 'type' under the header, 0 = not acceptable
+uint16_t acceptQuality(const char *accept, const char *type);
+
+// Index of the offered type with the highest quality. Ties go to the
+// type matched by the more specific range, then to the earlier type.
+// Without a header the first type is chosen, -1 if nothing is acceptable.
+int acceptNegotiate(const char *accept, const char *const *types, const size_t &count);
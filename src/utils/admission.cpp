@@ -0,0 +1,274 @@
+#define LOG_MODULE eLogModuleServer
+
+#include "admission.h"
+#include <string.h>
+
+AdmissionLimiter::AdmissionLimiter(const Config &config)
+	: m_config(config)
+	, m_clients(config.m_clients)
+	, m_inFlight(0)
+	, m_lowHeap(false)
+{
+	memset((void *)m_clients.data(), 0, m_clients.size() * sizeof(Client));
+}
+
+AdmissionLimiter::Client *AdmissionLimiter::findClient(const uint32_t &ip, const uint32_t &nowMs)
+{
+	Client *victim = NULL;
+
+	for (Client &client : m_clients) {
+		if (client.m_ip == ip) {
+			return &client;
+		}
+
+		// entries with requests in flight can't be evicted
+		if (client.m_inFlight) {
+			continue;
+		}
+
+		// prefer free entries, then the least recently used one
+		if (!victim || (victim->m_ip && (!client.m_ip || (nowMs - client.m_lastRefillMs) > (nowMs - victim->m_lastRefillMs)))) {
+			victim = &client;
+		}
+	}
+
+	if (victim) {
+		victim->m_ip = ip;
+		victim->m_tokens = m_config.m_rateBurst * 1000;
+		victim->m_lastRefillMs = nowMs;
+		victim->m_inFlight = 0;
+	}
+
+	return victim;
+}
+
+bool AdmissionLimiter::updateHeap(const uint32_t &freeHeap)
+{
+	// hysteresis, so we don't flap around the threshold
+	if (m_lowHeap && freeHeap > m_config.m_lowHeapLeave) {
+		m_lowHeap = false;
+		return true;
+	} else if (!m_lowHeap && freeHeap < m_config.m_lowHeapEnter) {
+		m_lowHeap = true;
+		return true;
+	}
+	return false;
+}
+
+AdmissionLimiter::Verdict AdmissionLimiter::admit(const uint32_t &ip, const uint32_t &nowMs, const bool &cheap)
+{
+	// under heap pressure only requests answered from the cache are served
+	if (m_lowHeap && !cheap) {
+		return eRejectLowHeap;
+	}
+
+	Client *client = findClient(ip, nowMs);
+	if (!client || m_inFlight >= m_config.m_maxInFlight || client->m_inFlight >= m_config.m_maxInFlightPerClient) {
+		return eRejectBusy;
+	}
+
+	// refill token bucket
+	uint32_t full = m_config.m_rateBurst * 1000;
+	uint32_t elapsed = nowMs - client->m_lastRefillMs;
+	if (elapsed >= full / m_config.m_rateRps) {
+		client->m_tokens = full;
+	} else {
+		uint32_t tokens = client->m_tokens + elapsed * m_config.m_rateRps;
+		client->m_tokens = (tokens > full) ? full : tokens;
+	}
+	client->m_lastRefillMs = nowMs;
+
+	if (client->m_tokens < 1000) {
+		return eRejectRate;
+	}
+
+	client->m_tokens -= 1000;
+	client->m_inFlight++;
+	m_inFlight++;
+	return eAdmit;
+}
+
+void AdmissionLimiter::release(const uint32_t &ip)
+{
+	if (m_inFlight) {
+		m_inFlight--;
+	}
+
+	for (Client &client : m_clients) {
+		if (client.m_ip == ip && client.m_inFlight) {
+			client.m_inFlight--;
+			break;
+		}
+	}
+}
+
+uint32_t AdmissionLimiter::inFlight(const uint32_t &ip) const
+{
+	for (const Client &client : m_clients) {
+		if (client.m_ip == ip) {
+			return client.m_inFlight;
+		}
+	}
+	return 0;
+}
+
+#if defined(ARDUINO)
+
+#include <FS.h>
+#include <FSImpl.h>
+#include "utils.h"
+#include "metrics.h"
+
+//
+// The in-flight slot of an admitted request. It is stored in the
+// request's _tempFile, which the request destroys with itself, so the
+// slot is released exactly once on every path. It is not a real file:
+// it reads as closed, so the request never touches it. (Handlers that
+// keep a file in _tempFile, like serveStatic(), would release it when
+// they replace it. None are registered.)
+//
+
+class AdmissionSlot : public fs::FileImpl {
+public:
+	AdmissionSlot(AdmissionControl &control, const uint32_t &ip)
+		: m_control(control)
+		, m_ip(ip)
+	{
+	}
+
+	virtual ~AdmissionSlot()
+	{
+		m_control.release(m_ip);
+	}
+
+	size_t write(const uint8_t *buf, size_t size) override { return 0; }
+	size_t read(uint8_t *buf, size_t size) override { return 0; }
+	void flush() override {}
+	bool seek(uint32_t pos, fs::SeekMode mode) override { return false; }
+	size_t position() const override { return 0; }
+	size_t size() const override { return 0; }
+	void close() override {}
+	time_t getLastWrite() override { return 0; }
+	const char *name() const override { return ""; }
+	boolean isDirectory(void) override { return false; }
+	fs::FileImplPtr openNextFile(const char *mode) override { return fs::FileImplPtr(); }
+	void rewindDirectory(void) override {}
+	operator bool() override { return false; }
+
+private:
+	AdmissionControl &m_control;
+	uint32_t m_ip;
+};
+
+AdmissionControl::AdmissionControl()
+	: m_limiter(AdmissionLimiter::Config{
+		HTTP_MAX_INFLIGHT,
+		HTTP_MAX_INFLIGHT_PER_CLIENT,
+		HTTP_RATE_LIMIT_RPS,
+		HTTP_RATE_LIMIT_BURST,
+		HTTP_RATE_LIMIT_CLIENTS,
+		HTTP_LOW_HEAP_ENTER,
+		HTTP_LOW_HEAP_LEAVE})
+	, m_rejectedPos(0)
+{
+	memset((void *)m_rejected, 0, sizeof(m_rejected));
+	m_mutex = xSemaphoreCreateMutex();
+}
+
+void AdmissionControl::updateHeap()
+{
+	uint32_t freeHeap = ESP.getFreeHeap();
+	if (m_limiter.updateHeap(freeHeap)) {
+		if (m_limiter.lowHeap()) {
+			LOG_WARNING("Heap low (%u bytes free), entering low heap mode\n", freeHeap);
+		} else {
+			LOG_PRINTF("Heap recovered (%u bytes free), leaving low heap mode\n", freeHeap);
+		}
+	}
+}
+
+bool AdmissionControl::lowHeap()
+{
+	bool lowHeap = false;
+	if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+		updateHeap();
+		lowHeap = m_limiter.lowHeap();
+		xSemaphoreGive(m_mutex);
+	}
+	return lowHeap;
+}
+
+void AdmissionControl::release(const uint32_t &ip)
+{
+	if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+		m_limiter.release(ip);
+		xSemaphoreGive(m_mutex);
+	}
+}
+
+AdmissionControl::Verdict AdmissionControl::admit(AsyncWebServerRequest *request)
+{
+	Verdict verdict = AdmissionLimiter::eRejectBusy;
+	uint32_t ip = request->client()->remoteIP();
+
+	// under heap pressure only the cached /get body is served
+	bool cheap = (request->method() == HTTP_GET) && (request->url() == "/get");
+
+	if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+		updateHeap();
+		verdict = m_limiter.admit(ip, millis(), cheap);
+		if (verdict != AdmissionLimiter::eAdmit) {
+			// remember the verdict for handleRequest()
+			m_rejected[m_rejectedPos++ % HTTP_MAX_INFLIGHT] = { request, verdict };
+		}
+		xSemaphoreGive(m_mutex);
+	}
+
+	if (verdict == AdmissionLimiter::eAdmit) {
+		request->_tempFile = fs::File(fs::FileImplPtr(new AdmissionSlot(*this, ip)));
+	} else {
+		metricsIncrement(verdict == AdmissionLimiter::eRejectRate ? eMetricsHttpRejectedRate : (verdict == AdmissionLimiter::eRejectBusy ? eMetricsHttpRejectedBusy : eMetricsHttpRejectedLowHeap));
+	}
+
+	return verdict;
+}
+
+AdmissionControl::Verdict AdmissionControl::verdict(AsyncWebServerRequest *request)
+{
+	Verdict verdict = AdmissionLimiter::eRejectBusy;
+	if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+		for (int i = 0; i < HTTP_MAX_INFLIGHT; i++) {
+			if (m_rejected[i].m_request == request) {
+				verdict = m_rejected[i].m_verdict;
+				m_rejected[i].m_request = NULL;
+				break;
+			}
+		}
+		xSemaphoreGive(m_mutex);
+	}
+	return verdict;
+}
+
+//
+// handler
+//
+
+bool AdmissionHandler::canHandle(AsyncWebServerRequest *request)
+{
+	// claim the request only when it has to be rejected
+	return m_control.admit(request) != AdmissionLimiter::eAdmit;
+}
+
+void AdmissionHandler::handleRequest(AsyncWebServerRequest *request)
+{
+	AdmissionControl::Verdict verdict = m_control.verdict(request);
+	LOG_DEBUG("%s(%d): rejecting %s from %s (%d)\n", __FUNCTION__, __LINE__, request->url().c_str(), request->client()->remoteIP().toString().c_str(), verdict);
+
+	AsyncWebServerResponse *response = (verdict == AdmissionLimiter::eRejectRate)
+		? request->beginResponse(429, "text/plain", "Too many requests")
+		: request->beginResponse(503, "text/plain", "Service unavailable");
+	response->addHeader("Retry-After", String(HTTP_RETRY_AFTER_S));
+	request->send(response);
+}
+
+#endif
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+//
+// HTTP admission control: global and per client in-flight limits,
+// per client token bucket rate limiting and heap aware load shedding
+//
+// AdmissionLimiter holds the decisions and the counters. It does no
+// locking and has no platform dependencies, so tools/admission_check
+// runs the same code on the host. Every admitted request has to be
+// released exactly once.
+//
+
+class AdmissionLimiter {
+public:
+	enum Verdict {
+		eAdmit,
+		eRejectBusy,
+		eRejectRate,
+		eRejectLowHeap
+	};
+
+	struct Config {
+		uint32_t m_maxInFlight;				// all clients
+		uint32_t m_maxInFlightPerClient;
+		uint32_t m_rateRps;					// sustained requests per second per client
+		uint32_t m_rateBurst;				// token bucket size
+		uint32_t m_clients;					// tracked remote IPs
+		uint32_t m_lowHeapEnter;			// free heap below which only cheap requests pass
+		uint32_t m_lowHeapLeave;			// free heap above which normal service resumes
+	};
+
+	explicit AdmissionLimiter(const Config &config);
+
+	// low heap mode with hysteresis, returns true when the mode changed
+	bool updateHeap(const uint32_t &freeHeap);
+	bool lowHeap() const { return m_lowHeap; }
+
+	// cheap requests are answered from a cache and pass in low heap mode
+	Verdict admit(const uint32_t &ip, const uint32_t &nowMs, const bool &cheap);
+
+	// frees the in-flight slot of an admitted request
+	void release(const uint32_t &ip);
+
+	uint32_t inFlight() const { return m_inFlight; }
+	uint32_t inFlight(const uint32_t &ip) const;
+
+private:
+	struct Client {
+		uint32_t m_ip;
+		uint32_t m_tokens;		// in 1/1000 of a token
+		uint32_t m_lastRefillMs;
+		uint32_t m_inFlight;
+	};
+
+	Client *findClient(const uint32_t &ip, const uint32_t &nowMs);
+
+	Config m_config;
+	std::vector<Client> m_clients;
+	uint32_t m_inFlight;
+	bool m_lowHeap;
+};
+
+#if defined(ARDUINO)
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include "config.h"
+
+//
+// AdmissionLimiter behind a mutex, fed from the web server
+//
+// The in-flight slot of an admitted request is owned by the request
+// itself (see AdmissionSlot in admission.cpp), so it is released when the
+// request is destroyed: after the response, when the client goes away
+// early, or when AsyncEventSource takes over the connection of an SSE
+// client (it deletes the request right away, a stream does not hold a
+// slot). The single onDisconnect() callback of the request is left to the
+// handlers.
+//
+
+class AdmissionControl {
+public:
+	typedef AdmissionLimiter::Verdict Verdict;
+
+	AdmissionControl();
+
+	// decide about the request, admitted requests are tracked until destroyed
+	Verdict admit(AsyncWebServerRequest *request);
+
+	// verdict of a recently rejected request
+	Verdict verdict(AsyncWebServerRequest *request);
+
+	bool lowHeap();
+
+	void release(const uint32_t &ip);
+
+private:
+	struct Rejected {
+		AsyncWebServerRequest *m_request;
+		Verdict m_verdict;
+	};
+
+	// updates the low heap mode, expects m_mutex to be held
+	void updateHeap();
+
+	SemaphoreHandle_t m_mutex;
+	AdmissionLimiter m_limiter;
+	Rejected m_rejected[HTTP_MAX_INFLIGHT];
+	uint32_t m_rejectedPos;
+};
+
+//
+// Handler placed in front of all other handlers. Rejected requests are
+// answered here, admitted ones fall through to the regular handlers.
+// (the server owns and deletes its handlers, hence the separate class)
+//
+
+class AdmissionHandler : public AsyncWebHandler {
+private:
+	AdmissionControl &m_control;
+
+public:
+	AdmissionHandler(AdmissionControl &control)
+		: m_control(control)
+	{
+	}
+
+	virtual bool canHandle(AsyncWebServerRequest *request) override;
+	virtual void handleRequest(AsyncWebServerRequest *request) override;
+	virtual bool isRequestHandlerTrivial() override { return true; }
+};
+
+#endif
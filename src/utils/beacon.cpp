@@ -0,0 +1,107 @@
+#define LOG_MODULE eLogModuleFleet
+
+#include <Arduino.h>
+#include <AsyncUDP.h>
+#include <mbedtls/md.h>
+
+#include "beacon.h"
+#include "config.h"
+#include "utils.h"
+#include "metrics.h"
+#include "../tasks/wifiTask.h"
+
+#define BEACON_MAGIC		"VBCN"
+#define BEACON_VERSION		2
+#define BEACON_HOST_MAX		32
+#define BEACON_MAC_LEN		16
+
+#define BEACON_CHANNEL_PM2_5		(1 << 0)
+#define BEACON_CHANNEL_CO2			(1 << 1)
+#define BEACON_CHANNEL_TEMPERATURE	(1 << 2)
+#define BEACON_CHANNEL_HUMIDITY		(1 << 3)
+#define BEACON_CHANNEL_PRESSURE		(1 << 4)
+
+#define CLAMP(min, max, val) ((val < min) ? min : ((val > max) ? max : val))
+
+struct __attribute__((packed)) BeaconHeader {
+	char m_magic[4];
+	uint8_t m_version;
+	uint8_t m_channels;
+	uint8_t m_hostLen;
+	uint8_t m_reserved0;
+	uint32_t m_bootId;
+	uint32_t m_sequence;
+	uint64_t m_timestampMs;
+	uint16_t m_pm2_5;
+	uint16_t m_co2;
+	int16_t m_temperature;
+	uint16_t m_humidity;
+	uint16_t m_pressure;
+	uint16_t m_reserved1;
+};
+
+static AsyncUDP g_udp;
+static IPAddress g_group(BEACON_GROUP);
+static char g_host[BEACON_HOST_MAX + 1] = {};
+static uint32_t g_bootId = 0;
+
+void beaconInit()
+{
+#if (BEACON_ENABLED == 1)
+	sensorSubscribe(beaconSend);
+	LOG_PRINTF("Beacons enabled: %s:%d\n", g_group.toString().c_str(), BEACON_PORT);
+#endif
+}
+
+void beaconSend(const SensorSample &sample)
+{
+	if (!wifiIsConnected()) {
+		return;
+	}
+
+	// host name is fixed once WiFi is up, the RNG is a true one with the radio on
+	if (!g_host[0]) {
+		strncpy(g_host, wifiHostName().c_str(), BEACON_HOST_MAX);
+		while (!g_bootId) {
+			g_bootId = esp_random();
+		}
+	}
+
+	uint8_t buf[sizeof(BeaconHeader) + BEACON_HOST_MAX + BEACON_MAC_LEN];
+	BeaconHeader *header = (BeaconHeader *)buf;
+	memset(header, 0, sizeof(*header));
+
+	memcpy(header->m_magic, BEACON_MAGIC, sizeof(header->m_magic));
+	header->m_version = BEACON_VERSION;
+	header->m_hostLen = strlen(g_host);
+	header->m_bootId = g_bootId;
+	header->m_sequence = sample.m_sequence;
+	header->m_timestampMs = sample.m_timestampMs;
+	header->m_pm2_5 = sample.m_pm2_5;
+	header->m_channels = BEACON_CHANNEL_PM2_5;
+#if (USE_CO2_SENSOR == 1)
+	header->m_co2 = sample.m_co2;
+	header->m_channels |= BEACON_CHANNEL_CO2 | BEACON_CHANNEL_TEMPERATURE | BEACON_CHANNEL_HUMIDITY;
+#elif (USE_ENV_SENSOR == 1)
+	header->m_channels |= BEACON_CHANNEL_TEMPERATURE | BEACON_CHANNEL_HUMIDITY | BEACON_CHANNEL_PRESSURE;
+#endif
+	header->m_temperature = CLAMP(-32768, 32767, (int32_t)lroundf(sample.m_temperature * 100));
+	header->m_humidity = CLAMP(0, 65535, (int32_t)lroundf(sample.m_humidity * 100));
+	header->m_pressure = CLAMP(0, 65535, (int32_t)lroundf(sample.m_pressure * 100));
+
+	size_t len = sizeof(BeaconHeader);
+	memcpy(buf + len, g_host, header->m_hostLen);
+	len += header->m_hostLen;
+
+	// authenticate everything sent so far
+	uint8_t mac[32];
+	if (mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), (const uint8_t *)BEACON_KEY, strlen(BEACON_KEY), buf, len, mac) != 0) {
+		return;
+	}
+	memcpy(buf + len, mac, BEACON_MAC_LEN);
+	len += BEACON_MAC_LEN;
+
+	if (g_udp.writeTo(buf, len, g_group, BEACON_PORT) == len) {
+		metricsIncrement(eMetricsBeaconsSent);
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <Arduino.h>
+#include "../tasks/sensorTask.h"
+
+//
+// multicast telemetry beacons: one authenticated datagram per sensor cycle,
+// so a collector can listen to the whole floor without any connections
+// (see tools/beacon_listener.py for a decoder)
+//
+// datagram layout (little endian):
+//
+//   char magic[4] "VBCN", uint8 version, uint8 channel mask, uint8 host length,
+//   uint8 reserved, uint32 boot id, uint32 sequence, uint64 timestamp ms, uint16 pm2_5,
+//   uint16 co2, int16 temperature (1/100 C), uint16 humidity (1/100 %),
+//   uint16 pressure (1/100 kPa), uint16 reserved, char host[host length],
+//   uint8 mac[16] (HMAC-SHA256 of everything before it, truncated)
+//
+// The boot id is random and drawn once per boot, the sequence restarts at
+// 0 with it. A collector accepts a sequence number only once per boot id,
+// and a boot id only while it is new, so captured beacons (also those of
+// earlier boots) can't be replayed.
+//
+
+void beaconInit();
+void beaconSend(const SensorSample &sample);
@@ -0,0 +1,163 @@
+#include <Arduino.h>
+#include <rom/crc.h>
+#include <esp_system.h>
+
+#include "bootTrace.h"
+#include "config.h"
+
+#define BOOT_TRACE_MAGIC	0x42545243	// "BTRC"
+
+static const char *g_phaseNames[eBootPhaseCount] = {
+	"setup",
+	"display",
+	"spiffs_mounted",
+	"fs_listed",
+	"config_loaded",
+	"drd_checked",
+	"scan_started",
+	"scan_done",
+	"wifi_connected",
+	"connected_seen",
+	"server_started",
+	"setup_done",
+	"sensor_init",
+	"animation_done",
+	"ntp_synced",
+	"sensor_warmed_up",
+	"first_sample",
+	"first_served",
+};
+
+struct BootRecord {
+	uint32_t m_bootCount;
+	uint32_t m_resetReason;
+	uint32_t m_reached;					// bit per phase
+	uint32_t m_ms[eBootPhaseCount];
+};
+
+// plain data only, it has to survive the reset
+struct BootTraceState {
+	uint32_t m_magic;
+	uint32_t m_bootCount;
+	uint32_t m_head;					// record of the current boot
+	BootRecord m_records[BOOT_TRACE_HISTORY];
+	uint32_t m_crc;
+};
+
+static RTC_NOINIT_ATTR BootTraceState g_state;
+static portMUX_TYPE g_mux = portMUX_INITIALIZER_UNLOCKED;
+static bool g_initialized = false;
+
+static uint32_t checksum()
+{
+	return crc32_le(0, (const uint8_t *)&g_state, offsetof(BootTraceState, m_crc));
+}
+
+static const char *resetReasonName(const uint32_t &reason)
+{
+	switch (reason) {
+	case ESP_RST_POWERON:
+		return "power_on";
+	case ESP_RST_EXT:
+		return "external";
+	case ESP_RST_SW:
+		return "software";
+	case ESP_RST_PANIC:
+		return "panic";
+	case ESP_RST_INT_WDT:
+		return "int_watchdog";
+	case ESP_RST_TASK_WDT:
+		return "task_watchdog";
+	case ESP_RST_WDT:
+		return "watchdog";
+	case ESP_RST_DEEPSLEEP:
+		return "deep_sleep";
+	case ESP_RST_BROWNOUT:
+		return "brownout";
+	case ESP_RST_SDIO:
+		return "sdio";
+	default:
+		return "unknown";
+	}
+}
+
+void bootTraceInit()
+{
+	// the content is garbage after power-on
+	if (g_state.m_magic != BOOT_TRACE_MAGIC || g_state.m_crc != checksum() || g_state.m_head >= BOOT_TRACE_HISTORY) {
+		memset((void *)&g_state, 0, sizeof(g_state));
+		g_state.m_magic = BOOT_TRACE_MAGIC;
+		g_state.m_head = BOOT_TRACE_HISTORY - 1;
+	}
+
+	g_state.m_bootCount++;
+	g_state.m_head = (g_state.m_head + 1) % BOOT_TRACE_HISTORY;
+
+	BootRecord &record = g_state.m_records[g_state.m_head];
+	memset((void *)&record, 0, sizeof(record));
+	record.m_bootCount = g_state.m_bootCount;
+	record.m_resetReason = esp_reset_reason();
+	g_state.m_crc = checksum();
+
+	g_initialized = true;
+	bootTraceMark(eBootPhaseSetup);
+}
+
+void bootTraceMark(const BootPhase &phase)
+{
+	if (!g_initialized || phase >= eBootPhaseCount) {
+		return;
+	}
+
+	BootRecord &record = g_state.m_records[g_state.m_head];
+
+	// fast path, most calls come after the phase was reached
+	if (__atomic_load_n(&record.m_reached, __ATOMIC_RELAXED) & (1 << phase)) {
+		return;
+	}
+
+	uint32_t ms = esp_timer_get_time() / 1000;
+
+	portENTER_CRITICAL(&g_mux);
+	if (!(record.m_reached & (1 << phase))) {
+		record.m_ms[phase] = ms;
+		record.m_reached |= (1 << phase);
+		g_state.m_crc = checksum();
+	}
+	portEXIT_CRITICAL(&g_mux);
+}
+
+static void recordJson(JsonObject obj, const BootRecord &record)
+{
+	obj["boot"] = record.m_bootCount;
+	obj["resetReason"] = resetReasonName(record.m_resetReason);
+
+	JsonObject phases = obj.createNestedObject("phases");
+	for (int i = 0; i < eBootPhaseCount; i++) {
+		if (record.m_reached & (1 << i)) {
+			phases[g_phaseNames[i]] = record.m_ms[i];
+		}
+	}
+}
+
+void bootTraceJson(JsonDocument &doc)
+{
+	BootTraceState state;
+
+	portENTER_CRITICAL(&g_mux);
+	memcpy(&state, (const void *)&g_state, sizeof(state));
+	portEXIT_CRITICAL(&g_mux);
+
+	doc["bootCount"] = state.m_bootCount;
+	doc["uptimeMs"] = (uint32_t)(esp_timer_get_time() / 1000);
+	recordJson(doc.createNestedObject("current"), state.m_records[state.m_head]);
+
+	// previous boots, newest first
+	JsonArray previous = doc.createNestedArray("previous");
+	for (uint32_t i = 1; i < BOOT_TRACE_HISTORY; i++) {
+		const BootRecord &record = state.m_records[(state.m_head + BOOT_TRACE_HISTORY - i) % BOOT_TRACE_HISTORY];
+		if (record.m_bootCount) {
+			recordJson(previous.createNestedObject(), record);
+		}
+	}
+}
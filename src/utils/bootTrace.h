@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+//
+// boot phase timeline: milliseconds since the application started
+// (esp_timer) at which each milestone was first reached. The last
+// BOOT_TRACE_HISTORY boots are kept in RTC memory, so the timeline of a
+// boot survives the reboot that follows it, and served at /diag/boot.
+//
+
+enum BootPhase {
+	eBootPhaseSetup,			// setup() entered
+	eBootPhaseDisplay,			// display initialized, boot animation running
+	eBootPhaseSpiffsMounted,
+	eBootPhaseFsListed,			// SPIFFS listing done (skipped on warm boots)
+	eBootPhaseConfigLoaded,		// WiFi config and last params loaded
+	eBootPhaseDrdChecked,		// double reset detection done
+	eBootPhaseScanStarted,		// first full WiFi scan
+	eBootPhaseScanDone,
+	eBootPhaseWifiConnected,	// first IP address
+	eBootPhaseConnectedSeen,	// wifiWaitForConnection() returned in setup()
+	eBootPhaseServerStarted,	// HTTP server listening
+	eBootPhaseSetupDone,		// all tasks started
+	eBootPhaseSensorInit,		// sensors initialized
+	eBootPhaseAnimationDone,	// boot animation faded out
+	eBootPhaseNtpSynced,		// first NTP update
+	eBootPhaseSensorWarmedUp,	// initial measurement delay over
+	eBootPhaseFirstSample,		// first sample published
+	eBootPhaseFirstServed,		// first /get response
+	eBootPhaseCount
+};
+
+// starts the timeline of this boot, call first in setup()
+void bootTraceInit();
+
+// records the first time a phase is reached, later calls are ignored
+void bootTraceMark(const BootPhase &phase);
+
+// current and previous boots, as served by /diag/boot
+void bootTraceJson(JsonDocument &doc);
@@ -0,0 +1,165 @@
+#include <Arduino.h>
+
+#include "cbor.h"
+
+#define CBOR_MAJOR_UINT		0
+#define CBOR_MAJOR_NINT		1
+#define CBOR_MAJOR_TEXT		3
+#define CBOR_MAJOR_ARRAY	4
+#define CBOR_MAJOR_MAP		5
+#define CBOR_MAJOR_SIMPLE	7
+
+#define CBOR_FALSE			0xf4
+#define CBOR_TRUE			0xf5
+#define CBOR_NULL			0xf6
+#define CBOR_FLOAT32		0xfa
+#define CBOR_FLOAT64		0xfb
+
+void CborWriter::write(const uint8_t *data, const size_t &len)
+{
+	if (m_len + len > m_maxLen) {
+		m_overflow = true;
+		return;
+	}
+	memcpy(m_buffer + m_len, data, len);
+	m_len += len;
+}
+
+void CborWriter::head(const uint8_t &major, const uint64_t &value)
+{
+	uint8_t buf[9];
+	size_t len;
+
+	// argument is stored big endian in the shortest possible form
+	if (value < 24) {
+		buf[0] = (major << 5) | value;
+		len = 1;
+	} else if (value <= 0xff) {
+		buf[0] = (major << 5) | 24;
+		len = 2;
+	} else if (value <= 0xffff) {
+		buf[0] = (major << 5) | 25;
+		len = 3;
+	} else if (value <= 0xffffffff) {
+		buf[0] = (major << 5) | 26;
+		len = 5;
+	} else {
+		buf[0] = (major << 5) | 27;
+		len = 9;
+	}
+
+	for (size_t i = 1; i < len; i++) {
+		buf[i] = value >> ((len - 1 - i) * 8);
+	}
+	write(buf, len);
+}
+
+void CborWriter::map(const size_t &count)
+{
+	head(CBOR_MAJOR_MAP, count);
+}
+
+void CborWriter::array(const size_t &count)
+{
+	head(CBOR_MAJOR_ARRAY, count);
+}
+
+void CborWriter::unsignedInt(const uint64_t &value)
+{
+	head(CBOR_MAJOR_UINT, value);
+}
+
+void CborWriter::signedInt(const int64_t &value)
+{
+	if (value < 0) {
+		head(CBOR_MAJOR_NINT, -1 - value);
+	} else {
+		head(CBOR_MAJOR_UINT, value);
+	}
+}
+
+void CborWriter::number(const double &value)
+{
+	uint8_t buf[9];
+	float single = value;
+
+	// sensor values are floats, so single precision is nearly always exact
+	if ((double)single == value || value != value) {
+		uint32_t bits;
+		memcpy(&bits, &single, sizeof(bits));
+		buf[0] = CBOR_FLOAT32;
+		for (int i = 0; i < 4; i++) {
+			buf[1 + i] = bits >> ((3 - i) * 8);
+		}
+		write(buf, 5);
+	} else {
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		buf[0] = CBOR_FLOAT64;
+		for (int i = 0; i < 8; i++) {
+			buf[1 + i] = bits >> ((7 - i) * 8);
+		}
+		write(buf, 9);
+	}
+}
+
+void CborWriter::text(const char *str)
+{
+	size_t len = strlen(str);
+	head(CBOR_MAJOR_TEXT, len);
+	write((const uint8_t *)str, len);
+}
+
+void CborWriter::boolValue(const bool &value)
+{
+	uint8_t b = value ? CBOR_TRUE : CBOR_FALSE;
+	write(&b, 1);
+}
+
+void CborWriter::nullValue()
+{
+	uint8_t b = CBOR_NULL;
+	write(&b, 1);
+}
+
+//
+// JSON document -> CBOR
+//
+
+static void encode(JsonVariantConst src, CborWriter &writer)
+{
+	if (src.is<JsonObjectConst>()) {
+		JsonObjectConst obj = src.as<JsonObjectConst>();
+		writer.map(obj.size());
+		for (JsonPairConst kv : obj) {
+			writer.text(kv.key().c_str());
+			encode(kv.value(), writer);
+		}
+	} else if (src.is<JsonArrayConst>()) {
+		JsonArrayConst array = src.as<JsonArrayConst>();
+		writer.array(array.size());
+		for (JsonVariantConst item : array) {
+			encode(item, writer);
+		}
+	} else if (src.is<bool>()) {
+		writer.boolValue(src.as<bool>());
+	} else if (src.is<uint64_t>()) {
+		// integers have to be tested before floats, is<float>() accepts them too
+		writer.unsignedInt(src.as<uint64_t>());
+	} else if (src.is<int64_t>()) {
+		writer.signedInt(src.as<int64_t>());
+	} else if (src.is<double>()) {
+		writer.number(src.as<double>());
+	} else if (src.is<const char *>()) {
+		writer.text(src.as<const char *>());
+	} else {
+		writer.nullValue();
+	}
+}
+
+size_t serializeCbor(JsonVariantConst src, uint8_t *buffer, const size_t &maxLen)
+{
+	CborWriter writer(buffer, maxLen);
+	encode(src, writer);
+	return writer.overflow() ? 0 : writer.length();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+//
+// minimal CBOR (RFC 8949) encoder writing into a caller provided buffer,
+// definite lengths only. On overflow the output is truncated and
+// overflow() is set.
+//
+
+class CborWriter {
+private:
+	uint8_t *m_buffer;
+	size_t m_maxLen;
+	size_t m_len;
+	bool m_overflow;
+
+	void head(const uint8_t &major, const uint64_t &value);
+	void write(const uint8_t *data, const size_t &len);
+
+public:
+	CborWriter(uint8_t *buffer, const size_t &maxLen)
+		: m_buffer(buffer)
+		, m_maxLen(maxLen)
+		, m_len(0)
+		, m_overflow(false)
+	{
+	}
+
+	void map(const size_t &count);
+	void array(const size_t &count);
+	void unsignedInt(const uint64_t &value);
+	void signedInt(const int64_t &value);
+	void number(const double &value);	// shortest exact float width
+	void text(const char *str);
+	void boolValue(const bool &value);
+	void nullValue();
+
+	size_t length() const { return m_len; }
+	bool overflow() const { return m_overflow; }
+};
+
+// encodes a JSON document as CBOR, returns 0 if it does not fit
+size_t serializeCbor(JsonVariantConst src, uint8_t *buffer, const size_t &maxLen);
@@ -0,0 +1,211 @@
+#include "configStore.h"
+#include <string.h>
+
+#define CONFIG_STORE_MAGIC			0x9E1C0F5A
+#define CONFIG_STORE_HEADER_LEN		16
+#define CONFIG_STORE_CRC_LEN		4
+
+static void put16(std::vector<uint8_t> &out, const uint16_t &value)
+{
+	out.push_back(value & 0xff);
+	out.push_back(value >> 8);
+}
+
+static void put32(std::vector<uint8_t> &out, const uint32_t &value)
+{
+	for (int i = 0; i < 4; i++) {
+		out.push_back((value >> (8 * i)) & 0xff);
+	}
+}
+
+static uint16_t get16(const uint8_t *data)
+{
+	return data[0] | (data[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+ConfigStore::ConfigStore(Storage &storage, const char *path)
+	: m_storage(storage)
+	, m_path(path)
+	, m_tmpPath(std::string(path) + ".tmp")
+	, m_sequence(0)
+{
+}
+
+uint32_t ConfigStore::crc32(const uint8_t *data, const size_t &len, uint32_t crc)
+{
+	// IEEE 802.3, bitwise: records are small and read once per boot
+	crc = ~crc;
+	for (size_t i = 0; i < len; i++) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
+
+void ConfigStore::encode(const uint16_t &version, const uint32_t &sequence, const uint8_t *payload, const size_t &len, std::vector<uint8_t> &out)
+{
+	out.clear();
+	out.reserve(CONFIG_STORE_HEADER_LEN + len + CONFIG_STORE_CRC_LEN);
+
+	put32(out, CONFIG_STORE_MAGIC);
+	put16(out, version);
+	put16(out, 0);
+	put32(out, sequence);
+	put32(out, len);
+	out.insert(out.end(), payload, payload + len);
+	put32(out, crc32(out.data(), out.size()));
+}
+
+bool ConfigStore::decode(const std::vector<uint8_t> &data, Record &record)
+{
+	if (data.size() < CONFIG_STORE_HEADER_LEN + CONFIG_STORE_CRC_LEN || get32(data.data()) != CONFIG_STORE_MAGIC) {
+		return false;
+	}
+
+	// a torn write is shorter than the header says
+	uint32_t len = get32(data.data() + 12);
+	if (len != data.size() - CONFIG_STORE_HEADER_LEN - CONFIG_STORE_CRC_LEN) {
+		return false;
+	}
+
+	size_t crcOffset = CONFIG_STORE_HEADER_LEN + len;
+	if (get32(data.data() + crcOffset) != crc32(data.data(), crcOffset)) {
+		return false;
+	}
+
+	record.m_version = get16(data.data() + 4);
+	record.m_sequence = get32(data.data() + 8);
+	record.m_payload.assign(data.begin() + CONFIG_STORE_HEADER_LEN, data.begin() + crcOffset);
+	return true;
+}
+
+ConfigStore::Result ConfigStore::load(Record &record)
+{
+	std::vector<uint8_t> data;
+	std::vector<uint8_t> tmpData;
+	bool haveFile = m_storage.read(m_path.c_str(), data);
+	bool haveTmp = m_storage.read(m_tmpPath.c_str(), tmpData);
+
+	Record fileRecord;
+	Record tmpRecord;
+	bool fileValid = haveFile && decode(data, fileRecord);
+	bool tmpValid = haveTmp && decode(tmpData, tmpRecord);
+
+	// a save was interrupted after its temporary copy was complete, finish it
+	if (tmpValid && (!fileValid || tmpRecord.m_sequence > fileRecord.m_sequence)) {
+		m_storage.remove(m_path.c_str());
+		m_storage.rename(m_tmpPath.c_str(), m_path.c_str());
+		m_sequence = tmpRecord.m_sequence;
+		record = tmpRecord;
+		return eResultOk;
+	}
+
+	// torn or stale temporary copy
+	if (haveTmp) {
+		m_storage.remove(m_tmpPath.c_str());
+	}
+
+	if (fileValid) {
+		m_sequence = fileRecord.m_sequence;
+		record = fileRecord;
+		return eResultOk;
+	}
+
+	if (!haveFile) {
+		return eResultMissing;
+	}
+
+	if (data.size() >= 4 && get32(data.data()) != CONFIG_STORE_MAGIC) {
+		record.m_version = 0;
+		record.m_sequence = 0;
+		record.m_payload = data;
+		return eResultLegacy;
+	}
+
+	return eResultCorrupted;
+}
+
+bool ConfigStore::save(const uint16_t &version, const uint8_t *payload, const size_t &len)
+{
+	std::vector<uint8_t> data;
+	encode(version, m_sequence + 1, payload, len, data);
+
+	// the previous copy stays untouched until the new one is known to be good
+	std::vector<uint8_t> check;
+	if (!m_storage.write(m_tmpPath.c_str(), data.data(), data.size()) || !m_storage.read(m_tmpPath.c_str(), check) || check != data) {
+		m_storage.remove(m_tmpPath.c_str());
+		return false;
+	}
+	m_sequence++;
+
+	// a failure from here on is finished by the next load()
+	m_storage.remove(m_path.c_str());
+	return m_storage.rename(m_tmpPath.c_str(), m_path.c_str());
+}
+
+const char *ConfigStore::resultName(const Result &result)
+{
+	switch (result) {
+	case eResultOk:
+		return "ok";
+	case eResultLegacy:
+		return "legacy";
+	case eResultMissing:
+		return "missing";
+	case eResultCorrupted:
+		return "corrupted";
+	default:
+		return "unknown";
+	}
+}
+
+#if defined(ARDUINO)
+
+bool FsConfigStorage::read(const char *path, std::vector<uint8_t> &data)
+{
+	if (!m_fs.exists(path)) {
+		return false;
+	}
+
+	File file = m_fs.open(path, "r");
+	if (!file) {
+		return false;
+	}
+
+	data.resize(file.size());
+	size_t len = file.read(data.data(), data.size());
+	file.close();
+	return len == data.size();
+}
+
+bool FsConfigStorage::write(const char *path, const uint8_t *data, const size_t &len)
+{
+	File file = m_fs.open(path, "w");
+	if (!file) {
+		return false;
+	}
+
+	size_t written = file.write(data, len);
+	file.close();
+	return written == len;
+}
+
+bool FsConfigStorage::rename(const char *from, const char *to)
+{
+	// SPIFFS does not replace an existing target
+	return m_fs.rename(from, to);
+}
+
+bool FsConfigStorage::remove(const char *path)
+{
+	return m_fs.remove(path);
+}
+
+#endif
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <string>
+
+//
+// versioned configuration records
+//
+// A record is a 16 byte little endian header (magic, payload layout
+// version, sequence number, payload length), the payload and a CRC32 of
+// both. save() writes "<path>.tmp", reads it back, then replaces <path>
+// with it. A power cut at any point leaves at least one valid copy, and
+// load() picks the valid copy with the higher sequence number and
+// finishes an interrupted replacement.
+//
+// Converting older payload layouts is up to the caller, load() returns
+// the stored version. Files written before records existed are returned
+// as version 0 with the raw file content.
+//
+
+class ConfigStore {
+public:
+	// file operations, SPIFFS on the device and in memory on the host
+	class Storage {
+	public:
+		virtual ~Storage() {}
+		virtual bool read(const char *path, std::vector<uint8_t> &data) = 0;
+		virtual bool write(const char *path, const uint8_t *data, const size_t &len) = 0;
+		virtual bool rename(const char *from, const char *to) = 0;
+		virtual bool remove(const char *path) = 0;
+	};
+
+	enum Result {
+		eResultOk,
+		eResultLegacy,			// file without record header, payload is the raw content
+		eResultMissing,
+		eResultCorrupted,
+	};
+
+	struct Record {
+		uint16_t m_version = 0;
+		uint32_t m_sequence = 0;
+		std::vector<uint8_t> m_payload;
+	};
+
+	ConfigStore(Storage &storage, const char *path);
+
+	Result load(Record &record);
+	bool save(const uint16_t &version, const uint8_t *payload, const size_t &len);
+
+	static const char *resultName(const Result &result);
+
+	// record encoding, exposed for the host checks
+	static void encode(const uint16_t &version, const uint32_t &sequence, const uint8_t *payload, const size_t &len, std::vector<uint8_t> &out);
+	static bool decode(const std::vector<uint8_t> &data, Record &record);
+	static uint32_t crc32(const uint8_t *data, const size_t &len, uint32_t crc = 0);
+
+private:
+	Storage &m_storage;
+	std::string m_path;
+	std::string m_tmpPath;
+
+	// sequence number of the last loaded or saved record
+	uint32_t m_sequence;
+};
+
+#if defined(ARDUINO)
+#include <FS.h>
+
+// ConfigStore storage on an Arduino file system (SPIFFS)
+class FsConfigStorage : public ConfigStore::Storage {
+public:
+	FsConfigStorage(fs::FS &fs) : m_fs(fs) {}
+
+	bool read(const char *path, std::vector<uint8_t> &data) override;
+	bool write(const char *path, const uint8_t *data, const size_t &len) override;
+	bool rename(const char *from, const char *to) override;
+	bool remove(const char *path) override;
+
+private:
+	fs::FS &m_fs;
+};
+#endif
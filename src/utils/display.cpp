@@ -1,3 +1,5 @@
+#define LOG_MODULE eLogModuleDisplay
+
 #include <Arduino.h>
 
 #ifdef USE_ADAFRUIT_NEOPIXEL
@@ -15,6 +17,7 @@ extern "C" {
 #include "utils.h"
 #include "watchdog.h"
 #include "hsvToRgb.h"
+#include "bootTrace.h"
 
 #define CLAMP(min, max, val) ((val < min) ? min : ((val > max) ? max : val))
 
@@ -99,6 +102,7 @@ private:
 		executeAtomically([=]{
 			if (m_booting) {
 				m_booting = false;
+				bootTraceMark(eBootPhaseAnimationDone);
 
 				// read brightness from preferences
 				m_preferences.begin(PREFERENCES_ID, false);
@@ -295,6 +299,11 @@ public:
 		});
 	}
 
+	uint8_t ledBrightness()
+	{
+		return m_brightness;
+	}
+
 	void fadeColors(uint32_t pmColor, uint32_t humColor, uint32_t co2Color, const int &steps)
 	{
 		bootFinished();
@@ -17,6 +17,7 @@ public:
 	virtual void fadeColors(uint32_t pmColor, uint32_t humColor, uint32_t co2Color, const int &steps) = 0;
 	virtual void highPriorityColor(uint32_t color, const bool &enable) = 0;
 	virtual void setLedBrightness(const uint8_t &brightness) = 0;
+	virtual uint8_t ledBrightness() = 0;
 	virtual void alert(int id) = 0;
 	virtual uint32_t rgbColor(const Colors &color) = 0;
 };
@@ -0,0 +1,226 @@
+#include "gzip.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(ARDUINO)
+#include <rom/crc.h>
+#else
+// bitwise stand-in for the ROM function on the host
+static uint32_t crc32_le(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	crc = ~crc;
+	while (len--) {
+		crc ^= *buf++;
+		for (int i = 0; i < 8; i++) {
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
+#endif
+
+#define GZIP_HASH_BITS		12
+#define GZIP_HASH_SIZE		(1 << GZIP_HASH_BITS)
+#define GZIP_WINDOW			32768
+#define GZIP_MIN_MATCH		3
+#define GZIP_MAX_MATCH		258
+
+//
+// deflate tables (RFC 1951, 3.2.5)
+//
+
+static const uint16_t g_lengthBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t g_lengthExtra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t g_distBase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const uint8_t g_distExtra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+//
+// LSB first bit writer
+//
+
+class BitWriter {
+private:
+	uint8_t *m_out;
+	size_t m_maxLen;
+	size_t m_pos;
+	uint32_t m_bits;
+	uint32_t m_count;
+	bool m_overflow;
+
+public:
+	BitWriter(uint8_t *out, const size_t &maxLen, const size_t &pos)
+		: m_out(out)
+		, m_maxLen(maxLen)
+		, m_pos(pos)
+		, m_bits(0)
+		, m_count(0)
+		, m_overflow(false)
+	{
+	}
+
+	void bits(const uint32_t &value, const uint32_t &count)
+	{
+		m_bits |= value << m_count;
+		m_count += count;
+		while (m_count >= 8) {
+			byte(m_bits & 0xff);
+			m_bits >>= 8;
+			m_count -= 8;
+		}
+	}
+
+	// Huffman codes are stored starting with the most significant bit
+	void code(uint32_t value, const uint32_t &count)
+	{
+		uint32_t reversed = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			reversed = (reversed << 1) | (value & 1);
+			value >>= 1;
+		}
+		bits(reversed, count);
+	}
+
+	void byte(const uint8_t &value)
+	{
+		if (m_pos < m_maxLen) {
+			m_out[m_pos++] = value;
+		} else {
+			m_overflow = true;
+		}
+	}
+
+	void align()
+	{
+		if (m_count) {
+			bits(0, 8 - m_count);
+		}
+	}
+
+	void le32(const uint32_t &value)
+	{
+		for (int i = 0; i < 4; i++) {
+			byte(value >> (i * 8));
+		}
+	}
+
+	size_t pos() const { return m_pos; }
+	bool overflow() const { return m_overflow; }
+};
+
+static void writeLiteral(BitWriter &writer, const uint32_t &value)
+{
+	if (value < 144) {
+		writer.code(0x30 + value, 8);
+	} else if (value < 256) {
+		writer.code(0x190 + value - 144, 9);
+	} else if (value < 280) {
+		writer.code(value - 256, 7);
+	} else {
+		writer.code(0xc0 + value - 280, 8);
+	}
+}
+
+static void writeMatch(BitWriter &writer, const uint32_t &length, const uint32_t &distance)
+{
+	int code = 28;
+	while (g_lengthBase[code] > length) {
+		code--;
+	}
+	writeLiteral(writer, 257 + code);
+	writer.bits(length - g_lengthBase[code], g_lengthExtra[code]);
+
+	code = 29;
+	while (g_distBase[code] > distance) {
+		code--;
+	}
+	writer.code(code, 5);
+	writer.bits(distance - g_distBase[code], g_distExtra[code]);
+}
+
+static inline uint32_t hash3(const uint8_t *p)
+{
+	return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - GZIP_HASH_BITS);
+}
+
+size_t gzipCompress(const uint8_t *in, const size_t &inLen, uint8_t *out, const size_t &outMax)
+{
+	static const uint8_t header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+	if (outMax < sizeof(header)) {
+		return 0;
+	}
+	memcpy(out, header, sizeof(header));
+
+	// positions + 1 of the last occurrence of each 3 byte hash, 0 = none
+	uint32_t *heads = (uint32_t *)calloc(GZIP_HASH_SIZE, sizeof(uint32_t));
+	if (!heads) {
+		return 0;
+	}
+
+	BitWriter writer(out, outMax, sizeof(header));
+
+	// single final block with fixed Huffman codes
+	writer.bits(1, 1);
+	writer.bits(1, 2);
+
+	size_t pos = 0;
+	while (pos < inLen && !writer.overflow()) {
+		uint32_t length = 0;
+		uint32_t distance = 0;
+
+		if (pos + GZIP_MIN_MATCH <= inLen) {
+			uint32_t h = hash3(in + pos);
+			uint32_t candidate = heads[h];
+			heads[h] = pos + 1;
+
+			if (candidate && pos - (candidate - 1) <= GZIP_WINDOW) {
+				const uint8_t *a = in + candidate - 1;
+				const uint8_t *b = in + pos;
+				uint32_t max = inLen - pos;
+				max = (max > GZIP_MAX_MATCH) ? GZIP_MAX_MATCH : max;
+				while (length < max && a[length] == b[length]) {
+					length++;
+				}
+				distance = pos - (candidate - 1);
+			}
+		}
+
+		if (length >= GZIP_MIN_MATCH) {
+			writeMatch(writer, length, distance);
+
+			// index the skipped positions so following lines can refer to them
+			for (uint32_t i = 1; i < length && pos + i + GZIP_MIN_MATCH <= inLen; i++) {
+				heads[hash3(in + pos + i)] = pos + i + 1;
+			}
+			pos += length;
+		} else {
+			writeLiteral(writer, in[pos]);
+			pos++;
+		}
+	}
+	free(heads);
+
+	// end of block
+	writeLiteral(writer, 256);
+	writer.align();
+
+	// trailer
+	writer.le32(crc32_le(0, in, inLen));
+	writer.le32(inLen);
+
+	return writer.overflow() ? 0 : writer.pos();
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// minimal gzip (RFC 1952) compressor: LZ77 with a single probe hash table
+// and the fixed Huffman code of RFC 1951. The ratio is behind zlib, but it
+// needs no dynamic trees and only a small scratch table, which is plenty
+// for repetitive text like line protocol or JSON.
+//
+// No platform dependencies besides the ROM crc32, tools/gzip_check runs it
+// on the host.
+//
+
+// returns size of the compressed data or 0 if it does not fit into 'out'
+size_t gzipCompress(const uint8_t *in, const size_t &inLen, uint8_t *out, const size_t &outMax);
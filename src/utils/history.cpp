@@ -0,0 +1,371 @@
+#include "history.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HISTORY_BINARY_MAGIC	"VHST"
+#define HISTORY_BINARY_VERSION	1
+
+//
+// binary export header
+//
+
+struct __attribute__((packed)) HistoryBinaryHeader {
+	char m_magic[4];
+	uint8_t m_version;
+	uint8_t m_recordSize;
+	uint16_t m_step;
+	uint32_t m_count;
+	uint32_t m_reserved;
+};
+
+static const char g_csvHeader[] = "timestamp,pm2_5,temperature,humidity,co2,pressure\n";
+
+//
+// ring
+//
+
+HistoryRing::HistoryRing()
+	: m_records(NULL)
+	, m_capacity(0)
+	, m_head(0)
+{
+}
+
+void HistoryRing::init(HistoryRecord *records, const uint32_t &capacity)
+{
+	m_records = records;
+	m_capacity = records ? capacity : 0;
+	m_head = 0;
+}
+
+void HistoryRing::append(const HistoryRecord &record)
+{
+	if (!m_capacity) {
+		return;
+	}
+
+	m_records[m_head % m_capacity] = record;
+	m_head++;
+}
+
+uint32_t HistoryRing::range(const uint32_t &from, const uint32_t &to, uint32_t &firstSeq) const
+{
+	firstSeq = 0;
+
+	if (!m_capacity || from > to) {
+		return 0;
+	}
+
+	uint32_t oldest = (m_head > m_capacity) ? m_head - m_capacity : 0;
+
+	// lower bound of 'from'
+	uint32_t lo = oldest;
+	uint32_t hi = m_head;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (m_records[mid % m_capacity].m_timestamp < from) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	firstSeq = lo;
+
+	// upper bound of 'to'
+	hi = m_head;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (m_records[mid % m_capacity].m_timestamp <= to) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo - firstSeq;
+}
+
+bool HistoryRing::get(const uint32_t &seq, HistoryRecord &record) const
+{
+	if (!m_capacity || seq >= m_head || m_head - seq > m_capacity) {
+		return false;
+	}
+
+	record = m_records[seq % m_capacity];
+	return true;
+}
+
+//
+// export
+//
+
+// formats signed fixed point value with 2 decimals, e.g. -1234 -> "-12.34"
+static void fixedToStr(char *buf, size_t size, const int32_t &value, const char *fmt)
+{
+	uint32_t abs = (value < 0) ? -value : value;
+	snprintf(buf, size, fmt, (value < 0) ? "-" : "", abs / 100, abs % 100);
+}
+
+static size_t formatValues(const HistoryRecord &r, const HistoryExport::Format &format, char *buf)
+{
+	switch (format) {
+	case HistoryExport::eFormatCsv:
+		// zero padded fixed width fields
+		return sprintf(buf, "%010u,%05u,%c%03u.%02u,%03u.%02u,%05u,%03u.%02u\n",
+			r.m_timestamp,
+			r.m_pm2_5,
+			(r.m_temperature < 0) ? '-' : '+', abs(r.m_temperature) / 100, abs(r.m_temperature) % 100,
+			r.m_humidity / 100, r.m_humidity % 100,
+			r.m_co2,
+			r.m_pressure / 100, r.m_pressure % 100);
+	case HistoryExport::eFormatNdjson: {
+		// space padded fixed width fields (leading zeros are not valid JSON)
+		char temperature[8];
+		char humidity[8];
+		char pressure[8];
+		fixedToStr(temperature, sizeof(temperature), r.m_temperature, "%s%u.%02u");
+		fixedToStr(humidity, sizeof(humidity), r.m_humidity, "%s%u.%02u");
+		fixedToStr(pressure, sizeof(pressure), r.m_pressure, "%s%u.%02u");
+		return sprintf(buf, "{\"t\":%10u,\"pm2_5\":%5u,\"temperature\":%7s,\"humidity\":%6s,\"co2\":%5u,\"pressure\":%6s}\n",
+			r.m_timestamp, r.m_pm2_5, temperature, humidity, r.m_co2, pressure);
+	}
+	case HistoryExport::eFormatBinary:
+	default:
+		memcpy(buf, &r, sizeof(r));
+		return sizeof(r);
+	}
+}
+
+HistoryExport::HistoryExport(const Format &format, const Source &source, const uint32_t &firstSeq, const uint32_t &count, const uint32_t &step)
+	: m_format(format)
+	, m_source(source)
+	, m_firstSeq(firstSeq)
+	, m_count(count)
+	, m_step(step ? step : 1)
+{
+}
+
+size_t HistoryExport::headerLength() const
+{
+	switch (m_format) {
+	case eFormatCsv:
+		return sizeof(g_csvHeader) - 1;
+	case eFormatBinary:
+		return sizeof(HistoryBinaryHeader);
+	default:
+		return 0;
+	}
+}
+
+size_t HistoryExport::recordLength() const
+{
+	char buf[128];
+	HistoryRecord empty = {};
+	return formatValues(empty, m_format, buf);
+}
+
+uint32_t HistoryExport::records() const
+{
+	return (m_count + m_step - 1) / m_step;
+}
+
+size_t HistoryExport::length() const
+{
+	return headerLength() + records() * recordLength();
+}
+
+size_t HistoryExport::formatRecord(const uint32_t &index, char *buf) const
+{
+	// average all samples within the bucket
+	uint32_t first = m_firstSeq + index * m_step;
+	uint32_t last = first + m_step;
+	if (last > m_firstSeq + m_count) {
+		last = m_firstSeq + m_count;
+	}
+
+	HistoryRecord out = {};
+	int32_t temperature = 0;
+	uint32_t pm2_5 = 0, humidity = 0, co2 = 0, pressure = 0, valid = 0;
+
+	for (uint32_t seq = first; seq < last; seq++) {
+		HistoryRecord r;
+		if (!m_source(seq, r)) {
+			// overwritten in the meantime
+			continue;
+		}
+
+		if (!valid) {
+			out.m_timestamp = r.m_timestamp;
+		}
+		pm2_5 += r.m_pm2_5;
+		temperature += r.m_temperature;
+		humidity += r.m_humidity;
+		co2 += r.m_co2;
+		pressure += r.m_pressure;
+		valid++;
+	}
+
+	if (valid) {
+		out.m_pm2_5 = pm2_5 / valid;
+		out.m_temperature = temperature / (int32_t)valid;
+		out.m_humidity = humidity / valid;
+		out.m_co2 = co2 / valid;
+		out.m_pressure = pressure / valid;
+	}
+
+	return formatValues(out, m_format, buf);
+}
+
+size_t HistoryExport::read(uint8_t *buffer, size_t maxLen, size_t offset) const
+{
+	size_t header = headerLength();
+	size_t record = recordLength();
+	size_t total = header + records() * record;
+	size_t written = 0;
+
+	while (written < maxLen && offset < total) {
+		char buf[128];
+		size_t pos;
+		size_t len;
+
+		if (offset < header) {
+			// header
+			if (m_format == eFormatCsv) {
+				memcpy(buf, g_csvHeader, header);
+			} else {
+				HistoryBinaryHeader binary = {};
+				memcpy(binary.m_magic, HISTORY_BINARY_MAGIC, sizeof(binary.m_magic));
+				binary.m_version = HISTORY_BINARY_VERSION;
+				binary.m_recordSize = sizeof(HistoryRecord);
+				binary.m_step = m_step;
+				binary.m_count = records();
+				memcpy(buf, &binary, sizeof(binary));
+			}
+			pos = offset;
+			len = header;
+		} else {
+			// record
+			formatRecord((offset - header) / record, buf);
+			pos = (offset - header) % record;
+			len = record;
+		}
+
+		size_t toCopy = len - pos;
+		if (toCopy > maxLen - written) {
+			toCopy = maxLen - written;
+		}
+		memcpy(buffer + written, buf + pos, toCopy);
+		written += toCopy;
+		offset += toCopy;
+	}
+
+	return written;
+}
+
+const char *HistoryExport::contentType() const
+{
+	switch (m_format) {
+	case eFormatCsv:
+		return "text/csv";
+	case eFormatNdjson:
+		return "application/x-ndjson";
+	default:
+		return "application/octet-stream";
+	}
+}
+
+size_t HistoryExport::etag(char *buf, const size_t &size) const
+{
+	return snprintf(buf, size, "\"%x-%x-%x-%x\"", (unsigned)m_firstSeq, (unsigned)m_count, (unsigned)m_step, (unsigned)m_format);
+}
+
+#if defined(ARDUINO)
+
+#include "config.h"
+#include "utils.h"
+
+#define CLAMP(min, max, val) ((val < min) ? min : ((val > max) ? max : val))
+
+static SemaphoreHandle_t g_mutex = NULL;
+static HistoryRing g_ring;
+
+void historyInit()
+{
+	if (g_ring.capacity()) {
+		return;
+	}
+
+	g_mutex = xSemaphoreCreateMutex();
+
+	// prefer PSRAM for the large buffer, internal heap gets a short one
+	HistoryRecord *records = NULL;
+	uint32_t capacity = 0;
+	if (psramFound()) {
+		records = (HistoryRecord *)ps_malloc(HISTORY_CAPACITY * sizeof(HistoryRecord));
+		capacity = HISTORY_CAPACITY;
+	}
+
+	if (!records) {
+		records = (HistoryRecord *)malloc(HISTORY_CAPACITY_NO_PSRAM * sizeof(HistoryRecord));
+		capacity = HISTORY_CAPACITY_NO_PSRAM;
+	}
+
+	if (!records) {
+		LOG_PRINTF("Unable to allocate sample history!\n");
+		return;
+	}
+
+	g_ring.init(records, capacity);
+	LOG_PRINTF("Sample history: %u samples (%u bytes)\n", capacity, (uint32_t)(capacity * sizeof(HistoryRecord)));
+
+	sensorSubscribe(historyAppend);
+}
+
+void historyAppend(const SensorSample &sample)
+{
+	if (!g_ring.capacity()) {
+		return;
+	}
+
+	HistoryRecord record;
+	record.m_timestamp = sample.m_timestampMs / 1000;
+	record.m_pm2_5 = sample.m_pm2_5;
+	record.m_temperature = CLAMP(-32768, 32767, (int32_t)lroundf(sample.m_temperature * 100));
+	record.m_humidity = CLAMP(0, 65535, (int32_t)lroundf(sample.m_humidity * 100));
+	record.m_co2 = sample.m_co2;
+	record.m_pressure = CLAMP(0, 65535, (int32_t)lroundf(sample.m_pressure * 100));
+	record.m_reserved = 0;
+
+	if (xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
+		g_ring.append(record);
+		xSemaphoreGive(g_mutex);
+	}
+}
+
+uint32_t historyRange(const uint32_t &from, const uint32_t &to, uint32_t &firstSeq)
+{
+	uint32_t count = 0;
+	firstSeq = 0;
+
+	if (g_ring.capacity() && xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
+		count = g_ring.range(from, to, firstSeq);
+		xSemaphoreGive(g_mutex);
+	}
+
+	return count;
+}
+
+bool historyGet(const uint32_t &seq, HistoryRecord &record)
+{
+	bool ret = false;
+
+	if (g_ring.capacity() && xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
+		ret = g_ring.get(seq, record);
+		xSemaphoreGive(g_mutex);
+	}
+
+	return ret;
+}
+
+#endif
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// sample history kept in a RAM ring buffer
+//
+// The ring and the export have no platform dependencies, so
+// tools/history_bench runs the same code on the host. The device
+// functions at the end wrap one ring behind a mutex.
+//
+
+struct __attribute__((packed)) HistoryRecord {
+	uint32_t m_timestamp;		// seconds (compensatedMillis() / 1000)
+	uint16_t m_pm2_5;			// ug/m3
+	int16_t m_temperature;		// 1/100 C
+	uint16_t m_humidity;		// 1/100 %
+	uint16_t m_co2;				// ppm
+	uint16_t m_pressure;		// 1/100 kPa
+	uint16_t m_reserved;
+};
+
+//
+// Ring of records addressed by sequence numbers, no locking
+//
+
+class HistoryRing {
+public:
+	HistoryRing();
+
+	void init(HistoryRecord *records, const uint32_t &capacity);
+	uint32_t capacity() const { return m_capacity; }
+
+	void append(const HistoryRecord &record);
+
+	// finds samples within <from; to> (seconds), returns number of samples
+	// and the sequence number of the first one
+	uint32_t range(const uint32_t &from, const uint32_t &to, uint32_t &firstSeq) const;
+
+	// returns false if the sample has already been overwritten
+	bool get(const uint32_t &seq, HistoryRecord &record) const;
+
+private:
+	HistoryRecord *m_records;
+	uint32_t m_capacity;
+	uint32_t m_head;		// sequence number of the next sample
+};
+
+//
+// Export of a history range as a byte stream. Every format uses fixed
+// length records, so any byte offset maps directly to a record, which
+// makes HTTP Range requests cheap and the output reproducible.
+//
+
+class HistoryExport {
+public:
+	enum Format {
+		eFormatCsv,
+		eFormatNdjson,
+		eFormatBinary
+	};
+
+	// reads one sample, false if it has been overwritten
+	typedef bool (*Source)(const uint32_t &seq, HistoryRecord &record);
+
+private:
+	Format m_format;
+	Source m_source;
+	uint32_t m_firstSeq;
+	uint32_t m_count;
+	uint32_t m_step;
+
+	size_t headerLength() const;
+	size_t recordLength() const;
+	size_t formatRecord(const uint32_t &index, char *buf) const;
+
+public:
+	HistoryExport(const Format &format, const Source &source, const uint32_t &firstSeq, const uint32_t &count, const uint32_t &step);
+
+	// total length of the stream
+	size_t length() const;
+
+	// copy up to maxLen bytes from the given stream offset
+	size_t read(uint8_t *buffer, size_t maxLen, size_t offset) const;
+
+	uint32_t records() const;
+	const char *contentType() const;
+	size_t etag(char *buf, const size_t &size) const;
+};
+
+#if defined(ARDUINO)
+
+#include <Arduino.h>
+#include "../tasks/sensorTask.h"
+
+void historyInit();
+void historyAppend(const SensorSample &sample);
+
+// HistoryRing::range() and get() of the device history
+uint32_t historyRange(const uint32_t &from, const uint32_t &to, uint32_t &firstSeq);
+bool historyGet(const uint32_t &seq, HistoryRecord &record);
+
+#endif
@@ -1,3 +1,5 @@
+#define LOG_MODULE eLogModuleDisplay
+
 #include <Adafruit_NeoPixel.h>
 #include "config.h"
 #include "utils.h"
@@ -0,0 +1,287 @@
+#include "logRecord.h"
+#include <stdio.h>
+
+static const char *g_moduleNames[eLogModuleCount] = {
+	"main",
+	"wifi",
+	"ntp",
+	"sensor",
+	"server",
+	"ota",
+	"mqtt",
+	"influx",
+	"coap",
+	"fleet",
+	"modbus",
+	"tls",
+	"display",
+	"power",
+};
+
+static const char *g_levelNames[eLogLevelCount] = {
+	"off",
+	"error",
+	"warning",
+	"info",
+	"debug",
+};
+
+struct Arg {
+	uint8_t m_tag;
+	int64_t m_int;
+	double m_double;
+	const char *m_string;
+	size_t m_stringLen;
+};
+
+static uint64_t getPointer(const uint8_t *data, const size_t &pointerSize)
+{
+	if (pointerSize == 8) {
+		uint64_t value;
+		memcpy(&value, data, sizeof(value));
+		return value;
+	}
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+// next argument of the record, false at the end or on a malformed record
+static bool nextArg(const uint8_t *record, const size_t &len, const size_t &pointerSize, size_t &offset, Arg &arg)
+{
+	if (offset >= len) {
+		return false;
+	}
+
+	arg.m_tag = record[offset++];
+	size_t size = 0;
+	switch (arg.m_tag) {
+	case eLogArgInt32:
+		size = 4;
+		break;
+	case eLogArgInt64:
+	case eLogArgDouble:
+		size = 8;
+		break;
+	case eLogArgPointer:
+		size = pointerSize;
+		break;
+	case eLogArgString:
+		if (offset >= len) {
+			return false;
+		}
+		size = record[offset++];
+		break;
+	default:
+		return false;
+	}
+
+	if (offset + size > len) {
+		return false;
+	}
+
+	const uint8_t *data = record + offset;
+	offset += size;
+	if (arg.m_tag == eLogArgInt32) {
+		int32_t value;
+		memcpy(&value, data, sizeof(value));
+		arg.m_int = value;
+	} else if (arg.m_tag == eLogArgInt64) {
+		memcpy(&arg.m_int, data, sizeof(arg.m_int));
+	} else if (arg.m_tag == eLogArgDouble) {
+		memcpy(&arg.m_double, data, sizeof(arg.m_double));
+	} else if (arg.m_tag == eLogArgPointer) {
+		arg.m_int = getPointer(data, pointerSize);
+	} else {
+		arg.m_string = (const char *)data;
+		arg.m_stringLen = size;
+	}
+	return true;
+}
+
+bool logRecordHeader(const uint8_t *record, const size_t &len, const size_t &pointerSize, LogRecordHeader &header)
+{
+	size_t headerLen = sizeof(uint64_t) + pointerSize + 3;
+	if ((pointerSize != 4 && pointerSize != 8) || len < headerLen) {
+		return false;
+	}
+
+	memcpy(&header.m_timeMs, record, sizeof(header.m_timeMs));
+	header.m_format = getPointer(record + sizeof(uint64_t), pointerSize);
+	header.m_module = record[sizeof(uint64_t) + pointerSize];
+	header.m_level = record[sizeof(uint64_t) + pointerSize + 1];
+	header.m_args = record[sizeof(uint64_t) + pointerSize + 2];
+	header.m_argsOffset = headerLen;
+	return true;
+}
+
+// appends to out, keeps it terminated
+static void append(char *out, const size_t &outLen, size_t &pos, const char *data, const size_t &len)
+{
+	if (pos + 1 >= outLen) {
+		return;
+	}
+	size_t n = (pos + len < outLen - 1) ? len : outLen - 1 - pos;
+	memcpy(out + pos, data, n);
+	pos += n;
+	out[pos] = 0;
+}
+
+// one conversion with the spec (flags, width, precision, no length modifier) and the argument
+static void convert(char *out, const size_t &outLen, size_t &pos, const char *spec, const size_t &specLen, const char &conversion, const Arg &arg)
+{
+	char format[32];
+	char text[LOG_RECORD_MAX + 64];
+	int n = 0;
+
+	// the argument type decides, the conversion only picks the representation
+	char conv = conversion;
+	if (arg.m_tag == eLogArgString) {
+		conv = 's';
+	} else if (arg.m_tag == eLogArgDouble && !strchr("eEfFgGaA", conv)) {
+		conv = 'f';
+	} else if ((arg.m_tag == eLogArgInt32 || arg.m_tag == eLogArgInt64) && !strchr("diouxXceEfFgGaA", conv)) {
+		conv = 'd';
+	}
+
+	if (specLen + 4 > sizeof(format)) {
+		return;
+	}
+	memcpy(format, spec, specLen);
+
+	if (conv == 's') {
+		char string[LOG_RECORD_STRING_MAX + 1];
+		memcpy(string, arg.m_string, arg.m_stringLen);
+		string[arg.m_stringLen] = 0;
+		format[specLen] = 's';
+		format[specLen + 1] = 0;
+		n = snprintf(text, sizeof(text), format, string);
+	} else if (arg.m_tag == eLogArgPointer) {
+		n = snprintf(text, sizeof(text), "0x%llx", (unsigned long long)arg.m_int);
+	} else if (strchr("eEfFgGaA", conv)) {
+		format[specLen] = conv;
+		format[specLen + 1] = 0;
+		n = snprintf(text, sizeof(text), format, (arg.m_tag == eLogArgDouble) ? arg.m_double : (double)arg.m_int);
+	} else if (conv == 'c') {
+		format[specLen] = 'c';
+		format[specLen + 1] = 0;
+		n = snprintf(text, sizeof(text), format, (int)arg.m_int);
+	} else {
+		// integers go through long long, 32 bit values keep their width for %x and %u
+		long long value = arg.m_int;
+		if (arg.m_tag == eLogArgInt32 && strchr("ouxX", conv)) {
+			value = (uint32_t)arg.m_int;
+		}
+		format[specLen] = 'l';
+		format[specLen + 1] = 'l';
+		format[specLen + 2] = conv;
+		format[specLen + 3] = 0;
+		n = snprintf(text, sizeof(text), format, value);
+	}
+
+	if (n > 0) {
+		append(out, outLen, pos, text, ((size_t)n < sizeof(text)) ? n : sizeof(text) - 1);
+	}
+}
+
+size_t logRecordFormat(const uint8_t *record, const size_t &len, const size_t &pointerSize, const char *format, char *out, const size_t &outLen)
+{
+	LogRecordHeader header;
+	if (!outLen) {
+		return 0;
+	}
+	out[0] = 0;
+	if (!logRecordHeader(record, len, pointerSize, header) || !format) {
+		return 0;
+	}
+
+	size_t pos = 0;
+	size_t offset = header.m_argsOffset;
+	const char *p = format;
+	while (*p) {
+		const char *percent = strchr(p, '%');
+		if (!percent) {
+			append(out, outLen, pos, p, strlen(p));
+			break;
+		}
+		append(out, outLen, pos, p, percent - p);
+
+		if (percent[1] == '%') {
+			append(out, outLen, pos, "%", 1);
+			p = percent + 2;
+			continue;
+		}
+
+		// %[flags][width][.precision][length]conversion, '*' widths take an argument
+		char spec[32];
+		size_t specLen = 0;
+		const char *q = percent;
+		spec[specLen++] = *q++;
+		while (*q && strchr("-+ #0123456789.*", *q) && specLen < sizeof(spec) - 8) {
+			if (*q == '*') {
+				Arg width;
+				int value = 0;
+				if (nextArg(record, len, pointerSize, offset, width) && width.m_tag == eLogArgInt32) {
+					value = (int)width.m_int;
+				}
+				specLen += snprintf(spec + specLen, sizeof(spec) - specLen, "%d", value);
+			} else {
+				spec[specLen++] = *q;
+			}
+			q++;
+		}
+		while (*q && strchr("hlLqjzt", *q)) {
+			q++;
+		}
+		if (!*q) {
+			break;
+		}
+
+		char conversion = *q++;
+		p = q;
+		if (conversion == 'n') {
+			continue;
+		}
+
+		Arg arg;
+		if (!nextArg(record, len, pointerSize, offset, arg)) {
+			append(out, outLen, pos, "?", 1);
+			continue;
+		}
+		convert(out, outLen, pos, spec, specLen, conversion, arg);
+	}
+
+	return pos;
+}
+
+const char *logModuleName(const uint8_t &module)
+{
+	return (module < eLogModuleCount) ? g_moduleNames[module] : "unknown";
+}
+
+const char *logLevelName(const uint8_t &level)
+{
+	return (level < eLogLevelCount) ? g_levelNames[level] : "unknown";
+}
+
+bool logModuleFromName(const char *name, LogModule &module)
+{
+	for (int i = 0; i < eLogModuleCount; i++) {
+		if (!strcmp(name, g_moduleNames[i])) {
+			module = (LogModule)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool logLevelFromName(const char *name, LogLevel &level)
+{
+	for (int i = 0; i < eLogLevelCount; i++) {
+		if (!strcmp(name, g_levelNames[i])) {
+			level = (LogLevel)i;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+
+//
+// binary log records
+//
+// A log call stores the format string pointer, its arguments and the time
+// instead of the formatted text. Formatting happens later, in the drain
+// task, and only while a sink is attached. The host decoder does it
+// offline, reading the format strings from the firmware ELF.
+//
+// Record layout (native byte order):
+//   uint64_t  time in milliseconds (compensatedMillis())
+//   pointer   format string, sizeof(void *) bytes (given by the dump header)
+//   uint8_t   module
+//   uint8_t   level
+//   uint8_t   argument count
+//   arguments: a LogArg tag byte followed by the value
+//
+// Arguments that do not fit into the record are left out and the count is
+// adjusted, the formatter prints them as "?". Strings are copied (up to
+// LOG_RECORD_STRING_MAX bytes), the format string itself must be a literal.
+//
+// The encoder is templated on the argument types, so the call site only
+// copies the values. Types printf could not print do not compile.
+//
+
+#define LOG_RECORD_MAX			256
+#define LOG_RECORD_STRING_MAX	200
+
+// dump: "VLOG", version, pointer size, 2 reserved bytes, then records each preceded by a uint16_t length
+#define LOG_DUMP_MAGIC			"VLOG"
+#define LOG_DUMP_VERSION		1
+#define LOG_DUMP_HEADER_LEN		8
+
+enum LogLevel {
+	eLogOff,
+	eLogError,
+	eLogWarning,
+	eLogInfo,
+	eLogDebug,
+	eLogLevelCount
+};
+
+enum LogModule {
+	eLogModuleMain,
+	eLogModuleWifi,
+	eLogModuleNtp,
+	eLogModuleSensor,
+	eLogModuleServer,
+	eLogModuleOta,
+	eLogModuleMqtt,
+	eLogModuleInflux,
+	eLogModuleCoap,
+	eLogModuleFleet,
+	eLogModuleModbus,
+	eLogModuleTls,
+	eLogModuleDisplay,
+	eLogModulePower,
+	eLogModuleCount
+};
+
+enum LogArg {
+	eLogArgInt32 = 1,
+	eLogArgInt64,
+	eLogArgDouble,
+	eLogArgString,			// uint8_t length, the bytes, no terminator
+	eLogArgPointer,			// pointer size
+};
+
+class LogRecordEncoder {
+public:
+	LogRecordEncoder(uint8_t *buffer, const size_t &size)
+		: m_buffer(buffer)
+		, m_size(size)
+		, m_len(0)
+		, m_args(0)
+		, m_full(false)
+	{
+	}
+
+	void header(const uint64_t &timeMs, const uint8_t &module, const uint8_t &level, const char *format)
+	{
+		const void *pointer = format;
+		put(&timeMs, sizeof(timeMs));
+		put(&pointer, sizeof(pointer));
+		put(&module, 1);
+		put(&level, 1);
+		m_countOffset = m_len;
+		put(&m_args, 1);
+	}
+
+	void args()
+	{
+	}
+
+	template <typename T, typename... Rest>
+	void args(const T &first, const Rest &... rest)
+	{
+		arg(first);
+		args(rest...);
+	}
+
+	size_t finish()
+	{
+		m_buffer[m_countOffset] = m_args;
+		return m_len;
+	}
+
+private:
+	void put(const void *data, const size_t &len)
+	{
+		memcpy(m_buffer + m_len, data, len);
+		m_len += len;
+	}
+
+	// tag and value, or nothing once an argument did not fit
+	void tagged(const uint8_t &tag, const void *data, const size_t &len)
+	{
+		if (m_full || m_len + 1 + len > m_size) {
+			m_full = true;
+			return;
+		}
+		put(&tag, 1);
+		put(data, len);
+		m_args++;
+	}
+
+	template <typename T>
+	typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type arg(const T &value)
+	{
+		// what the default argument promotions would pass
+		if (sizeof(T) > 4) {
+			int64_t wide = (int64_t)value;
+			tagged(eLogArgInt64, &wide, sizeof(wide));
+		} else {
+			int32_t narrow = (int32_t)value;
+			tagged(eLogArgInt32, &narrow, sizeof(narrow));
+		}
+	}
+
+	void arg(const double &value)
+	{
+		tagged(eLogArgDouble, &value, sizeof(value));
+	}
+
+	void arg(const float &value)
+	{
+		arg((double)value);
+	}
+
+	void arg(const char *value)
+	{
+		size_t len = value ? strnlen(value, LOG_RECORD_STRING_MAX) : 0;
+		if (m_full || m_len + 2 + len > m_size) {
+			m_full = true;
+			return;
+		}
+		uint8_t tag = eLogArgString;
+		uint8_t len8 = len;
+		put(&tag, 1);
+		put(&len8, 1);
+		put(value, len);
+		m_args++;
+	}
+
+	void arg(char *value)
+	{
+		arg((const char *)value);
+	}
+
+	template <typename T>
+	void arg(T *value)
+	{
+		const void *pointer = value;
+		tagged(eLogArgPointer, &pointer, sizeof(pointer));
+	}
+
+	uint8_t *m_buffer;
+	size_t m_size;
+	size_t m_len;
+	size_t m_countOffset;
+	uint8_t m_args;
+	bool m_full;
+};
+
+// encodes a record into buffer (at least LOG_RECORD_MAX bytes), returns its length
+template <typename... Args>
+size_t logRecordEncode(uint8_t *buffer, const uint64_t &timeMs, const uint8_t &module, const uint8_t &level, const char *format, const Args &... args)
+{
+	LogRecordEncoder encoder(buffer, LOG_RECORD_MAX);
+	encoder.header(timeMs, module, level, format);
+	encoder.args(args...);
+	return encoder.finish();
+}
+
+struct LogRecordHeader {
+	uint64_t m_timeMs;
+	uint64_t m_format;			// address on the device that wrote the record
+	uint8_t m_module;
+	uint8_t m_level;
+	uint8_t m_args;
+	size_t m_argsOffset;
+};
+
+// parses the fixed part of a record written on a device with the given pointer size
+bool logRecordHeader(const uint8_t *record, const size_t &len, const size_t &pointerSize, LogRecordHeader &header);
+
+// formats the message of a record with its (resolved) format string, returns the text length
+size_t logRecordFormat(const uint8_t *record, const size_t &len, const size_t &pointerSize, const char *format, char *out, const size_t &outLen);
+
+const char *logModuleName(const uint8_t &module);
+const char *logLevelName(const uint8_t &level);
+
+// module or level by name, false if unknown
+bool logModuleFromName(const char *name, LogModule &module);
+bool logLevelFromName(const char *name, LogLevel &level);
@@ -0,0 +1,335 @@
+#include "logRing.h"
+#include <string.h>
+
+// header word: payload length, padding flag, committed flag
+#define LOG_RING_LEN_MASK		0x0000ffff
+#define LOG_RING_PAD			0x40000000
+#define LOG_RING_COMMITTED		0x80000000
+
+LogRing::LogRing(const size_t &size)
+	: m_size(size)
+	, m_mask(size - 1)
+	, m_words(size / 4, 0)
+	, m_head(0)
+	, m_tail(0)
+	, m_peeked(0)
+	, m_written(0)
+	, m_dropped(0)
+	, m_droppedBytes(0)
+	, m_highWater(0)
+{
+}
+
+bool LogRing::write(const char *data, const size_t &len)
+{
+	uint32_t need = 4 + ((len + 3) & ~3);
+	if (len > LOG_RING_LEN_MASK || need > m_size / 4) {
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		m_droppedBytes.fetch_add(len, std::memory_order_relaxed);
+		return false;
+	}
+
+	// reserve the record (and the padding up to the end of the buffer if it does not fit)
+	uint32_t head = m_head.load(std::memory_order_relaxed);
+	uint32_t pad;
+	uint32_t used;
+	do {
+		uint32_t offset = head & m_mask;
+		pad = (offset + need > m_size) ? m_size - offset : 0;
+
+		// acquire: the consumer zeroed the released records before moving the tail
+		used = head + pad + need - m_tail.load(std::memory_order_acquire);
+		if (used > m_size) {
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			m_droppedBytes.fetch_add(len, std::memory_order_relaxed);
+			return false;
+		}
+	} while (!m_head.compare_exchange_weak(head, head + pad + need, std::memory_order_relaxed));
+
+	uint32_t highWater = m_highWater.load(std::memory_order_relaxed);
+	while (used > highWater && !m_highWater.compare_exchange_weak(highWater, used, std::memory_order_relaxed)) {
+	}
+
+	if (pad) {
+		__atomic_store_n(header(head), (pad - 4) | LOG_RING_PAD | LOG_RING_COMMITTED, __ATOMIC_RELEASE);
+		head += pad;
+	}
+
+	uint32_t *word = header(head);
+	memcpy(word + 1, data, len);
+	__atomic_store_n(word, (uint32_t)len | LOG_RING_COMMITTED, __ATOMIC_RELEASE);
+
+	m_written.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+const char *LogRing::peek(size_t &len)
+{
+	uint32_t tail = m_tail.load(std::memory_order_relaxed);
+	while (1) {
+		uint32_t value = __atomic_load_n(header(tail), __ATOMIC_ACQUIRE);
+		if (!(value & LOG_RING_COMMITTED)) {
+			return NULL;
+		}
+
+		uint32_t size = 4 + (((value & LOG_RING_LEN_MASK) + 3) & ~3);
+		if (value & LOG_RING_PAD) {
+			memset(header(tail), 0, size);
+			tail += size;
+			m_tail.store(tail, std::memory_order_release);
+			continue;
+		}
+
+		m_peeked = size;
+		len = value & LOG_RING_LEN_MASK;
+		return (const char *)(header(tail) + 1);
+	}
+}
+
+void LogRing::release()
+{
+	if (!m_peeked) {
+		return;
+	}
+
+	uint32_t tail = m_tail.load(std::memory_order_relaxed);
+	memset(header(tail), 0, m_peeked);
+	m_tail.store(tail + m_peeked, std::memory_order_release);
+	m_peeked = 0;
+}
+
+void LogRing::stats(Stats &stats) const
+{
+	stats.m_written = m_written.load(std::memory_order_relaxed);
+	stats.m_dropped = m_dropped.load(std::memory_order_relaxed);
+	stats.m_droppedBytes = m_droppedBytes.load(std::memory_order_relaxed);
+	stats.m_highWater = m_highWater.load(std::memory_order_relaxed);
+}
+
+#if defined(ARDUINO)
+
+#include <Arduino.h>
+#include "config.h"
+#include "utils.h"
+#include "metrics.h"
+#include "SerialAndTelnetInit.h"
+
+// formatted message, longer ones are cut
+#define LOG_TEXT_MAX 512
+
+static LogRing g_ring(LOG_RING_SIZE);
+static TaskHandle_t g_drainTask = NULL;
+static uint32_t g_reportedDropped = 0;
+
+// recent records, each preceded by its uint16_t length, oldest overwritten first
+static SemaphoreHandle_t g_historyMutex = NULL;
+static uint8_t g_history[LOG_HISTORY_SIZE];
+static size_t g_historyStart = 0;
+static size_t g_historyLen = 0;
+
+//
+// history, the helpers below expect the history mutex to be held
+//
+
+static void historyCopyIn(const size_t &position, const void *data, const size_t &len)
+{
+	for (size_t i = 0; i < len; i++) {
+		g_history[(position + i) % LOG_HISTORY_SIZE] = ((const uint8_t *)data)[i];
+	}
+}
+
+static void historyCopyOut(const size_t &position, void *data, const size_t &len)
+{
+	for (size_t i = 0; i < len; i++) {
+		((uint8_t *)data)[i] = g_history[(position + i) % LOG_HISTORY_SIZE];
+	}
+}
+
+static void historyAppend(const uint8_t *record, const size_t &len)
+{
+	uint16_t len16 = len;
+	if (!g_historyMutex || sizeof(len16) + len > LOG_HISTORY_SIZE) {
+		return;
+	}
+
+	if (xSemaphoreTake(g_historyMutex, portMAX_DELAY) == pdTRUE) {
+		while (g_historyLen + sizeof(len16) + len > LOG_HISTORY_SIZE) {
+			uint16_t oldest;
+			historyCopyOut(g_historyStart, &oldest, sizeof(oldest));
+			g_historyStart = (g_historyStart + sizeof(oldest) + oldest) % LOG_HISTORY_SIZE;
+			g_historyLen -= sizeof(oldest) + oldest;
+		}
+
+		size_t end = g_historyStart + g_historyLen;
+		historyCopyIn(end, &len16, sizeof(len16));
+		historyCopyIn(end + sizeof(len16), record, len);
+		g_historyLen += sizeof(len16) + len;
+		xSemaphoreGive(g_historyMutex);
+	}
+}
+
+// calls output for every record in the history, oldest first
+template <typename Output>
+static void historyForEach(const Output &output)
+{
+	if (!g_historyMutex || xSemaphoreTake(g_historyMutex, portMAX_DELAY) != pdTRUE) {
+		return;
+	}
+
+	size_t offset = 0;
+	while (offset < g_historyLen) {
+		uint16_t len;
+		uint8_t record[LOG_RECORD_MAX];
+		historyCopyOut(g_historyStart + offset, &len, sizeof(len));
+		historyCopyOut(g_historyStart + offset + sizeof(len), record, len);
+		offset += sizeof(len) + len;
+		output(record, len);
+	}
+
+	xSemaphoreGive(g_historyMutex);
+}
+
+//
+// formatting
+//
+
+// "time: message" of a record written by this firmware, false if it is malformed
+static bool formatRecord(const uint8_t *record, const size_t &len, char *timeBuf, const size_t &timeLen, char *text, size_t &textLen)
+{
+	LogRecordHeader header;
+	if (!logRecordHeader(record, len, sizeof(void *), header)) {
+		return false;
+	}
+
+	epochToTimeStr(header.m_timeMs, timeBuf, timeLen);
+	textLen = logRecordFormat(record, len, sizeof(void *), (const char *)(uintptr_t)header.m_format, text, textLen);
+	return true;
+}
+
+// expects the SerialAndTelnet lock to be held
+static void drain()
+{
+	// formatting is the expensive part, it is skipped while nobody is listening
+	bool attached = LOG_SERIAL_SINK || SerialAndTelnet.isClientConnected();
+
+	size_t len;
+	const char *data;
+	while ((data = g_ring.peek(len)) != NULL) {
+		historyAppend((const uint8_t *)data, len);
+
+		char timeBuf[32];
+		char text[LOG_TEXT_MAX];
+		size_t textLen = sizeof(text);
+		if (attached && formatRecord((const uint8_t *)data, len, timeBuf, sizeof(timeBuf), text, textLen)) {
+			SERIAL.print(timeBuf);
+			SERIAL.print(": ");
+			SERIAL.write((const uint8_t *)text, textLen);
+		}
+		g_ring.release();
+	}
+
+	// reported where the consumer noticed it, close to where it happened
+	LogRing::Stats stats;
+	g_ring.stats(stats);
+	if (stats.m_dropped != g_reportedDropped) {
+		uint32_t dropped = stats.m_dropped - g_reportedDropped;
+		g_reportedDropped = stats.m_dropped;
+		if (attached) {
+			SERIAL.printf("*** %u log messages dropped, the log ring is full\n", dropped);
+		}
+		metricsIncrement(eMetricsLogDropped, dropped);
+	}
+	metricsSet(eMetricsLogRingHighWater, stats.m_highWater);
+}
+
+static void drainTask(void *pvParameters __attribute__((unused)))
+{
+	while (1) {
+		// woken by the producers, the timeout catches messages written before the task existed
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOG_DRAIN_INTERVAL_MS));
+		if (SerialAndTelnetInit::lock()) {
+			drain();
+			SerialAndTelnetInit::unlock();
+		}
+	}
+}
+
+//
+// API
+//
+
+void logRingInit()
+{
+	g_historyMutex = xSemaphoreCreateMutex();
+
+	xTaskCreate(
+		drainTask,
+		"logDrainTask",
+		4096, // Stack size (bytes)
+		NULL, // Parameter
+		1,	  // Task priority
+		&g_drainTask
+	);
+}
+
+bool logRingWrite(const char *data, const size_t &len)
+{
+	bool result = g_ring.write(data, len);
+	if (g_drainTask) {
+		xTaskNotifyGive(g_drainTask);
+	}
+	return result;
+}
+
+void logRingFlush()
+{
+	if (SerialAndTelnetInit::lock()) {
+		drain();
+		SERIAL.flush();
+		SerialAndTelnetInit::unlock();
+	}
+}
+
+void logHistoryText(Print &out)
+{
+	historyForEach([&](const uint8_t *record, const size_t &len) {
+		char timeBuf[32];
+		char text[LOG_TEXT_MAX];
+		size_t textLen = sizeof(text);
+		if (formatRecord(record, len, timeBuf, sizeof(timeBuf), text, textLen)) {
+			out.print(timeBuf);
+			out.print(": ");
+			out.write((const uint8_t *)text, textLen);
+		}
+	});
+}
+
+void logHistoryDump(Print &out)
+{
+	uint8_t header[LOG_DUMP_HEADER_LEN] = { 0 };
+	memcpy(header, LOG_DUMP_MAGIC, 4);
+	header[4] = LOG_DUMP_VERSION;
+	header[5] = sizeof(void *);
+	out.write(header, sizeof(header));
+
+	historyForEach([&](const uint8_t *record, const size_t &len) {
+		uint16_t len16 = len;
+		out.write((const uint8_t *)&len16, sizeof(len16));
+		out.write(record, len);
+	});
+}
+
+void logLevelsJson(JsonDocument &doc)
+{
+	doc["serialSink"] = LOG_SERIAL_SINK;
+	doc["telnetClient"] = SerialAndTelnet.isClientConnected();
+
+	JsonObject modules = doc.createNestedObject("modules");
+	for (int i = 0; i < eLogModuleCount; i++) {
+		JsonObject obj = modules.createNestedObject(logModuleName(i));
+		obj["compiled"] = logLevelName(g_logCompiledLevels[i]);
+		obj["runtime"] = logLevelName(g_logLevels[i]);
+	}
+}
+
+#endif
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+//
+// multi-producer, single-consumer byte ring for log messages
+//
+// A producer reserves space by advancing m_head with a compare-and-swap,
+// copies its message and then commits the record by publishing its
+// header word. It never waits: when the ring is full the message is
+// dropped and counted. A record that would not fit before the end of the
+// buffer is preceded by a padding record, so every message is contiguous
+// and can be handed to the sinks without copying.
+//
+// The consumer (the drain task) takes committed records in order from
+// m_tail and zeroes them on release, so an uncommitted header always
+// reads as zero. A producer preempted between reservation and commit
+// holds back the records behind it, never the other producers.
+//
+// The class has no platform dependencies, so tools/log_bench runs the
+// same code on the host.
+//
+
+class LogRing {
+public:
+	struct Stats {
+		uint32_t m_written;			// messages committed
+		uint32_t m_dropped;			// messages that did not fit
+		uint32_t m_droppedBytes;
+		uint32_t m_highWater;		// most bytes ever in use
+	};
+
+	// size is a power of two, messages are limited to a quarter of it
+	explicit LogRing(const size_t &size);
+
+	// producers: copies the message, false if it was dropped
+	bool write(const char *data, const size_t &len);
+
+	// consumer: next committed message, NULL if there is none
+	const char *peek(size_t &len);
+
+	// consumer: frees the message returned by peek()
+	void release();
+
+	void stats(Stats &stats) const;
+
+	size_t size() const { return m_size; }
+
+private:
+	uint32_t *header(const uint32_t &position) { return &m_words[(position & m_mask) / 4]; }
+
+	size_t m_size;
+	uint32_t m_mask;
+	std::vector<uint32_t> m_words;
+
+	std::atomic<uint32_t> m_head;		// next reservation, bytes
+	std::atomic<uint32_t> m_tail;		// oldest unreleased record, bytes
+	uint32_t m_peeked;					// size of the record returned by peek()
+
+	std::atomic<uint32_t> m_written;
+	std::atomic<uint32_t> m_dropped;
+	std::atomic<uint32_t> m_droppedBytes;
+	std::atomic<uint32_t> m_highWater;
+};
+
+#if defined(ARDUINO)
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// starts the drain task formatting the records (see logRecord.h) to Serial/Telnet
+void logRingInit();
+
+// non-blocking, callable from any task (not from an ISR)
+bool logRingWrite(const char *data, const size_t &len);
+
+// drains the ring in the calling task, before a restart
+void logRingFlush();
+
+// the last LOG_HISTORY_SIZE bytes of records as text, and as a dump for tools/log_decode
+void logHistoryText(Print &out);
+void logHistoryDump(Print &out);
+
+// compiled and runtime level of every module
+void logLevelsJson(JsonDocument &doc);
+
+#endif
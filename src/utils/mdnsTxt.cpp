@@ -0,0 +1,98 @@
+#include "mdnsTxt.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MDNS_TXT_VERSION	"1"
+
+static size_t add(MdnsTxtRecord *records, const size_t &maxRecords, size_t count, const char *key, const char *fmt, ...)
+{
+	if (count >= maxRecords || strlen(key) >= sizeof(records[count].m_key)) {
+		return count;
+	}
+
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(records[count].m_value, sizeof(records[count].m_value), fmt, args);
+	va_end(args);
+
+	// a cut off number reads as a different value
+	if (len < 0 || (size_t)len >= sizeof(records[count].m_value)) {
+		return count;
+	}
+
+	strcpy(records[count].m_key, key);
+	return count + 1;
+}
+
+size_t mdnsTxtEncode(const SensorSample &sample, const MdnsTxtSensors &sensors, MdnsTxtRecord *records, const size_t &maxRecords)
+{
+	size_t count = 0;
+	count = add(records, maxRecords, count, "v", "%s", MDNS_TXT_VERSION);
+	count = add(records, maxRecords, count, "seq", "%u", sample.m_sequence);
+	count = add(records, maxRecords, count, "ts", "%llu", (unsigned long long)(sample.m_timestampMs / 1000));
+	count = add(records, maxRecords, count, "pm2_5", "%u", sample.m_pm2_5);
+	if (sensors == eMdnsTxtCo2) {
+		count = add(records, maxRecords, count, "co2", "%u", sample.m_co2);
+		count = add(records, maxRecords, count, "temp", "%.1f", sample.m_temperature);
+		count = add(records, maxRecords, count, "hum", "%.1f", sample.m_humidity);
+	} else if (sensors == eMdnsTxtEnv) {
+		count = add(records, maxRecords, count, "temp", "%.1f", sample.m_temperature);
+		count = add(records, maxRecords, count, "hum", "%.1f", sample.m_humidity);
+		count = add(records, maxRecords, count, "pres", "%.2f", sample.m_pressure);
+	}
+	return count;
+}
+
+#if defined(ARDUINO)
+
+#include <Arduino.h>
+#include <mdns.h>
+
+#include "config.h"
+#include "utils.h"
+
+#if (USE_CO2_SENSOR == 1)
+#define MDNS_TXT_SENSORS	eMdnsTxtCo2
+#elif (USE_ENV_SENSOR == 1)
+#define MDNS_TXT_SENSORS	eMdnsTxtEnv
+#else
+#define MDNS_TXT_SENSORS	eMdnsTxtPm2_5Only
+#endif
+
+static uint32_t g_lastUpdateMs = 0;
+static bool g_updated = false;
+
+void mdnsTxtInit()
+{
+#if (MDNS_TXT_ENABLED == 1)
+	sensorSubscribe(mdnsTxtUpdate);
+#endif
+}
+
+void mdnsTxtUpdate(const SensorSample &sample)
+{
+	// every change makes the responder announce the service again,
+	// so don't flood the network
+	if (g_updated && (millis() - g_lastUpdateMs) < MDNS_TXT_MIN_INTERVAL_MS) {
+		return;
+	}
+
+	MdnsTxtRecord records[MDNS_TXT_MAX_RECORDS];
+	size_t count = mdnsTxtEncode(sample, MDNS_TXT_SENSORS, records, MDNS_TXT_MAX_RECORDS);
+
+	mdns_txt_item_t items[MDNS_TXT_MAX_RECORDS];
+	for (size_t i = 0; i < count; i++) {
+		items[i].key = records[i].m_key;
+		items[i].value = records[i].m_value;
+	}
+
+	// all records at once, so there is a single announcement
+	// (fails until the server task has registered the service)
+	if (mdns_service_txt_set("_http", "_tcp", items, count) == ESP_OK) {
+		g_lastUpdateMs = millis();
+		g_updated = true;
+	}
+}
+
+#endif
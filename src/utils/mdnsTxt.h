@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../tasks/sensorTask.h"
+
+//
+// latest reading advertised as TXT records of the _http._tcp service, so
+// scanners get the values from a single mDNS browse
+//
+// The encoder has no platform dependencies, tools/mdns_txt_check runs it
+// on the host against the TXT limits (RFC 6763: keys of at most 9
+// characters, key=value strings of at most 255 bytes, the whole record
+// set small enough for one packet).
+//
+
+#define MDNS_TXT_MAX_RECORDS	8
+
+struct MdnsTxtRecord {
+	char m_key[10];
+	char m_value[24];
+};
+
+// channels besides pm2_5, matching USE_CO2_SENSOR / USE_ENV_SENSOR
+enum MdnsTxtSensors {
+	eMdnsTxtPm2_5Only = 0,
+	eMdnsTxtCo2,
+	eMdnsTxtEnv,
+};
+
+// Fills TXT records for the sample, returns number of records. Values
+// that do not fit m_value are left out rather than advertised truncated,
+// records beyond maxRecords are dropped.
+size_t mdnsTxtEncode(const SensorSample &sample, const MdnsTxtSensors &sensors, MdnsTxtRecord *records, const size_t &maxRecords);
+
+#if defined(ARDUINO)
+
+void mdnsTxtInit();
+void mdnsTxtUpdate(const SensorSample &sample);
+
+#endif
@@ -0,0 +1,293 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <stdarg.h>
+
+#include "metrics.h"
+#include "config.h"
+#include "utils.h"
+#include "watchdog.h"
+#include "../tasks/sensorTask.h"
+
+#define METRICS_PREFIX "vindriktning_"
+
+static SemaphoreHandle_t g_mutex = NULL;
+static uint32_t g_counters[eMetricsCounterCount] = {};
+static MetricsSnapshot::Histogram g_histograms[eMetricsHistogramCount] = {};
+static float g_gauges[eMetricsGaugeCount] = {};
+
+//
+// histogram bucket upper bounds in microseconds
+//
+
+static const uint32_t g_bucketBoundsUs[METRICS_HISTOGRAM_BUCKETS] = {
+	1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000
+};
+
+static const char *g_bucketLabels[METRICS_HISTOGRAM_BUCKETS] = {
+	"0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25", "0.5", "1"
+};
+
+static const struct {
+	const char *m_name;
+	const char *m_help;
+} g_counterInfo[eMetricsCounterCount] = {
+	{ "http_requests_total", "Number of HTTP requests handled" },
+	{ "sensor_failures_total", "Number of failed sensor reads" },
+	{ "wifi_reconnects_total", "Number of WiFi reconnection attempts" },
+	{ "server_task_wakeups_total", "Number of server task wakeups" },
+	{ "wifi_task_wakeups_total", "Number of WiFi task wakeups" },
+	{ "http_rejected_busy_total", "HTTP requests rejected by the in-flight limits" },
+	{ "http_rejected_rate_total", "HTTP requests rejected by the rate limiter" },
+	{ "http_rejected_low_heap_total", "HTTP requests rejected in low heap mode" },
+	{ "mqtt_published_total", "Samples published over MQTT" },
+	{ "mqtt_dropped_total", "Samples dropped because the MQTT queue was full" },
+	{ "influx_requests_total", "InfluxDB write requests" },
+	{ "influx_request_failures_total", "Failed InfluxDB write requests" },
+	{ "influx_samples_sent_total", "Samples written to InfluxDB" },
+	{ "influx_bytes_sent_total", "Request body bytes written to InfluxDB (after compression)" },
+	{ "influx_dropped_total", "Samples dropped before reaching InfluxDB" },
+	{ "coap_requests_total", "Number of CoAP requests handled" },
+	{ "coap_notifications_total", "Number of CoAP Observe notifications sent" },
+	{ "coap_retransmits_total", "Number of confirmable CoAP notifications sent again" },
+	{ "beacons_sent_total", "Number of multicast telemetry beacons sent" },
+	{ "fleet_fetches_total", "Successful peer snapshot fetches" },
+	{ "fleet_fetch_failures_total", "Failed peer snapshot fetches" },
+	{ "modbus_requests_total", "Modbus TCP requests handled" },
+	{ "modbus_exceptions_total", "Modbus TCP requests answered with an exception" },
+	{ "tls_handshake_failures_total", "Failed TLS handshakes" },
+	{ "wifi_disconnects_total", "Lost WiFi connections" },
+	{ "wifi_roams_total", "Roams to a stronger access point" },
+	{ "wifi_roam_scans_total", "Single channel roaming scans" },
+	{ "wifi_roam_failures_total", "Roams that failed to connect to the new access point" },
+	{ "log_dropped_total", "Log messages dropped because the log ring was full" },
+};
+
+static const struct {
+	const char *m_name;
+	const char *m_help;
+} g_gaugeInfo[eMetricsGaugeCount] = {
+	{ "mqtt_queue_depth", "Samples waiting for MQTT publishing in RAM" },
+	{ "mqtt_spool_depth", "Samples waiting for MQTT publishing in flash" },
+	{ "influx_spill_depth", "Samples waiting for InfluxDB write" },
+	{ "coap_observers", "Registered CoAP observers" },
+	{ "fleet_peers", "Peers known to the fleet aggregator" },
+	{ "modbus_clients", "Connected Modbus TCP clients" },
+	{ "wifi_boot_connect_seconds", "Time from boot to the first IP address" },
+	{ "wifi_boot_fast_path", "Boot connect path: 0 scan and DHCP, 1 RTC parameters, 2 RTC parameters and lease" },
+	{ "wifi_boot_saved_seconds", "Boot connect time saved compared to the last boot without RTC data" },
+	{ "wifi_last_disconnect_reason", "Driver reason code of the last lost WiFi connection" },
+	{ "wifi_last_outage_seconds", "Time from the last lost WiFi connection until reconnected" },
+	{ "wifi_power_profile", "Power save profile in effect: 0 latency, 1 balanced, 2 power" },
+	{ "ntp_offset_seconds", "Last correction applied to the wall clock" },
+	{ "ntp_uncertainty_seconds", "Estimated error bound of the wall clock after the last correction" },
+	{ "ntp_drift_ppm", "Estimated drift of the crystal, positive if it runs fast" },
+	{ "ntp_poll_interval_seconds", "Current NTP poll interval" },
+	{ "log_ring_high_water_bytes", "Most bytes ever waiting in the log ring" },
+};
+
+static const struct {
+	const char *m_name;
+	const char *m_help;
+} g_histogramInfo[eMetricsHistogramCount] = {
+	{ "http_request_duration_seconds", "HTTP handler latency" },
+	{ "sensor_read_duration_seconds", "Time spent reading the sensors" },
+	{ "mqtt_publish_duration_seconds", "MQTT publish latency (until acknowledged for QoS > 0)" },
+	{ "influx_write_duration_seconds", "InfluxDB write request latency" },
+	{ "coap_request_duration_seconds", "CoAP request handling time" },
+	{ "fleet_sweep_duration_seconds", "Time to fetch all peer snapshots" },
+	{ "tls_handshake_full_duration_seconds", "Full TLS handshake time" },
+	{ "tls_handshake_resumed_duration_seconds", "Resumed TLS handshake time (session ticket or cached session ID)" },
+};
+
+//
+// writer
+//
+
+void MetricsWriter::write(const char *str, size_t len)
+{
+	size_t end = m_pos + len;
+
+	// copy the part of the string that falls into our window
+	if (end > m_skip && m_written < m_maxLen) {
+		size_t from = (m_pos < m_skip) ? m_skip - m_pos : 0;
+		size_t toCopy = len - from;
+		if (toCopy > m_maxLen - m_written) {
+			toCopy = m_maxLen - m_written;
+		}
+		memcpy(m_buffer + m_written, str + from, toCopy);
+		m_written += toCopy;
+	}
+
+	m_pos = end;
+}
+
+void MetricsWriter::print(const char *str)
+{
+	write(str, strlen(str));
+}
+
+void MetricsWriter::printf(const char *fmt, ...)
+{
+	char buf[128];
+	va_list ap;
+	va_start(ap, fmt);
+	int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (len > 0) {
+		write(buf, (len < (int)sizeof(buf)) ? len : sizeof(buf) - 1);
+	}
+}
+
+//
+// registry
+//
+
+void metricsInit()
+{
+	if (!g_mutex) {
+		g_mutex = xSemaphoreCreateMutex();
+	}
+}
+
+void metricsIncrement(const MetricsCounter &counter, uint32_t value)
+{
+	if (g_mutex && xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
+		g_counters[counter] += value;
+		xSemaphoreGive(g_mutex);
+	}
+}
+
+void metricsObserve(const MetricsHistogram &histogram, uint32_t valueUs)
+{
+	int bucket = 0;
+	while (bucket < METRICS_HISTOGRAM_BUCKETS && valueUs > g_bucketBoundsUs[bucket]) {
+		bucket++;
+	}
+
+	if (g_mutex && xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
+		MetricsSnapshot::Histogram &h = g_histograms[histogram];
+		h.m_buckets[bucket]++;
+		h.m_count++;
+		h.m_sumUs += valueUs;
+		xSemaphoreGive(g_mutex);
+	}
+}
+
+void metricsSet(const MetricsGauge &gauge, const float &value)
+{
+	if (g_mutex && xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
+		g_gauges[gauge] = value;
+		xSemaphoreGive(g_mutex);
+	}
+}
+
+void metricsSnapshot(MetricsSnapshot &snapshot)
+{
+	memset((void *)&snapshot, 0, sizeof(snapshot));
+
+#if (USE_CO2_SENSOR == 1)
+	snapshot.m_sensorValid = lastSensorData(snapshot.m_pm2_5, snapshot.m_temperature, snapshot.m_humidity, snapshot.m_co2);
+#elif (USE_ENV_SENSOR == 1)
+	snapshot.m_sensorValid = lastSensorData(snapshot.m_pm2_5, snapshot.m_temperature, snapshot.m_humidity, snapshot.m_pressure);
+#else
+	snapshot.m_sensorValid = lastSensorData(snapshot.m_pm2_5);
+#endif
+
+	snapshot.m_rssi = WiFi.RSSI();
+	snapshot.m_freeHeap = ESP.getFreeHeap();
+	snapshot.m_minFreeHeap = ESP.getMinFreeHeap();
+	snapshot.m_uptimeMs = esp_timer_get_time() / 1000;
+	snapshot.m_watchdogTimeToResetMs = watchdogTimeToReset();
+
+	if (g_mutex && xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
+		memcpy(snapshot.m_counters, g_counters, sizeof(g_counters));
+		memcpy(snapshot.m_histograms, g_histograms, sizeof(g_histograms));
+		memcpy(snapshot.m_gauges, g_gauges, sizeof(g_gauges));
+		xSemaphoreGive(g_mutex);
+	}
+}
+
+//
+// rendering
+//
+
+static void renderGauge(MetricsWriter &writer, const char *name, const char *help, double value)
+{
+	writer.printf("# HELP " METRICS_PREFIX "%s %s\n", name, help);
+	writer.printf("# TYPE " METRICS_PREFIX "%s gauge\n", name);
+	writer.printf(METRICS_PREFIX "%s %.3f\n", name, value);
+}
+
+void metricsRender(const MetricsSnapshot &snapshot, MetricsWriter &writer)
+{
+	//
+	// gauges
+	//
+
+	if (snapshot.m_sensorValid) {
+		renderGauge(writer, "pm2_5_ugm3", "PM2.5 concentration in ug/m3", snapshot.m_pm2_5);
+#if (USE_CO2_SENSOR == 1)
+		renderGauge(writer, "temperature_celsius", "Temperature", snapshot.m_temperature);
+		renderGauge(writer, "humidity_percent", "Relative humidity", snapshot.m_humidity);
+		renderGauge(writer, "co2_ppm", "CO2 concentration", snapshot.m_co2);
+#elif (USE_ENV_SENSOR == 1)
+		renderGauge(writer, "temperature_celsius", "Temperature", snapshot.m_temperature);
+		renderGauge(writer, "humidity_percent", "Relative humidity", snapshot.m_humidity);
+		renderGauge(writer, "pressure_kpa", "Atmospheric pressure", snapshot.m_pressure);
+#endif
+	}
+
+	renderGauge(writer, "wifi_rssi_dbm", "WiFi signal strength", snapshot.m_rssi);
+	renderGauge(writer, "heap_free_bytes", "Free heap", snapshot.m_freeHeap);
+	renderGauge(writer, "heap_min_free_bytes", "Lowest free heap since boot", snapshot.m_minFreeHeap);
+	renderGauge(writer, "uptime_seconds", "Time since boot", snapshot.m_uptimeMs / 1000.0);
+	renderGauge(writer, "watchdog_time_to_reset_seconds", "Time until the periodic reset", snapshot.m_watchdogTimeToResetMs / 1000.0);
+
+	for (int i = 0; i < eMetricsGaugeCount; i++) {
+		renderGauge(writer, g_gaugeInfo[i].m_name, g_gaugeInfo[i].m_help, snapshot.m_gauges[i]);
+	}
+
+	//
+	// counters
+	//
+
+	for (int i = 0; i < eMetricsCounterCount; i++) {
+		writer.printf("# HELP " METRICS_PREFIX "%s %s\n", g_counterInfo[i].m_name, g_counterInfo[i].m_help);
+		writer.printf("# TYPE " METRICS_PREFIX "%s counter\n", g_counterInfo[i].m_name);
+		writer.printf(METRICS_PREFIX "%s %u\n", g_counterInfo[i].m_name, snapshot.m_counters[i]);
+	}
+
+	//
+	// task wakeup rates (idle CPU indicator)
+	//
+
+	if (snapshot.m_uptimeMs) {
+		writer.print("# HELP " METRICS_PREFIX "task_wakeups_per_hour Average task wakeups per hour since boot\n");
+		writer.print("# TYPE " METRICS_PREFIX "task_wakeups_per_hour gauge\n");
+		writer.printf(METRICS_PREFIX "task_wakeups_per_hour{task=\"server\"} %.1f\n", snapshot.m_counters[eMetricsServerTaskWakeups] * 3600000.0 / snapshot.m_uptimeMs);
+		writer.printf(METRICS_PREFIX "task_wakeups_per_hour{task=\"wifi\"} %.1f\n", snapshot.m_counters[eMetricsWifiTaskWakeups] * 3600000.0 / snapshot.m_uptimeMs);
+	}
+
+	//
+	// histograms
+	//
+
+	for (int i = 0; i < eMetricsHistogramCount; i++) {
+		const MetricsSnapshot::Histogram &h = snapshot.m_histograms[i];
+		const char *name = g_histogramInfo[i].m_name;
+
+		writer.printf("# HELP " METRICS_PREFIX "%s %s\n", name, g_histogramInfo[i].m_help);
+		writer.printf("# TYPE " METRICS_PREFIX "%s histogram\n", name);
+
+		// buckets are cumulative
+		uint32_t cumulative = 0;
+		for (int b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++) {
+			cumulative += h.m_buckets[b];
+			writer.printf(METRICS_PREFIX "%s_bucket{le=\"%s\"} %u\n", name, g_bucketLabels[b], cumulative);
+		}
+		writer.printf(METRICS_PREFIX "%s_bucket{le=\"+Inf\"} %u\n", name, h.m_count);
+		writer.printf(METRICS_PREFIX "%s_sum %.6f\n", name, h.m_sumUs / 1000000.0);
+		writer.printf(METRICS_PREFIX "%s_count %u\n", name, h.m_count);
+	}
+}
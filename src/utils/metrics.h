@@ -0,0 +1,156 @@
+#pragma once
+
+#include <Arduino.h>
+#include "config.h"
+
+//
+// lightweight metrics registry (counters + fixed bucket histograms)
+// rendered in Prometheus text exposition format by metricsRender()
+//
+
+enum MetricsCounter {
+	eMetricsHttpRequests,
+	eMetricsSensorFailures,
+	eMetricsWifiReconnects,
+	eMetricsServerTaskWakeups,
+	eMetricsWifiTaskWakeups,
+	eMetricsHttpRejectedBusy,
+	eMetricsHttpRejectedRate,
+	eMetricsHttpRejectedLowHeap,
+	eMetricsMqttPublished,
+	eMetricsMqttDropped,
+	eMetricsInfluxRequests,
+	eMetricsInfluxFailures,
+	eMetricsInfluxSamplesSent,
+	eMetricsInfluxBytesSent,
+	eMetricsInfluxDropped,
+	eMetricsCoapRequests,
+	eMetricsCoapNotifications,
+	eMetricsCoapRetransmits,
+	eMetricsBeaconsSent,
+	eMetricsFleetFetches,
+	eMetricsFleetFetchFailures,
+	eMetricsModbusRequests,
+	eMetricsModbusExceptions,
+	eMetricsTlsHandshakeFailures,
+	eMetricsWifiDisconnects,
+	eMetricsWifiRoams,
+	eMetricsWifiRoamScans,
+	eMetricsWifiRoamFailures,
+	eMetricsLogDropped,
+	eMetricsCounterCount
+};
+
+enum MetricsGauge {
+	eMetricsMqttQueueDepth,
+	eMetricsMqttSpoolDepth,
+	eMetricsInfluxSpillDepth,
+	eMetricsCoapObservers,
+	eMetricsFleetPeers,
+	eMetricsModbusClients,
+	eMetricsWifiBootConnectTime,
+	eMetricsWifiBootFastPath,
+	eMetricsWifiBootSavedTime,
+	eMetricsWifiLastDisconnectReason,
+	eMetricsWifiLastOutageTime,
+	eMetricsWifiPowerProfile,
+	eMetricsNtpOffset,
+	eMetricsNtpUncertainty,
+	eMetricsNtpDrift,
+	eMetricsNtpPollInterval,
+	eMetricsLogRingHighWater,
+	eMetricsGaugeCount
+};
+
+enum MetricsHistogram {
+	eMetricsHttpLatency,
+	eMetricsSensorReadTime,
+	eMetricsMqttPublishLatency,
+	eMetricsInfluxWriteLatency,
+	eMetricsCoapRequestTime,
+	eMetricsFleetSweepTime,
+	eMetricsTlsHandshakeFullTime,
+	eMetricsTlsHandshakeResumedTime,
+	eMetricsHistogramCount
+};
+
+// number of finite buckets per histogram (+Inf bucket is implicit)
+#define METRICS_HISTOGRAM_BUCKETS 10
+
+struct MetricsSnapshot {
+	// gauges
+	uint16_t m_pm2_5;
+#if (USE_CO2_SENSOR == 1)
+	float m_temperature;
+	float m_humidity;
+	uint16_t m_co2;
+#elif (USE_ENV_SENSOR == 1)
+	float m_temperature;
+	float m_humidity;
+	float m_pressure;
+#endif
+	bool m_sensorValid;
+	int32_t m_rssi;
+	uint32_t m_freeHeap;
+	uint32_t m_minFreeHeap;
+	uint64_t m_uptimeMs;
+	uint32_t m_watchdogTimeToResetMs;
+
+	// counters
+	uint32_t m_counters[eMetricsCounterCount];
+
+	// gauges set by other modules
+	float m_gauges[eMetricsGaugeCount];
+
+	// histograms
+	struct Histogram {
+		uint32_t m_buckets[METRICS_HISTOGRAM_BUCKETS + 1];
+		uint32_t m_count;
+		uint64_t m_sumUs;
+	} m_histograms[eMetricsHistogramCount];
+};
+
+//
+// Writer producing a byte window <skip; skip + maxLen) of the rendered text
+// into a caller provided buffer. Everything outside of the window is only
+// counted, so the output can be streamed in chunks without ever holding
+// the whole document in RAM.
+//
+
+class MetricsWriter {
+private:
+	char *m_buffer;
+	size_t m_maxLen;
+	size_t m_skip;
+	size_t m_pos;
+	size_t m_written;
+
+public:
+	MetricsWriter(char *buffer, size_t maxLen, size_t skip)
+		: m_buffer(buffer)
+		, m_maxLen(maxLen)
+		, m_skip(skip)
+		, m_pos(0)
+		, m_written(0)
+	{
+	}
+
+	void write(const char *str, size_t len);
+	void print(const char *str);
+	void printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+	// bytes copied into the buffer
+	size_t written() const { return m_written; }
+
+	// total length of the rendered document so far
+	size_t position() const { return m_pos; }
+
+	bool full() const { return m_written >= m_maxLen; }
+};
+
+void metricsInit();
+void metricsIncrement(const MetricsCounter &counter, uint32_t value = 1);
+void metricsObserve(const MetricsHistogram &histogram, uint32_t valueUs);
+void metricsSet(const MetricsGauge &gauge, const float &value);
+void metricsSnapshot(MetricsSnapshot &snapshot);
+void metricsRender(const MetricsSnapshot &snapshot, MetricsWriter &writer);
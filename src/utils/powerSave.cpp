@@ -0,0 +1,341 @@
+#define LOG_MODULE eLogModulePower
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_wifi.h>
+#include <lwip/sockets.h>
+#include <lwip/icmp.h>
+#include <lwip/inet_chksum.h>
+
+#include "powerSave.h"
+#include "config.h"
+#include "utils.h"
+#include "metrics.h"
+
+// identifier of our echo requests, replies to other pings are ignored
+#define POWER_SAVE_PROBE_ID		0x5053
+
+// round trip histogram bucket upper bounds in milliseconds (+Inf bucket is implicit)
+#define POWER_SAVE_BUCKETS		9
+
+static const uint32_t g_bucketBoundsMs[POWER_SAVE_BUCKETS] = {
+	2, 5, 10, 20, 50, 100, 200, 500, 1000
+};
+
+static const char *g_profileNames[ePowerSaveProfileCount] = {
+	"latency",
+	"balanced",
+	"power",
+};
+
+static const wifi_ps_type_t g_profileModes[ePowerSaveProfileCount] = {
+	WIFI_PS_NONE,
+	WIFI_PS_MIN_MODEM,
+	WIFI_PS_MAX_MODEM,
+};
+
+static const char *g_boostNames[ePowerSaveBoostCount] = {
+	"ota",
+	"upload",
+	"events",
+};
+
+struct ProbeStats {
+	uint32_t m_probes;
+	uint32_t m_lost;
+	uint32_t m_minUs;
+	uint32_t m_maxUs;
+	uint64_t m_sumUs;
+	uint32_t m_buckets[POWER_SAVE_BUCKETS + 1];
+};
+
+static SemaphoreHandle_t g_mutex = NULL;
+static PowerSaveProfile g_selected = (PowerSaveProfile)POWER_SAVE_PROFILE;
+static PowerSaveProfile g_effective = ePowerSaveProfileCount;
+static uint32_t g_leaseUntilMs[ePowerSaveBoostCount] = {};
+static uint32_t g_leases = 0;			// bit per source
+static ProbeStats g_stats[ePowerSaveProfileCount] = {};
+
+static int g_socket = -1;
+static uint16_t g_probeSeq = 0;
+static uint32_t g_lastProbeMs = 0;
+
+//
+// the helpers below expect the mutex to be held
+//
+
+static void expireLeases(const uint32_t &now)
+{
+	for (int i = 0; i < ePowerSaveBoostCount; i++) {
+		if ((g_leases & (1 << i)) && (int32_t)(now - g_leaseUntilMs[i]) >= 0) {
+			g_leases &= ~(1 << i);
+			LOG_PRINTF("Power save boost released: %s (expired)\n", g_boostNames[i]);
+		}
+	}
+}
+
+static void apply(const bool &force)
+{
+	PowerSaveProfile effective = g_leases ? ePowerSaveLatency : g_selected;
+
+	// the driver forgets the mode when WiFi is restarted (config portal)
+	wifi_ps_type_t mode;
+	bool driverChanged = (esp_wifi_get_ps(&mode) == ESP_OK) && (mode != g_profileModes[effective]);
+
+	if (effective != g_effective || driverChanged || force) {
+		esp_wifi_set_ps(g_profileModes[effective]);
+		if (effective != g_effective) {
+			LOG_PRINTF("Power save profile: %s\n", g_profileNames[effective]);
+		}
+		g_effective = effective;
+		metricsSet(eMetricsWifiPowerProfile, effective);
+	}
+}
+
+//
+// gateway round trip probe
+//
+
+static bool probe(const uint32_t &gateway, uint32_t &rttUs)
+{
+	if (g_socket < 0) {
+		g_socket = socket(AF_INET, SOCK_RAW, IP_PROTO_ICMP);
+		if (g_socket < 0) {
+			LOG_PRINTF("Unable to open ICMP socket (%d)\n", errno);
+			return false;
+		}
+
+		struct timeval timeout = { 0, 100000 };
+		setsockopt(g_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	}
+
+	struct icmp_echo_hdr request;
+	memset(&request, 0, sizeof(request));
+	ICMPH_TYPE_SET(&request, ICMP_ECHO);
+	ICMPH_CODE_SET(&request, 0);
+	request.id = htons(POWER_SAVE_PROBE_ID);
+	request.seqno = htons(++g_probeSeq);
+	request.chksum = inet_chksum(&request, sizeof(request));
+
+	struct sockaddr_in to;
+	memset(&to, 0, sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_addr.s_addr = gateway;
+
+	int64_t startUs = esp_timer_get_time();
+	if (sendto(g_socket, &request, sizeof(request), 0, (struct sockaddr *)&to, sizeof(to)) != sizeof(request)) {
+		return false;
+	}
+
+	// the raw socket sees all ICMP traffic, wait for our reply only
+	while (esp_timer_get_time() - startUs < POWER_SAVE_PROBE_TIMEOUT_MS * 1000LL) {
+		uint8_t buffer[64];
+		int len = recv(g_socket, buffer, sizeof(buffer), 0);
+		int64_t nowUs = esp_timer_get_time();
+		if (len <= 0) {
+			continue;
+		}
+
+		size_t ipLen = (buffer[0] & 0x0f) * 4;
+		if ((size_t)len < ipLen + sizeof(struct icmp_echo_hdr)) {
+			continue;
+		}
+
+		const struct icmp_echo_hdr *reply = (const struct icmp_echo_hdr *)(buffer + ipLen);
+		if (ICMPH_TYPE(reply) == ICMP_ER && reply->id == request.id && reply->seqno == request.seqno) {
+			rttUs = nowUs - startUs;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void account(ProbeStats &stats, const bool &success, const uint32_t &rttUs)
+{
+	stats.m_probes++;
+	if (!success) {
+		stats.m_lost++;
+		return;
+	}
+
+	if (stats.m_probes - stats.m_lost == 1 || rttUs < stats.m_minUs) {
+		stats.m_minUs = rttUs;
+	}
+	if (rttUs > stats.m_maxUs) {
+		stats.m_maxUs = rttUs;
+	}
+	stats.m_sumUs += rttUs;
+
+	int bucket = 0;
+	while (bucket < POWER_SAVE_BUCKETS && rttUs > g_bucketBoundsMs[bucket] * 1000) {
+		bucket++;
+	}
+	stats.m_buckets[bucket]++;
+}
+
+// upper bound of the bucket holding the given fraction of the replies, -1 above the last bound
+static int32_t percentileMs(const ProbeStats &stats, const float &fraction)
+{
+	uint32_t replies = stats.m_probes - stats.m_lost;
+	uint32_t rank = (uint32_t)ceilf(replies * fraction);
+	uint32_t seen = 0;
+	for (int i = 0; i < POWER_SAVE_BUCKETS; i++) {
+		seen += stats.m_buckets[i];
+		if (seen >= rank) {
+			return g_bucketBoundsMs[i];
+		}
+	}
+	return -1;
+}
+
+//
+// API
+//
+
+void powerSaveInit()
+{
+	if (!g_mutex) {
+		g_mutex = xSemaphoreCreateMutex();
+	}
+
+	Preferences preferences;
+	preferences.begin(PREFERENCES_ID, false);
+	uint32_t profile = preferences.getUInt("powersave", POWER_SAVE_PROFILE);
+	preferences.end();
+
+	if (xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
+		g_selected = (profile < ePowerSaveProfileCount) ? (PowerSaveProfile)profile : (PowerSaveProfile)POWER_SAVE_PROFILE;
+		apply(true);
+		xSemaphoreGive(g_mutex);
+	}
+}
+
+void powerSaveSelect(const PowerSaveProfile &profile)
+{
+	if (!g_mutex || profile >= ePowerSaveProfileCount) {
+		return;
+	}
+
+	if (xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
+		g_selected = profile;
+		apply(false);
+		xSemaphoreGive(g_mutex);
+	}
+
+	Preferences preferences;
+	preferences.begin(PREFERENCES_ID, false);
+	preferences.putUInt("powersave", profile);
+	preferences.end();
+}
+
+bool powerSaveFromName(const char *name, PowerSaveProfile &profile)
+{
+	for (int i = 0; i < ePowerSaveProfileCount; i++) {
+		if (!strcmp(name, g_profileNames[i])) {
+			profile = (PowerSaveProfile)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *powerSaveName(const PowerSaveProfile &profile)
+{
+	return (profile < ePowerSaveProfileCount) ? g_profileNames[profile] : "unknown";
+}
+
+void powerSaveBoost(const PowerSaveBoost &source, const uint32_t &leaseMs)
+{
+	if (!g_mutex || source >= ePowerSaveBoostCount) {
+		return;
+	}
+
+	if (xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
+		bool active = g_leases & (1 << source);
+		if (leaseMs) {
+			g_leaseUntilMs[source] = millis() + leaseMs;
+			g_leases |= (1 << source);
+		} else {
+			g_leases &= ~(1 << source);
+		}
+
+		if (active != (leaseMs > 0)) {
+			LOG_PRINTF("Power save boost %s: %s\n", leaseMs ? "acquired" : "released", g_boostNames[source]);
+			apply(false);
+		}
+		xSemaphoreGive(g_mutex);
+	}
+}
+
+void powerSavePoll(const uint32_t &gateway)
+{
+	if (!g_mutex) {
+		return;
+	}
+
+	uint32_t now = millis();
+	PowerSaveProfile profile = ePowerSaveProfileCount;
+
+	if (xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
+		expireLeases(now);
+		apply(false);
+		profile = g_effective;
+		xSemaphoreGive(g_mutex);
+	}
+
+	if (!gateway || (g_lastProbeMs && now - g_lastProbeMs < POWER_SAVE_PROBE_INTERVAL_S * 1000)) {
+		return;
+	}
+	g_lastProbeMs = now;
+
+	uint32_t rttUs = 0;
+	bool success = probe(gateway, rttUs);
+
+	if (xSemaphoreTake(g_mutex, portMAX_DELAY) == pdTRUE) {
+		// a probe spanning a profile change is not accounted
+		if (profile == g_effective && profile < ePowerSaveProfileCount) {
+			account(g_stats[profile], success, rttUs);
+		}
+		xSemaphoreGive(g_mutex);
+	}
+}
+
+void powerSaveJson(JsonDocument &doc)
+{
+	if (!g_mutex || xSemaphoreTake(g_mutex, portMAX_DELAY) != pdTRUE) {
+		return;
+	}
+
+	uint32_t now = millis();
+	doc["selected"] = g_profileNames[g_selected];
+	doc["effective"] = powerSaveName(g_effective);
+	doc["probeIntervalS"] = POWER_SAVE_PROBE_INTERVAL_S;
+
+	JsonObject boosts = doc.createNestedObject("boosts");
+	for (int i = 0; i < ePowerSaveBoostCount; i++) {
+		if ((g_leases & (1 << i)) && (int32_t)(g_leaseUntilMs[i] - now) > 0) {
+			boosts[g_boostNames[i]] = g_leaseUntilMs[i] - now;
+		}
+	}
+
+	// gateway round trip times per profile, percentiles are bucket bounds
+	JsonObject profiles = doc.createNestedObject("gatewayRtt");
+	for (int i = 0; i < ePowerSaveProfileCount; i++) {
+		const ProbeStats &stats = g_stats[i];
+		uint32_t replies = stats.m_probes - stats.m_lost;
+
+		JsonObject obj = profiles.createNestedObject(g_profileNames[i]);
+		obj["probes"] = stats.m_probes;
+		obj["lost"] = stats.m_lost;
+		if (replies) {
+			obj["minMs"] = stats.m_minUs / 1000.0;
+			obj["meanMs"] = (stats.m_sumUs / replies) / 1000.0;
+			obj["p50Ms"] = percentileMs(stats, 0.5f);
+			obj["p90Ms"] = percentileMs(stats, 0.9f);
+			obj["maxMs"] = stats.m_maxUs / 1000.0;
+		}
+	}
+
+	xSemaphoreGive(g_mutex);
+}
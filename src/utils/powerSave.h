@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+//
+// WiFi power save profiles
+//
+// The profile selects the modem sleep mode of the station:
+//
+//   latency   radio always on
+//   balanced  modem sleep, wakes for every DTIM beacon
+//   power     modem sleep, wakes every listen interval (3 beacons)
+//
+// Frames for a sleeping station are buffered by the access point until
+// it wakes, which is what a client sees as extra request latency. The
+// selected profile is kept in preferences. Activities that need low
+// latency hold a boost lease, which switches to the latency profile
+// until all leases are released or have expired.
+//
+// An ICMP echo to the gateway every POWER_SAVE_PROBE_INTERVAL_S is
+// accounted to the profile in effect and served at /diag/power as
+// "gatewayRtt". The device sends the echo itself and is awake for the
+// reply, so this is a link health figure, not the latency of inbound
+// requests. tools/power_probe.py measures that from a client.
+//
+
+enum PowerSaveProfile {
+	ePowerSaveLatency,
+	ePowerSaveBalanced,
+	ePowerSavePower,
+	ePowerSaveProfileCount
+};
+
+enum PowerSaveBoost {
+	ePowerSaveBoostOta,			// ArduinoOTA transfer
+	ePowerSaveBoostUpload,		// firmware upload over HTTP
+	ePowerSaveBoostEvents,		// server-sent events subscribers
+	ePowerSaveBoostCount
+};
+
+// applies the profile kept in preferences (POWER_SAVE_PROFILE by default)
+void powerSaveInit();
+
+// selects and stores the profile, takes effect unless boosted
+void powerSaveSelect(const PowerSaveProfile &profile);
+
+// profile by its name, returns false for an unknown name
+bool powerSaveFromName(const char *name, PowerSaveProfile &profile);
+const char *powerSaveName(const PowerSaveProfile &profile);
+
+// (re)starts a boost lease of the source for leaseMs, 0 releases it
+void powerSaveBoost(const PowerSaveBoost &source, const uint32_t &leaseMs);
+
+// expires leases and runs the gateway probe, call periodically from the
+// WiFi task, gateway is 0 while not connected
+void powerSavePoll(const uint32_t &gateway);
+
+// profiles, leases and gateway round trips, as served by /diag/power
+void powerSaveJson(JsonDocument &doc);
@@ -0,0 +1,74 @@
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include "snapshot.h"
+#include "config.h"
+#include "utils.h"
+#include "watchdog.h"
+#include "../tasks/sensorTask.h"
+#include "../tasks/ntpTask.h"
+
+static void addTime(JsonDocument &doc)
+{
+	uint64_t currTimeMs = compensatedMillis();
+	doc["currTimeMs"] = currTimeMs;
+	doc["currTime"] = epochToTimeStr(currTimeMs);
+	doc["watchdogTimeToReset"] = msToTimeStr(watchdogTimeToReset());
+}
+
+void snapshotSensors(JsonDocument &doc)
+{
+	uint16_t pm2_5 = 0;
+#if (USE_CO2_SENSOR == 1)
+	float temperature = 0;
+	float humidity = 0;
+	uint16_t co2 = 0;
+	if (lastSensorData(pm2_5, temperature, humidity, co2)) {
+		doc["co2"] = co2;
+		doc["temperature"] = temperature;
+		doc["humidity"] = humidity;
+		doc["pm2_5"] = pm2_5;
+	} else {
+		doc["co2"] = 0;
+		doc["temperature"] = 0;
+		doc["humidity"] = 0;
+		doc["pm2_5"] = 0;
+	}
+#elif (USE_ENV_SENSOR == 1)
+	float temperature = 0;
+	float humidity = 0;
+	float pressure = 0;
+	if (lastSensorData(pm2_5, temperature, humidity, pressure)) {
+		doc["pressure"] = pressure;
+		doc["temperature"] = temperature;
+		doc["humidity"] = humidity;
+		doc["pm2_5"] = pm2_5;
+	} else {
+		doc["pressure"] = 0;
+		doc["temperature"] = 0;
+		doc["humidity"] = 0;
+		doc["pm2_5"] = 0;
+	}
+#else
+	if (lastSensorData(pm2_5)) {
+		doc["pm2_5"] = pm2_5;
+	} else {
+		doc["pm2_5"] = 0;
+	}
+#endif
+
+	// add time parameter
+	addTime(doc);
+}
+
+void snapshotRssi(JsonDocument &doc)
+{
+	// print the received signal strength:
+	long rssi = WiFi.RSSI();
+	LOG_DEBUG("signal strength (RSSI): %ld dBm\n", rssi);
+
+	doc["rssi"] = rssi;
+
+	// add time parameter
+	addTime(doc);
+}
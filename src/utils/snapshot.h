@@ -0,0 +1,14 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+//
+// documents shared by the HTTP and CoAP read endpoints
+//
+
+// latest sensor readings + time, as served by /get
+void snapshotSensors(JsonDocument &doc);
+
+// signal strength + time, as served by /rssi
+void snapshotRssi(JsonDocument &doc);
@@ -0,0 +1,326 @@
+#include "sntpClient.h"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+// seconds from 1900 (NTP era 0) to 1970
+#define SNTP_UNIX_OFFSET_S		2208988800LL
+
+// rounds in the fit before the poll interval may grow
+#define SNTP_STABLE_ROUNDS		3
+
+static uint32_t get32(const uint8_t *data)
+{
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static uint64_t get64(const uint8_t *data)
+{
+	return ((uint64_t)get32(data) << 32) | get32(data + 4);
+}
+
+static void put64(uint8_t *data, const uint64_t &value)
+{
+	for (int i = 0; i < 8; i++) {
+		data[i] = (value >> (56 - 8 * i)) & 0xff;
+	}
+}
+
+// 16.16 fixed point seconds to microseconds
+static int64_t shortToUs(const uint32_t &value)
+{
+	return ((int64_t)value * 1000000) >> 16;
+}
+
+static int64_t absUs(const int64_t &value)
+{
+	return (value < 0) ? -value : value;
+}
+
+SntpClient::SntpClient(const Config &config, const size_t &servers)
+	: m_config(config)
+	, m_servers(servers)
+	, m_historyLen(0)
+	, m_historyHead(0)
+	, m_fitted(false)
+	, m_fitBaseUs(0)
+	, m_fitOffsetUs(0)
+	, m_drift(0)
+	, m_jitterUs(0)
+	, m_pollS(config.m_minPollS)
+	, m_uncertaintyUs(0)
+	, m_lastErrorUs(0)
+	, m_lastUpdateUs(0)
+	, m_synced(false)
+{
+	for (Server &server : m_servers) {
+		memset((void *)&server, 0, sizeof(server));
+	}
+}
+
+int64_t SntpClient::toEpochUs(const uint64_t &timestamp)
+{
+	int64_t seconds = timestamp >> 32;
+
+	// era 1 starts in 2036, timestamps from before 1968 belong to it
+	if (seconds < 0x80000000LL) {
+		seconds += 0x100000000LL;
+	}
+
+	// the fraction is rounded, so fromEpochUs() round trips
+	return (seconds - SNTP_UNIX_OFFSET_S) * 1000000 + (int64_t)(((timestamp & 0xffffffff) * 1000000 + 0x80000000) >> 32);
+}
+
+uint64_t SntpClient::fromEpochUs(const int64_t &epochUs)
+{
+	int64_t seconds = epochUs / 1000000;
+	int64_t us = epochUs % 1000000;
+	if (us < 0) {
+		seconds--;
+		us += 1000000;
+	}
+
+	uint64_t ntpSeconds = (uint64_t)(seconds + SNTP_UNIX_OFFSET_S) & 0xffffffff;
+	return (ntpSeconds << 32) | (((uint64_t)us << 32) / 1000000);
+}
+
+void SntpClient::startRound()
+{
+	for (Server &server : m_servers) {
+		server.m_pending = false;
+		server.m_answered = false;
+		server.m_status.m_reach <<= 1;
+		server.m_status.m_used = false;
+	}
+}
+
+void SntpClient::request(const size_t &server, const int64_t &monotonicUs, uint8_t *packet)
+{
+	// LI 0, version 4, mode 3 (client), everything else zero but the transmit timestamp
+	memset(packet, 0, SNTP_PACKET_LEN);
+	packet[0] = (4 << 3) | 3;
+
+	// the server returns it as the origin timestamp, which ties the answer to this request
+	Server &state = m_servers[server];
+	state.m_origin = fromEpochUs(monotonicUs);
+	state.m_sentUs = monotonicUs;
+	state.m_pending = true;
+	put64(packet + 40, state.m_origin);
+}
+
+bool SntpClient::response(const size_t &server, const uint8_t *packet, const size_t &len, const int64_t &monotonicUs)
+{
+	if (server >= m_servers.size() || len < SNTP_PACKET_LEN) {
+		return false;
+	}
+
+	Server &state = m_servers[server];
+	uint8_t leap = packet[0] >> 6;
+	uint8_t version = (packet[0] >> 3) & 0x07;
+	uint8_t mode = packet[0] & 0x07;
+	uint8_t stratum = packet[1];
+
+	// unsynchronized servers and kiss-o'-death packets (stratum 0) are ignored
+	if (!state.m_pending || mode != 4 || version < 1 || version > 4 || leap == 3 || stratum == 0 || stratum > 15) {
+		return false;
+	}
+
+	uint64_t origin = get64(packet + 24);
+	uint64_t receive = get64(packet + 32);
+	uint64_t transmit = get64(packet + 40);
+	if (origin != state.m_origin || !receive || !transmit) {
+		return false;
+	}
+	state.m_pending = false;
+
+	// t1, t4 monotonic, t2, t3 server wall time
+	int64_t t1 = state.m_sentUs;
+	int64_t t2 = toEpochUs(receive);
+	int64_t t3 = toEpochUs(transmit);
+	int64_t t4 = monotonicUs;
+
+	Sample sample;
+	sample.m_monotonicUs = t1 + (t4 - t1) / 2;
+	sample.m_offsetUs = ((t2 - t1) + (t3 - t4)) / 2;
+	sample.m_delayUs = std::max((int64_t)0, (t4 - t1) - (t3 - t2));
+	sample.m_distanceUs = sample.m_delayUs / 2 + shortToUs(get32(packet + 4)) / 2 + shortToUs(get32(packet + 8));
+	sample.m_stratum = stratum;
+
+	if (!state.m_answered || sample.m_delayUs < state.m_best.m_delayUs) {
+		state.m_best = sample;
+	}
+	state.m_answered = true;
+	state.m_status.m_reach |= 1;
+	return true;
+}
+
+bool SntpClient::predict(const int64_t &monotonicUs, int64_t &offsetUs) const
+{
+	if (!m_fitted) {
+		return false;
+	}
+	offsetUs = (int64_t)llround(m_fitOffsetUs + m_drift * (monotonicUs - m_fitBaseUs));
+	return true;
+}
+
+void SntpClient::fit()
+{
+	// relative to the newest point, keeps the doubles small
+	const Point &newest = m_history[(m_historyHead + SNTP_CLIENT_HISTORY - 1) % SNTP_CLIENT_HISTORY];
+
+	double sumW = 0;
+	double sumX = 0;
+	double sumY = 0;
+	int64_t oldestUs = newest.m_monotonicUs;
+	for (size_t i = 0; i < m_historyLen; i++) {
+		const Point &point = m_history[i];
+		double x = (point.m_monotonicUs - newest.m_monotonicUs) / 1e6;
+		double y = point.m_offsetUs - newest.m_offsetUs;
+		sumW += point.m_weight;
+		sumX += point.m_weight * x;
+		sumY += point.m_weight * y;
+		oldestUs = std::min(oldestUs, point.m_monotonicUs);
+	}
+	double meanX = sumX / sumW;
+	double meanY = sumY / sumW;
+
+	// the drift needs some time span, until then the previous estimate is kept
+	double slope = m_drift * 1e6;
+	if (m_historyLen >= 2 && newest.m_monotonicUs - oldestUs >= (int64_t)m_config.m_minPollS * 1000000) {
+		double sxx = 0;
+		double sxy = 0;
+		for (size_t i = 0; i < m_historyLen; i++) {
+			const Point &point = m_history[i];
+			double x = (point.m_monotonicUs - newest.m_monotonicUs) / 1e6 - meanX;
+			double y = (point.m_offsetUs - newest.m_offsetUs) - meanY;
+			sxx += point.m_weight * x * x;
+			sxy += point.m_weight * x * y;
+		}
+		if (sxx > 0) {
+			slope = std::max(-(double)m_config.m_maxDriftPpm, std::min((double)m_config.m_maxDriftPpm, sxy / sxx));
+		}
+	}
+
+	double intercept = meanY - slope * meanX;
+
+	// weighted residual, meaningful with more points than parameters
+	double residual = 0;
+	for (size_t i = 0; i < m_historyLen; i++) {
+		const Point &point = m_history[i];
+		double x = (point.m_monotonicUs - newest.m_monotonicUs) / 1e6;
+		double r = (point.m_offsetUs - newest.m_offsetUs) - (intercept + slope * x);
+		residual += point.m_weight * r * r;
+	}
+	m_jitterUs = (m_historyLen > 2) ? (int64_t)sqrt(residual / sumW) : 0;
+
+	// slope is in microseconds per second, i.e. ppm
+	m_drift = slope / 1e6;
+	m_fitBaseUs = newest.m_monotonicUs;
+	m_fitOffsetUs = newest.m_offsetUs + intercept;
+	m_fitted = true;
+}
+
+bool SntpClient::finishRound(const int64_t &monotonicUs, Estimate &estimate)
+{
+	// best sample of every server, projected to the end of the round
+	struct Candidate {
+		size_t m_server;
+		int64_t m_offsetUs;
+		int64_t m_distanceUs;
+	};
+	std::vector<Candidate> candidates;
+	for (size_t i = 0; i < m_servers.size(); i++) {
+		const Server &server = m_servers[i];
+		if (server.m_answered) {
+			int64_t offsetUs = server.m_best.m_offsetUs + (int64_t)llround(m_drift * (monotonicUs - server.m_best.m_monotonicUs));
+			candidates.push_back(Candidate{i, offsetUs, server.m_best.m_distanceUs});
+		}
+	}
+
+	if (candidates.empty()) {
+		return false;
+	}
+
+	// drop servers that disagree with the median by more than both their distances
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+		return a.m_offsetUs < b.m_offsetUs;
+	});
+	const Candidate median = candidates[candidates.size() / 2];
+
+	double sumW = 0;
+	double sumOffset = 0;
+	for (const Candidate &candidate : candidates) {
+		if (absUs(candidate.m_offsetUs - median.m_offsetUs) > candidate.m_distanceUs + median.m_distanceUs + m_config.m_agreeUs) {
+			continue;
+		}
+		double distance = std::max((int64_t)1, candidate.m_distanceUs);
+		double weight = 1.0 / (distance * distance);
+		sumW += weight;
+		sumOffset += weight * (candidate.m_offsetUs - median.m_offsetUs);
+		m_servers[candidate.m_server].m_status.m_used = true;
+	}
+	int64_t measuredUs = median.m_offsetUs + (int64_t)llround(sumOffset / sumW);
+	int64_t distanceUs = (int64_t)(1.0 / sqrt(sumW));
+
+	for (const Candidate &candidate : candidates) {
+		const Server &server = m_servers[candidate.m_server];
+		ServerStatus &status = m_servers[candidate.m_server].m_status;
+		status.m_offsetUs = candidate.m_offsetUs - measuredUs;
+		status.m_delayUs = server.m_best.m_delayUs;
+		status.m_distanceUs = server.m_best.m_distanceUs;
+		status.m_stratum = server.m_best.m_stratum;
+	}
+
+	// compare with what the previous fit expected
+	int64_t predictedUs;
+	if (predict(monotonicUs, predictedUs)) {
+		int64_t errorUs = measuredUs - predictedUs;
+		m_lastErrorUs = errorUs;
+
+		if (absUs(errorUs) > m_config.m_stepUs) {
+			// the time changed under us, start over (the drift is kept)
+			m_historyLen = 0;
+			m_historyHead = 0;
+			m_fitted = false;
+			m_pollS = m_config.m_minPollS;
+		} else if (absUs(errorUs) <= m_config.m_stableUs && m_historyLen + 1 >= SNTP_STABLE_ROUNDS) {
+			// the fit residual is no threshold here, it also grows when the drift itself changes
+			m_pollS = std::min(m_pollS * 2, m_config.m_maxPollS);
+		} else if (absUs(errorUs) > 2 * m_config.m_stableUs) {
+			m_pollS = std::max(m_pollS / 2, m_config.m_minPollS);
+		}
+	}
+
+	Point &point = m_history[m_historyHead];
+	point.m_monotonicUs = monotonicUs;
+	point.m_offsetUs = measuredUs;
+	point.m_weight = sumW;
+	m_historyHead = (m_historyHead + 1) % SNTP_CLIENT_HISTORY;
+	m_historyLen = std::min(m_historyLen + 1, (size_t)SNTP_CLIENT_HISTORY);
+	fit();
+
+	int64_t offsetUs = measuredUs;
+	predict(monotonicUs, offsetUs);
+
+	m_uncertaintyUs = distanceUs + m_jitterUs;
+	m_lastUpdateUs = monotonicUs;
+	m_synced = true;
+
+	estimate.m_monotonicUs = monotonicUs;
+	estimate.m_epochUs = monotonicUs + offsetUs;
+	estimate.m_ratePpb = (int32_t)llround(m_drift * 1e9);
+	estimate.m_uncertaintyUs = m_uncertaintyUs;
+	return true;
+}
+
+void SntpClient::status(Status &status) const
+{
+	status.m_synced = m_synced;
+	status.m_pollS = m_pollS;
+	status.m_driftPpm = -m_drift * 1e6;
+	status.m_jitterUs = m_jitterUs;
+	status.m_uncertaintyUs = m_uncertaintyUs;
+	status.m_lastErrorUs = m_lastErrorUs;
+	status.m_lastUpdateUs = m_lastUpdateUs;
+	status.m_rounds = m_historyLen;
+}
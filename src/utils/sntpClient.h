@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+//
+// SNTP client estimating the wall clock from several servers
+//
+// Every poll round queries each server a few times in a burst and keeps
+// the sample with the lowest round trip delay, the one least disturbed by
+// queueing. Offsets are taken against the monotonic clock, not against
+// the corrected wall clock, so samples stay comparable across corrections.
+// Servers that disagree with the median are dropped, the rest are
+// averaged weighted by their synchronization distance (half the delay
+// plus the root delay and dispersion reported by the server).
+//
+// A weighted linear fit over the last SNTP_CLIENT_HISTORY rounds gives
+// the crystal drift and a smoothed offset. The poll interval doubles
+// while each round lands within m_stableUs of the previous fit, and halves
+// when the error exceeds twice that.
+// An error beyond m_stepUs restarts the fit.
+//
+// The class builds and parses the packets, the caller does the network
+// I/O and takes the monotonic timestamps right before sending and right
+// after receiving. It has no platform dependencies, so tools/sntp_check
+// runs the same code against a local NTP stand-in.
+//
+
+#define SNTP_PACKET_LEN			48
+#define SNTP_CLIENT_HISTORY		8
+
+class SntpClient {
+public:
+	struct Config {
+		uint32_t m_minPollS;
+		uint32_t m_maxPollS;
+		int64_t m_stepUs;			// error that restarts the estimation
+		int64_t m_stableUs;			// error below which the poll interval may grow
+		int64_t m_agreeUs;			// margin for servers to agree with the median
+		int32_t m_maxDriftPpm;
+	};
+
+	struct Estimate {
+		int64_t m_monotonicUs;
+		int64_t m_epochUs;			// wall time at m_monotonicUs
+		int32_t m_ratePpb;			// wall clock rate relative to the monotonic clock
+		int64_t m_uncertaintyUs;
+	};
+
+	struct ServerStatus {
+		uint8_t m_reach;			// bit per round, 1 if it answered
+		uint8_t m_stratum;
+		bool m_used;				// part of the last estimate
+		int64_t m_offsetUs;			// relative to the last estimate
+		int64_t m_delayUs;
+		int64_t m_distanceUs;
+	};
+
+	struct Status {
+		bool m_synced;
+		uint32_t m_pollS;
+		float m_driftPpm;			// crystal, positive if the monotonic clock runs fast
+		int64_t m_jitterUs;			// residual of the drift fit
+		int64_t m_uncertaintyUs;
+		int64_t m_lastErrorUs;		// last round against the prediction
+		int64_t m_lastUpdateUs;		// monotonic time of the last estimate
+		size_t m_rounds;			// rounds in the fit
+	};
+
+	SntpClient(const Config &config, const size_t &servers);
+
+	// starts a poll round, call before the requests
+	void startRound();
+
+	// request packet (SNTP_PACKET_LEN bytes) for a server, sent at monotonicUs,
+	// may be repeated within a round once the previous one was answered or lost
+	void request(const size_t &server, const int64_t &monotonicUs, uint8_t *packet);
+
+	// response received at monotonicUs, false if it is invalid or unexpected
+	bool response(const size_t &server, const uint8_t *packet, const size_t &len, const int64_t &monotonicUs);
+
+	// combines the round, returns false if no server answered
+	bool finishRound(const int64_t &monotonicUs, Estimate &estimate);
+
+	uint32_t pollIntervalS() const { return m_pollS; }
+
+	void status(Status &status) const;
+	const ServerStatus &server(const size_t &server) const { return m_servers[server].m_status; }
+	size_t servers() const { return m_servers.size(); }
+
+	// NTP timestamp (seconds since 1900, 32.32 fixed point) to epoch microseconds and back
+	static int64_t toEpochUs(const uint64_t &timestamp);
+	static uint64_t fromEpochUs(const int64_t &epochUs);
+
+private:
+	struct Sample {
+		int64_t m_monotonicUs;
+		int64_t m_offsetUs;			// server time - monotonic time
+		int64_t m_delayUs;
+		int64_t m_distanceUs;
+		uint8_t m_stratum;
+	};
+
+	struct Server {
+		uint64_t m_origin;			// transmit timestamp of the pending request
+		int64_t m_sentUs;
+		bool m_pending;
+		bool m_answered;
+		Sample m_best;
+		ServerStatus m_status;
+	};
+
+	struct Point {
+		int64_t m_monotonicUs;
+		int64_t m_offsetUs;
+		double m_weight;
+	};
+
+	// offset predicted by the fit, false without one
+	bool predict(const int64_t &monotonicUs, int64_t &offsetUs) const;
+	void fit();
+
+	Config m_config;
+	std::vector<Server> m_servers;
+
+	Point m_history[SNTP_CLIENT_HISTORY];
+	size_t m_historyLen;
+	size_t m_historyHead;
+
+	// fit: offset = m_fitOffsetUs + m_drift * (monotonic - m_fitBaseUs)
+	bool m_fitted;
+	int64_t m_fitBaseUs;
+	double m_fitOffsetUs;
+	double m_drift;
+	int64_t m_jitterUs;
+
+	uint32_t m_pollS;
+	int64_t m_uncertaintyUs;
+	int64_t m_lastErrorUs;
+	int64_t m_lastUpdateUs;
+	bool m_synced;
+};
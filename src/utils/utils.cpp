@@ -1,32 +1,40 @@
 #include "Arduino.h"
 
-#include <stdarg.h>
+#include <time.h>
 #include "utils.h"
 #include "config.h"
-#include "SerialAndTelnetInit.h"
+#include "logRing.h"
 #include "../tasks/ntpTask.h"
 
-#define LOG_SIZE_MAX 512
+#define MIN_EPOCH_MS 1577836800000ULL	// 2020-01-01, anything older is uptime
+
+uint8_t g_logLevels[eLogModuleCount] = {
+	LOG_RUNTIME_LEVEL, LOG_RUNTIME_LEVEL, LOG_RUNTIME_LEVEL, LOG_RUNTIME_LEVEL, LOG_RUNTIME_LEVEL,
+	LOG_RUNTIME_LEVEL, LOG_RUNTIME_LEVEL, LOG_RUNTIME_LEVEL, LOG_RUNTIME_LEVEL, LOG_RUNTIME_LEVEL,
+	LOG_RUNTIME_LEVEL, LOG_RUNTIME_LEVEL, LOG_RUNTIME_LEVEL, LOG_RUNTIME_LEVEL,
+};
+static_assert(eLogModuleCount == 14, "g_logLevels needs an initializer per module");
 
 void logInit()
 {
+	logRingInit();
+}
 
+void logSetLevel(const LogModule &module, const LogLevel &level)
+{
+	if (module < eLogModuleCount && level < eLogLevelCount) {
+		g_logLevels[module] = level;
+	}
 }
 
-void printf_internal(const char *fmt, ...)
+uint64_t logTimeMs()
 {
-	char buf[LOG_SIZE_MAX];
-	va_list ap;
-	va_start(ap, fmt);
-	vsnprintf(buf, LOG_SIZE_MAX, fmt, ap);
-	va_end(ap);
+	return compensatedMillis();
+}
 
-	if (SerialAndTelnetInit::lock()) {
-		SERIAL.print(msToTimeStr(compensatedMillis()));
-		SERIAL.print(": ");
-		SERIAL.print(buf);
-		SerialAndTelnetInit::unlock();
-	}
+void logWriteRecord(const uint8_t *record, const size_t &len)
+{
+	logRingWrite((const char *)record, len);
 }
 
 char *msToTimeStr(uint64_t ms)
@@ -44,6 +52,29 @@ char *msToTimeStr(uint64_t ms)
 	return timeBuf;
 }
 
+// local time of day (NTP_TIMEZONE) for wall clock values, a duration for uptime
+char *epochToTimeStr(uint64_t ms, char *buf, size_t len)
+{
+	if (ms < MIN_EPOCH_MS) {
+		unsigned long s = ms / 1000;
+		snprintf(buf, len, "%02lu:%02lu:%02lu.%03lu", (s % 86400L) / 3600, (s % 3600) / 60, s % 60, (unsigned long)(ms % 1000));
+		return buf;
+	}
+
+	time_t s = ms / 1000;
+	struct tm local;
+	localtime_r(&s, &local);
+
+	snprintf(buf, len, "%02d:%02d:%02d.%03lu", local.tm_hour, local.tm_min, local.tm_sec, (unsigned long)(ms % 1000));
+	return buf;
+}
+
+char *epochToTimeStr(uint64_t ms)
+{
+	static char timeBuf[32];
+	return epochToTimeStr(ms, timeBuf, sizeof(timeBuf));
+}
+
 void longDelay(uint32_t ms)
 {
 	uint32_t start = millis();
@@ -4,6 +4,7 @@
 
 #include "config/config.h"
 #include "TelnetSpy.h"
+#include "logRecord.h"
 
 // create instance of telnet/serial wrapper
 extern TelnetSpy SerialAndTelnet;
@@ -12,13 +13,71 @@ extern TelnetSpy SerialAndTelnet;
 #define SERIAL  SerialAndTelnet
 
 //
-// printf macro
+// logging macros, see logRecord.h
 //
+// A file sets its module by defining LOG_MODULE before its includes.
+// Levels above LOG_LEVEL_<module> are not compiled in, the runtime level
+// (/log/level) filters further before the arguments are evaluated.
+// LOG_PRINTF is an info message.
+//
+
+#ifndef LOG_MODULE
+#define LOG_MODULE eLogModuleMain
+#endif
+
+static constexpr uint8_t g_logCompiledLevels[eLogModuleCount] = {
+	LOG_LEVEL_MAIN,
+	LOG_LEVEL_WIFI,
+	LOG_LEVEL_NTP,
+	LOG_LEVEL_SENSOR,
+	LOG_LEVEL_SERVER,
+	LOG_LEVEL_OTA,
+	LOG_LEVEL_MQTT,
+	LOG_LEVEL_INFLUX,
+	LOG_LEVEL_COAP,
+	LOG_LEVEL_FLEET,
+	LOG_LEVEL_MODBUS,
+	LOG_LEVEL_TLS,
+	LOG_LEVEL_DISPLAY,
+	LOG_LEVEL_POWER,
+};
+
+extern uint8_t g_logLevels[eLogModuleCount];
+
+#define LOG_AT(level, fmt, ...) do { \
+	if ((level) <= g_logCompiledLevels[LOG_MODULE] && (level) <= g_logLevels[LOG_MODULE]) { \
+		logWrite(LOG_MODULE, level, PSTR(fmt), ##__VA_ARGS__); \
+	} \
+	if (0) { \
+		logCheckFormat(fmt, ##__VA_ARGS__); \
+	} \
+} while (0)
+
+#define LOG_ERROR(fmt, ...) LOG_AT(eLogError, fmt, ##__VA_ARGS__)
+#define LOG_WARNING(fmt, ...) LOG_AT(eLogWarning, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) LOG_AT(eLogInfo, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) LOG_AT(eLogDebug, fmt, ##__VA_ARGS__)
+#define LOG_PRINTF(fmt, ...) LOG_AT(eLogInfo, fmt, ##__VA_ARGS__)
+
+// never called, lets the compiler check the arguments against the format
+__attribute__((format(printf, 1, 2))) static inline void logCheckFormat(const char *fmt, ...)
+{
+}
+
+uint64_t logTimeMs();
+void logWriteRecord(const uint8_t *record, const size_t &len);
 
-#define LOG_PRINTF(fmt, ...) printf_internal(PSTR(fmt), ##__VA_ARGS__)
-void printf_internal(const char *fmt, ...);
+template <typename... Args>
+void logWrite(const uint8_t &module, const uint8_t &level, const char *fmt, const Args &... args)
+{
+	uint8_t record[LOG_RECORD_MAX];
+	logWriteRecord(record, logRecordEncode(record, logTimeMs(), module, level, fmt, args...));
+}
 
 void logInit();
+void logSetLevel(const LogModule &module, const LogLevel &level);
 char *msToTimeStr(uint64_t ms);
+char *epochToTimeStr(uint64_t ms);
+char *epochToTimeStr(uint64_t ms, char *buf, size_t len);
 
 void longDelay(uint32_t ms);
@@ -0,0 +1,121 @@
+#include "wallClock.h"
+
+WallClock::WallClock(const int64_t &stepThresholdUs, const int32_t &maxSlewPpm)
+	: m_stepThresholdUs(stepThresholdUs)
+	, m_maxSlewPpm(maxSlewPpm)
+	, m_generation(0)
+{
+	for (Segment &segment : m_segments) {
+		segment = Segment{0, 0, 0, 0, 0};
+	}
+}
+
+void WallClock::read(Segment &segment) const
+{
+	while (1) {
+		uint32_t generation = m_generation.load(std::memory_order_acquire);
+		segment = m_segments[generation % WALL_CLOCK_SEGMENTS];
+
+		// the writer only touches the slot of the next generation, ours is
+		// overwritten only after it published WALL_CLOCK_SEGMENTS - 1 more
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (m_generation.load(std::memory_order_relaxed) - generation < WALL_CLOCK_SEGMENTS - 1) {
+			return;
+		}
+	}
+}
+
+int64_t WallClock::epochUs(const Segment &segment, const int64_t &monotonicUs)
+{
+	int64_t elapsedUs = monotonicUs - segment.m_baseMonotonicUs;
+	int64_t slewedUs = (elapsedUs < 0) ? 0 : ((elapsedUs > segment.m_slewDurationUs) ? segment.m_slewDurationUs : elapsedUs);
+
+	int64_t epochUs = segment.m_baseEpochUs + elapsedUs + elapsedUs * segment.m_ratePpb / 1000000000;
+	if (segment.m_slewDurationUs) {
+		epochUs += segment.m_slewUs * slewedUs / segment.m_slewDurationUs;
+	}
+	return epochUs;
+}
+
+int64_t WallClock::epochUs(const int64_t &monotonicUs) const
+{
+	Segment segment;
+	read(segment);
+	return epochUs(segment, monotonicUs);
+}
+
+int64_t WallClock::slewRemainingUs(const int64_t &monotonicUs) const
+{
+	Segment segment;
+	read(segment);
+	if (!segment.m_slewDurationUs) {
+		return 0;
+	}
+
+	int64_t elapsedUs = monotonicUs - segment.m_baseMonotonicUs;
+	int64_t slewedUs = (elapsedUs < 0) ? 0 : ((elapsedUs > segment.m_slewDurationUs) ? segment.m_slewDurationUs : elapsedUs);
+	return segment.m_slewUs - segment.m_slewUs * slewedUs / segment.m_slewDurationUs;
+}
+
+bool WallClock::sync(const int64_t &epochUs, const int64_t &monotonicUs, const int32_t &ratePpb)
+{
+	// single writer, the current slot can be read directly
+	uint32_t generation = m_generation.load(std::memory_order_relaxed);
+	const Segment &current = m_segments[generation % WALL_CLOCK_SEGMENTS];
+
+	// the new segment continues where the current one is now
+	int64_t nowUs = WallClock::epochUs(current, monotonicUs);
+	int64_t errorUs = epochUs - nowUs;
+	bool step = !generation || errorUs > m_stepThresholdUs || errorUs < -m_stepThresholdUs;
+
+	Segment next;
+	next.m_baseMonotonicUs = monotonicUs;
+	next.m_ratePpb = ratePpb;
+	if (step) {
+		next.m_baseEpochUs = epochUs;
+		next.m_slewUs = 0;
+		next.m_slewDurationUs = 0;
+	} else {
+		next.m_baseEpochUs = nowUs;
+		next.m_slewUs = errorUs;
+		next.m_slewDurationUs = ((errorUs < 0) ? -errorUs : errorUs) * 1000000 / m_maxSlewPpm;
+	}
+
+	m_segments[(generation + 1) % WALL_CLOCK_SEGMENTS] = next;
+	m_generation.store(generation + 1, std::memory_order_release);
+	return step;
+}
+
+#if defined(ARDUINO)
+
+#include <esp_timer.h>
+#include "config.h"
+
+static WallClock g_clock(CLOCK_STEP_THRESHOLD_MS * 1000LL, CLOCK_SLEW_MAX_PPM);
+
+int64_t clockMonotonicUs()
+{
+	return esp_timer_get_time();
+}
+
+uint64_t clockEpochMs()
+{
+	return g_clock.epochUs(esp_timer_get_time()) / 1000;
+}
+
+int64_t clockEpochUs()
+{
+	return g_clock.epochUs(esp_timer_get_time());
+}
+
+bool clockSync(const int64_t &epochUs, const int64_t &monotonicUs, const int32_t &ratePpb)
+{
+	return g_clock.sync(epochUs, monotonicUs, ratePpb);
+}
+
+bool clockSynced()
+{
+	return g_clock.synced();
+}
+
+#endif
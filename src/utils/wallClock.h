@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+//
+// wall clock on top of a 64 bit monotonic microsecond counter (esp_timer)
+//
+// The mapping from monotonic to wall time is a segment: a base point, the
+// rate correction of the monotonic clock (its estimated drift) and a slew,
+// a rate offset applied until the correction is complete. Time
+// corrections below m_stepThresholdUs are slewed at most m_maxSlewPpm, so
+// the wall clock never jumps and never runs backwards. Larger ones (and
+// the first one) step the clock.
+//
+// Segments are published in a small ring with a generation counter. A
+// reader copies the current segment and checks the generation afterwards.
+// The copy is valid unless the writer reused the slot meanwhile, which
+// takes WALL_CLOCK_SEGMENTS - 1 corrections during a single read. Readers
+// never wait for the writer, a writer preempted mid-update does not block
+// them. There is a single writer (the NTP task).
+//
+// Before the first correction the wall clock is the monotonic time.
+// The class has no platform dependencies, so tools/clock_bench runs the
+// same code on the host.
+//
+
+#define WALL_CLOCK_SEGMENTS 4
+
+class WallClock {
+public:
+	WallClock(const int64_t &stepThresholdUs, const int32_t &maxSlewPpm);
+
+	// wall time in microseconds at the given monotonic time
+	int64_t epochUs(const int64_t &monotonicUs) const;
+
+	// correction: the wall time was epochUs at monotonicUs and advances ratePpb
+	// faster than the monotonic clock, returns true if the clock was stepped
+	bool sync(const int64_t &epochUs, const int64_t &monotonicUs, const int32_t &ratePpb = 0);
+
+	bool synced() const { return m_generation.load(std::memory_order_acquire) > 0; }
+
+	// correction still to be slewed at the given monotonic time
+	int64_t slewRemainingUs(const int64_t &monotonicUs) const;
+
+private:
+	struct Segment {
+		int64_t m_baseMonotonicUs;
+		int64_t m_baseEpochUs;
+		int64_t m_slewUs;			// signed correction spread over the slew duration
+		int64_t m_slewDurationUs;
+		int32_t m_ratePpb;
+	};
+
+	void read(Segment &segment) const;
+	static int64_t epochUs(const Segment &segment, const int64_t &monotonicUs);
+
+	int64_t m_stepThresholdUs;
+	int32_t m_maxSlewPpm;
+
+	Segment m_segments[WALL_CLOCK_SEGMENTS];
+	std::atomic<uint32_t> m_generation;
+};
+
+#if defined(ARDUINO)
+
+// microseconds since boot, never wraps
+int64_t clockMonotonicUs();
+
+// milliseconds since the epoch, wait-free
+uint64_t clockEpochMs();
+
+// NTP correction measured at the given monotonic time, returns true if the clock was stepped
+bool clockSync(const int64_t &epochUs, const int64_t &monotonicUs, const int32_t &ratePpb);
+
+// current wall time in microseconds
+int64_t clockEpochUs();
+
+bool clockSynced();
+
+#endif
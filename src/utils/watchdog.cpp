@@ -3,6 +3,7 @@
 #include "config.h"
 #include "utils.h"
 #include "display.h"
+#include "logRing.h"
 
 static SemaphoreHandle_t mutex = NULL;
 static uint32_t periodicResetTs = 0;
@@ -25,6 +26,7 @@ void watchdogTask(void *pvParameters __attribute__((unused)))
 			uint32_t red = Display::instance().rgbColor(Display::eColorRed);
 			Display::instance().fadeColors(red, red, red, 16);
 			delay(2000);
+			logRingFlush();
 			ESP.restart();
 		}
 
@@ -33,6 +35,7 @@ void watchdogTask(void *pvParameters __attribute__((unused)))
 			uint32_t red = Display::instance().rgbColor(Display::eColorRed);
 			Display::instance().fadeColors(red, red, red, 16);
 			delay(2000);
+			logRingFlush();
 			ESP.restart();
 		}
 
@@ -43,6 +46,7 @@ void watchdogTask(void *pvParameters __attribute__((unused)))
 			uint32_t red = Display::instance().rgbColor(Display::eColorRed);
 			Display::instance().fadeColors(red, red, red, 16);
 			delay(2000);
+			logRingFlush();
 			ESP.restart();
 		}
 
@@ -0,0 +1,137 @@
+#define LOG_MODULE eLogModuleServer
+
+#include <Arduino.h>
+#include <esp_partition.h>
+
+#include "webAssets.h"
+#include "config.h"
+#include "utils.h"
+
+#define WEB_ASSETS_MAGIC		"VWWW"
+#define WEB_ASSETS_VERSION		1
+#define WEB_ASSETS_PATH_LEN		48
+#define WEB_ASSETS_MIME_LEN		32
+
+//
+// on-flash layout, must match tools/build_www.py
+//
+
+struct __attribute__((packed)) WebAssetsHeader {
+	char m_magic[4];
+	uint16_t m_version;
+	uint16_t m_count;
+};
+
+struct __attribute__((packed)) WebAssetsEntry {
+	char m_path[WEB_ASSETS_PATH_LEN];
+	char m_mime[WEB_ASSETS_MIME_LEN];
+	uint32_t m_offset;
+	uint32_t m_length;
+	uint32_t m_etag;
+	uint32_t m_reserved;
+};
+
+static WebAsset g_assets[WEB_ASSETS_MAX];
+static size_t g_assetCount = 0;
+
+bool webAssetsInit()
+{
+	if (g_assetCount) {
+		return true;
+	}
+
+	const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)WEB_ASSETS_SUBTYPE, WEB_ASSETS_PARTITION);
+	if (!partition) {
+		LOG_PRINTF("Web assets partition not found, using built-in pages\n");
+		return false;
+	}
+
+	// map the whole partition into the data address space, it stays mapped forever
+	const void *mapped = NULL;
+	spi_flash_mmap_handle_t handle;
+	esp_err_t err = esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &mapped, &handle);
+	if (err != ESP_OK) {
+		LOG_PRINTF("Unable to map web assets partition (%d)\n", err);
+		return false;
+	}
+
+	const uint8_t *base = (const uint8_t *)mapped;
+	const WebAssetsHeader *header = (const WebAssetsHeader *)base;
+
+	if (memcmp(header->m_magic, WEB_ASSETS_MAGIC, sizeof(header->m_magic)) || header->m_version != WEB_ASSETS_VERSION) {
+		LOG_PRINTF("Web assets partition is empty or has unknown format\n");
+		spi_flash_munmap(handle);
+		return false;
+	}
+
+	const WebAssetsEntry *entries = (const WebAssetsEntry *)(base + sizeof(WebAssetsHeader));
+	size_t count = (header->m_count < WEB_ASSETS_MAX) ? header->m_count : WEB_ASSETS_MAX;
+
+	for (size_t i = 0; i < count; i++) {
+		const WebAssetsEntry &entry = entries[i];
+
+		// skip entries pointing outside of the partition
+		if ((uint64_t)entry.m_offset + entry.m_length > partition->size) {
+			LOG_PRINTF("Web asset #%u is corrupted, skipping\n", (unsigned)i);
+			continue;
+		}
+
+		WebAsset &asset = g_assets[g_assetCount++];
+		asset.m_path = entry.m_path;
+		asset.m_mime = entry.m_mime;
+		asset.m_data = base + entry.m_offset;
+		asset.m_length = entry.m_length;
+		asset.m_etag = entry.m_etag;
+		LOG_PRINTF("Web asset %s (%u bytes)\n", asset.m_path, asset.m_length);
+	}
+
+	return g_assetCount > 0;
+}
+
+size_t webAssetsCount()
+{
+	return g_assetCount;
+}
+
+const WebAsset *webAssetsAt(const size_t &index)
+{
+	return (index < g_assetCount) ? &g_assets[index] : NULL;
+}
+
+const WebAsset *webAssetsFind(const char *path)
+{
+	for (size_t i = 0; i < g_assetCount; i++) {
+		if (!strcmp(g_assets[i].m_path, path)) {
+			return &g_assets[i];
+		}
+	}
+	return NULL;
+}
+
+void webAssetsSend(AsyncWebServerRequest *request, const WebAsset *asset)
+{
+	char etag[12];
+	snprintf(etag, sizeof(etag), "\"%08x\"", asset->m_etag);
+
+	AsyncWebServerResponse *response;
+
+	// content did not change, a 304 still carries the validator and the
+	// caching headers of the 200 it stands for (RFC 7232 4.1)
+	if (request->hasHeader("If-None-Match") && request->header("If-None-Match") == etag) {
+		response = request->beginResponse(304);
+	} else {
+		// the response reads straight from the mapped flash, there is no RAM copy of the asset
+		response = request->beginResponse_P(200, asset->m_mime, asset->m_data, asset->m_length);
+		response->addHeader("Content-Encoding", "gzip");
+	}
+	response->addHeader("ETag", etag);
+
+	// html pages are not versioned by name, so always revalidate them
+	if (!strcmp(asset->m_mime, "text/html")) {
+		response->addHeader("Cache-Control", "no-cache");
+	} else {
+		response->addHeader("Cache-Control", "public, max-age=" + String(WEB_ASSETS_MAX_AGE));
+	}
+
+	request->send(response);
+}
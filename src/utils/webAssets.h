@@ -0,0 +1,23 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+//
+// gzipped static web assets served directly from the memory mapped "www"
+// flash partition (see tools/build_www.py for the image layout)
+//
+
+struct WebAsset {
+	const char *m_path;
+	const char *m_mime;
+	const uint8_t *m_data;
+	uint32_t m_length;
+	uint32_t m_etag;
+};
+
+bool webAssetsInit();
+size_t webAssetsCount();
+const WebAsset *webAssetsAt(const size_t &index);
+const WebAsset *webAssetsFind(const char *path);
+void webAssetsSend(AsyncWebServerRequest *request, const WebAsset *asset);
@@ -0,0 +1,190 @@
+#include "wifiReconnect.h"
+
+// driver disconnect reasons (wifi_err_reason_t), repeated here so the
+// policy builds on the host
+#define REASON_UNSPECIFIED				1
+#define REASON_AUTH_EXPIRE				2
+#define REASON_AUTH_LEAVE				3
+#define REASON_ASSOC_EXPIRE				4
+#define REASON_ASSOC_TOOMANY			5
+#define REASON_NOT_AUTHED				6
+#define REASON_NOT_ASSOCED				7
+#define REASON_ASSOC_LEAVE				8
+#define REASON_ASSOC_NOT_AUTHED			9
+#define REASON_DISASSOC_PWRCAP_BAD		10
+#define REASON_DISASSOC_SUPCHAN_BAD		11
+#define REASON_IE_INVALID				13
+#define REASON_MIC_FAILURE				14
+#define REASON_4WAY_HANDSHAKE_TIMEOUT	15
+#define REASON_GROUP_KEY_UPDATE_TIMEOUT	16
+#define REASON_IE_IN_4WAY_DIFFERS		17
+#define REASON_CIPHER_SUITE_REJECTED	24
+#define REASON_BEACON_TIMEOUT			200
+#define REASON_NO_AP_FOUND				201
+#define REASON_AUTH_FAIL				202
+#define REASON_ASSOC_FAIL				203
+#define REASON_HANDSHAKE_TIMEOUT		204
+#define REASON_CONNECTION_FAIL			205
+
+// security failures start backing off this many steps further
+#define SLOW_BACKOFF_STEPS				3
+
+WiFiReconnect::WiFiReconnect(const Config &config, const uint32_t &seed)
+	: m_config(config)
+	, m_random(seed ? seed : 1)
+	, m_connected(false)
+	, m_pending(false)
+	, m_next(eActionNone)
+	, m_dueMs(0)
+	, m_failures(0)
+	, m_fastAttempts(0)
+	, m_outageStartMs(0)
+	, m_lastOutageMs(0)
+{
+}
+
+WiFiReconnect::Strategy WiFiReconnect::classify(const uint8_t &reason)
+{
+	switch (reason) {
+	case REASON_ASSOC_TOOMANY:
+	case REASON_DISASSOC_PWRCAP_BAD:
+	case REASON_DISASSOC_SUPCHAN_BAD:
+	case REASON_NO_AP_FOUND:
+	case REASON_ASSOC_FAIL:
+	case REASON_CONNECTION_FAIL:
+		return eStrategyScan;
+
+	case REASON_IE_INVALID:
+	case REASON_MIC_FAILURE:
+	case REASON_4WAY_HANDSHAKE_TIMEOUT:
+	case REASON_IE_IN_4WAY_DIFFERS:
+	case REASON_CIPHER_SUITE_REJECTED:
+	case REASON_AUTH_FAIL:
+	case REASON_HANDSHAKE_TIMEOUT:
+		return eStrategySlow;
+
+	default:
+		// beacon timeout, expired / lost association and unknown reasons:
+		// the AP is probably still there
+		return eStrategyFast;
+	}
+}
+
+void WiFiReconnect::disconnected(const uint8_t &reason, const uint32_t &nowMs)
+{
+	if (!m_connected) {
+		// already reconnecting
+		return;
+	}
+
+	m_connected = false;
+	m_failures = 0;
+	m_fastAttempts = 0;
+	m_outageStartMs = nowMs;
+	schedule(classify(reason), nowMs);
+}
+
+void WiFiReconnect::attemptFinished(const bool &connected, const uint8_t &reason, const uint32_t &nowMs)
+{
+	if (connected) {
+		if (!m_connected) {
+			m_lastOutageMs = nowMs - m_outageStartMs;
+		}
+		m_connected = true;
+		m_pending = false;
+		m_failures = 0;
+		m_fastAttempts = 0;
+		return;
+	}
+
+	m_connected = false;
+	m_failures++;
+
+	schedule(classify(reason), nowMs);
+}
+
+WiFiReconnect::Action WiFiReconnect::poll(const uint32_t &nowMs)
+{
+	if (!m_pending || (int32_t)(nowMs - m_dueMs) < 0) {
+		return eActionNone;
+	}
+
+	m_pending = false;
+	if (m_next == eActionFast) {
+		m_fastAttempts++;
+	}
+	return m_next;
+}
+
+uint32_t WiFiReconnect::msToNextAttempt(const uint32_t &nowMs) const
+{
+	if (!m_pending) {
+		return UINT32_MAX;
+	}
+
+	int32_t remaining = (int32_t)(m_dueMs - nowMs);
+	return remaining > 0 ? remaining : 0;
+}
+
+const char *WiFiReconnect::actionName(const Action &action)
+{
+	switch (action) {
+	case eActionFast:
+		return "fast";
+	case eActionScan:
+		return "scan";
+	default:
+		return "none";
+	}
+}
+
+void WiFiReconnect::schedule(const Strategy &strategy, const uint32_t &nowMs)
+{
+	uint32_t delayMs;
+
+	if (strategy == eStrategyFast && m_fastAttempts < m_config.m_fastRetries) {
+		// the first retry right away, then back off
+		m_next = eActionFast;
+		delayMs = backoff(m_failures, m_config.m_maxBackoffMs);
+	} else if (strategy == eStrategySlow) {
+		m_next = eActionScan;
+		delayMs = backoff(m_failures + SLOW_BACKOFF_STEPS, m_config.m_maxBackoffMs);
+	} else {
+		// also when the BSSID wasn't found on its channel during the fast
+		// retries, it's more likely gone than back in a moment
+		delayMs = backoff(m_failures, m_config.m_maxScanBackoffMs);
+		m_next = eActionScan;
+	}
+
+	m_dueMs = nowMs + delayMs;
+	m_pending = true;
+}
+
+uint32_t WiFiReconnect::backoff(const uint32_t &exponent, const uint32_t &maxMs)
+{
+	if (!exponent) {
+		return 0;
+	}
+
+	// min * 2^(exponent - 1), capped
+	uint32_t delayMs = m_config.m_minBackoffMs;
+	for (uint32_t i = 1; i < exponent && delayMs < maxMs; i++) {
+		delayMs *= 2;
+	}
+	if (delayMs > maxMs) {
+		delayMs = maxMs;
+	}
+
+	// "equal jitter": half fixed, half random, so devices that lost the
+	// same AP don't come back in lockstep
+	return delayMs / 2 + random() % (delayMs / 2 + 1);
+}
+
+uint32_t WiFiReconnect::random()
+{
+	// xorshift32
+	m_random ^= m_random << 13;
+	m_random ^= m_random >> 17;
+	m_random ^= m_random << 5;
+	return m_random;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+
+//
+// WiFi reconnection policy driven by the disconnect reasons reported by
+// the driver (wifi_err_reason_t). A lost link is retried on the same BSSID
+// first. An AP that is gone or refuses us triggers a full scan, and
+// security failures back off further. Failed attempts back off
+// exponentially with jitter, up to a limit, and never give up. Scans for a
+// missing or full AP don't bother anyone else, so they have a lower limit
+// and catch a flapping router in one of its short up phases.
+//
+// The class only decides what to do and when, the caller performs the
+// attempts. It has no platform dependencies, so tools/reconnect_sim runs
+// the same code on the host.
+//
+
+class WiFiReconnect {
+public:
+	enum Action {
+		eActionNone,		// connected, or the next attempt is not due yet
+		eActionFast,		// reconnect to the last BSSID and channel
+		eActionScan,		// scan and connect to the best known network
+	};
+
+	struct Config {
+		uint32_t m_minBackoffMs;	// delay after the first failed attempt
+		uint32_t m_maxBackoffMs;	// backoff limit
+		uint32_t m_maxScanBackoffMs;	// backoff limit while the AP is missing or full
+		uint32_t m_fastRetries;		// same BSSID attempts before falling back to a scan
+	};
+
+	WiFiReconnect(const Config &config, const uint32_t &seed);
+
+	// link lost with the given driver reason
+	void disconnected(const uint8_t &reason, const uint32_t &nowMs);
+
+	// result of an attempt, reason is the last disconnect reason seen during it
+	void attemptFinished(const bool &connected, const uint8_t &reason, const uint32_t &nowMs);
+
+	// returns the next action once it is due, the caller has to report
+	// its result with attemptFinished()
+	Action poll(const uint32_t &nowMs);
+
+	// time until poll() returns an action, UINT32_MAX if nothing is scheduled
+	uint32_t msToNextAttempt(const uint32_t &nowMs) const;
+
+	bool connected() const { return m_connected; }
+
+	// failed attempts of the current outage
+	uint32_t failures() const { return m_failures; }
+
+	// disconnect -> connected time of the last outage
+	uint32_t lastOutageMs() const { return m_lastOutageMs; }
+
+	static const char *actionName(const Action &action);
+
+private:
+	enum Strategy {
+		eStrategyFast,		// link loss, the AP is most likely still there
+		eStrategyScan,		// AP gone or full, look for another one
+		eStrategySlow,		// authentication / security failure, scan and back off more
+	};
+
+	static Strategy classify(const uint8_t &reason);
+
+	void schedule(const Strategy &strategy, const uint32_t &nowMs);
+	uint32_t backoff(const uint32_t &exponent, const uint32_t &maxMs);
+	uint32_t random();
+
+	Config m_config;
+	uint32_t m_random;
+
+	bool m_connected;
+	bool m_pending;
+	Action m_next;
+	uint32_t m_dueMs;
+
+	uint32_t m_failures;
+	uint32_t m_fastAttempts;
+	uint32_t m_outageStartMs;
+	uint32_t m_lastOutageMs;
+};
@@ -0,0 +1,200 @@
+#define LOG_MODULE eLogModuleWifi
+
+#include <Arduino.h>
+
+#include "wifiRoam.h"
+#include "wifiScan.h"
+#include "metrics.h"
+#include "utils.h"
+#include "watchdog.h"
+
+// the moving average follows 1/ROAM_RSSI_WEIGHT of every new sample
+#define ROAM_RSSI_WEIGHT		4
+
+static String bssidStr(const uint8_t *bssid)
+{
+	char buffer[18];
+	snprintf(buffer, sizeof(buffer), "%02X:%02X:%02X:%02X:%02X:%02X", bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5]);
+	return buffer;
+}
+
+WiFiRoam::WiFiRoam()
+{
+	m_mutex = xSemaphoreCreateMutex();
+
+	memset(m_bssid, 0, sizeof(m_bssid));
+	m_rssiAvg = 0;
+	m_rssiCount = 0;
+	m_lastSampleMs = 0;
+	m_roamCount = 0;
+	m_lastScanMs = 0;
+	m_lastRoamMs = 0;
+	m_scanned = false;
+	m_roamedOnce = false;
+	m_lastChannels = 0;
+}
+
+void WiFiRoam::sample(const uint32_t &nowMs)
+{
+	int32_t rssi = WiFi.RSSI();
+	uint8_t *bssid = WiFi.BSSID();
+
+	if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+		// a new BSSID (roam or reconnect) starts a new average
+		if (!bssid || memcmp(bssid, m_bssid, sizeof(m_bssid)) || !m_lastSampleMs) {
+			if (bssid) {
+				memcpy(m_bssid, bssid, sizeof(m_bssid));
+			}
+			m_rssiAvg = rssi;
+		} else {
+			m_rssiAvg += (rssi - m_rssiAvg) / ROAM_RSSI_WEIGHT;
+		}
+
+		m_rssiHistory[m_rssiCount % ROAM_RSSI_HISTORY] = rssi;
+		m_rssiCount++;
+		m_lastSampleMs = nowMs;
+		xSemaphoreGive(m_mutex);
+	}
+}
+
+void WiFiRoam::scanChannel(const uint8_t &channel, const String &ssid, const uint8_t *current, Candidate &best)
+{
+	std::vector<WiFiScanEntry> results;
+	wifiScan(1 << channel, ssid.c_str(), ROAM_SCAN_DWELL_MS, results);
+	metricsIncrement(eMetricsWifiRoamScans);
+
+	for (const WiFiScanEntry &entry : results) {
+		if (ssid != entry.m_ssid || !memcmp(entry.m_bssid, current, sizeof(m_bssid))) {
+			continue;
+		}
+
+		if (entry.m_rssi > best.m_rssi) {
+			memcpy(best.m_bssid, entry.m_bssid, sizeof(best.m_bssid));
+			best.m_channel = entry.m_channel;
+			best.m_rssi = entry.m_rssi;
+		}
+	}
+}
+
+bool WiFiRoam::poll(const uint32_t &nowMs, const uint16_t &channels, Candidate &candidate)
+{
+	if (!m_lastSampleMs || nowMs - m_lastSampleMs >= ROAM_RSSI_SAMPLE_S * 1000) {
+		sample(nowMs);
+	}
+
+	// json() reads the average from other tasks, work on a copy
+	float rssiAvg = 0;
+	uint8_t bssid[sizeof(m_bssid)];
+	if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+		rssiAvg = m_rssiAvg;
+		memcpy(bssid, m_bssid, sizeof(bssid));
+		xSemaphoreGive(m_mutex);
+	}
+
+	// rate limiting: scan less often while the signal is good, never roam twice in a row quickly
+	uint32_t interval = (rssiAvg < ROAM_RSSI_WEAK_DBM ? ROAM_SCAN_INTERVAL_WEAK_S : ROAM_SCAN_INTERVAL_S) * 1000;
+	if (m_scanned && nowMs - m_lastScanMs < interval) {
+		return false;
+	}
+	if (m_roamedOnce && nowMs - m_lastRoamMs < ROAM_MIN_INTERVAL_S * 1000) {
+		return false;
+	}
+
+	m_scanned = true;
+	m_lastScanMs = nowMs;
+	m_lastChannels = channels;
+
+	String ssid = WiFi.SSID();
+	Candidate best;
+	memset(&best, 0, sizeof(best));
+	best.m_rssi = INT32_MIN;
+
+	for (uint8_t channel = 1; channel <= 14; channel++) {
+		if (channels & (1 << channel)) {
+			scanChannel(channel, ssid, bssid, best);
+			watchdogReset();
+		}
+	}
+
+	if (best.m_rssi == INT32_MIN) {
+		return false;
+	}
+
+	LOG_PRINTF("[ROAM] best other BSSID %s channel %d, %d dBm (current %d dBm average)\n", bssidStr(best.m_bssid).c_str(), best.m_channel, best.m_rssi, (int)rssiAvg);
+
+	if (best.m_rssi < rssiAvg + ROAM_HYSTERESIS_DB) {
+		return false;
+	}
+
+	candidate = best;
+	return true;
+}
+
+void WiFiRoam::roamed(const Candidate &candidate, const bool &success, const uint32_t &nowMs)
+{
+	if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+		Event &event = m_roams[m_roamCount % ROAM_EVENT_HISTORY];
+		event.m_uptimeS = nowMs / 1000;
+		memcpy(event.m_from, m_bssid, sizeof(event.m_from));
+		memcpy(event.m_to, candidate.m_bssid, sizeof(event.m_to));
+		event.m_fromRssi = m_rssiAvg;
+		event.m_toRssi = candidate.m_rssi;
+		event.m_channel = candidate.m_channel;
+		event.m_success = success;
+		m_roamCount++;
+		xSemaphoreGive(m_mutex);
+	}
+
+	m_roamedOnce = true;
+	m_lastRoamMs = nowMs;
+
+	// start over with the new BSSID right away
+	m_lastSampleMs = 0;
+}
+
+void WiFiRoam::json(JsonDocument &doc)
+{
+	doc["ssid"] = WiFi.SSID();
+	doc["bssid"] = WiFi.BSSIDstr();
+	doc["channel"] = WiFi.channel();
+	doc["rssi"] = WiFi.RSSI();
+
+	if (xSemaphoreTake(m_mutex, portMAX_DELAY) == pdTRUE) {
+		doc["rssiAvg"] = (int)m_rssiAvg;
+
+		JsonArray channels = doc.createNestedArray("scanChannels");
+		for (uint8_t channel = 1; channel <= 14; channel++) {
+			if (m_lastChannels & (1 << channel)) {
+				channels.add(channel);
+			}
+		}
+		doc["lastScanS"] = m_scanned ? m_lastScanMs / 1000 : 0;
+
+		// oldest first
+		JsonArray roams = doc.createNestedArray("roams");
+		uint32_t first = m_roamCount > ROAM_EVENT_HISTORY ? m_roamCount - ROAM_EVENT_HISTORY : 0;
+		for (uint32_t i = first; i < m_roamCount; i++) {
+			const Event &event = m_roams[i % ROAM_EVENT_HISTORY];
+			JsonObject obj = roams.createNestedObject();
+			obj["uptimeS"] = event.m_uptimeS;
+			obj["from"] = bssidStr(event.m_from);
+			obj["to"] = bssidStr(event.m_to);
+			obj["fromRssi"] = event.m_fromRssi;
+			obj["toRssi"] = event.m_toRssi;
+			obj["channel"] = event.m_channel;
+			obj["success"] = event.m_success;
+		}
+
+		// RSSI every ROAM_RSSI_SAMPLE_S, oldest first, the last one taken at lastSampleS
+		JsonObject history = doc.createNestedObject("rssiHistory");
+		history["intervalS"] = ROAM_RSSI_SAMPLE_S;
+		history["lastSampleS"] = m_lastSampleMs / 1000;
+		JsonArray values = history.createNestedArray("values");
+		first = m_rssiCount > ROAM_RSSI_HISTORY ? m_rssiCount - ROAM_RSSI_HISTORY : 0;
+		for (uint32_t i = first; i < m_rssiCount; i++) {
+			values.add(m_rssiHistory[i % ROAM_RSSI_HISTORY]);
+		}
+
+		xSemaphoreGive(m_mutex);
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <ArduinoJson.h>
+#include "config.h"
+
+//
+// roaming between BSSIDs of the connected SSID
+//
+// While connected, the RSSI is sampled every ROAM_RSSI_SAMPLE_S into a
+// history and a moving average. Every ROAM_SCAN_INTERVAL_S, or
+// ROAM_SCAN_INTERVAL_WEAK_S while the signal is weak, the known channels
+// are scanned one at a time for the connected SSID. Known channels are
+// ROAM_CHANNELS plus the ones learned by WiFiSelector. A BSSID that is
+// ROAM_HYSTERESIS_DB stronger than the average is returned as a roaming
+// candidate. The caller performs the roam and reports the result, which
+// is kept as a roam event.
+//
+
+class WiFiRoam {
+public:
+	struct Candidate {
+		uint8_t m_bssid[6];
+		int32_t m_channel;
+		int32_t m_rssi;
+	};
+
+	WiFiRoam();
+
+	// call periodically while connected, returns true with a candidate to roam to
+	bool poll(const uint32_t &nowMs, const uint16_t &channels, Candidate &candidate);
+
+	// result of a roam to the candidate returned by poll()
+	void roamed(const Candidate &candidate, const bool &success, const uint32_t &nowMs);
+
+	// state, roam events and RSSI history, as served by /diag/wifi
+	void json(JsonDocument &doc);
+
+private:
+	struct Event {
+		uint32_t m_uptimeS;
+		uint8_t m_from[6];
+		uint8_t m_to[6];
+		int8_t m_fromRssi;
+		int8_t m_toRssi;
+		uint8_t m_channel;
+		bool m_success;
+	};
+
+	void sample(const uint32_t &nowMs);
+	void scanChannel(const uint8_t &channel, const String &ssid, const uint8_t *current, Candidate &best);
+
+	SemaphoreHandle_t m_mutex;
+
+	// moving average of the current BSSID
+	uint8_t m_bssid[6];
+	float m_rssiAvg;
+
+	// RSSI history ring
+	int8_t m_rssiHistory[ROAM_RSSI_HISTORY];
+	uint32_t m_rssiCount;
+	uint32_t m_lastSampleMs;
+
+	// roam events ring
+	Event m_roams[ROAM_EVENT_HISTORY];
+	uint32_t m_roamCount;
+
+	uint32_t m_lastScanMs;
+	uint32_t m_lastRoamMs;
+	bool m_scanned;
+	bool m_roamedOnce;
+	uint16_t m_lastChannels;
+};
@@ -0,0 +1,157 @@
+#include <Arduino.h>
+#include <rom/crc.h>
+#include <esp_clk.h>
+#include <tcpip_adapter.h>
+#include <lwip/dhcp.h>
+#include <lwip/prot/dhcp.h>
+
+#include "wifiRtc.h"
+#include "config.h"
+
+#define WIFI_RTC_MAGIC			0x57525443	// "WRTC"
+
+#define WIFI_RTC_PARAMS_VALID	(1 << 0)
+#define WIFI_RTC_LEASE_VALID	(1 << 1)
+
+// plain data only, anything with a constructor would be reset on every boot
+struct WifiRtcState {
+	uint32_t m_magic;
+	uint32_t m_flags;
+	char m_ssid[SSID_MAX_LEN];
+	char m_password[PASS_MAX_LEN];
+	uint8_t m_bssid[6];
+	int32_t m_channel;
+	WifiRtcLease m_lease;
+	uint32_t m_slowConnectMs;
+	uint32_t m_crc;
+};
+
+static RTC_NOINIT_ATTR WifiRtcState g_rtc;
+
+static uint32_t checksum()
+{
+	return crc32_le(0, (const uint8_t *)&g_rtc, offsetof(WifiRtcState, m_crc));
+}
+
+static bool valid()
+{
+	return g_rtc.m_magic == WIFI_RTC_MAGIC && g_rtc.m_crc == checksum();
+}
+
+static void commit()
+{
+	g_rtc.m_magic = WIFI_RTC_MAGIC;
+	g_rtc.m_crc = checksum();
+}
+
+// starts from scratch if the content is garbage (power-on)
+static void prepare()
+{
+	if (!valid()) {
+		memset((void *)&g_rtc, 0, sizeof(g_rtc));
+	}
+}
+
+bool wifiRtcLoadParams(WiFiMultiSSID::LastParams &params)
+{
+	if (!valid() || !(g_rtc.m_flags & WIFI_RTC_PARAMS_VALID)) {
+		return false;
+	}
+
+	memset((void *)&params, 0, sizeof(params));
+	memcpy(params.m_credentials.m_ssid, g_rtc.m_ssid, sizeof(params.m_credentials.m_ssid));
+	memcpy(params.m_credentials.m_password, g_rtc.m_password, sizeof(params.m_credentials.m_password));
+	memcpy(params.m_bssid, g_rtc.m_bssid, sizeof(params.m_bssid));
+	params.m_channel = g_rtc.m_channel;
+	return true;
+}
+
+void wifiRtcSaveParams(const WiFiMultiSSID::LastParams &params)
+{
+	prepare();
+
+	// a different network invalidates the lease
+	if (strncmp(g_rtc.m_ssid, params.m_credentials.m_ssid, sizeof(g_rtc.m_ssid))) {
+		g_rtc.m_flags &= ~WIFI_RTC_LEASE_VALID;
+	}
+
+	memcpy(g_rtc.m_ssid, params.m_credentials.m_ssid, sizeof(g_rtc.m_ssid));
+	memcpy(g_rtc.m_password, params.m_credentials.m_password, sizeof(g_rtc.m_password));
+	memcpy(g_rtc.m_bssid, params.m_bssid, sizeof(g_rtc.m_bssid));
+	g_rtc.m_channel = params.m_channel;
+	g_rtc.m_flags |= WIFI_RTC_PARAMS_VALID;
+	commit();
+}
+
+bool wifiRtcLoadLease(const char *ssid, WifiRtcLease &lease, uint32_t &remainingS)
+{
+	if (!valid() || !(g_rtc.m_flags & WIFI_RTC_LEASE_VALID) || strncmp(g_rtc.m_ssid, ssid, sizeof(g_rtc.m_ssid))) {
+		return false;
+	}
+
+	// a regular DHCP client would start renewing at T1, so don't use it longer
+	uint64_t renewUs = g_rtc.m_lease.m_obtainedUs + (uint64_t)g_rtc.m_lease.m_leaseS * 1000000 / 2;
+	uint64_t nowUs = wifiRtcTimeUs();
+	if (nowUs < g_rtc.m_lease.m_obtainedUs || nowUs + (uint64_t)WIFI_RTC_LEASE_MARGIN_S * 1000000 >= renewUs) {
+		return false;
+	}
+
+	lease = g_rtc.m_lease;
+	remainingS = (renewUs - nowUs) / 1000000;
+	return true;
+}
+
+void wifiRtcSaveLease(WifiRtcLease &lease)
+{
+	prepare();
+	lease.m_obtainedUs = wifiRtcTimeUs();
+	g_rtc.m_lease = lease;
+	g_rtc.m_flags |= WIFI_RTC_LEASE_VALID;
+	commit();
+}
+
+void wifiRtcInvalidateLease()
+{
+	if (valid()) {
+		g_rtc.m_flags &= ~WIFI_RTC_LEASE_VALID;
+		commit();
+	}
+}
+
+void wifiRtcInvalidate()
+{
+	prepare();
+	uint32_t slowConnectMs = g_rtc.m_slowConnectMs;
+	memset((void *)&g_rtc, 0, sizeof(g_rtc));
+	g_rtc.m_slowConnectMs = slowConnectMs;
+	commit();
+}
+
+uint32_t wifiRtcSlowConnectMs()
+{
+	return valid() ? g_rtc.m_slowConnectMs : 0;
+}
+
+void wifiRtcSetSlowConnectMs(const uint32_t &ms)
+{
+	prepare();
+	g_rtc.m_slowConnectMs = ms;
+	commit();
+}
+
+uint64_t wifiRtcTimeUs()
+{
+	return esp_clk_rtc_time();
+}
+
+uint32_t wifiRtcDhcpLeaseS()
+{
+	struct netif *netif = NULL;
+	if (tcpip_adapter_get_netif(TCPIP_ADAPTER_IF_STA, (void **)&netif) != ESP_OK || !netif) {
+		return 0;
+	}
+
+	struct dhcp *dhcp = netif_dhcp_data(netif);
+
+	return (dhcp && dhcp->state == DHCP_STATE_BOUND) ? dhcp->offered_t0_lease : 0;
+}
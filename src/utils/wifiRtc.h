@@ -0,0 +1,44 @@
+#pragma once
+
+#include <Arduino.h>
+#include "WiFiMultiSSID.h"
+
+//
+// last connection parameters and DHCP lease kept in RTC memory, so warm
+// reboots (watchdog, periodic reset, OTA) reconnect without reading SPIFFS
+// and without running DHCP. The content is lost on power-on, which is
+// detected by the checksum.
+//
+
+struct WifiRtcLease {
+	uint32_t m_ip;
+	uint32_t m_gateway;
+	uint32_t m_netmask;
+	uint32_t m_dns1;
+	uint32_t m_dns2;
+	uint32_t m_leaseS;			// lease time granted by the server
+	uint64_t m_obtainedUs;		// RTC clock when the lease was obtained
+};
+
+// false after power-on or when nothing was stored yet
+bool wifiRtcLoadParams(WiFiMultiSSID::LastParams &params);
+void wifiRtcSaveParams(const WiFiMultiSSID::LastParams &params);
+
+// false when there is no lease for the SSID or it is past its renewal
+// time (T1, half of the lease), remainingS is the time left until T1
+bool wifiRtcLoadLease(const char *ssid, WifiRtcLease &lease, uint32_t &remainingS);
+void wifiRtcSaveLease(WifiRtcLease &lease);
+void wifiRtcInvalidateLease();
+
+// forgets everything, e.g. when the configuration is erased
+void wifiRtcInvalidate();
+
+// boot -> IP time of the last boot that had to scan and run DHCP
+uint32_t wifiRtcSlowConnectMs();
+void wifiRtcSetSlowConnectMs(const uint32_t &ms);
+
+// current value of the RTC clock, keeps running across software resets
+uint64_t wifiRtcTimeUs();
+
+// lease time of the current DHCP lease, 0 if unknown
+uint32_t wifiRtcDhcpLeaseS();
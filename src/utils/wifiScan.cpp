@@ -0,0 +1,86 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_wifi.h>
+
+#include "wifiScan.h"
+
+#define WIFI_SCAN_EVENT_DONE	BIT0
+
+// how often the periodic callback runs while waiting
+#define WIFI_SCAN_SLICE_MS		100
+
+static EventGroupHandle_t g_events = NULL;
+
+static bool scanOnce(const uint8_t &channel, const char *ssid, const uint32_t &dwellMs, std::vector<WiFiScanEntry> &results, std::function<void(void)> periodicCb)
+{
+	wifi_scan_config_t config;
+	memset(&config, 0, sizeof(config));
+	config.ssid = (uint8_t *)ssid;
+	config.channel = channel;
+	config.scan_type = WIFI_SCAN_TYPE_ACTIVE;
+	config.scan_time.active.min = dwellMs / 2;
+	config.scan_time.active.max = dwellMs;
+
+	// results of a previous scan would leak otherwise
+	WiFi.scanDelete();
+	xEventGroupClearBits(g_events, WIFI_SCAN_EVENT_DONE);
+
+	if (esp_wifi_scan_start(&config, false) != ESP_OK) {
+		return false;
+	}
+
+	// the WiFi library has fetched the results when the event bit is set
+	uint32_t timeoutMs = dwellMs * (channel ? 1 : 14) + 1000;
+	uint32_t startMs = millis();
+	while (!(xEventGroupWaitBits(g_events, WIFI_SCAN_EVENT_DONE, pdTRUE, pdTRUE, pdMS_TO_TICKS(WIFI_SCAN_SLICE_MS)) & WIFI_SCAN_EVENT_DONE)) {
+		if (millis() - startMs >= timeoutMs) {
+			esp_wifi_scan_stop();
+			return false;
+		}
+
+		if (periodicCb) {
+			periodicCb();
+		}
+	}
+
+	int16_t count = WiFi.scanComplete();
+	for (int16_t i = 0; i < count; i++) {
+		WiFiScanEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		strncpy(entry.m_ssid, WiFi.SSID(i).c_str(), sizeof(entry.m_ssid) - 1);
+		uint8_t *bssid = WiFi.BSSID(i);
+		if (bssid) {
+			memcpy(entry.m_bssid, bssid, sizeof(entry.m_bssid));
+		}
+		entry.m_channel = WiFi.channel(i);
+		entry.m_rssi = WiFi.RSSI(i);
+		results.push_back(entry);
+	}
+
+	WiFi.scanDelete();
+	return count >= 0;
+}
+
+bool wifiScan(const uint16_t &channels, const char *ssid, const uint32_t &dwellMs, std::vector<WiFiScanEntry> &results, std::function<void(void)> periodicCb)
+{
+	if (!g_events) {
+		g_events = xEventGroupCreate();
+		WiFi.onEvent(
+			[](system_event_id_t event, system_event_info_t info) -> void {
+				xEventGroupSetBits(g_events, WIFI_SCAN_EVENT_DONE);
+			},
+			SYSTEM_EVENT_SCAN_DONE);
+	}
+
+	if (channels == WIFI_ALL_CHANNELS) {
+		return scanOnce(0, ssid, dwellMs, results, periodicCb);
+	}
+
+	bool ok = true;
+	for (uint8_t channel = 1; channel <= 14; channel++) {
+		if (channels & (1 << channel)) {
+			ok = scanOnce(channel, ssid, dwellMs, results, periodicCb) && ok;
+		}
+	}
+	return ok;
+}
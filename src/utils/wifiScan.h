@@ -0,0 +1,17 @@
+#pragma once
+
+#include <Arduino.h>
+#include <vector>
+#include <functional>
+#include "wifiSelector.h"
+
+//
+// event driven WiFi scans: the caller sleeps until SYSTEM_EVENT_SCAN_DONE
+// instead of polling the scan status
+//
+// The channels of the mask are scanned one at a time, WIFI_ALL_CHANNELS
+// is a single scan of all channels. With an SSID only that network is
+// probed for. Results are appended, false is returned if any scan failed.
+//
+
+bool wifiScan(const uint16_t &channels, const char *ssid, const uint32_t &dwellMs, std::vector<WiFiScanEntry> &results, std::function<void(void)> periodicCb = 0);
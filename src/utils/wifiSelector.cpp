@@ -0,0 +1,247 @@
+#include "wifiSelector.h"
+#include <algorithm>
+#include <string.h>
+
+// serialized bytes per network after the SSID, and per access point
+#define WIFI_SELECTOR_NETWORK_LEN	2
+#define WIFI_SELECTOR_STATION_LEN	14
+
+// statistics are halved at this many attempts, so old history fades out
+#define WIFI_SELECTOR_MAX_ATTEMPTS	64
+
+// the connect time average follows 1/WIFI_SELECTOR_CONNECT_WEIGHT of every new attempt
+#define WIFI_SELECTOR_CONNECT_WEIGHT	4
+
+WiFiSelector::WiFiSelector(const Config &config)
+	: m_config(config)
+	, m_dirty(false)
+	, m_failed(false)
+{
+}
+
+WiFiSelector::Network *WiFiSelector::find(const std::string &ssid)
+{
+	for (Network &network : m_networks) {
+		if (network.m_ssid == ssid) {
+			return &network;
+		}
+	}
+	return nullptr;
+}
+
+const WiFiSelector::Station *WiFiSelector::findStation(const uint8_t *bssid) const
+{
+	for (const Station &station : m_stations) {
+		if (!memcmp(station.m_bssid, bssid, sizeof(station.m_bssid))) {
+			return &station;
+		}
+	}
+	return nullptr;
+}
+
+void WiFiSelector::setNetworks(const std::vector<std::string> &ssids)
+{
+	std::vector<Network> networks;
+	for (const std::string &ssid : ssids) {
+		Network *known = find(ssid);
+		networks.push_back(known ? *known : Network{ssid, 0});
+	}
+	m_networks.swap(networks);
+}
+
+uint16_t WiFiSelector::channels() const
+{
+	uint16_t channels = 0;
+	for (const Network &network : m_networks) {
+		channels |= network.m_channels;
+	}
+	return channels;
+}
+
+void WiFiSelector::scanned(const std::vector<WiFiScanEntry> &scan, const uint16_t &probed)
+{
+	for (Network &network : m_networks) {
+		uint16_t seen = 0;
+		for (const WiFiScanEntry &entry : scan) {
+			if (network.m_ssid == entry.m_ssid && entry.m_channel < 16) {
+				seen |= (1 << entry.m_channel);
+			}
+		}
+
+		// an SSID that is not seen at all may just be down, keep its channels
+		if (!seen) {
+			continue;
+		}
+
+		// the probed channels where it was not seen are forgotten
+		uint16_t channels = (network.m_channels & ~probed) | seen;
+		if (channels != network.m_channels) {
+			network.m_channels = channels;
+			m_dirty = true;
+		}
+	}
+}
+
+float WiFiSelector::score(const WiFiScanEntry &entry) const
+{
+	const Station *station = findStation(entry.m_bssid);
+
+	// 50% without history, approaching the measured rate with more attempts
+	float successRate = station ? (station->m_successes + 1.0f) / (station->m_attempts + 2.0f) : 0.5f;
+	float connectS = station ? station->m_connectMs / 1000.0f : 0.0f;
+
+	return entry.m_rssi + m_config.m_successWeightDb * successRate - m_config.m_connectPenaltyDbPerS * connectS;
+}
+
+void WiFiSelector::rank(const std::vector<WiFiScanEntry> &scan, std::vector<Candidate> &candidates) const
+{
+	candidates.clear();
+
+	for (const WiFiScanEntry &entry : scan) {
+		for (size_t i = 0; i < m_networks.size(); i++) {
+			if (m_networks[i].m_ssid != entry.m_ssid) {
+				continue;
+			}
+
+			Candidate candidate;
+			candidate.m_network = i;
+			memcpy(candidate.m_bssid, entry.m_bssid, sizeof(candidate.m_bssid));
+			candidate.m_channel = entry.m_channel;
+			candidate.m_rssi = entry.m_rssi;
+			candidate.m_score = score(entry);
+			candidates.push_back(candidate);
+			break;
+		}
+	}
+
+	std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+		return a.m_score > b.m_score;
+	});
+}
+
+void WiFiSelector::attemptFinished(const std::string &ssid, const uint8_t *bssid, const uint8_t &channel, const bool &success, const uint32_t &connectMs)
+{
+	Network *network = find(ssid);
+	if (!network) {
+		return;
+	}
+
+	// move the access point to the front, the least recently used one drops out
+	Station station = {{0}, 0, 0, 0};
+	const Station *known = findStation(bssid);
+	if (known) {
+		station = *known;
+		m_stations.erase(m_stations.begin() + (known - m_stations.data()));
+	} else {
+		memcpy(station.m_bssid, bssid, sizeof(station.m_bssid));
+		if (m_stations.size() >= WIFI_SELECTOR_MAX_BSSIDS) {
+			m_stations.pop_back();
+		}
+	}
+
+	if (station.m_attempts >= WIFI_SELECTOR_MAX_ATTEMPTS) {
+		station.m_attempts /= 2;
+		station.m_successes /= 2;
+	}
+	station.m_attempts++;
+
+	if (success) {
+		if (!station.m_successes) {
+			station.m_connectMs = connectMs;
+			m_dirty = true;
+		} else {
+			station.m_connectMs += ((int32_t)connectMs - (int32_t)station.m_connectMs) / WIFI_SELECTOR_CONNECT_WEIGHT;
+		}
+		station.m_successes++;
+
+		if (channel > 0 && channel < 16 && !(network->m_channels & (1 << channel))) {
+			network->m_channels |= (1 << channel);
+			m_dirty = true;
+		}
+
+		m_dirty = m_dirty || m_failed;
+	} else {
+		// persisted along with the next success, not to write flash during outages
+		m_failed = true;
+	}
+
+	m_stations.insert(m_stations.begin(), station);
+}
+
+static void put16(std::vector<uint8_t> &out, const uint16_t &value)
+{
+	out.push_back(value & 0xff);
+	out.push_back(value >> 8);
+}
+
+static uint16_t get16(const uint8_t *data)
+{
+	return data[0] | (data[1] << 8);
+}
+
+void WiFiSelector::serialize(std::vector<uint8_t> &out)
+{
+	// network count, then per network: SSID length, SSID, channels
+	out.clear();
+	out.push_back(m_networks.size());
+	for (const Network &network : m_networks) {
+		out.push_back(network.m_ssid.size());
+		out.insert(out.end(), network.m_ssid.begin(), network.m_ssid.end());
+		put16(out, network.m_channels);
+	}
+
+	// access point count, then per access point: BSSID, attempts, successes, connect ms
+	out.push_back(m_stations.size());
+	for (const Station &station : m_stations) {
+		out.insert(out.end(), station.m_bssid, station.m_bssid + sizeof(station.m_bssid));
+		put16(out, station.m_attempts);
+		put16(out, station.m_successes);
+		put16(out, station.m_connectMs & 0xffff);
+		put16(out, station.m_connectMs >> 16);
+	}
+
+	m_dirty = false;
+	m_failed = false;
+}
+
+bool WiFiSelector::deserialize(const std::vector<uint8_t> &data)
+{
+	size_t offset = 0;
+	if (data.empty()) {
+		return false;
+	}
+
+	uint8_t networks = data[offset++];
+	for (uint8_t i = 0; i < networks; i++) {
+		if (offset >= data.size() || offset + 1 + data[offset] + WIFI_SELECTOR_NETWORK_LEN > data.size()) {
+			return false;
+		}
+
+		std::string ssid((const char *)&data[offset + 1], data[offset]);
+		uint16_t channels = get16(&data[offset + 1 + data[offset]]);
+		offset += 1 + data[offset] + WIFI_SELECTOR_NETWORK_LEN;
+
+		// only the channels of configured networks are kept
+		Network *network = find(ssid);
+		if (network) {
+			network->m_channels = channels;
+		}
+	}
+
+	if (offset >= data.size() || data[offset] > WIFI_SELECTOR_MAX_BSSIDS || offset + 1 + data[offset] * WIFI_SELECTOR_STATION_LEN != data.size()) {
+		return false;
+	}
+
+	uint8_t stations = data[offset++];
+	m_stations.clear();
+	for (uint8_t i = 0; i < stations; i++, offset += WIFI_SELECTOR_STATION_LEN) {
+		Station station;
+		memcpy(station.m_bssid, &data[offset], sizeof(station.m_bssid));
+		station.m_attempts = get16(&data[offset + 6]);
+		station.m_successes = get16(&data[offset + 8]);
+		station.m_connectMs = get16(&data[offset + 10]) | ((uint32_t)get16(&data[offset + 12]) << 16);
+		m_stations.push_back(station);
+	}
+
+	return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+//
+// connection candidate selection for WiFiMultiSSID, platform independent
+// so the host simulation (tools/connect_sim) runs the same code
+//
+// For every configured SSID the selector learns the channels it was seen
+// on, and for the last WIFI_SELECTOR_MAX_BSSIDS access points used the
+// connection success rate and average connect time. Scans probe the
+// learned channels first and fall back to all channels only if that finds
+// nothing usable. Candidates are ranked by
+//
+//   RSSI + m_successWeightDb * success rate - m_connectPenaltyDbPerS * connect time
+//
+// where an access point without history counts with a 50% success rate
+// and no connect time.
+//
+
+// channels 1 to 14 as a bit mask
+#define WIFI_ALL_CHANNELS 0x7FFE
+
+// access points with connection statistics
+#define WIFI_SELECTOR_MAX_BSSIDS 8
+
+struct WiFiScanEntry {
+	char m_ssid[33];
+	uint8_t m_bssid[6];
+	uint8_t m_channel;
+	int8_t m_rssi;
+};
+
+class WiFiSelector {
+public:
+	struct Config {
+		float m_successWeightDb;
+		float m_connectPenaltyDbPerS;
+	};
+
+	struct Candidate {
+		size_t m_network;		// index in the configured SSIDs
+		uint8_t m_bssid[6];
+		uint8_t m_channel;
+		int8_t m_rssi;
+		float m_score;
+	};
+
+	WiFiSelector(const Config &config);
+
+	// configured SSIDs, history of SSIDs no longer configured is dropped
+	void setNetworks(const std::vector<std::string> &ssids);
+
+	// channel bit mask to probe first, 0 if nothing was learned yet
+	uint16_t channels() const;
+
+	// learns from a scan of the probed channels (bit mask)
+	void scanned(const std::vector<WiFiScanEntry> &scan, const uint16_t &probed);
+
+	// configured networks in the scan, best first
+	void rank(const std::vector<WiFiScanEntry> &scan, std::vector<Candidate> &candidates) const;
+
+	// result of a connection attempt, AP not found is not a failure of the network
+	void attemptFinished(const std::string &ssid, const uint8_t *bssid, const uint8_t &channel, const bool &success, const uint32_t &connectMs);
+
+	// history changed in a way worth persisting
+	bool dirty() const { return m_dirty; }
+
+	void serialize(std::vector<uint8_t> &out);
+	bool deserialize(const std::vector<uint8_t> &data);
+
+private:
+	struct Network {
+		std::string m_ssid;
+		uint16_t m_channels;
+	};
+
+	struct Station {
+		uint8_t m_bssid[6];
+		uint16_t m_attempts;
+		uint16_t m_successes;
+		uint32_t m_connectMs;	// moving average of successful attempts
+	};
+
+	Network *find(const std::string &ssid);
+	const Station *findStation(const uint8_t *bssid) const;
+	float score(const WiFiScanEntry &entry) const;
+
+	Config m_config;
+	std::vector<Network> m_networks;
+
+	// most recently used first
+	std::vector<Station> m_stations;
+	bool m_dirty;
+
+	// failures not persisted yet
+	bool m_failed;
+};
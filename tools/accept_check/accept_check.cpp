@@ -0,0 +1,126 @@
+//
+// Host check of src/utils/accept.cpp, the Accept header negotiation of
+// /get, /rssi and /history: whole token matching (application/cbor-seq
+// is not application/cbor), q-values, precedence of the most specific
+// range, q=0 exclusion, whitespace and case, and the choices the server
+// makes for headers sent by browsers and common clients.
+//
+// Build and run (one line):
+//   g++ -O2 -std=c++11 -Wall -Wextra -Isrc/utils -o accept_check tools/accept_check/accept_check.cpp src/utils/accept.cpp
+//   ./accept_check
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "accept.h"
+
+static int g_failures = 0;
+static int g_checks = 0;
+
+static void check(const bool &condition, const char *what, const long long &a = 0, const long long &b = 0)
+{
+	g_checks++;
+	if (!condition) {
+		g_failures++;
+		printf("FAIL: %s (%lld, %lld)\n", what, a, b);
+	}
+}
+
+// offered by negotiate() in serverTask.cpp
+static const char *const g_document[] = { "application/json", "application/cbor", "application/msgpack", "application/x-msgpack" };
+static const char *const g_history[] = { "text/csv", "application/x-ndjson", "application/octet-stream" };
+
+static void quality(const char *accept, const char *type, const int &expected)
+{
+	int q = acceptQuality(accept, type);
+	if (q != expected) {
+		printf("  Accept: %s / %s\n", accept, type);
+	}
+	check(q == expected, "quality", q, expected);
+}
+
+static void negotiate(const char *accept, const char *const *types, const size_t &count, const int &expected)
+{
+	int chosen = acceptNegotiate(accept, types, count);
+	if (chosen != expected) {
+		printf("  Accept: %s\n", accept ? accept : "(none)");
+	}
+	check(chosen == expected, "negotiate", chosen, expected);
+}
+
+#define DOCUMENT(accept, expected)	negotiate(accept, g_document, sizeof(g_document) / sizeof(g_document[0]), expected)
+#define HISTORY(accept, expected)	negotiate(accept, g_history, sizeof(g_history) / sizeof(g_history[0]), expected)
+
+int main()
+{
+	// whole tokens only
+	quality("application/cbor-seq", "application/cbor", 0);
+	quality("application/cbor", "application/cbor-seq", 0);
+	quality("application/cbor", "application/cbor", 1000);
+	quality("Application/CBOR", "application/cbor", 1000);
+	quality("application/x-cbor", "application/cbor", 0);
+	quality("text/*", "application/cbor", 0);
+	quality("application", "application/cbor", 0);
+	quality("", "application/cbor", 0);
+
+	// q-values
+	quality("application/cbor;q=0.5", "application/cbor", 500);
+	quality("application/cbor; q=0.25", "application/cbor", 250);
+	quality("application/cbor ; Q=0.125", "application/cbor", 125);
+	quality("application/cbor;q=1.000", "application/cbor", 1000);
+	quality("application/cbor;q=0", "application/cbor", 0);
+	quality("application/cbor;q=0.0001", "application/cbor", 0);
+	quality("application/cbor;q=1.5", "application/cbor", 1000);
+	quality("application/cbor;q=x", "application/cbor", 1000);
+	quality("application/cbor;charset=utf-8;q=0.7", "application/cbor", 700);
+	quality("application/cbor;level=1", "application/cbor", 1000);
+
+	// the most specific range wins, also when less specific ones come later or rate higher
+	quality("application/cbor;q=0.2, application/*;q=0.9, */*", "application/cbor", 200);
+	quality("*/*, application/*;q=0.3", "application/cbor", 300);
+	quality("*/*;q=0.1", "application/cbor", 100);
+	quality("application/cbor;q=0, */*", "application/cbor", 0);
+	quality("application/cbor-seq, */*;q=0.4", "application/cbor", 400);
+
+	// no header: the server's first choice
+	DOCUMENT(NULL, 0);
+	DOCUMENT("", 0);
+
+	// clients asking for one encoding
+	DOCUMENT("application/json", 0);
+	DOCUMENT("application/cbor", 1);
+	DOCUMENT("application/msgpack", 2);
+	DOCUMENT("application/x-msgpack", 3);
+	DOCUMENT("application/cbor-seq", -1);
+	DOCUMENT("application/cbor-seq, application/json;q=0.5", 0);
+
+	// preferences
+	DOCUMENT("application/cbor;q=0.5, application/json", 0);
+	DOCUMENT("application/json;q=0.5, application/cbor", 1);
+	DOCUMENT("application/cbor, application/msgpack;q=0.9, application/json;q=0.1", 1);
+	DOCUMENT("application/json;q=0, application/*", 1);
+	DOCUMENT("application/cbor, */*;q=0.1", 1);
+
+	// same quality: the explicitly listed type wins over a wildcard
+	DOCUMENT("application/cbor, */*", 1);
+	DOCUMENT("*/*, application/msgpack", 2);
+
+	// browsers and generic clients get JSON
+	DOCUMENT("text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8", 0);
+	DOCUMENT("*/*", 0);
+	DOCUMENT("application/*", 0);
+	DOCUMENT("text/html", -1);
+
+	// history export
+	HISTORY(NULL, 0);
+	HISTORY("application/x-ndjson", 1);
+	HISTORY("application/octet-stream", 2);
+	HISTORY("application/x-ndjson;q=0.5, application/octet-stream", 2);
+	HISTORY("text/csv;q=0.1, application/*", 1);
+	HISTORY("application/ndjson", -1);
+	HISTORY("*/*;q=0.8", 0);
+
+	printf("%d checks, %d failures\n", g_checks, g_failures);
+	return g_failures ? 1 : 0;
+}
@@ -0,0 +1,384 @@
+//
+// Host load generator for src/utils/admission.cpp (AdmissionLimiter). It
+// simulates the clients of a busy device and feeds their requests to the
+// limiter, with the config.h defaults. Clients: dashboards polling /get,
+// a Prometheus scraper, an ElegantOTA page loading its assets in a burst,
+// and one misbehaving client hammering the device with parallel requests.
+// Every admitted request holds its slot for a random service time. The
+// free heap shrinks with every request in flight, and a background
+// consumer takes a large chunk from time to time, so low heap mode is
+// entered and left.
+//
+// Checks: the global and per client limits hold, the misbehaving client
+// gets no more than its token bucket allows, low heap mode admits /get
+// only, the well behaved clients are served, and every slot is released
+// (also by requests aborted before their response). A threaded run then
+// admits and releases concurrently behind a mutex, as the device does.
+//
+// Build and run (one line):
+//   g++ -O2 -std=c++11 -Wall -Wextra -pthread -Isrc/utils -o admission_check tools/admission_check/admission_check.cpp src/utils/admission.cpp
+//   ./admission_check [--seconds 600] [--seed 1]
+//
+// tools/http_load.py runs a similar load against a real device.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "admission.h"
+
+// config.h defaults
+#define HTTP_MAX_INFLIGHT				8
+#define HTTP_MAX_INFLIGHT_PER_CLIENT	2
+#define HTTP_RATE_LIMIT_RPS				5
+#define HTTP_RATE_LIMIT_BURST			10
+#define HTTP_RATE_LIMIT_CLIENTS			16
+#define HTTP_LOW_HEAP_ENTER				(24 * 1024)
+#define HTTP_LOW_HEAP_LEAVE				(32 * 1024)
+
+// heap model
+#define HEAP_IDLE			(64 * 1024)		// free with nothing in flight
+#define HEAP_PER_REQUEST	(4 * 1024)		// response buffers and AsyncTCP state
+#define HEAP_DIP			(36 * 1024)		// taken by a background consumer
+#define HEAP_DIP_EVERY_MS	60000
+#define HEAP_DIP_MS			8000
+
+#define ABORT_PERCENT		5				// requests whose client goes away before the response
+
+static int g_failures = 0;
+static int g_checks = 0;
+
+static void check(const bool &condition, const char *what, const long long &a = 0, const long long &b = 0)
+{
+	g_checks++;
+	if (!condition) {
+		g_failures++;
+		printf("FAIL: %s (%lld, %lld)\n", what, a, b);
+	}
+}
+
+static AdmissionLimiter::Config config()
+{
+	return AdmissionLimiter::Config{
+		HTTP_MAX_INFLIGHT,
+		HTTP_MAX_INFLIGHT_PER_CLIENT,
+		HTTP_RATE_LIMIT_RPS,
+		HTTP_RATE_LIMIT_BURST,
+		HTTP_RATE_LIMIT_CLIENTS,
+		HTTP_LOW_HEAP_ENTER,
+		HTTP_LOW_HEAP_LEAVE};
+}
+
+//
+// simulated clients
+//
+
+struct ClientClass {
+	const char *m_name;
+	int m_count;
+	uint32_t m_periodMs;		// between rounds
+	int m_parallel;				// requests per round, sent at once
+	bool m_cheap;				// GET /get
+	uint32_t m_serviceMinMs;
+	uint32_t m_serviceMaxMs;
+	bool m_wellBehaved;
+};
+
+static const ClientClass g_classes[] = {
+	{ "dashboard", 6, 2000, 1, true, 5, 40, true },
+	{ "scraper", 1, 1000, 1, false, 20, 120, true },
+	{ "ota page", 1, 30000, 10, false, 10, 300, false },
+	{ "hammer", 1, 20, 4, false, 5, 60, false },
+};
+
+struct Client {
+	const ClientClass *m_class;
+	uint32_t m_ip;
+	uint32_t m_nextMs;
+	uint64_t m_requests;
+	uint64_t m_admitted;
+	uint64_t m_rejected[4];
+};
+
+struct InFlight {
+	uint32_t m_ip;
+	uint32_t m_doneMs;
+	bool m_cheap;
+};
+
+static uint32_t freeHeap(const uint32_t &nowMs, const size_t &inFlight)
+{
+	uint32_t heap = HEAP_IDLE - inFlight * HEAP_PER_REQUEST;
+	if (nowMs % HEAP_DIP_EVERY_MS >= HEAP_DIP_EVERY_MS - HEAP_DIP_MS) {
+		heap -= HEAP_DIP;
+	}
+	return heap;
+}
+
+static void simulate(const uint32_t &seconds, const uint32_t &seed)
+{
+	std::mt19937 rng(seed);
+	AdmissionLimiter limiter(config());
+
+	std::vector<Client> clients;
+	uint32_t ip = 0x0a000001;
+	for (const ClientClass &clientClass : g_classes) {
+		for (int i = 0; i < clientClass.m_count; i++) {
+			Client client;
+			memset((void *)&client, 0, sizeof(client));
+			client.m_class = &clientClass;
+			client.m_ip = ip++;
+			client.m_nextMs = rng() % clientClass.m_periodMs;
+			clients.push_back(client);
+		}
+	}
+
+	std::vector<InFlight> inFlight;
+	uint64_t admitted = 0;
+	uint64_t released = 0;
+	uint64_t aborted = 0;
+	uint64_t lowHeapMs = 0;
+	uint64_t expensiveInLowHeap = 0;
+	uint32_t maxInFlight = 0;
+	uint32_t maxPerClient = 0;
+	uint32_t minHeap = HEAP_IDLE;
+
+	for (uint32_t now = 0; now < seconds * 1000; now++) {
+		// finished (or aborted) requests release their slot when they are destroyed
+		for (size_t i = 0; i < inFlight.size();) {
+			if (inFlight[i].m_doneMs <= now) {
+				limiter.release(inFlight[i].m_ip);
+				released++;
+				inFlight[i] = inFlight.back();
+				inFlight.pop_back();
+			} else {
+				i++;
+			}
+		}
+
+		uint32_t heap = freeHeap(now, inFlight.size());
+		minHeap = std::min(minHeap, heap);
+		limiter.updateHeap(heap);
+		if (limiter.lowHeap()) {
+			lowHeapMs++;
+		}
+
+		for (Client &client : clients) {
+			if (now < client.m_nextMs) {
+				continue;
+			}
+			const ClientClass &clientClass = *client.m_class;
+			client.m_nextMs = now + clientClass.m_periodMs;
+
+			for (int i = 0; i < clientClass.m_parallel; i++) {
+				client.m_requests++;
+				AdmissionLimiter::Verdict verdict = limiter.admit(client.m_ip, now, clientClass.m_cheap);
+				if (verdict != AdmissionLimiter::eAdmit) {
+					client.m_rejected[verdict]++;
+					continue;
+				}
+
+				client.m_admitted++;
+				admitted++;
+				if (limiter.lowHeap() && !clientClass.m_cheap) {
+					expensiveInLowHeap++;
+				}
+
+				InFlight request;
+				request.m_ip = client.m_ip;
+				request.m_cheap = clientClass.m_cheap;
+				if ((int)(rng() % 100) < ABORT_PERCENT) {
+					request.m_doneMs = now + 1 + rng() % 5;
+					aborted++;
+				} else {
+					request.m_doneMs = now + clientClass.m_serviceMinMs + rng() % (clientClass.m_serviceMaxMs - clientClass.m_serviceMinMs + 1);
+				}
+				inFlight.push_back(request);
+
+				maxInFlight = std::max(maxInFlight, limiter.inFlight());
+				maxPerClient = std::max(maxPerClient, limiter.inFlight(client.m_ip));
+			}
+		}
+	}
+
+	// drain
+	for (const InFlight &request : inFlight) {
+		limiter.release(request.m_ip);
+		released++;
+	}
+
+	printf("%u s simulated, %.1f%% in low heap mode, %llu requests aborted early\n\n",
+		seconds, 100.0 * lowHeapMs / (seconds * 1000.0), (unsigned long long)aborted);
+	printf("%-12s %10s %10s %10s %10s %10s %8s\n", "client", "requests", "admitted", "busy", "rate", "low heap", "served");
+	for (const Client &client : clients) {
+		printf("%-12s %10llu %10llu %10llu %10llu %10llu %7.1f%%\n", client.m_class->m_name,
+			(unsigned long long)client.m_requests, (unsigned long long)client.m_admitted,
+			(unsigned long long)client.m_rejected[AdmissionLimiter::eRejectBusy],
+			(unsigned long long)client.m_rejected[AdmissionLimiter::eRejectRate],
+			(unsigned long long)client.m_rejected[AdmissionLimiter::eRejectLowHeap],
+			client.m_requests ? 100.0 * client.m_admitted / client.m_requests : 0.0);
+	}
+	printf("\nmost in flight %u (limit %d), per client %u (limit %d), lowest free heap %u\n\n",
+		maxInFlight, HTTP_MAX_INFLIGHT, maxPerClient, HTTP_MAX_INFLIGHT_PER_CLIENT, minHeap);
+
+	check(maxInFlight <= HTTP_MAX_INFLIGHT, "global in-flight limit", maxInFlight);
+	check(maxPerClient <= HTTP_MAX_INFLIGHT_PER_CLIENT, "per client in-flight limit", maxPerClient);
+	check(admitted == released, "every slot released", admitted, released);
+	check(limiter.inFlight() == 0, "no slot left in flight", limiter.inFlight());
+	check(expensiveInLowHeap == 0, "low heap mode admits /get only", expensiveInLowHeap);
+	check(lowHeapMs > 0, "low heap mode entered", lowHeapMs);
+
+	for (const Client &client : clients) {
+		const ClientClass &clientClass = *client.m_class;
+		if (clientClass.m_wellBehaved) {
+			// the scraper loses the low heap periods, the dashboards nothing
+			double expected = clientClass.m_cheap ? 0.99 : 1.0 - 1.5 * lowHeapMs / (seconds * 1000.0);
+			check(client.m_admitted >= expected * client.m_requests, clientClass.m_name, client.m_admitted, client.m_requests);
+		}
+		// never more than the token bucket refills
+		uint64_t allowed = (uint64_t)HTTP_RATE_LIMIT_RPS * seconds + HTTP_RATE_LIMIT_BURST;
+		check(client.m_admitted <= allowed, "token bucket", client.m_admitted, allowed);
+	}
+
+	const Client &hammer = clients.back();
+	check(hammer.m_rejected[AdmissionLimiter::eRejectRate] > 0, "hammer rate limited", hammer.m_rejected[AdmissionLimiter::eRejectRate]);
+}
+
+//
+// edge cases
+//
+
+static void checkLimiter()
+{
+	AdmissionLimiter limiter(config());
+
+	// burst, then one token per 1000 / RPS ms
+	uint32_t now = 1000;
+	for (int i = 0; i < HTTP_RATE_LIMIT_BURST; i++) {
+		check(limiter.admit(1, now, false) == AdmissionLimiter::eAdmit, "burst admitted", i);
+		limiter.release(1);
+	}
+	check(limiter.admit(1, now, false) == AdmissionLimiter::eRejectRate, "beyond burst");
+	check(limiter.admit(1, now + 1000 / HTTP_RATE_LIMIT_RPS, false) == AdmissionLimiter::eAdmit, "refilled token");
+	limiter.release(1);
+
+	// per client limit
+	check(limiter.admit(2, now, false) == AdmissionLimiter::eAdmit, "first of client 2");
+	check(limiter.admit(2, now, false) == AdmissionLimiter::eAdmit, "second of client 2");
+	check(limiter.admit(2, now, false) == AdmissionLimiter::eRejectBusy, "third of client 2");
+	limiter.release(2);
+	limiter.release(2);
+
+	// global limit
+	for (uint32_t ip = 10; ip < 10 + HTTP_MAX_INFLIGHT; ip++) {
+		check(limiter.admit(ip, now, false) == AdmissionLimiter::eAdmit, "global", ip);
+	}
+	check(limiter.admit(100, now, false) == AdmissionLimiter::eRejectBusy, "global limit");
+	for (uint32_t ip = 10; ip < 10 + HTTP_MAX_INFLIGHT; ip++) {
+		limiter.release(ip);
+	}
+	check(limiter.inFlight() == 0, "all released", limiter.inFlight());
+
+	// clients with requests in flight are not evicted from the table
+	AdmissionLimiter small(AdmissionLimiter::Config{ 8, 2, 5, 10, 2, HTTP_LOW_HEAP_ENTER, HTTP_LOW_HEAP_LEAVE });
+	check(small.admit(1, now, false) == AdmissionLimiter::eAdmit, "table slot 1");
+	check(small.admit(2, now, false) == AdmissionLimiter::eAdmit, "table slot 2");
+	check(small.admit(3, now, false) == AdmissionLimiter::eRejectBusy, "table full of busy clients");
+	small.release(1);
+	check(small.admit(3, now, false) == AdmissionLimiter::eAdmit, "idle entry evicted");
+	check(small.inFlight(2) == 1 && small.inFlight(3) == 1, "counts kept", small.inFlight(2), small.inFlight(3));
+
+	// hysteresis
+	check(!limiter.updateHeap(HTTP_LOW_HEAP_ENTER + 1) && !limiter.lowHeap(), "above enter");
+	check(limiter.updateHeap(HTTP_LOW_HEAP_ENTER - 1) && limiter.lowHeap(), "entered");
+	check(!limiter.updateHeap(HTTP_LOW_HEAP_LEAVE) && limiter.lowHeap(), "between thresholds");
+	check(limiter.admit(5, now + 10000, false) == AdmissionLimiter::eRejectLowHeap, "low heap rejects");
+	check(limiter.admit(5, now + 10000, true) == AdmissionLimiter::eAdmit, "low heap serves /get");
+	limiter.release(5);
+	check(limiter.updateHeap(HTTP_LOW_HEAP_LEAVE + 1) && !limiter.lowHeap(), "left");
+
+	// a release without a slot does not underflow
+	limiter.release(99);
+	check(limiter.inFlight() == 0, "no underflow", limiter.inFlight());
+}
+
+// AsyncTCP callbacks admit and request destructors release from any task
+static void checkThreads()
+{
+	AdmissionLimiter limiter(AdmissionLimiter::Config{ HTTP_MAX_INFLIGHT, HTTP_MAX_INFLIGHT_PER_CLIENT, 1000000, 1000000, HTTP_RATE_LIMIT_CLIENTS, 0, 0 });
+	std::mutex mutex;
+	std::atomic<uint32_t> maxInFlight(0);
+	std::atomic<uint64_t> admitted(0);
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++) {
+		threads.push_back(std::thread([&, t]{
+			std::mt19937 rng(t);
+			std::vector<uint32_t> held;
+			for (int i = 0; i < 200000; i++) {
+				uint32_t ip = 1 + rng() % 6;
+				if (held.size() < 3 && rng() % 2) {
+					std::lock_guard<std::mutex> lock(mutex);
+					if (limiter.admit(ip, i / 100, false) == AdmissionLimiter::eAdmit) {
+						held.push_back(ip);
+						admitted++;
+						uint32_t now = limiter.inFlight();
+						uint32_t seen = maxInFlight.load();
+						while (now > seen && !maxInFlight.compare_exchange_weak(seen, now)) {
+						}
+					}
+				} else if (!held.empty()) {
+					std::lock_guard<std::mutex> lock(mutex);
+					limiter.release(held.back());
+					held.pop_back();
+				}
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			for (uint32_t ip : held) {
+				limiter.release(ip);
+			}
+		}));
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+
+	check(admitted > 0, "threads admitted", admitted.load());
+	check(maxInFlight <= HTTP_MAX_INFLIGHT, "threads global limit", maxInFlight.load());
+	check(limiter.inFlight() == 0, "threads released everything", limiter.inFlight());
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [--seconds <n>] [--seed <n>]\n", name);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t seconds = 600;
+	uint32_t seed = 1;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+			seconds = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+			seed = atoi(argv[++i]);
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	checkLimiter();
+	simulate(seconds, seed);
+	checkThreads();
+
+	printf("%d checks, %d failures\n", g_checks, g_failures);
+	return g_failures ? 1 : 0;
+}
@@ -0,0 +1,235 @@
+#
+# Passive collector for the multicast telemetry beacons (BEACON_ENABLED).
+# Joins the group, verifies the HMAC, and prints every device's readings
+# together with lost / replayed / forged datagram counts.
+#
+#   python3 tools/beacon_listener.py [--key vindriktning] [--group 239.255.77.77] [--port 47777]
+#
+# For testing without hardware, --simulate N sends beacons of N fake
+# devices to the same group over loopback:
+#
+#   python3 tools/beacon_listener.py --interface 127.0.0.1 --simulate 3
+#
+# --selftest runs the replay checks offline and exits.
+#
+# Replay protection: the sequence restarts with every boot, together with
+# a new random boot id. Within a boot id only increasing sequence numbers
+# are accepted. A new boot id is accepted once, boot ids seen before are
+# replays, so neither a captured sequence 0 beacon nor any beacon of an
+# earlier boot can be sent again.
+#
+# Datagram layout: see src/utils/beacon.h
+#
+
+import argparse
+import collections
+import hashlib
+import hmac
+import random
+import socket
+import struct
+import threading
+import time
+
+BEACON_MAGIC = b"VBCN"
+BEACON_VERSION = 2
+BEACON_MAC_LEN = 16
+BEACON_HEADER = struct.Struct("<4sBBBBIIQHHhHHH")
+BOOT_IDS_KEPT = 64		# per host
+
+CHANNELS = (
+	(1 << 0, "pm2_5", "ug/m3"),
+	(1 << 1, "co2", "ppm"),
+	(1 << 2, "temperature", "C"),
+	(1 << 3, "humidity", "%"),
+	(1 << 4, "pressure", "kPa"),
+)
+
+
+def encode(key, host, boot_id, sequence, timestamp_ms, pm2_5=0, co2=0, temperature=0.0, humidity=0.0, pressure=0.0, channels=0x1f):
+	host = host.encode()
+	data = BEACON_HEADER.pack(BEACON_MAGIC, BEACON_VERSION, channels, len(host), 0, boot_id, sequence, timestamp_ms,
+		pm2_5, co2, round(temperature * 100), round(humidity * 100), round(pressure * 100), 0) + host
+	return data + hmac.new(key, data, hashlib.sha256).digest()[:BEACON_MAC_LEN]
+
+
+def decode(key, data):
+	if len(data) < BEACON_HEADER.size + BEACON_MAC_LEN:
+		raise ValueError("short datagram")
+
+	(magic, version, channels, host_len, _, boot_id, sequence, timestamp_ms,
+		pm2_5, co2, temperature, humidity, pressure, _) = BEACON_HEADER.unpack_from(data)
+
+	if magic != BEACON_MAGIC:
+		raise ValueError("bad magic")
+	if version != BEACON_VERSION:
+		raise ValueError("unsupported version %d" % version)
+
+	end = BEACON_HEADER.size + host_len
+	if len(data) != end + BEACON_MAC_LEN:
+		raise ValueError("bad length")
+
+	mac = hmac.new(key, data[:end], hashlib.sha256).digest()[:BEACON_MAC_LEN]
+	if not hmac.compare_digest(mac, data[end:]):
+		raise ValueError("bad mac")
+
+	values = {
+		"pm2_5": pm2_5,
+		"co2": co2,
+		"temperature": temperature / 100,
+		"humidity": humidity / 100,
+		"pressure": pressure / 100,
+	}
+	return {
+		"host": data[BEACON_HEADER.size:end].decode(errors="replace"),
+		"boot_id": boot_id,
+		"sequence": sequence,
+		"timestamp_ms": timestamp_ms,
+		"values": {name: values[name] for bit, name, _ in CHANNELS if channels & bit},
+	}
+
+
+def simulate(args, key, count):
+	sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+	sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 1)
+	sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_LOOP, 1)
+	sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(args.interface))
+
+	boot_ids = [random.getrandbits(32) or 1 for _ in range(count)]
+	sequence = 0
+	while True:
+		for i in range(count):
+			beacon = encode(key, "vindriktning-sim%02d" % i, boot_ids[i], sequence, int(time.time() * 1000),
+				pm2_5=5 + i, co2=450 + 10 * i, temperature=21.5 + i / 10, humidity=40.25, pressure=101.3)
+			sock.sendto(beacon, (args.group, args.port))
+		sequence += 1
+		time.sleep(args.interval)
+
+
+class Device:
+	def __init__(self):
+		self.boot_id = None
+		self.sequence = None
+		self.boot_ids = collections.deque(maxlen=BOOT_IDS_KEPT)
+		self.received = 0
+		self.lost = 0
+		self.replayed = 0
+		self.reboots = 0
+
+	def accept(self, beacon):
+		# a valid MAC can still be an old datagram sent again
+		if beacon["boot_id"] == self.boot_id:
+			if beacon["sequence"] <= self.sequence:
+				self.replayed += 1
+				return False
+			self.lost += beacon["sequence"] - self.sequence - 1
+		elif beacon["boot_id"] in self.boot_ids:
+			# an earlier boot
+			self.replayed += 1
+			return False
+		else:
+			if self.boot_id is not None:
+				self.reboots += 1
+			self.boot_id = beacon["boot_id"]
+			self.boot_ids.append(self.boot_id)
+
+		self.sequence = beacon["sequence"]
+		self.received += 1
+		return True
+
+
+def selftest():
+	failures = 0
+	checks = 0
+
+	def check(condition, what):
+		nonlocal failures, checks
+		checks += 1
+		if not condition:
+			failures += 1
+			print("FAIL: %s" % what)
+
+	def beacon(boot_id, sequence):
+		return {"boot_id": boot_id, "sequence": sequence}
+
+	device = Device()
+	check(device.accept(beacon(7, 0)), "first beacon")
+	check(device.accept(beacon(7, 1)), "next sequence")
+	check(not device.accept(beacon(7, 0)), "sequence 0 replayed within the boot")
+	check(not device.accept(beacon(7, 1)), "sequence replayed")
+	check(device.accept(beacon(7, 4)) and device.lost == 2, "gap counted as lost")
+	check(device.accept(beacon(9, 0)) and device.reboots == 1, "reboot with a new boot id")
+	check(not device.accept(beacon(7, 0)), "sequence 0 of an earlier boot")
+	check(not device.accept(beacon(7, 5)), "later sequence of an earlier boot")
+	check(device.accept(beacon(9, 1)), "current boot continues")
+	check(not device.accept(beacon(9, 0)), "sequence 0 replayed after the reboot")
+	check(device.received == 5 and device.replayed == 5, "counters")
+
+	# a decoded datagram round trips and a modified one fails the MAC
+	key = b"vindriktning"
+	data = encode(key, "vindriktning-test", 0x12345678, 3, 1700000000000, pm2_5=5)
+	decoded = decode(key, data)
+	check(decoded["boot_id"] == 0x12345678 and decoded["sequence"] == 3, "decode")
+	forged = bytearray(data)
+	forged[8] ^= 1
+	try:
+		decode(key, bytes(forged))
+		rejected = False
+	except ValueError:
+		rejected = True
+	check(rejected, "modified boot id passes the MAC")
+
+	print("%d checks, %d failures" % (checks, failures))
+	return 1 if failures else 0
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Multicast beacon collector")
+	parser.add_argument("--group", default="239.255.77.77")
+	parser.add_argument("--port", type=int, default=47777)
+	parser.add_argument("--key", default="vindriktning", help="BEACON_KEY of the devices")
+	parser.add_argument("--interface", default="0.0.0.0", help="local interface address to join the group on")
+	parser.add_argument("--simulate", type=int, default=0, metavar="N", help="also send beacons of N fake devices")
+	parser.add_argument("--interval", type=float, default=1.0, help="simulated cycle length in seconds")
+	parser.add_argument("--selftest", action="store_true", help="run the replay checks and exit")
+	args = parser.parse_args()
+	key = args.key.encode()
+
+	if args.selftest:
+		return selftest()
+
+	sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+	sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+	sock.bind(("", args.port))
+	sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP,
+		socket.inet_aton(args.group) + socket.inet_aton(args.interface))
+	print("listening on %s:%d" % (args.group, args.port))
+
+	if args.simulate:
+		threading.Thread(target=simulate, args=(args, key, args.simulate), daemon=True).start()
+
+	devices = {}
+	rejected = 0
+
+	while True:
+		data, addr = sock.recvfrom(1500)
+		try:
+			beacon = decode(key, data)
+		except ValueError as e:
+			rejected += 1
+			print("%s: rejected (%s), %d rejected so far" % (addr[0], e, rejected))
+			continue
+
+		device = devices.setdefault(beacon["host"], Device())
+		if not device.accept(beacon):
+			print("%-24s %-15s seq=%-6d replayed (boot %08x), %d replayed so far" % (
+				beacon["host"], addr[0], beacon["sequence"], beacon["boot_id"], device.replayed))
+			continue
+
+		values = " ".join("%s=%s" % (name, beacon["values"][name]) for _, name, _ in CHANNELS if name in beacon["values"])
+		print("%-24s %-15s seq=%-6d %s (rx %d, lost %d, replayed %d, reboots %d)" % (
+			beacon["host"], addr[0], beacon["sequence"], values, device.received, device.lost, device.replayed, device.reboots))
+
+
+if __name__ == "__main__":
+	raise SystemExit(main())
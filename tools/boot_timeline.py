@@ -0,0 +1,71 @@
+#
+# Prints the boot phase timeline from /diag/boot (src/utils/bootTrace.h)
+# for the current and the previous boots, and optionally fails when a
+# phase is reached later than a budget, to catch startup regressions.
+#
+#   python3 tools/boot_timeline.py <device>
+#   python3 tools/boot_timeline.py <device> --budget wifi_connected=4000 --budget first_sample=15000
+#   python3 tools/boot_timeline.py --file boot.json          # saved /diag/boot response
+#
+# Times are milliseconds since the application started. Budgets are
+# checked against the current boot only, the exit code is 1 if any is
+# exceeded or the phase was not reached.
+#
+
+import argparse
+import json
+import sys
+import urllib.request
+
+
+def load(args):
+	if args.file:
+		with open(args.file) as f:
+			return json.load(f)
+	with urllib.request.urlopen("http://%s/diag/boot" % args.host, timeout=10) as response:
+		return json.load(response)
+
+
+def print_boot(title, boot):
+	print("%s: boot #%d, reset reason %s" % (title, boot["boot"], boot["resetReason"]))
+	phases = sorted(boot["phases"].items(), key=lambda item: item[1])
+	previous = 0
+	for name, ms in phases:
+		print("  %-18s %8d ms  %+8d ms" % (name, ms, ms - previous))
+		previous = ms
+	print()
+
+
+def main():
+	parser = argparse.ArgumentParser(description="boot phase timeline")
+	parser.add_argument("host", nargs="?")
+	parser.add_argument("--file", help="read a saved /diag/boot response instead of the device")
+	parser.add_argument("--budget", action="append", default=[], metavar="PHASE=MS", help="fail if PHASE is reached later than MS")
+	args = parser.parse_args()
+
+	if not args.host and not args.file:
+		parser.error("device or --file required")
+
+	doc = load(args)
+	print_boot("current", doc["current"])
+	for boot in doc.get("previous", []):
+		print_boot("previous", boot)
+
+	failed = False
+	for budget in args.budget:
+		name, _, limit = budget.partition("=")
+		ms = doc["current"]["phases"].get(name)
+		if ms is None:
+			print("budget %s: not reached (uptime %d ms)" % (name, doc["uptimeMs"]))
+			failed = True
+		elif ms > int(limit):
+			print("budget %s: %d ms > %s ms" % (name, ms, limit))
+			failed = True
+		else:
+			print("budget %s: %d ms <= %s ms" % (name, ms, limit))
+
+	sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,128 @@
+#
+# PlatformIO extra script: packs gzipped web assets from www/ into an image
+# for the "www" data partition and registers two custom targets:
+#
+#   pio run -t buildwww     - build .pio/build/<env>/www.bin
+#   pio run -t uploadwww    - build and flash it to the "www" partition
+#
+# Image layout (little endian):
+#
+#   header: magic "VWWW", uint16 version, uint16 entry count
+#   entry:  char path[48], char mime[32], uint32 offset, uint32 length,
+#           uint32 etag (crc32 of the gzipped data), uint32 reserved
+#   data:   gzipped files, offsets are relative to the partition start
+#
+
+import csv
+import gzip
+import io
+import os
+import struct
+import zlib
+
+Import("env")
+
+WWW_MAGIC = b"VWWW"
+WWW_VERSION = 1
+WWW_PATH_LEN = 48
+WWW_MIME_LEN = 32
+WWW_PARTITION = "www"
+
+MIME_TYPES = {
+	".html": "text/html",
+	".htm": "text/html",
+	".js": "application/javascript",
+	".css": "text/css",
+	".json": "application/json",
+	".svg": "image/svg+xml",
+	".png": "image/png",
+	".ico": "image/x-icon",
+	".txt": "text/plain",
+}
+
+project_dir = env.subst("$PROJECT_DIR")
+build_dir = env.subst("$BUILD_DIR")
+www_dir = os.path.join(project_dir, "www")
+www_image = os.path.join(build_dir, "www.bin")
+
+
+def partition_info(name):
+	table = env.GetProjectOption("board_build.partitions", "partitions.csv")
+	with open(os.path.join(project_dir, table)) as f:
+		for row in csv.reader(line for line in f if not line.lstrip().startswith("#")):
+			row = [col.strip() for col in row]
+			if len(row) >= 5 and row[0] == name:
+				return int(row[3], 0), int(row[4], 0)
+	raise Exception("partition '%s' not found in %s" % (name, table))
+
+
+def gzip_bytes(data):
+	# mtime=0 keeps the output (and thus the etag) reproducible
+	out = io.BytesIO()
+	with gzip.GzipFile(fileobj=out, mode="wb", compresslevel=9, mtime=0) as f:
+		f.write(data)
+	return out.getvalue()
+
+
+def build_image(*args, **kwargs):
+	files = []
+	for root, _, names in os.walk(www_dir):
+		for name in sorted(names):
+			full = os.path.join(root, name)
+			path = "/" + os.path.relpath(full, www_dir).replace(os.sep, "/")
+			if len(path) >= WWW_PATH_LEN:
+				raise Exception("asset path too long: %s" % path)
+			mime = MIME_TYPES.get(os.path.splitext(name)[1].lower(), "application/octet-stream")
+			with open(full, "rb") as f:
+				files.append((path, mime, gzip_bytes(f.read())))
+
+	entry_size = WWW_PATH_LEN + WWW_MIME_LEN + 16
+	offset = 8 + entry_size * len(files)
+
+	header = struct.pack("<4sHH", WWW_MAGIC, WWW_VERSION, len(files))
+	entries = b""
+	data = b""
+	for path, mime, payload in files:
+		entries += struct.pack("<%ds%dsIIII" % (WWW_PATH_LEN, WWW_MIME_LEN),
+			path.encode(), mime.encode(), offset + len(data), len(payload),
+			zlib.crc32(payload) & 0xFFFFFFFF, 0)
+		data += payload
+		print("www: %-32s %6d bytes gzipped" % (path, len(payload)))
+
+	image = header + entries + data
+	_, size = partition_info(WWW_PARTITION)
+	if len(image) > size:
+		raise Exception("www image (%d bytes) exceeds partition size (%d bytes)" % (len(image), size))
+
+	os.makedirs(build_dir, exist_ok=True)
+	with open(www_image, "wb") as f:
+		f.write(image)
+	print("www: image %s, %d bytes" % (www_image, len(image)))
+
+
+def upload_image(*args, **kwargs):
+	build_image()
+	offset, _ = partition_info(WWW_PARTITION)
+	env.AutodetectUploadPort()
+	return env.Execute(" ".join([
+		'"$PYTHONEXE"', '"$UPLOADER"',
+		"--chip", "esp32",
+		"--port", '"$UPLOAD_PORT"',
+		"--baud", "$UPLOAD_SPEED",
+		"write_flash", hex(offset), '"%s"' % www_image,
+	]))
+
+
+env.AddCustomTarget(
+	name="buildwww",
+	dependencies=None,
+	actions=[build_image],
+	title="Build web assets",
+	description="Pack gzipped www/ files into the www partition image")
+
+env.AddCustomTarget(
+	name="uploadwww",
+	dependencies=None,
+	actions=[upload_image],
+	title="Upload web assets",
+	description="Flash the www partition image")
@@ -0,0 +1,252 @@
+//
+// Host benchmark and checks of src/utils/wallClock.cpp. Reader threads
+// read the wall clock while one writer applies corrections as fast as it
+// can, once with the previous mutex guarded compensatedMillis() and once
+// with WallClock. Reports the read cost and verifies that no reader ever
+// sees the clock go backwards. The slew arithmetic is checked separately.
+//
+// Build and run (one line):
+//   g++ -O2 -std=c++11 -Wall -Wextra -pthread -Isrc/utils -o clock_bench tools/clock_bench/clock_bench.cpp src/utils/wallClock.cpp
+//   ./clock_bench [--readers 4] [--ms 1000] [--write-interval-us 0]
+//
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wallClock.h"
+
+// defaults of config.h
+#define STEP_THRESHOLD_US	128000
+#define SLEW_MAX_PPM		500
+
+static int64_t monotonicUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int g_failures = 0;
+static int g_checks = 0;
+
+static void check(const bool &condition, const char *what, const long long &a = 0, const long long &b = 0)
+{
+	g_checks++;
+	if (!condition) {
+		g_failures++;
+		printf("FAIL: %s (%lld, %lld)\n", what, a, b);
+	}
+}
+
+//
+// previous implementation: epoch seconds and a millis() reference under a mutex
+//
+
+class LegacyClock {
+public:
+	uint64_t epochMs()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		uint32_t millis = monotonicUs() / 1000;
+		return m_lastEpochTime * 1000 + (uint32_t)(millis - m_lastEpochMillis);
+	}
+
+	void sync(const uint64_t &epochMs)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_lastEpochTime = epochMs / 1000;
+		m_lastEpochMillis = monotonicUs() / 1000;
+	}
+
+private:
+	std::mutex m_mutex;
+	uint64_t m_lastEpochTime = 0;
+	uint32_t m_lastEpochMillis = 0;
+};
+
+class NewClock {
+public:
+	NewClock()
+		: m_clock(STEP_THRESHOLD_US, SLEW_MAX_PPM)
+	{
+	}
+
+	uint64_t epochMs()
+	{
+		return m_clock.epochUs(monotonicUs()) / 1000;
+	}
+
+	void sync(const uint64_t &epochMs)
+	{
+		m_clock.sync(epochMs * 1000, monotonicUs());
+	}
+
+private:
+	WallClock m_clock;
+};
+
+struct Result {
+	uint64_t m_reads;
+	uint64_t m_backwards;
+	uint64_t m_writes;
+};
+
+template <typename Clock>
+static Result contention(const int &readers, const int &durationMs, const int &writeIntervalUs)
+{
+	Clock clock;
+	const uint64_t epochMs = 1700000000000ULL;
+	clock.sync(epochMs);
+
+	std::atomic<bool> stop(false);
+	std::vector<uint64_t> reads(readers, 0);
+	std::vector<uint64_t> backwards(readers, 0);
+	uint64_t writes = 0;
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < readers; i++) {
+		threads.emplace_back([&, i] {
+			uint64_t last = 0;
+			uint64_t count = 0;
+			uint64_t errors = 0;
+			while (!stop.load(std::memory_order_relaxed)) {
+				uint64_t now = clock.epochMs();
+				errors += (now < last);
+				last = now;
+				count++;
+			}
+			reads[i] = count;
+			backwards[i] = errors;
+		});
+	}
+
+	// corrections of up to +-50 ms around the true time, as NTP jitter would cause
+	std::thread writer([&] {
+		std::mt19937 random(1);
+		int64_t startUs = monotonicUs();
+		while (!stop.load(std::memory_order_relaxed)) {
+			int64_t jitterMs = (int64_t)(random() % 101) - 50;
+			clock.sync(epochMs + (monotonicUs() - startUs) / 1000 + jitterMs);
+			writes++;
+			if (writeIntervalUs) {
+				std::this_thread::sleep_for(std::chrono::microseconds(writeIntervalUs));
+			}
+		}
+	});
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(durationMs));
+	stop = true;
+	writer.join();
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+
+	Result result = {0, 0, writes};
+	for (int i = 0; i < readers; i++) {
+		result.m_reads += reads[i];
+		result.m_backwards += backwards[i];
+	}
+	return result;
+}
+
+static void report(const char *name, const Result &result, const int &readers, const int &durationMs)
+{
+	double nsPerRead = (double)durationMs * 1e6 * readers / (result.m_reads ? result.m_reads : 1);
+	printf("  %-8s %12llu reads  %8.1f ns/read per thread  %10llu corrections  %llu backwards\n",
+		name, (unsigned long long)result.m_reads, nsPerRead, (unsigned long long)result.m_writes, (unsigned long long)result.m_backwards);
+}
+
+static void checkSlew()
+{
+	WallClock clock(STEP_THRESHOLD_US, SLEW_MAX_PPM);
+	const int64_t epochUs = 1700000000000000LL;
+
+	// uptime until the first correction, which always steps
+	check(!clock.synced() && clock.epochUs(123456) == 123456, "uptime before sync");
+	check(clock.sync(epochUs, 1000000), "first correction steps");
+	check(clock.synced() && clock.epochUs(1000000) == epochUs, "stepped value");
+	check(clock.epochUs(3000000) == epochUs + 2000000, "runs at the monotonic rate");
+
+	// +100 ms is slewed over 200 s at 500 ppm (wall clock = epochUs + monotonic - 1 s until then)
+	check(!clock.sync(epochUs + 10000000 + 100000, 11000000), "small correction slews");
+	check(clock.epochUs(11000000) == epochUs + 10000000, "no jump at the correction");
+	check(clock.slewRemainingUs(11000000) == 100000, "slew pending", clock.slewRemainingUs(11000000));
+	check(clock.epochUs(111000000) == epochUs + 110000000 + 50000, "half slewed", clock.epochUs(111000000) - epochUs);
+	check(clock.epochUs(211000000) == epochUs + 210000000 + 100000, "fully slewed", clock.epochUs(211000000) - epochUs);
+	check(clock.epochUs(311000000) == epochUs + 310000000 + 100000, "monotonic rate after the slew");
+	check(clock.slewRemainingUs(211000000) == 0, "nothing pending");
+
+	// negative corrections slow the clock down, it never runs backwards
+	check(!clock.sync(epochUs + 399000000, 400000000), "negative correction slews");
+	int64_t last = clock.epochUs(400000000);
+	for (int64_t t = 400000000; t < 1000000000; t += 1000) {
+		int64_t now = clock.epochUs(t);
+		if (now < last || now - last > 1001) {
+			check(false, "slowed down, not backwards", t, now - last);
+			break;
+		}
+		last = now;
+	}
+	check(clock.epochUs(1000000000) == epochUs + 999000000, "negative slew complete", clock.epochUs(1000000000) - epochUs);
+
+	// a new correction during a slew continues from the current value
+	clock.sync(epochUs + 1000000000 + 100000, 1000000000);
+	int64_t before = clock.epochUs(1050000000);
+	clock.sync(epochUs + 1050000000, 1050000000);
+	check(clock.epochUs(1050000000) == before, "restarted slew is continuous", clock.epochUs(1050000000), before);
+
+	// large corrections step
+	check(clock.sync(epochUs + 2000000000 + 5000000, 2000000000), "large correction steps");
+	check(clock.epochUs(2000000000) == epochUs + 2000000000 + 5000000, "large correction value");
+}
+
+static void usage(const char *name)
+{
+	printf("usage: %s [--readers n] [--ms duration] [--write-interval-us n]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	int readers = 4;
+	int durationMs = 1000;
+	int writeIntervalUs = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 >= argc) {
+			usage(argv[0]);
+		}
+		if (!strcmp(argv[i], "--readers")) {
+			readers = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--ms")) {
+			durationMs = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--write-interval-us")) {
+			writeIntervalUs = atoi(argv[++i]);
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	if (readers < 1 || durationMs < 1 || writeIntervalUs < 0) {
+		usage(argv[0]);
+	}
+
+	checkSlew();
+
+	for (int n = 1; n <= readers; n *= 2) {
+		printf("%d reader%s, 1 writer, %d ms\n", n, n > 1 ? "s" : "", durationMs);
+		report("mutex", contention<LegacyClock>(n, durationMs, writeIntervalUs), n, durationMs);
+
+		Result result = contention<NewClock>(n, durationMs, writeIntervalUs);
+		report("seqlock", result, n, durationMs);
+		check(!result.m_backwards, "wall clock readers never go backwards", result.m_backwards);
+	}
+
+	printf("%d checks, %d failures\n", g_checks, g_failures);
+	return g_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
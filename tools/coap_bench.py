@@ -0,0 +1,302 @@
+#
+# Compares the CoAP read endpoint (COAP_ENABLED) against HTTP /get:
+# round-trip latency measured here, handler time per request taken from
+# the device's /metrics histograms.
+#
+#   python3 tools/coap_bench.py <device> [--count 200]
+#   python3 tools/coap_bench.py <device> --observe [--skip-acks 2]
+#
+# --skip-acks leaves the first transmissions of every confirmable
+# notification unacknowledged, so the device has to retransmit it (5 or
+# more drops the observer).
+#
+# Only the Python standard library is needed, CBOR payloads are decoded
+# by the small decoder below.
+#
+
+import argparse
+import http.client
+import os
+import random
+import socket
+import statistics
+import struct
+import time
+
+COAP_PORT = 5683
+COAP_CON = 0
+COAP_NON = 1
+COAP_ACK = 2
+COAP_RST = 3
+COAP_GET = 0x01
+COAP_OPTION_OBSERVE = 6
+COAP_OPTION_URI_PATH = 11
+COAP_OPTION_CONTENT_FORMAT = 12
+COAP_OPTION_ACCEPT = 17
+
+
+#
+# CBOR (subset used by the device: ints, floats, text, arrays, maps, simple values)
+#
+
+def cbor_decode(data, pos=0):
+	ib = data[pos]
+	major, info = ib >> 5, ib & 0x1f
+	pos += 1
+
+	if major == 7:
+		if info == 20:
+			return False, pos
+		if info == 21:
+			return True, pos
+		if info == 22:
+			return None, pos
+		if info == 25:
+			# half precision
+			h = struct.unpack(">H", data[pos:pos + 2])[0]
+			return struct.unpack(">e", struct.pack(">H", h))[0], pos + 2
+		if info == 26:
+			return struct.unpack(">f", data[pos:pos + 4])[0], pos + 4
+		if info == 27:
+			return struct.unpack(">d", data[pos:pos + 8])[0], pos + 8
+		raise ValueError("unsupported simple value %d" % info)
+
+	if info < 24:
+		arg = info
+	elif info in (24, 25, 26, 27):
+		size = 1 << (info - 24)
+		arg = int.from_bytes(data[pos:pos + size], "big")
+		pos += size
+	else:
+		raise ValueError("indefinite lengths are not supported")
+
+	if major == 0:
+		return arg, pos
+	if major == 1:
+		return -1 - arg, pos
+	if major == 2:
+		return bytes(data[pos:pos + arg]), pos + arg
+	if major == 3:
+		return data[pos:pos + arg].decode("utf-8"), pos + arg
+	if major == 4:
+		items = []
+		for _ in range(arg):
+			item, pos = cbor_decode(data, pos)
+			items.append(item)
+		return items, pos
+	if major == 5:
+		obj = {}
+		for _ in range(arg):
+			key, pos = cbor_decode(data, pos)
+			obj[key], pos = cbor_decode(data, pos)
+		return obj, pos
+	raise ValueError("unsupported major type %d" % major)
+
+
+#
+# CoAP
+#
+
+def coap_option(number, last, value):
+	delta = number - last
+	header = b""
+	nibbles = []
+	ext = b""
+	for field in (delta, len(value)):
+		if field < 13:
+			nibbles.append(field)
+		elif field < 269:
+			nibbles.append(13)
+			ext += bytes([field - 13])
+		else:
+			nibbles.append(14)
+			ext += struct.pack(">H", field - 269)
+	header = bytes([(nibbles[0] << 4) | nibbles[1]])
+	return header + ext + value
+
+
+def coap_uint(value):
+	return value.to_bytes((value.bit_length() + 7) // 8, "big") if value else b""
+
+
+def coap_request(mid, token, path, observe=None, accept=None, type=COAP_CON):
+	msg = bytes([(1 << 6) | (type << 4) | len(token), COAP_GET]) + struct.pack(">H", mid) + token
+	options = []
+	if observe is not None:
+		options.append((COAP_OPTION_OBSERVE, coap_uint(observe)))
+	for segment in path.strip("/").split("/"):
+		options.append((COAP_OPTION_URI_PATH, segment.encode()))
+	if accept is not None:
+		options.append((COAP_OPTION_ACCEPT, coap_uint(accept)))
+	last = 0
+	for number, value in options:
+		msg += coap_option(number, last, value)
+		last = number
+	return msg
+
+
+def coap_parse(data):
+	type = (data[0] >> 4) & 3
+	tkl = data[0] & 0x0f
+	code = data[1]
+	mid = struct.unpack(">H", data[2:4])[0]
+	token = data[4:4 + tkl]
+	pos = 4 + tkl
+	number = 0
+	options = {}
+	while pos < len(data) and data[pos] != 0xff:
+		fields = [data[pos] >> 4, data[pos] & 0x0f]
+		pos += 1
+		for i in range(2):
+			if fields[i] == 13:
+				fields[i] = data[pos] + 13
+				pos += 1
+			elif fields[i] == 14:
+				fields[i] = struct.unpack(">H", data[pos:pos + 2])[0] + 269
+				pos += 2
+		number += fields[0]
+		options.setdefault(number, []).append(data[pos:pos + fields[1]])
+		pos += fields[1]
+	payload = data[pos + 1:] if pos < len(data) else b""
+	return type, code, mid, token, options, payload
+
+
+def code_str(code):
+	return "%d.%02d" % (code >> 5, code & 0x1f)
+
+
+#
+# benchmarks
+#
+
+def percentiles(samples):
+	samples = sorted(samples)
+	pick = lambda p: samples[min(len(samples) - 1, int(len(samples) * p))]
+	return "min %.2f  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f ms" % (
+		samples[0], pick(0.5), pick(0.9), pick(0.99), samples[-1])
+
+
+def bench_coap(host, count, accept):
+	sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+	sock.settimeout(2)
+	addr = (socket.gethostbyname(host), COAP_PORT)
+	rtts = []
+	size = 0
+	lost = 0
+	mid = random.randint(0, 0xffff)
+
+	for _ in range(count):
+		mid = (mid + 1) & 0xffff
+		token = os.urandom(4)
+		start = time.perf_counter()
+		sock.sendto(coap_request(mid, token, "get", accept=accept), addr)
+		try:
+			while True:
+				data, _ = sock.recvfrom(1500)
+				type, code, rmid, rtoken, options, payload = coap_parse(data)
+				if rtoken == token:
+					break
+		except socket.timeout:
+			lost += 1
+			continue
+		rtts.append((time.perf_counter() - start) * 1000)
+		size = len(data)
+
+	print("CoAP: %d requests, %d lost, %d bytes per response" % (count, lost, size))
+	if rtts:
+		print("  rtt " + percentiles(rtts))
+	return payload
+
+
+def bench_http(host, count):
+	rtts = []
+	size = 0
+	for _ in range(count):
+		start = time.perf_counter()
+		conn = http.client.HTTPConnection(host, 80, timeout=5)
+		conn.request("GET", "/get")
+		response = conn.getresponse()
+		body = response.read()
+		conn.close()
+		rtts.append((time.perf_counter() - start) * 1000)
+		size = len(body)
+		if response.status == 429:
+			# admission control kicked in, slow down
+			time.sleep(1)
+
+	print("HTTP: %d requests, %d bytes per body (plus headers)" % (count, size))
+	print("  rtt " + percentiles(rtts))
+
+
+def device_handler_times(host):
+	conn = http.client.HTTPConnection(host, 80, timeout=5)
+	conn.request("GET", "/metrics")
+	text = conn.getresponse().read().decode()
+	conn.close()
+
+	values = {}
+	for line in text.splitlines():
+		for name in ("http_request_duration_seconds", "coap_request_duration_seconds"):
+			for suffix in ("_sum", "_count"):
+				if line.startswith("vindriktning_" + name + suffix + " "):
+					values[name + suffix] = float(line.split()[1])
+
+	for name in ("coap_request_duration_seconds", "http_request_duration_seconds"):
+		count = values.get(name + "_count", 0)
+		if count:
+			print("device %s: %.0f us per request (%d requests)" % (name, values[name + "_sum"] / count * 1e6, count))
+
+
+def observe(host, skip_acks):
+	sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+	addr = (socket.gethostbyname(host), COAP_PORT)
+	token = os.urandom(4)
+	sock.sendto(coap_request(random.randint(0, 0xffff), token, "get", observe=0), addr)
+	print("observing coap://%s/get, Ctrl+C to stop" % host)
+
+	# CON MID -> (transmissions seen, time of the first one)
+	confirmable = {}
+	try:
+		while True:
+			data, _ = sock.recvfrom(1500)
+			type, code, mid, rtoken, options, payload = coap_parse(data)
+			if rtoken != token:
+				continue
+			seq = int.from_bytes(options.get(COAP_OPTION_OBSERVE, [b""])[0], "big")
+			value, _ = cbor_decode(payload) if payload else (None, 0)
+			print("%s obs=%d %s %s" % (code_str(code), seq, "CON" if type == COAP_CON else "NON", value))
+			if type == COAP_CON:
+				count, first = confirmable.get(mid, (0, time.monotonic()))
+				confirmable[mid] = (count + 1, first)
+				if count:
+					print("  retransmission %d of mid %d after %.1f s" % (count, mid, time.monotonic() - first))
+				if count < skip_acks:
+					continue
+				# acknowledge, otherwise the device drops us
+				sock.sendto(bytes([(1 << 6) | (COAP_ACK << 4), 0]) + struct.pack(">H", mid), addr)
+	except KeyboardInterrupt:
+		# deregister
+		sock.sendto(coap_request(random.randint(0, 0xffff), token, "get", observe=1), addr)
+
+
+def main():
+	parser = argparse.ArgumentParser(description="CoAP vs HTTP read benchmark")
+	parser.add_argument("host")
+	parser.add_argument("--count", type=int, default=200)
+	parser.add_argument("--json", action="store_true", help="request JSON (Accept: 50) instead of CBOR over CoAP")
+	parser.add_argument("--observe", action="store_true", help="register as observer and print notifications")
+	parser.add_argument("--skip-acks", type=int, default=0, help="transmissions of each confirmable notification left unacknowledged")
+	args = parser.parse_args()
+
+	if args.observe:
+		observe(args.host, args.skip_acks)
+		return
+
+	payload = bench_coap(args.host, args.count, 50 if args.json else None)
+	print("  payload: %s" % (payload.decode() if args.json else cbor_decode(payload)[0]))
+	bench_http(args.host, args.count)
+	device_handler_times(args.host)
+
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,226 @@
+//
+// Host checks of src/utils/configStore.cpp: power cuts at every step and
+// byte of a save, corrupted records and legacy files. A save interrupted
+// anywhere has to load either the previous or the new content, never
+// fail or return anything else.
+//
+// Build and run (one line):
+//   g++ -O2 -std=c++11 -Wall -Wextra -Isrc/utils -o config_store_check tools/config_store_check/config_store_check.cpp src/utils/configStore.cpp
+//   ./config_store_check
+//
+
+#include <map>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "configStore.h"
+
+#define PATH "/wifi_cred.dat"
+
+// in memory file system, stops executing operations after a power cut
+class MemoryStorage : public ConfigStore::Storage {
+public:
+	std::map<std::string, std::vector<uint8_t>> m_files;
+
+	// operations left before the power cut, -1 never
+	int m_opsLeft = -1;
+	// bytes of the interrupted write that still reach the flash
+	size_t m_tornBytes = 0;
+
+	bool step()
+	{
+		if (m_opsLeft == 0) {
+			return false;
+		}
+		if (m_opsLeft > 0) {
+			m_opsLeft--;
+		}
+		return true;
+	}
+
+	bool read(const char *path, std::vector<uint8_t> &data) override
+	{
+		if (!step()) {
+			return false;
+		}
+		auto it = m_files.find(path);
+		if (it == m_files.end()) {
+			return false;
+		}
+		data = it->second;
+		return true;
+	}
+
+	bool write(const char *path, const uint8_t *data, const size_t &len) override
+	{
+		if (m_opsLeft == 1) {
+			// cut during the write: truncated file
+			m_opsLeft = 0;
+			m_files[path].assign(data, data + std::min(len, m_tornBytes));
+			return false;
+		}
+		if (!step()) {
+			return false;
+		}
+		m_files[path].assign(data, data + len);
+		return true;
+	}
+
+	bool rename(const char *from, const char *to) override
+	{
+		if (!step() || !m_files.count(from) || m_files.count(to)) {
+			return false;
+		}
+		m_files[to] = m_files[from];
+		m_files.erase(from);
+		return true;
+	}
+
+	bool remove(const char *path) override
+	{
+		if (!step()) {
+			return false;
+		}
+		return m_files.erase(path) > 0;
+	}
+};
+
+static int g_failures = 0;
+static int g_checks = 0;
+
+static void check(const bool &condition, const char *what, const int &a = 0, const int &b = 0)
+{
+	g_checks++;
+	if (!condition) {
+		g_failures++;
+		printf("FAIL: %s (%d, %d)\n", what, a, b);
+	}
+}
+
+static std::vector<uint8_t> content(const uint8_t &seed, const size_t &len)
+{
+	std::vector<uint8_t> data(len);
+	for (size_t i = 0; i < len; i++) {
+		data[i] = seed + i * 7;
+	}
+	return data;
+}
+
+static void checkTornSaves()
+{
+	std::vector<uint8_t> oldData = content(1, 300);
+	std::vector<uint8_t> newData = content(2, 300);
+
+	// write, read back, remove, rename: the power is cut during the write and before each later step
+	for (int ops = 1; ops <= 5; ops++) {
+		size_t recordLen = 16 + newData.size() + 4;
+		for (size_t torn = 0; torn <= (ops == 1 ? recordLen : 0); torn++) {
+			MemoryStorage storage;
+			{
+				ConfigStore store(storage, PATH);
+				check(store.save(1, oldData.data(), oldData.size()), "initial save");
+			}
+
+			ConfigStore store(storage, PATH);
+			ConfigStore::Record record;
+			store.load(record);
+
+			storage.m_opsLeft = ops;
+			storage.m_tornBytes = torn;
+			store.save(1, newData.data(), newData.size());
+
+			// reboot
+			storage.m_opsLeft = -1;
+			ConfigStore rebooted(storage, PATH);
+			ConfigStore::Result result = rebooted.load(record);
+			check(result == ConfigStore::eResultOk, "torn save loads", ops, torn);
+			check(record.m_payload == oldData || record.m_payload == newData, "torn save content", ops, torn);
+
+			// whatever was loaded, the files are back to a single valid copy
+			check(storage.m_files.size() == 1 && storage.m_files.count(PATH), "torn save cleaned up", ops, torn);
+
+			// and the next save wins
+			check(rebooted.save(1, oldData.data(), oldData.size()), "save after recovery", ops, torn);
+			ConfigStore again(storage, PATH);
+			check(again.load(record) == ConfigStore::eResultOk && record.m_payload == oldData, "load after recovery", ops, torn);
+		}
+	}
+}
+
+static void checkCorruption()
+{
+	std::vector<uint8_t> data = content(3, 64);
+
+	MemoryStorage storage;
+	ConfigStore store(storage, PATH);
+	check(store.save(2, data.data(), data.size()), "save");
+	std::vector<uint8_t> good = storage.m_files[PATH];
+
+	// every single bit flip is detected
+	for (size_t i = 0; i < good.size(); i++) {
+		for (int bit = 0; bit < 8; bit++) {
+			storage.m_files[PATH] = good;
+			storage.m_files[PATH][i] ^= (1 << bit);
+
+			ConfigStore::Record record;
+			ConfigStore::Result result = ConfigStore(storage, PATH).load(record);
+			check(result != ConfigStore::eResultOk, "bit flip detected", i, bit);
+		}
+	}
+
+	// truncated and extended records
+	for (size_t len = 0; len < good.size(); len++) {
+		storage.m_files[PATH].assign(good.begin(), good.begin() + len);
+		ConfigStore::Record record;
+		check(ConfigStore(storage, PATH).load(record) != ConfigStore::eResultOk, "truncation detected", len);
+	}
+	storage.m_files[PATH] = good;
+	storage.m_files[PATH].push_back(0);
+	ConfigStore::Record record;
+	check(ConfigStore(storage, PATH).load(record) != ConfigStore::eResultOk, "extension detected");
+
+	// a corrupted file next to a good temporary copy falls back to the copy
+	storage.m_files[PATH] = good;
+	storage.m_files[PATH][20] ^= 0x10;
+	storage.m_files[std::string(PATH) + ".tmp"] = good;
+	check(ConfigStore(storage, PATH).load(record) == ConfigStore::eResultOk && record.m_payload == data && record.m_version == 2, "fallback to temporary copy");
+
+	// missing file
+	storage.m_files.clear();
+	check(ConfigStore(storage, PATH).load(record) == ConfigStore::eResultMissing, "missing file");
+}
+
+static void checkLegacy()
+{
+	MemoryStorage storage;
+	std::vector<uint8_t> raw = content(4, 200);
+	raw[0] = 'H';
+	storage.m_files[PATH] = raw;
+
+	ConfigStore::Record record;
+	ConfigStore store(storage, PATH);
+	check(store.load(record) == ConfigStore::eResultLegacy && record.m_version == 0 && record.m_payload == raw, "legacy file");
+
+	// migration writes the new format over it
+	check(store.save(1, raw.data(), raw.size()), "save migrated");
+	check(ConfigStore(storage, PATH).load(record) == ConfigStore::eResultOk && record.m_version == 1 && record.m_payload == raw, "migrated file");
+}
+
+static void checkCrc()
+{
+	// standard check value of CRC-32/ISO-HDLC
+	const char *text = "123456789";
+	check(ConfigStore::crc32((const uint8_t *)text, 9) == 0xCBF43926, "crc32 check value");
+}
+
+int main()
+{
+	checkCrc();
+	checkTornSaves();
+	checkCorruption();
+	checkLegacy();
+
+	printf("%d checks, %d failures\n", g_checks, g_failures);
+	return g_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
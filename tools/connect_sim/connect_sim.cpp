@@ -0,0 +1,416 @@
+//
+// Host benchmark of the multi SSID connect (src/utils/wifiSelector) against
+// a simulated scan backend. Every trial is one scan based connect, as after
+// a boot without usable last params. The selector keeps its history from
+// trial to trial, like the device does across boots. The previous behaviour
+// (full scan, strongest BSSID, one candidate per scan) runs as a baseline.
+//
+// Build and run (one line):
+//   g++ -O2 -std=c++11 -Wall -Wextra -Isrc/utils -o connect_sim tools/connect_sim/connect_sim.cpp src/utils/wifiSelector.cpp
+//   ./connect_sim [--trials 1000] [--seed 1] [--dwell 120] [--scenario mesh]
+//
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "wifiSelector.h"
+
+// scan and attempt durations
+#define CHANNEL_SWITCH_MS	15		// per scanned channel, on top of the dwell time
+#define LEGACY_SCAN_MS		2500	// WiFi.scanNetworks() of all channels, polled every 100 ms
+#define FAIL_MS				4000	// failed association or 4-way handshake
+#define FOREIGN_NETWORKS	15		// networks of the neighbours, on random channels
+
+// config.h defaults
+#define CANDIDATES			2
+#define SUCCESS_DB			20.0f
+#define CONNECT_DB_PER_S	4.0f
+
+// give up a trial after this many scan and connect cycles
+#define MAX_CYCLES			10
+
+struct Ap {
+	std::string m_ssid;
+	uint8_t m_bssid[6];
+	uint8_t m_channel;
+	int m_rssi;
+	double m_success;			// probability an attempt succeeds
+	uint32_t m_connectMs;
+	double m_present;			// probability the AP is on air in a trial
+	double m_channelChange;		// probability the AP moved to another channel before a trial
+};
+
+struct Env {
+	std::vector<std::string> m_configured;
+	std::vector<Ap> m_aps;
+};
+
+typedef std::mt19937 Rng;
+
+static double uniform(Rng &rng)
+{
+	return std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+}
+
+static Ap ap(const char *ssid, const uint8_t &id, const uint8_t &channel, const int &rssi, const double &success, const uint32_t &connectMs, const double &present = 1.0, const double &channelChange = 0.0)
+{
+	Ap ap;
+	ap.m_ssid = ssid;
+	uint8_t bssid[6] = {0x24, 0x0a, 0xc4, 0x00, 0x00, id};
+	memcpy(ap.m_bssid, bssid, sizeof(bssid));
+	ap.m_channel = channel;
+	ap.m_rssi = rssi;
+	ap.m_success = success;
+	ap.m_connectMs = connectMs;
+	ap.m_present = present;
+	ap.m_channelChange = channelChange;
+	return ap;
+}
+
+//
+// scenarios
+//
+
+struct Scenario {
+	const char *m_name;
+	const char *m_description;
+	Env m_env;
+};
+
+static std::vector<Scenario> scenarios()
+{
+	std::vector<Scenario> list;
+
+	list.push_back({ "single", "one AP of one configured network", {
+		{ "home" },
+		{ ap("home", 1, 6, -62, 0.98, 1200) } } });
+
+	list.push_back({ "mesh", "two BSSIDs, the stronger one is flaky and slow", {
+		{ "home" },
+		{ ap("home", 1, 1, -55, 0.5, 3000), ap("home", 2, 11, -62, 0.98, 1000) } } });
+
+	list.push_back({ "multi-ssid", "two configured networks, the weaker one is reliable", {
+		{ "office", "guest" },
+		{ ap("office", 1, 6, -68, 0.97, 1200), ap("guest", 2, 11, -64, 0.7, 2500) } } });
+
+	list.push_back({ "channel-change", "AP moves to another channel before 10% of the trials", {
+		{ "home" },
+		{ ap("home", 1, 6, -60, 0.98, 1200, 1.0, 0.1) } } });
+
+	list.push_back({ "hotspot", "phone hotspot configured first, on air in 20% of the trials", {
+		{ "phone", "home" },
+		{ ap("phone", 1, 11, -50, 0.95, 1500, 0.2), ap("home", 2, 1, -66, 0.98, 1200) } } });
+
+	return list;
+}
+
+//
+// simulated scan backend
+//
+
+struct World {
+	std::vector<Ap> m_aps;			// configured networks, on air in this trial
+	std::vector<WiFiScanEntry> m_foreign;
+};
+
+static World trialWorld(Env &env, Rng &rng)
+{
+	static const uint8_t channels[] = {1, 6, 11};
+	World world;
+
+	for (Ap &ap : env.m_aps) {
+		if (uniform(rng) < ap.m_channelChange) {
+			ap.m_channel = channels[rng() % 3];
+		}
+		if (uniform(rng) < ap.m_present) {
+			world.m_aps.push_back(ap);
+		}
+	}
+
+	for (uint8_t i = 0; i < FOREIGN_NETWORKS; i++) {
+		WiFiScanEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		snprintf(entry.m_ssid, sizeof(entry.m_ssid), "neighbour-%u", i);
+		entry.m_bssid[5] = 0x80 + i;
+		entry.m_channel = 1 + rng() % 13;
+		entry.m_rssi = -60 - rng() % 35;
+		world.m_foreign.push_back(entry);
+	}
+	return world;
+}
+
+static void scan(const World &world, const uint16_t &channels, Rng &rng, std::vector<WiFiScanEntry> &results)
+{
+	std::normal_distribution<double> jitter(0.0, 3.0);
+	results.clear();
+
+	for (const Ap &ap : world.m_aps) {
+		if (channels & (1 << ap.m_channel)) {
+			WiFiScanEntry entry;
+			memset(&entry, 0, sizeof(entry));
+			strncpy(entry.m_ssid, ap.m_ssid.c_str(), sizeof(entry.m_ssid) - 1);
+			memcpy(entry.m_bssid, ap.m_bssid, sizeof(entry.m_bssid));
+			entry.m_channel = ap.m_channel;
+			entry.m_rssi = ap.m_rssi + (int)jitter(rng);
+			results.push_back(entry);
+		}
+	}
+	for (const WiFiScanEntry &entry : world.m_foreign) {
+		if (channels & (1 << entry.m_channel)) {
+			results.push_back(entry);
+		}
+	}
+}
+
+static uint32_t scanMs(const uint16_t &channels, const uint32_t &dwellMs)
+{
+	uint32_t count = 0;
+	for (uint8_t channel = 1; channel <= 14; channel++) {
+		count += (channels >> channel) & 1;
+	}
+	return count * (dwellMs + CHANNEL_SWITCH_MS);
+}
+
+static const Ap *find(const World &world, const uint8_t *bssid)
+{
+	for (const Ap &ap : world.m_aps) {
+		if (!memcmp(ap.m_bssid, bssid, sizeof(ap.m_bssid))) {
+			return &ap;
+		}
+	}
+	return nullptr;
+}
+
+// one attempt, returns its duration
+static uint32_t attempt(const Ap &ap, Rng &rng, bool &connected)
+{
+	connected = uniform(rng) < ap.m_success;
+	return connected ? (uint32_t)(ap.m_connectMs * (0.8 + 0.4 * uniform(rng))) : FAIL_MS;
+}
+
+//
+// connect strategies
+//
+
+struct Result {
+	bool m_connected;
+	uint32_t m_ms;
+	uint32_t m_attempts;
+	uint32_t m_channels;		// scanned channels
+};
+
+// WiFiMultiSSID::connect() and scanAndConnect()
+static Result runSelector(WiFiSelector &selector, const World &world, const uint32_t &dwellMs, Rng &rng)
+{
+	Result result = {false, 0, 0, 0};
+	std::vector<WiFiScanEntry> results;
+	std::vector<WiFiSelector::Candidate> candidates;
+
+	for (int cycle = 0; cycle < MAX_CYCLES; cycle++) {
+		std::vector<WiFiSelector::Candidate> tried;
+		uint16_t plans[2] = {selector.channels(), WIFI_ALL_CHANNELS};
+
+		for (uint16_t channels : plans) {
+			if (!channels) {
+				continue;
+			}
+
+			scan(world, channels, rng, results);
+			result.m_ms += scanMs(channels, dwellMs);
+			result.m_channels += scanMs(channels, 0) / CHANNEL_SWITCH_MS;
+			selector.scanned(results, channels);
+			selector.rank(results, candidates);
+
+			uint32_t attempts = 0;
+			for (const WiFiSelector::Candidate &candidate : candidates) {
+				if (attempts >= CANDIDATES) {
+					break;
+				}
+				bool done = false;
+				for (const WiFiSelector::Candidate &previous : tried) {
+					done = done || !memcmp(previous.m_bssid, candidate.m_bssid, sizeof(candidate.m_bssid));
+				}
+				if (done) {
+					continue;
+				}
+				tried.push_back(candidate);
+				attempts++;
+
+				const Ap *ap = find(world, candidate.m_bssid);
+				bool connected;
+				uint32_t ms = attempt(*ap, rng, connected);
+				selector.attemptFinished(ap->m_ssid, ap->m_bssid, ap->m_channel, connected, ms);
+				result.m_ms += ms;
+				result.m_attempts++;
+
+				if (connected) {
+					result.m_connected = true;
+					return result;
+				}
+			}
+		}
+	}
+	return result;
+}
+
+// previous WiFiMultiSSID::connect(): full scan, strongest configured BSSID
+static Result runLegacy(const Env &env, const World &world, Rng &rng)
+{
+	Result result = {false, 0, 0, 0};
+	std::vector<WiFiScanEntry> results;
+
+	for (int cycle = 0; cycle < MAX_CYCLES; cycle++) {
+		scan(world, WIFI_ALL_CHANNELS, rng, results);
+		result.m_ms += LEGACY_SCAN_MS;
+		result.m_channels += 14;
+
+		const WiFiScanEntry *best = nullptr;
+		for (const WiFiScanEntry &entry : results) {
+			bool configured = std::find(env.m_configured.begin(), env.m_configured.end(), std::string(entry.m_ssid)) != env.m_configured.end();
+			if (configured && (!best || entry.m_rssi > best->m_rssi)) {
+				best = &entry;
+			}
+		}
+		if (!best) {
+			continue;
+		}
+
+		bool connected;
+		result.m_ms += attempt(*find(world, best->m_bssid), rng, connected);
+		result.m_attempts++;
+		if (connected) {
+			result.m_connected = true;
+			return result;
+		}
+	}
+	return result;
+}
+
+//
+// report
+//
+
+static uint32_t percentile(std::vector<uint32_t> &values, const double &p)
+{
+	if (values.empty()) {
+		return 0;
+	}
+	std::sort(values.begin(), values.end());
+	size_t index = (size_t)(p * (values.size() - 1) + 0.5);
+	return values[index];
+}
+
+static void report(const char *name, const std::vector<Result> &results)
+{
+	std::vector<uint32_t> times;
+	uint64_t total = 0;
+	uint64_t attempts = 0;
+	uint64_t channels = 0;
+	uint32_t failed = 0;
+
+	for (const Result &r : results) {
+		if (r.m_connected) {
+			times.push_back(r.m_ms);
+			total += r.m_ms;
+		} else {
+			failed++;
+		}
+		attempts += r.m_attempts;
+		channels += r.m_channels;
+	}
+
+	printf("  %-8s connect mean %5.2f s  p50 %5.2f s  p95 %5.2f s  attempts %4.2f  channels scanned %5.1f",
+		name,
+		times.empty() ? 0.0 : (double)total / times.size() / 1000.0,
+		percentile(times, 0.5) / 1000.0,
+		percentile(times, 0.95) / 1000.0,
+		(double)attempts / results.size(),
+		(double)channels / results.size());
+	if (failed) {
+		printf("  not connected %u", failed);
+	}
+	printf("\n");
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [--trials N] [--seed N] [--dwell MS] [--scenario NAME]\n", argv0);
+	fprintf(stderr, "scenarios:\n");
+	for (const Scenario &s : scenarios()) {
+		fprintf(stderr, "  %-15s %s\n", s.m_name, s.m_description);
+	}
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t trials = 1000;
+	uint32_t seed = 1;
+	uint32_t dwellMs = 120;
+	std::string only;
+
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 >= argc) {
+			usage(argv[0]);
+		}
+		if (!strcmp(argv[i], "--trials")) {
+			trials = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--seed")) {
+			seed = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--dwell")) {
+			dwellMs = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--scenario")) {
+			only = argv[++i];
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	if (!trials) {
+		usage(argv[0]);
+	}
+
+	printf("%u trials per scenario, %u ms dwell, %d candidates per scan\n\n", trials, dwellMs, CANDIDATES);
+
+	bool found = false;
+	for (Scenario &scenario : scenarios()) {
+		if (!only.empty() && only != scenario.m_name) {
+			continue;
+		}
+		found = true;
+
+		// same worlds for both strategies
+		Env legacyEnv = scenario.m_env;
+		Env selectorEnv = scenario.m_env;
+		Rng legacyRng(seed);
+		Rng selectorRng(seed);
+		Rng legacyWorldRng(seed + 1);
+		Rng selectorWorldRng(seed + 1);
+
+		WiFiSelector selector(WiFiSelector::Config{SUCCESS_DB, CONNECT_DB_PER_S});
+		selector.setNetworks(scenario.m_env.m_configured);
+
+		std::vector<Result> legacy;
+		std::vector<Result> selected;
+		for (uint32_t i = 0; i < trials; i++) {
+			legacy.push_back(runLegacy(legacyEnv, trialWorld(legacyEnv, legacyWorldRng), legacyRng));
+			selected.push_back(runSelector(selector, trialWorld(selectorEnv, selectorWorldRng), dwellMs, selectorRng));
+		}
+
+		printf("%s: %s\n", scenario.m_name, scenario.m_description);
+		report("legacy", legacy);
+		report("selector", selected);
+		printf("\n");
+	}
+
+	if (!found) {
+		usage(argv[0]);
+	}
+	return 0;
+}
@@ -0,0 +1,78 @@
+//
+// Host benchmark of the /get and /rssi encodings: JSON vs CBOR vs MessagePack.
+// Reports body size and serialization time of each encoding for the same
+// documents the device builds.
+//
+// ArduinoJson is the copy PlatformIO fetched for the firmware build.
+//
+// Build and run (one line):
+//   g++ -O2 -std=c++11 -DARDUINOJSON_USE_LONG_LONG=1 -Itools/encoding_bench/host -I.pio/libdeps/esp-wrover-kit/ArduinoJson/src -Isrc/utils -o encoding_bench tools/encoding_bench/encoding_bench.cpp src/utils/cbor.cpp
+//   ./encoding_bench
+//
+
+#include <ArduinoJson.h>
+#include <chrono>
+#include <stdio.h>
+
+#include "cbor.h"
+
+#define ITERATIONS 200000
+#define BUFFER_SIZE 512
+
+static void fillGet(JsonDocument &doc)
+{
+	// USE_CO2_SENSOR build, the largest variant
+	doc["co2"] = (uint16_t)612;
+	doc["temperature"] = 23.47f;
+	doc["humidity"] = 41.18f;
+	doc["pm2_5"] = (uint16_t)7;
+	doc["currTimeMs"] = (uint64_t)1700000123456ULL;
+	doc["currTime"] = (char *)"22:15:23.456";
+	doc["watchdogTimeToReset"] = (char *)"05:59:12.004";
+}
+
+static void fillRssi(JsonDocument &doc)
+{
+	doc["rssi"] = -67;
+	doc["currTimeMs"] = (uint64_t)1700000123456ULL;
+	doc["currTime"] = (char *)"22:15:23.456";
+	doc["watchdogTimeToReset"] = (char *)"05:59:12.004";
+}
+
+template <typename Serializer>
+static void bench(const char *name, const JsonDocument &doc, Serializer serialize)
+{
+	char buffer[BUFFER_SIZE];
+	size_t len = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < ITERATIONS; i++) {
+		len = serialize(doc, buffer, sizeof(buffer));
+		// keep the compiler from dropping the loop
+		asm volatile("" : : "r"(buffer) : "memory");
+	}
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+	printf("  %-12s %4zu bytes  %7.1f ns\n", name, len, (double)ns / ITERATIONS);
+}
+
+static void benchAll(const char *title, const JsonDocument &doc)
+{
+	printf("%s\n", title);
+	bench("json", doc, [](const JsonDocument &d, char *b, size_t n) { return serializeJson(d, b, n); });
+	bench("cbor", doc, [](const JsonDocument &d, char *b, size_t n) { return serializeCbor(d, (uint8_t *)b, n); });
+	bench("msgpack", doc, [](const JsonDocument &d, char *b, size_t n) { return serializeMsgPack(d, b, n); });
+}
+
+int main()
+{
+	StaticJsonDocument<BUFFER_SIZE> get;
+	fillGet(get);
+	benchAll("/get", get);
+
+	StaticJsonDocument<BUFFER_SIZE> rssi;
+	fillRssi(rssi);
+	benchAll("/rssi", rssi);
+
+	return 0;
+}
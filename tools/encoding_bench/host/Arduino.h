@@ -0,0 +1,6 @@
+// minimal stand-in for the Arduino core, enough for src/utils/cbor.cpp on the host
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
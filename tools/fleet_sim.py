@@ -0,0 +1,109 @@
+#
+# Simulated peers for the fleet aggregator (FLEET_ENABLED). Every peer
+# serves /get on its own port with a configurable delay and failure rate.
+#
+#   python3 tools/fleet_sim.py --peers 8 [--bind 0.0.0.0] [--delay 0.2] [--fail 0.1]
+#
+# Put the printed FLEET_STATIC_PEERS line into config.h of the aggregator
+# (use --bind 0.0.0.0 and the host's LAN address so the device can reach
+# it), then check the merged view:
+#
+#   python3 tools/fleet_sim.py --peers 8 --check http://<aggregator>/fleet
+#
+# Without --check the peers run on loopback until interrupted.
+#
+
+import argparse
+import json
+import random
+import threading
+import time
+import urllib.request
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+def make_handler(index, args):
+	class PeerHandler(BaseHTTPRequestHandler):
+		def do_GET(self):
+			if self.path != "/get":
+				self.send_error(404)
+				return
+
+			time.sleep(random.uniform(0, args.delay))
+			if random.random() < args.fail:
+				self.send_error(503)
+				return
+
+			now = int(time.time() * 1000)
+			body = json.dumps({
+				"pm2_5": 5 + index,
+				"currTimeMs": now,
+				"currTime": time.strftime("%H:%M:%S", time.gmtime(now / 1000)) + ".%03d" % (now % 1000),
+				"watchdogTimeToReset": "05:00:00.000",
+			}).encode()
+
+			self.send_response(200)
+			self.send_header("Content-Type", "application/json")
+			self.send_header("Content-Length", str(len(body)))
+			self.end_headers()
+			self.wfile.write(body)
+
+		def log_message(self, format, *args):
+			pass
+
+	return PeerHandler
+
+
+def check(url, names):
+	# give the aggregator a couple of sweeps to find everything
+	deadline = time.time() + 60
+	while time.time() < deadline:
+		try:
+			fleet = json.load(urllib.request.urlopen(url, timeout=5))
+		except OSError as e:
+			print("fetch failed: %s" % e)
+			time.sleep(2)
+			continue
+
+		seen = {peer["ip"]: peer for peer in fleet.get("peers", [])}
+		missing = [name for name in names if name not in seen]
+		ok = [name for name in names if name in seen and seen[name].get("ok")]
+		print("%d peers listed, %d/%d simulated peers ok, missing %s" % (len(seen), len(ok), len(names), missing or "none"))
+		if not missing:
+			return True
+		time.sleep(5)
+	return False
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Simulated fleet peers")
+	parser.add_argument("--peers", type=int, default=4)
+	parser.add_argument("--bind", default="127.0.0.1")
+	parser.add_argument("--advertise", help="address to print in FLEET_STATIC_PEERS (default: --bind)")
+	parser.add_argument("--base-port", type=int, default=18080)
+	parser.add_argument("--delay", type=float, default=0.2, help="max response delay in seconds")
+	parser.add_argument("--fail", type=float, default=0.0, help="fraction of requests answered with 503")
+	parser.add_argument("--check", metavar="URL", help="verify the aggregator's /fleet lists all peers")
+	args = parser.parse_args()
+
+	names = []
+	for i in range(args.peers):
+		port = args.base_port + i
+		server = ThreadingHTTPServer((args.bind, port), make_handler(i, args))
+		threading.Thread(target=server.serve_forever, daemon=True).start()
+		names.append("%s:%d" % (args.advertise or args.bind, port))
+
+	print("#define FLEET_STATIC_PEERS\t\t\t\"%s\"" % ",".join(names))
+
+	if args.check:
+		raise SystemExit(0 if check(args.check, names) else 1)
+
+	try:
+		while True:
+			time.sleep(1)
+	except KeyboardInterrupt:
+		pass
+
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,245 @@
+//
+// Host round trip test for src/utils/gzip.cpp (gzipCompress). Every
+// compressed buffer is inflated with zlib in gzip mode, which also checks
+// the header, the crc32 and the length trailer, and compared with the
+// input. Inputs: empty and single byte buffers, random bytes (no matches),
+// long runs (maximal match length), text repeating at distances around
+// the 32 KB window, and line protocol batches of every size up to
+// INFLUX_SPILL_SAMPLES. Too small output buffers have to return 0 without
+// writing past their end.
+//
+// It then reports the line protocol size per sample, raw and compressed,
+// at INFLUX_BATCH_SIZE and a few other batch sizes, next to zlib -6 for
+// reference. The samples are random walks, one every 10 s.
+//
+// Build and run (one line):
+//   g++ -O2 -std=c++11 -Wall -Wextra -Isrc/utils -o gzip_check tools/gzip_check/gzip_check.cpp src/utils/gzip.cpp -lz
+//   ./gzip_check
+//
+
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "gzip.h"
+
+// config.h defaults
+#define INFLUX_MEASUREMENT		"vindriktning"
+#define INFLUX_BATCH_SIZE		30
+#define INFLUX_SPILL_SAMPLES	256
+#define INFLUX_LINE_MAX			192		// influxTask.cpp
+
+#define HOST_NAME				"Vindriktning-a1b2c3"
+#define GUARD					0xa5
+
+static int g_failures = 0;
+static int g_checks = 0;
+
+static void check(const bool &condition, const char *what, const long long &a = 0, const long long &b = 0)
+{
+	g_checks++;
+	if (!condition) {
+		g_failures++;
+		printf("FAIL: %s (%lld, %lld)\n", what, a, b);
+	}
+}
+
+//
+// helpers
+//
+
+static bool inflateGzip(const uint8_t *in, const size_t &len, std::string &out)
+{
+	z_stream stream = {};
+	if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+		return false;
+	}
+
+	stream.next_in = (Bytef *)in;
+	stream.avail_in = len;
+	out.clear();
+
+	int ret;
+	do {
+		uint8_t buf[4096];
+		stream.next_out = buf;
+		stream.avail_out = sizeof(buf);
+		ret = inflate(&stream, Z_NO_FLUSH);
+		out.append((const char *)buf, sizeof(buf) - stream.avail_out);
+	} while (ret == Z_OK);
+
+	// the whole input has to be one gzip member
+	bool ok = (ret == Z_STREAM_END) && !stream.avail_in;
+	inflateEnd(&stream);
+	return ok;
+}
+
+static size_t zlibSize(const std::string &in)
+{
+	z_stream stream = {};
+	deflateInit2(&stream, 6, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+	std::vector<uint8_t> out(deflateBound(&stream, in.size()));
+	stream.next_in = (Bytef *)in.data();
+	stream.avail_in = in.size();
+	stream.next_out = out.data();
+	stream.avail_out = out.size();
+	deflate(&stream, Z_FINISH);
+	size_t len = out.size() - stream.avail_out;
+	deflateEnd(&stream);
+	return len;
+}
+
+#define OUT_AUTO	((size_t)-1)
+
+// compresses into a buffer with guard bytes behind outMax, checks the
+// guard and the round trip, returns the compressed size
+static size_t roundTrip(const std::string &in, const char *what, const size_t &outMax = OUT_AUTO)
+{
+	size_t max = (outMax != OUT_AUTO) ? outMax : in.size() + in.size() / 4 + 64;
+	std::vector<uint8_t> out(max + 16, GUARD);
+
+	size_t len = gzipCompress((const uint8_t *)in.data(), in.size(), out.data(), max);
+
+	bool guard = true;
+	for (size_t i = max; i < out.size(); i++) {
+		guard = guard && out[i] == GUARD;
+	}
+	check(guard, what, max, in.size());
+
+	if (len) {
+		std::string inflated;
+		check(inflateGzip(out.data(), len, inflated), what, len, in.size());
+		check(inflated == in, what, inflated.size(), in.size());
+	}
+	return len;
+}
+
+struct Walk {
+	std::mt19937 m_rng;
+	uint64_t m_timestampMs;
+	double m_pm2_5, m_co2, m_temperature, m_humidity, m_pressure;
+
+	Walk()
+		: m_rng(1)
+		, m_timestampMs(1760000000000ull)
+		, m_pm2_5(12), m_co2(650), m_temperature(21.5), m_humidity(45), m_pressure(101.3)
+	{
+	}
+
+	double step(double &value, const double &delta, const double &min, const double &max)
+	{
+		std::uniform_real_distribution<double> d(-delta, delta);
+		value += d(m_rng);
+		value = (value < min) ? min : ((value > max) ? max : value);
+		return value;
+	}
+
+	// same format as InfluxTaskCtx::formatLine()
+	std::string line(const int &sensors)
+	{
+		char buf[INFLUX_LINE_MAX];
+		m_timestampMs += 10000;
+		unsigned pm2_5 = (unsigned)step(m_pm2_5, 1.5, 0, 500);
+		if (sensors == 1) {
+			snprintf(buf, sizeof(buf), INFLUX_MEASUREMENT ",host=%s pm2_5=%ui,co2=%ui,temperature=%.2f,humidity=%.2f %llu\n", HOST_NAME, pm2_5,
+				(unsigned)step(m_co2, 8, 400, 5000), step(m_temperature, 0.05, -10, 50), step(m_humidity, 0.2, 0, 100), (unsigned long long)m_timestampMs);
+		} else if (sensors == 2) {
+			snprintf(buf, sizeof(buf), INFLUX_MEASUREMENT ",host=%s pm2_5=%ui,temperature=%.2f,humidity=%.2f,pressure=%.2f %llu\n", HOST_NAME, pm2_5,
+				step(m_temperature, 0.05, -10, 50), step(m_humidity, 0.2, 0, 100), step(m_pressure, 0.01, 90, 110), (unsigned long long)m_timestampMs);
+		} else {
+			snprintf(buf, sizeof(buf), INFLUX_MEASUREMENT ",host=%s pm2_5=%ui %llu\n", HOST_NAME, pm2_5, (unsigned long long)m_timestampMs);
+		}
+		return buf;
+	}
+};
+
+static std::string batch(const int &sensors, const uint32_t &count)
+{
+	Walk walk;
+	std::string out;
+	for (uint32_t i = 0; i < count; i++) {
+		out += walk.line(sensors);
+	}
+	return out;
+}
+
+//
+// checks
+//
+
+static void checkRoundTrips()
+{
+	roundTrip("", "empty input");
+	roundTrip("x", "single byte");
+	roundTrip("abcabcabc", "short match");
+
+	// no matches, every literal takes 8 or 9 bits
+	std::mt19937 rng(2);
+	std::string random;
+	for (int i = 0; i < 50000; i++) {
+		random += (char)(rng() & 0xff);
+	}
+	roundTrip(random, "random bytes");
+
+	// runs longer than the maximal match
+	roundTrip(std::string(100000, 'a'), "long run");
+	size_t len = roundTrip(std::string(258 * 3 + 1, 'b'), "run of 3 maximal matches");
+	check(len && len < 40, "runs use maximal matches", len);
+
+	// a block repeating at distances around the window size
+	for (size_t distance : { 32767, 32768, 32769, 40000 }) {
+		std::string block;
+		for (size_t i = 0; i < distance; i++) {
+			block += (char)(rng() & 0xff);
+		}
+		roundTrip(block + block.substr(0, 1000), "repeat around the window");
+	}
+
+	// every batch size the spill buffer can produce, all sensor variants
+	for (int sensors = 0; sensors < 3; sensors++) {
+		for (uint32_t count = 1; count <= INFLUX_SPILL_SAMPLES; count++) {
+			roundTrip(batch(sensors, count), "line protocol batch");
+		}
+	}
+
+	// too small output buffers return 0 and stay within their bounds
+	std::string lines = batch(1, INFLUX_BATCH_SIZE);
+	size_t fits = roundTrip(lines, "reference size");
+	for (size_t max : { (size_t)0, (size_t)9, (size_t)10, (size_t)11, fits / 2, fits - 1 }) {
+		check(roundTrip(lines, "too small output", max) == 0, "too small output returns 0", max, fits);
+	}
+	check(roundTrip(lines, "exact output", fits) == fits, "exact output size fits", fits);
+}
+
+//
+// ratio
+//
+
+static void report()
+{
+	static const char *names[] = { "pm2.5 only", "CO2 sensor", "env sensor" };
+
+	printf("line protocol bytes per sample (zlib -6 for reference)\n");
+	printf("%-12s %6s %8s %8s %8s %8s\n", "sensors", "batch", "raw", "gzip", "zlib -6", "ratio");
+	for (int sensors = 0; sensors < 3; sensors++) {
+		for (uint32_t count : { 1u, 10u, (uint32_t)INFLUX_BATCH_SIZE, 60u, (uint32_t)INFLUX_SPILL_SAMPLES }) {
+			std::string lines = batch(sensors, count);
+			size_t gz = roundTrip(lines, "report");
+			printf("%-12s %5u%s %8.1f %8.1f %8.1f %7.2fx\n", names[sensors], count, count == INFLUX_BATCH_SIZE ? "*" : " ",
+				(double)lines.size() / count, (double)gz / count, (double)zlibSize(lines) / count, (double)lines.size() / gz);
+		}
+	}
+	printf("* INFLUX_BATCH_SIZE\n");
+}
+
+int main()
+{
+	checkRoundTrips();
+	report();
+
+	printf("%d checks, %d failures\n", g_checks, g_failures);
+	return g_failures ? 1 : 0;
+}
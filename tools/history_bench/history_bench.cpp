@@ -0,0 +1,259 @@
+//
+// Host check and benchmark for src/utils/history.cpp (HistoryRing and
+// HistoryExport). It fills rings of both config.h sizes with synthetic
+// samples, wraps them, and checks the range search, the stream length,
+// that chunked reads at any offset produce the same bytes as one read,
+// the binary header and the bucket averaging. It then measures the export
+// rate in samples/s per format, reading in chunks of a TCP segment like
+// the web server does, with a plain and a mutex guarded sample source
+// (the device locks every sample).
+//
+// Host numbers only compare formats and revisions, they say nothing
+// about the rate on the ESP32.
+//
+// Build and run (one line):
+//   g++ -O2 -std=c++11 -Wall -Wextra -Isrc/utils -o history_bench tools/history_bench/history_bench.cpp src/utils/history.cpp
+//   ./history_bench [--seconds 1]
+//
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+
+// config.h defaults
+#define HISTORY_CAPACITY			8640
+#define HISTORY_CAPACITY_NO_PSRAM	360
+
+#define SAMPLE_PERIOD_S		10
+#define CHUNK				1436		// TCP payload per response callback
+
+static int g_failures = 0;
+static int g_checks = 0;
+
+static void check(const bool &condition, const char *what, const long long &a = 0, const long long &b = 0)
+{
+	g_checks++;
+	if (!condition) {
+		g_failures++;
+		printf("FAIL: %s (%lld, %lld)\n", what, a, b);
+	}
+}
+
+//
+// sample source
+//
+
+static HistoryRing g_ring;
+static std::mutex g_mutex;
+static volatile uint32_t g_sink;	// keeps the reads from being optimized away
+
+static bool ringGet(const uint32_t &seq, HistoryRecord &record)
+{
+	return g_ring.get(seq, record);
+}
+
+static bool lockedGet(const uint32_t &seq, HistoryRecord &record)
+{
+	std::lock_guard<std::mutex> lock(g_mutex);
+	return g_ring.get(seq, record);
+}
+
+static HistoryRecord sample(const uint32_t &i)
+{
+	HistoryRecord r = {};
+	r.m_timestamp = 1700000000 + i * SAMPLE_PERIOD_S;
+	r.m_pm2_5 = i % 500;
+	r.m_temperature = (int16_t)((int32_t)(i % 7000) - 2000);
+	r.m_humidity = (i * 7) % 10000;
+	r.m_co2 = 400 + i % 4000;
+	r.m_pressure = 9000 + i % 2000;
+	return r;
+}
+
+static void fill(std::vector<HistoryRecord> &storage, const uint32_t &capacity, const uint32_t &samples)
+{
+	storage.assign(capacity, HistoryRecord());
+	g_ring.init(storage.data(), capacity);
+	for (uint32_t i = 0; i < samples; i++) {
+		g_ring.append(sample(i));
+	}
+}
+
+static std::string readAll(const HistoryExport &stream, const size_t &chunk, const size_t &offset = 0)
+{
+	std::string out;
+	std::vector<uint8_t> buffer(chunk);
+	size_t total = stream.length();
+	size_t pos = offset;
+	while (pos < total) {
+		size_t len = stream.read(buffer.data(), chunk, pos);
+		if (!len) {
+			break;
+		}
+		out.append((const char *)buffer.data(), len);
+		pos += len;
+	}
+	return out;
+}
+
+//
+// checks
+//
+
+static void checkRing()
+{
+	std::vector<HistoryRecord> storage;
+	HistoryRecord r;
+	uint32_t firstSeq;
+
+	// empty and unallocated rings
+	g_ring.init(NULL, 100);
+	check(g_ring.capacity() == 0, "ring without storage has no capacity");
+	check(!g_ring.get(0, r), "get on an unallocated ring");
+	check(g_ring.range(0, ~0u, firstSeq) == 0, "range on an unallocated ring");
+
+	// partially filled
+	fill(storage, HISTORY_CAPACITY_NO_PSRAM, 100);
+	check(g_ring.range(0, ~0u, firstSeq) == 100 && firstSeq == 0, "range of a partial ring", firstSeq);
+	check(g_ring.get(99, r) && r.m_timestamp == sample(99).m_timestamp, "newest sample of a partial ring");
+	check(!g_ring.get(100, r), "get past the head");
+
+	// wrapped several times
+	uint32_t samples = 3 * HISTORY_CAPACITY_NO_PSRAM + 17;
+	fill(storage, HISTORY_CAPACITY_NO_PSRAM, samples);
+	uint32_t oldest = samples - HISTORY_CAPACITY_NO_PSRAM;
+	check(!g_ring.get(oldest - 1, r), "overwritten sample is gone", oldest - 1);
+	check(g_ring.get(oldest, r) && r.m_timestamp == sample(oldest).m_timestamp, "oldest sample kept", oldest);
+	check(g_ring.range(0, ~0u, firstSeq) == HISTORY_CAPACITY_NO_PSRAM && firstSeq == oldest, "range of a wrapped ring", firstSeq, oldest);
+
+	// bounds are inclusive, timestamps between samples round inwards
+	uint32_t from = sample(oldest + 10).m_timestamp;
+	uint32_t to = sample(oldest + 19).m_timestamp;
+	check(g_ring.range(from, to, firstSeq) == 10 && firstSeq == oldest + 10, "inclusive range", firstSeq);
+	check(g_ring.range(from - 1, to + 1, firstSeq) == 10 && firstSeq == oldest + 10, "range between samples", firstSeq);
+	check(g_ring.range(to, from, firstSeq) == 0, "reversed range");
+	check(g_ring.range(0, sample(0).m_timestamp, firstSeq) == 0, "range before the oldest sample");
+}
+
+static void checkExport(const HistoryExport::Format &format, const char *name)
+{
+	std::vector<HistoryRecord> storage;
+	fill(storage, HISTORY_CAPACITY_NO_PSRAM, 2 * HISTORY_CAPACITY_NO_PSRAM + 5);
+
+	uint32_t firstSeq;
+	uint32_t count = g_ring.range(0, ~0u, firstSeq);
+
+	for (uint32_t step = 1; step <= 7; step += 3) {
+		HistoryExport stream(format, ringGet, firstSeq, count, step);
+		std::string whole = readAll(stream, 1 << 20);
+		check(whole.size() == stream.length(), name, whole.size(), stream.length());
+		check(stream.records() == (count + step - 1) / step, name, stream.records(), step);
+
+		// chunk sizes that split records and the header
+		size_t chunks[] = { 1, 7, 64, CHUNK };
+		for (size_t chunk : chunks) {
+			check(readAll(stream, chunk) == whole, name, chunk, step);
+		}
+
+		// any start offset, as for Range requests
+		size_t offsets[] = { 1, 20, 63, whole.size() / 2, whole.size() - 1 };
+		for (size_t offset : offsets) {
+			check(readAll(stream, CHUNK, offset) == whole.substr(offset), name, offset, step);
+		}
+
+		char etag[48];
+		check(stream.etag(etag, sizeof(etag)) > 2 && etag[0] == '"', name, step);
+	}
+
+	// the buckets average their samples
+	HistoryExport averaged(HistoryExport::eFormatBinary, ringGet, firstSeq, 4, 4);
+	std::string bin = readAll(averaged, 1 << 20);
+	HistoryRecord r;
+	memcpy(&r, bin.data() + bin.size() - sizeof(r), sizeof(r));
+	uint32_t co2 = 0;
+	for (uint32_t i = 0; i < 4; i++) {
+		HistoryRecord s;
+		g_ring.get(firstSeq + i, s);
+		co2 += s.m_co2;
+	}
+	check(r.m_co2 == co2 / 4, "bucket average", r.m_co2, co2 / 4);
+	check(!memcmp(bin.data(), "VHST", 4) && (uint8_t)bin[5] == sizeof(HistoryRecord), "binary header");
+
+	// samples overwritten during the export read as zero instead of failing
+	HistoryExport stale(format, ringGet, 0, 10, 1);
+	check(readAll(stale, CHUNK).size() == stale.length(), name, 0, 0);
+}
+
+//
+// benchmark
+//
+
+static void bench(const HistoryExport::Format &format, const char *name, const HistoryExport::Source &source, const char *sourceName, const double &seconds)
+{
+	std::vector<HistoryRecord> storage;
+	fill(storage, HISTORY_CAPACITY, HISTORY_CAPACITY + 123);
+
+	uint32_t firstSeq;
+	uint32_t count = g_ring.range(0, ~0u, firstSeq);
+	HistoryExport stream(format, source, firstSeq, count, 1);
+
+	std::vector<uint8_t> buffer(CHUNK);
+	size_t total = stream.length();
+	uint64_t samples = 0;
+	uint64_t bytes = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	double elapsed = 0;
+	while (elapsed < seconds) {
+		for (size_t pos = 0; pos < total;) {
+			size_t len = stream.read(buffer.data(), CHUNK, pos);
+			g_sink += buffer[len - 1];
+			pos += len;
+		}
+		samples += count;
+		bytes += total;
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	printf("%-8s %-8s %6.1f B/sample %12.0f samples/s %8.1f MB/s\n", name, sourceName, (double)total / count, samples / elapsed, bytes / elapsed / 1e6);
+}
+
+static void usage(const char *name)
+{
+	printf("usage: %s [--seconds 1]\n", name);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	double seconds = 1.0;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+			seconds = atof(argv[++i]);
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	checkRing();
+	checkExport(HistoryExport::eFormatCsv, "csv export");
+	checkExport(HistoryExport::eFormatNdjson, "ndjson export");
+	checkExport(HistoryExport::eFormatBinary, "binary export");
+
+	printf("export of %u samples in %u byte chunks\n", HISTORY_CAPACITY, CHUNK);
+	bench(HistoryExport::eFormatCsv, "csv", ringGet, "plain", seconds);
+	bench(HistoryExport::eFormatNdjson, "ndjson", ringGet, "plain", seconds);
+	bench(HistoryExport::eFormatBinary, "binary", ringGet, "plain", seconds);
+	bench(HistoryExport::eFormatCsv, "csv", lockedGet, "locked", seconds);
+	bench(HistoryExport::eFormatNdjson, "ndjson", lockedGet, "locked", seconds);
+	bench(HistoryExport::eFormatBinary, "binary", lockedGet, "locked", seconds);
+
+	printf("%d checks, %d failures\n", g_checks, g_failures);
+	return g_failures ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+#
+# Load generator for the HTTP admission control of a real device: the
+# client mix of tools/admission_check (dashboards polling /get, a
+# Prometheus scraper, an ElegantOTA page burst and a client hammering with
+# parallel requests), each client from its own thread. Reports per client
+# the answers by status and the latency, then checks that the device
+# recovers: after the load every slot has to be free again, so sequential
+# /get requests succeed. Rejections have to carry Retry-After.
+#
+#   python3 tools/http_load.py <device> [--seconds 60] [--sse 10]
+#
+# --sse opens that many /fleet/events streams (FLEET_ENABLED) for the whole
+# run. Streams do not hold admission slots, so they must not cause 503s.
+# All clients share this host's IP, so the per client limits apply to the
+# sum of them, unlike on the host simulation. Run it from several hosts to
+# reproduce independent clients.
+#
+
+import argparse
+import http.client
+import threading
+import time
+
+CLIENTS = [
+	# name, count, period s, parallel requests, path
+	("dashboard", 3, 2.0, 1, "/get"),
+	("scraper", 1, 1.0, 1, "/metrics"),
+	("ota page", 1, 30.0, 6, "/update"),
+	("hammer", 1, 0.02, 4, "/rssi"),
+]
+
+
+class Stats:
+	def __init__(self):
+		self.lock = threading.Lock()
+		self.status = {}
+		self.latency = []
+		self.missing_retry_after = 0
+
+	def add(self, status, latency, retry_after):
+		with self.lock:
+			self.status[status] = self.status.get(status, 0) + 1
+			if status == 200:
+				self.latency.append(latency)
+			if status in (429, 503) and retry_after is None:
+				self.missing_retry_after += 1
+
+
+def request(host, path, timeout=5.0):
+	start = time.monotonic()
+	conn = http.client.HTTPConnection(host, 80, timeout=timeout)
+	try:
+		conn.request("GET", path, headers={"Connection": "close"})
+		response = conn.getresponse()
+		response.read()
+		return response.status, time.monotonic() - start, response.getheader("Retry-After")
+	except (OSError, http.client.HTTPException):
+		return "error", time.monotonic() - start, None
+	finally:
+		conn.close()
+
+
+def client(host, period, parallel, path, stats, stop):
+	while not stop.is_set():
+		round_start = time.monotonic()
+		threads = [threading.Thread(target=lambda: stats.add(*request(host, path))) for _ in range(parallel)]
+		for thread in threads:
+			thread.start()
+		for thread in threads:
+			thread.join()
+		stop.wait(max(0.0, period - (time.monotonic() - round_start)))
+
+
+def sse(host, stop, opened):
+	conn = http.client.HTTPConnection(host, 80, timeout=5.0)
+	try:
+		conn.request("GET", "/fleet/events")
+		response = conn.getresponse()
+		if response.status != 200:
+			return
+		opened.append(1)
+		conn.sock.settimeout(1.0)
+		while not stop.is_set():
+			try:
+				if not response.fp.readline():
+					break
+			except OSError:
+				pass
+	except (OSError, http.client.HTTPException):
+		pass
+	finally:
+		conn.close()
+
+
+def percentile(values, fraction):
+	if not values:
+		return 0.0
+	values = sorted(values)
+	return values[min(len(values) - 1, int(fraction * len(values)))]
+
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument("device")
+	parser.add_argument("--seconds", type=float, default=60.0)
+	parser.add_argument("--sse", type=int, default=0)
+	args = parser.parse_args()
+
+	stop = threading.Event()
+	threads = []
+	opened = []
+	for _ in range(args.sse):
+		threads.append(threading.Thread(target=sse, args=(args.device, stop, opened)))
+
+	stats = {}
+	for name, count, period, parallel, path in CLIENTS:
+		for i in range(count):
+			key = "%s %d" % (name, i + 1) if count > 1 else name
+			stats[key] = Stats()
+			threads.append(threading.Thread(target=client, args=(args.device, period, parallel, path, stats[key], stop)))
+
+	for thread in threads:
+		thread.start()
+	time.sleep(args.seconds)
+	stop.set()
+	for thread in threads:
+		thread.join()
+
+	if args.sse:
+		print("%d of %d event streams opened" % (len(opened), args.sse))
+	print("%-12s %8s %8s %8s %8s %8s %10s %10s" % ("client", "200", "429", "503", "other", "error", "p50 ms", "p95 ms"))
+	missing = 0
+	for name, s in stats.items():
+		other = sum(n for status, n in s.status.items() if status not in (200, 429, 503, "error"))
+		print("%-12s %8d %8d %8d %8d %8d %10.1f %10.1f" % (name, s.status.get(200, 0), s.status.get(429, 0), s.status.get(503, 0),
+			other, s.status.get("error", 0), 1000 * percentile(s.latency, 0.5), 1000 * percentile(s.latency, 0.95)))
+		missing += s.missing_retry_after
+
+	failures = 0
+	if missing:
+		print("FAIL: %d rejections without Retry-After" % missing)
+		failures += 1
+
+	# the rate limit refills within HTTP_RATE_LIMIT_BURST / HTTP_RATE_LIMIT_RPS seconds
+	time.sleep(3.0)
+	recovered = [request(args.device, "/get")[0] for _ in range(5)]
+	if recovered.count(200) != len(recovered):
+		print("FAIL: the device did not recover after the load: %s" % recovered)
+		failures += 1
+	else:
+		print("recovered: %d of %d sequential /get requests answered" % (recovered.count(200), len(recovered)))
+
+	return 1 if failures else 0
+
+
+if __name__ == "__main__":
+	raise SystemExit(main())
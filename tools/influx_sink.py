@@ -0,0 +1,99 @@
+#
+# Stand-in InfluxDB write endpoint for checking the line protocol writer
+# (INFLUX_ENABLED) without a real database. Accepts v1 (/write) and v2
+# (/api/v2/write) writes, optionally gzipped, and reports the bytes sent
+# per sample and the request rate.
+#
+#   python3 tools/influx_sink.py [--port 8086] [--fail 0.0] [--verbose]
+#
+# Point INFLUX_URL at http://<this host>:8086/api/v2/write?...&precision=ms.
+# --fail answers the given fraction of requests with 503 to exercise the
+# retry/backoff path.
+#
+
+import argparse
+import gzip
+import random
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+class Stats:
+	def __init__(self):
+		self.started = time.time()
+		self.requests = 0
+		self.failed = 0
+		self.samples = 0
+		self.wire_bytes = 0
+		self.raw_bytes = 0
+
+
+stats = Stats()
+args = None
+
+
+class WriteHandler(BaseHTTPRequestHandler):
+	protocol_version = "HTTP/1.1"
+
+	def do_POST(self):
+		if not self.path.startswith(("/write", "/api/v2/write")):
+			self.reply(404)
+			return
+
+		body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+
+		if random.random() < args.fail:
+			stats.failed += 1
+			self.reply(503)
+			return
+
+		raw = body
+		if self.headers.get("Content-Encoding") == "gzip":
+			try:
+				raw = gzip.decompress(body)
+			except OSError as e:
+				print("bad gzip body: %s" % e)
+				self.reply(400)
+				return
+
+		lines = [l for l in raw.decode("utf-8").split("\n") if l]
+		stats.requests += 1
+		stats.samples += len(lines)
+		stats.wire_bytes += len(body)
+		stats.raw_bytes += len(raw)
+
+		elapsed = max(time.time() - stats.started, 1)
+		print("%s: %d samples, %d bytes (%d raw) | total %d samples, %.1f B/sample (%.1f raw), %.2f req/min, %d failed" % (
+			self.client_address[0], len(lines), len(body), len(raw),
+			stats.samples, stats.wire_bytes / stats.samples, stats.raw_bytes / stats.samples,
+			stats.requests * 60 / elapsed, stats.failed))
+
+		if args.verbose:
+			for line in lines:
+				print("  " + line)
+
+		self.reply(204)
+
+	def reply(self, code):
+		self.send_response(code)
+		self.send_header("Content-Length", "0")
+		self.end_headers()
+
+	def log_message(self, format, *args):
+		pass
+
+
+def main():
+	global args
+	parser = argparse.ArgumentParser(description="Stand-in InfluxDB write endpoint")
+	parser.add_argument("--port", type=int, default=8086)
+	parser.add_argument("--fail", type=float, default=0.0, help="fraction of requests answered with 503")
+	parser.add_argument("--verbose", action="store_true", help="print received lines")
+	args = parser.parse_args()
+
+	print("listening on port %d" % args.port)
+	ThreadingHTTPServer(("", args.port), WriteHandler).serve_forever()
+
+
+if __name__ == "__main__":
+	main()
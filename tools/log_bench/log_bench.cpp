@@ -0,0 +1,405 @@
+//
+// Host benchmark and checks of src/utils/logRing.cpp. Producer threads log
+// in bursts while a consumer writes to a sink as slow as the 115200 baud
+// serial port. It runs once with the previous scheme and once with
+// LogRing. The previous scheme formats the message and writes it to the
+// sink while holding a mutex. Reports the time a producer spends per
+// message. A stress run then checks every message with a small ring:
+// messages are intact, in order per producer, and each one is either
+// delivered or counted as dropped.
+//
+// Build and run (one line):
+//   g++ -O2 -std=c++11 -Wall -Wextra -pthread -Isrc/utils -o log_bench tools/log_bench/log_bench.cpp src/utils/logRing.cpp
+//   ./log_bench [--producers 4] [--bursts 10] [--burst-len 10] [--sink-bps 11520]
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logRing.h"
+
+// defaults of config.h
+#define RING_SIZE			8192
+#define LOG_SIZE_MAX		512
+
+#define BURST_GAP_MS		500
+
+static int g_failures = 0;
+static int g_checks = 0;
+
+static void check(const bool &condition, const char *what, const long long &a = 0, const long long &b = 0)
+{
+	g_checks++;
+	if (!condition) {
+		g_failures++;
+		printf("FAIL: %s (%lld, %lld)\n", what, a, b);
+	}
+}
+
+static int64_t nowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// serial port: the write returns once the bytes are out
+class Sink {
+public:
+	explicit Sink(const int &bytesPerS)
+		: m_bytesPerS(bytesPerS)
+	{
+	}
+
+	void write(const char *data, const size_t &len)
+	{
+		(void)data;
+		m_bytes += len;
+		if (m_bytesPerS) {
+			std::this_thread::sleep_for(std::chrono::microseconds(len * 1000000ULL / m_bytesPerS));
+		}
+	}
+
+	uint64_t bytes() const { return m_bytes; }
+
+private:
+	int m_bytesPerS;
+	uint64_t m_bytes = 0;
+};
+
+// message of a producer: "p<producer> n<seq> " and a payload derived from both
+static int format(char *buf, const int &producer, const int &seq, const char *fmt, ...)
+{
+	int len = snprintf(buf, LOG_SIZE_MAX, "p%d n%d ", producer, seq);
+	va_list ap;
+	va_start(ap, fmt);
+	len += vsnprintf(buf + len, LOG_SIZE_MAX - len, fmt, ap);
+	va_end(ap);
+	return len;
+}
+
+static int message(char *buf, const int &producer, const int &seq)
+{
+	// about the length of a typical request log line
+	return format(buf, producer, seq, "[HTTP] GET /get from 192.168.%d.%d took %d ms %s\n",
+		producer, seq % 256, seq % 97, "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx" + (seq % 40));
+}
+
+//
+// previous implementation: format and write under the serial mutex
+//
+
+class LegacyLog {
+public:
+	explicit LegacyLog(const int &sinkBps)
+		: m_sink(sinkBps)
+	{
+	}
+
+	void log(const int &producer, const int &seq)
+	{
+		char buf[LOG_SIZE_MAX];
+		int len = message(buf, producer, seq);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_sink.write(buf, len);
+	}
+
+	void stop() {}
+	uint32_t dropped() const { return 0; }
+	uint32_t highWater() const { return 0; }
+
+private:
+	std::mutex m_mutex;
+	Sink m_sink;
+};
+
+//
+// LogRing with a drain thread
+//
+
+class RingLog {
+public:
+	// verify is called by the consumer for every delivered message
+	typedef std::function<void(const char *, size_t)> Verify;
+
+	RingLog(const int &sinkBps, const size_t &ringSize = RING_SIZE, const Verify &verify = Verify())
+		: m_ring(ringSize)
+		, m_sink(sinkBps)
+		, m_verify(verify)
+		, m_drain([this] { drain(); })
+	{
+	}
+
+	void log(const int &producer, const int &seq)
+	{
+		char buf[LOG_SIZE_MAX];
+		int len = message(buf, producer, seq);
+		m_ring.write(buf, len);
+	}
+
+	void stop()
+	{
+		m_stop = true;
+		m_drain.join();
+	}
+
+	uint32_t dropped() const
+	{
+		LogRing::Stats stats;
+		m_ring.stats(stats);
+		return stats.m_dropped;
+	}
+
+	uint32_t highWater() const
+	{
+		LogRing::Stats stats;
+		m_ring.stats(stats);
+		return stats.m_highWater;
+	}
+
+private:
+	void drain()
+	{
+		while (1) {
+			bool stopping = m_stop;
+			bool drained = false;
+			size_t len;
+			const char *data;
+			while ((data = m_ring.peek(len)) != NULL) {
+				drained = true;
+				if (m_verify) {
+					m_verify(data, len);
+				}
+				m_sink.write(data, len);
+				m_ring.release();
+			}
+			if (stopping) {
+				break;
+			}
+			// the drain task is woken by the producers, polling stands in for that
+			if (!drained) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+	}
+
+	LogRing m_ring;
+	Sink m_sink;
+	Verify m_verify;
+	std::atomic<bool> m_stop{false};
+	std::thread m_drain;
+};
+
+struct Result {
+	std::vector<int64_t> m_latencyNs;
+	uint32_t m_dropped;
+	uint32_t m_highWater;
+};
+
+template <typename Log>
+static Result run(Log &log, const int &producers, const int &bursts, const int &burstLen)
+{
+	std::vector<std::vector<int64_t>> latencies(producers);
+	std::vector<std::thread> threads;
+	for (int p = 0; p < producers; p++) {
+		threads.emplace_back([&, p] {
+			int seq = 0;
+			// staggered so the bursts overlap partially
+			std::this_thread::sleep_for(std::chrono::milliseconds(p * 7));
+			for (int b = 0; b < bursts; b++) {
+				int64_t burstStart = nowNs();
+				for (int i = 0; i < burstLen; i++) {
+					int64_t start = nowNs();
+					log.log(p, seq++);
+					latencies[p].push_back(nowNs() - start);
+				}
+				int64_t nextNs = burstStart + BURST_GAP_MS * 1000000LL;
+				std::this_thread::sleep_for(std::chrono::nanoseconds(std::max((int64_t)0, nextNs - nowNs())));
+			}
+		});
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	log.stop();
+
+	Result result;
+	for (const std::vector<int64_t> &l : latencies) {
+		result.m_latencyNs.insert(result.m_latencyNs.end(), l.begin(), l.end());
+	}
+	std::sort(result.m_latencyNs.begin(), result.m_latencyNs.end());
+	result.m_dropped = log.dropped();
+	result.m_highWater = log.highWater();
+	return result;
+}
+
+static double percentileUs(const std::vector<int64_t> &sorted, const double &fraction)
+{
+	if (sorted.empty()) {
+		return 0;
+	}
+	return sorted[std::min(sorted.size() - 1, (size_t)(fraction * sorted.size()))] / 1000.0;
+}
+
+static void report(const char *name, const Result &result)
+{
+	printf("  %-7s p50 %10.1f us  p99 %10.1f us  max %10.1f us  %5u dropped  high water %5u bytes\n",
+		name, percentileUs(result.m_latencyNs, 0.5), percentileUs(result.m_latencyNs, 0.99),
+		percentileUs(result.m_latencyNs, 1.0), result.m_dropped, result.m_highWater);
+}
+
+// small ring, no sink delay, producers far faster than the consumer at times
+static void stress(const int &producers)
+{
+	const int perProducer = 20000;
+	std::vector<int> lastSeq(producers, -1);
+	uint32_t delivered = 0;
+	uint32_t corrupt = 0;
+	uint32_t reordered = 0;
+
+	RingLog log(0, 1024, [&](const char *data, size_t len) {
+		char buf[LOG_SIZE_MAX];
+		int p;
+		int seq;
+		if (sscanf(data, "p%d n%d ", &p, &seq) != 2 || p < 0 || p >= producers) {
+			corrupt++;
+			return;
+		}
+		int expectedLen = message(buf, p, seq);
+		if ((size_t)expectedLen != len || memcmp(buf, data, len)) {
+			corrupt++;
+		}
+		if (seq <= lastSeq[p]) {
+			reordered++;
+		}
+		lastSeq[p] = seq;
+		delivered++;
+	});
+
+	std::vector<std::thread> threads;
+	for (int p = 0; p < producers; p++) {
+		threads.emplace_back([&, p] {
+			for (int seq = 0; seq < perProducer; seq++) {
+				log.log(p, seq);
+				// pauses let the consumer catch up now and then, so both full and free space are exercised
+				if (seq % 4 == 0) {
+					std::this_thread::sleep_for(std::chrono::microseconds(50));
+				}
+			}
+		});
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	log.stop();
+
+	uint32_t dropped = log.dropped();
+	printf("stress: %d producers, 1024 byte ring: %u delivered, %u dropped\n", producers, delivered, dropped);
+	check(!corrupt, "messages intact", corrupt);
+	check(!reordered, "messages in order per producer", reordered);
+	check(delivered + dropped == (uint32_t)(producers * perProducer), "every message delivered or counted", delivered + dropped, producers * perProducer);
+	check(log.highWater() <= 1024, "high water within the ring", log.highWater());
+}
+
+static void checkRing()
+{
+	LogRing ring(256);
+	size_t len;
+
+	check(ring.peek(len) == NULL, "empty ring");
+	check(!ring.write("x", 100), "messages over a quarter of the ring are dropped");
+
+	// fill, wrap around with padding, drain
+	char buf[64];
+	for (int round = 0; round < 20; round++) {
+		int written = 0;
+		while (written < 10 && ring.write(buf, snprintf(buf, sizeof(buf), "message %d/%d", round, written))) {
+			written++;
+		}
+		for (int i = 0; i < written; i++) {
+			const char *data = ring.peek(len);
+			int expected = snprintf(buf, sizeof(buf), "message %d/%d", round, i);
+			if (!data || len != (size_t)expected || memcmp(data, buf, len)) {
+				check(false, "wrapped message intact", round, i);
+				return;
+			}
+			ring.release();
+		}
+		check(ring.peek(len) == NULL, "drained");
+	}
+}
+
+static void usage(const char *name)
+{
+	printf("usage: %s [--producers n] [--bursts n] [--burst-len n] [--sink-bps n]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	int producers = 4;
+	int bursts = 10;
+	int burstLen = 10;
+	int sinkBps = 11520;
+
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 >= argc) {
+			usage(argv[0]);
+		}
+		if (!strcmp(argv[i], "--producers")) {
+			producers = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--bursts")) {
+			bursts = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--burst-len")) {
+			burstLen = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--sink-bps")) {
+			sinkBps = atoi(argv[++i]);
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	if (producers < 1 || bursts < 1 || burstLen < 1 || sinkBps < 1) {
+		usage(argv[0]);
+	}
+
+	checkRing();
+
+	printf("%d producers, bursts of %d messages every %d ms, sink %d bytes/s, time per message:\n",
+		producers, burstLen, BURST_GAP_MS, sinkBps);
+	{
+		LegacyLog log(sinkBps);
+		report("mutex", run(log, producers, bursts, burstLen));
+	}
+	{
+		RingLog log(sinkBps);
+		Result result = run(log, producers, bursts, burstLen);
+		report("ring", result);
+		check(percentileUs(result.m_latencyNs, 0.99) < 1000, "ring producers do not wait for the sink", percentileUs(result.m_latencyNs, 0.99));
+	}
+
+	// overload: the sink cannot keep up, the ring drops instead of blocking
+	printf("overload, bursts of %d messages:\n", burstLen * 10);
+	{
+		LegacyLog log(sinkBps);
+		report("mutex", run(log, producers, std::max(1, bursts / 5), burstLen * 10));
+	}
+	{
+		RingLog log(sinkBps);
+		Result result = run(log, producers, std::max(1, bursts / 5), burstLen * 10);
+		report("ring", result);
+		check(result.m_dropped > 0, "overload drops messages", result.m_dropped);
+	}
+
+	stress(producers);
+
+	printf("%d checks, %d failures\n", g_checks, g_failures);
+	return g_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
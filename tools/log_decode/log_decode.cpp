@@ -0,0 +1,213 @@
+//
+// Host decoder of the binary log (/log.bin, see src/utils/logRecord.h).
+// The records only hold the addresses of their format strings, they are
+// read from the firmware ELF the device runs (.pio/build/<env>/firmware.elf).
+// A dump of a different build decodes to garbage or to "?" formats.
+//
+// Build and run (one line):
+//   g++ -O2 -std=c++11 -Wall -Wextra -Isrc/utils -o log_decode tools/log_decode/log_decode.cpp src/utils/logRecord.cpp
+//   curl -o log.bin http://<device>/log.bin
+//   ./log_decode .pio/build/<env>/firmware.elf log.bin [--module wifi] [--level debug]
+//
+// The device and the host are both little endian.
+//
+
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logRecord.h"
+
+#define MIN_EPOCH_MS	1577836800000ULL	// 2020-01-01, anything older is uptime
+#define TEXT_MAX		1024
+
+#define ELF_SHF_ALLOC	0x2
+#define ELF_SHT_NOBITS	8
+
+struct Section {
+	uint64_t m_addr;
+	uint64_t m_offset;
+	uint64_t m_size;
+};
+
+static bool readFile(const char *path, std::vector<uint8_t> &data)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		return false;
+	}
+
+	uint8_t buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+		data.insert(data.end(), buf, buf + n);
+	}
+	fclose(file);
+	return true;
+}
+
+template <typename T>
+static T get(const std::vector<uint8_t> &data, const uint64_t &offset)
+{
+	T value = 0;
+	if (offset + sizeof(T) <= data.size()) {
+		memcpy(&value, &data[offset], sizeof(T));
+	}
+	return value;
+}
+
+//
+// ELF, only the section headers: the loaded sections map addresses to file offsets
+//
+
+class Elf {
+public:
+	bool load(const char *path)
+	{
+		if (!readFile(path, m_data) || m_data.size() < 52 || memcmp(&m_data[0], "\x7f" "ELF", 4)) {
+			return false;
+		}
+
+		bool is64 = m_data[4] == 2;
+		uint64_t shoff = is64 ? get<uint64_t>(m_data, 0x28) : get<uint32_t>(m_data, 0x20);
+		uint16_t shentsize = get<uint16_t>(m_data, is64 ? 0x3a : 0x2e);
+		uint16_t shnum = get<uint16_t>(m_data, is64 ? 0x3c : 0x30);
+
+		for (uint16_t i = 0; i < shnum; i++) {
+			uint64_t sh = shoff + (uint64_t)i * shentsize;
+			uint32_t type = get<uint32_t>(m_data, sh + 4);
+			uint64_t flags = is64 ? get<uint64_t>(m_data, sh + 8) : get<uint32_t>(m_data, sh + 8);
+
+			Section section;
+			section.m_addr = is64 ? get<uint64_t>(m_data, sh + 16) : get<uint32_t>(m_data, sh + 12);
+			section.m_offset = is64 ? get<uint64_t>(m_data, sh + 24) : get<uint32_t>(m_data, sh + 16);
+			section.m_size = is64 ? get<uint64_t>(m_data, sh + 32) : get<uint32_t>(m_data, sh + 20);
+			if ((flags & ELF_SHF_ALLOC) && type != ELF_SHT_NOBITS && section.m_offset + section.m_size <= m_data.size()) {
+				m_sections.push_back(section);
+			}
+		}
+		return !m_sections.empty();
+	}
+
+	// the string at a device address, NULL if no section holds it
+	const char *string(const uint64_t &addr) const
+	{
+		for (const Section &section : m_sections) {
+			if (addr >= section.m_addr && addr < section.m_addr + section.m_size) {
+				const char *str = (const char *)&m_data[section.m_offset + (addr - section.m_addr)];
+				size_t max = section.m_size - (addr - section.m_addr);
+				return memchr(str, 0, max) ? str : NULL;
+			}
+		}
+		return NULL;
+	}
+
+private:
+	std::vector<uint8_t> m_data;
+	std::vector<Section> m_sections;
+};
+
+static void timeStr(const uint64_t &ms, char *buf, const size_t &len)
+{
+	if (ms < MIN_EPOCH_MS) {
+		unsigned long s = ms / 1000;
+		snprintf(buf, len, "+%02lu:%02lu:%02lu.%03lu", s / 3600, (s % 3600) / 60, s % 60, (unsigned long)(ms % 1000));
+		return;
+	}
+
+	time_t s = ms / 1000;
+	struct tm utc;
+	gmtime_r(&s, &utc);
+	snprintf(buf, len, "%04d-%02d-%02dT%02d:%02d:%02d.%03luZ", utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday,
+		utc.tm_hour, utc.tm_min, utc.tm_sec, (unsigned long)(ms % 1000));
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s <firmware.elf> <log.bin> [--module <name>] [--level <name>]\n", name);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		usage(argv[0]);
+	}
+
+	int module = -1;
+	LogLevel level = eLogDebug;
+	for (int i = 3; i < argc; i++) {
+		LogModule m;
+		if (!strcmp(argv[i], "--module") && i + 1 < argc && logModuleFromName(argv[i + 1], m)) {
+			module = m;
+			i++;
+		} else if (!strcmp(argv[i], "--level") && i + 1 < argc && logLevelFromName(argv[i + 1], level)) {
+			i++;
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	Elf elf;
+	if (!elf.load(argv[1])) {
+		fprintf(stderr, "%s: not an ELF file with loaded sections\n", argv[1]);
+		return 1;
+	}
+
+	std::vector<uint8_t> dump;
+	if (!readFile(argv[2], dump) || dump.size() < LOG_DUMP_HEADER_LEN || memcmp(&dump[0], LOG_DUMP_MAGIC, 4)) {
+		fprintf(stderr, "%s: not a log dump\n", argv[2]);
+		return 1;
+	}
+	if (dump[4] != LOG_DUMP_VERSION) {
+		fprintf(stderr, "%s: unsupported version %u\n", argv[2], dump[4]);
+		return 1;
+	}
+
+	size_t pointerSize = dump[5];
+	size_t offset = LOG_DUMP_HEADER_LEN;
+	int records = 0;
+	int unresolved = 0;
+	while (offset + sizeof(uint16_t) <= dump.size()) {
+		uint16_t len = get<uint16_t>(dump, offset);
+		offset += sizeof(len);
+		if (offset + len > dump.size()) {
+			fprintf(stderr, "%s: truncated record at offset %zu\n", argv[2], offset);
+			return 1;
+		}
+
+		const uint8_t *record = &dump[offset];
+		offset += len;
+
+		LogRecordHeader header;
+		if (!logRecordHeader(record, len, pointerSize, header)) {
+			fprintf(stderr, "%s: malformed record at offset %zu\n", argv[2], offset - len);
+			return 1;
+		}
+		if ((module >= 0 && header.m_module != module) || header.m_level > level) {
+			continue;
+		}
+
+		char time[64];
+		char text[TEXT_MAX];
+		timeStr(header.m_timeMs, time, sizeof(time));
+		const char *format = elf.string(header.m_format);
+		if (format) {
+			logRecordFormat(record, len, pointerSize, format, text, sizeof(text));
+		} else {
+			snprintf(text, sizeof(text), "<format 0x%llx not in the ELF, %u arguments>\n", (unsigned long long)header.m_format, header.m_args);
+			unresolved++;
+		}
+
+		// the messages end with their own newline
+		size_t textLen = strlen(text);
+		printf("%s %-7s %-7s %s%s", time, logModuleName(header.m_module), logLevelName(header.m_level), text,
+			(textLen && text[textLen - 1] == '\n') ? "" : "\n");
+		records++;
+	}
+
+	fprintf(stderr, "%d records, %d with unresolved formats\n", records, unresolved);
+	return unresolved ? 1 : 0;
+}
@@ -0,0 +1,445 @@
+//
+// Host benchmark and checks of src/utils/logRecord.{h,cpp}. Measures what
+// a log call costs the calling task with the previous schemes and with
+// binary records: formatting the time and the message (before the log
+// ring), formatting the message only (text log ring) and encoding the
+// format pointer and the arguments (binary log ring). Every variant then
+// writes to a LogRing, which is drained outside of the measurement. The
+// deferred formatting done by the drain task and a call filtered by the
+// runtime level are reported too.
+//
+// The checks compare the formatted records to snprintf() of the same
+// format and arguments, and cover truncation and 32 bit records.
+//
+// --dump writes the sample messages as /log.bin would, so tools/log_decode
+// can be checked against this binary (built without PIE the format
+// addresses are the ones in the ELF):
+//
+// Build and run (one line):
+//   g++ -O2 -std=c++11 -Wall -Wextra -no-pie -Isrc/utils -o log_record_bench tools/log_record_bench/log_record_bench.cpp src/utils/logRecord.cpp src/utils/logRing.cpp
+//   ./log_record_bench [--calls 200000] [--dump log.bin]
+//   ./log_decode log_record_bench log.bin
+//
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logRecord.h"
+#include "logRing.h"
+
+// defaults of config.h
+#define RING_SIZE			8192
+#define LOG_SIZE_MAX		512
+#define BATCH				32
+
+static int g_failures = 0;
+static int g_checks = 0;
+static volatile uint8_t g_runtimeLevel = eLogInfo;
+
+static void check(const bool &condition, const char *what, const long long &a = 0, const long long &b = 0)
+{
+	g_checks++;
+	if (!condition) {
+		g_failures++;
+		printf("FAIL: %s (%lld, %lld)\n", what, a, b);
+	}
+}
+
+static int64_t nowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t nowMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// epochToTimeStr() of src/utils/utils.cpp
+static char *timeStr(const uint64_t &ms, char *buf, const size_t &len)
+{
+	time_t s = ms / 1000;
+	struct tm local;
+	localtime_r(&s, &local);
+	snprintf(buf, len, "%02d:%02d:%02d.%03lu", local.tm_hour, local.tm_min, local.tm_sec, (unsigned long)(ms % 1000));
+	return buf;
+}
+
+//
+// the schemes, each writes one message to the ring
+//
+
+// before the log ring: the time string and the message formatted by the caller
+__attribute__((format(printf, 2, 3))) static void logTimeText(LogRing &ring, const char *fmt, ...)
+{
+	char buf[LOG_SIZE_MAX];
+	char time[32];
+	int len = snprintf(buf, sizeof(buf), "%s: ", timeStr(nowMs(), time, sizeof(time)));
+
+	va_list ap;
+	va_start(ap, fmt);
+	len += vsnprintf(buf + len, sizeof(buf) - len, fmt, ap);
+	va_end(ap);
+	ring.write(buf, std::min(len, LOG_SIZE_MAX - 1));
+}
+
+// text log ring: the time as a number, the message formatted by the caller
+__attribute__((format(printf, 2, 3))) static void logText(LogRing &ring, const char *fmt, ...)
+{
+	char buf[sizeof(uint64_t) + LOG_SIZE_MAX];
+	uint64_t now = nowMs();
+	memcpy(buf, &now, sizeof(now));
+
+	va_list ap;
+	va_start(ap, fmt);
+	int len = vsnprintf(buf + sizeof(now), LOG_SIZE_MAX, fmt, ap);
+	va_end(ap);
+	ring.write(buf, sizeof(now) + std::min(len, LOG_SIZE_MAX - 1));
+}
+
+// binary log ring, what logWrite() in src/utils/utils.h does
+template <typename... Args>
+static void logBinary(LogRing &ring, const uint8_t &level, const char *fmt, const Args &... args)
+{
+	if (level <= g_runtimeLevel) {
+		uint8_t record[LOG_RECORD_MAX];
+		ring.write((const char *)record, logRecordEncode(record, nowMs(), eLogModuleSensor, level, fmt, args...));
+	}
+}
+
+//
+// samples, messages as the firmware logs them
+//
+
+#define SAMPLE_PLAIN		"Starting Sensor task\n"
+#define SAMPLE_INT			"PM2.5 concentration: %u ug/m3\n"
+#define SAMPLE_DOUBLE		"Co2: %d ppm, temperature = %f C, humidity = %f %%\n"
+#define SAMPLE_STRING		"[WIFI] Connecting BSSID: %02X:%02X:%02X:%02X:%02X:%02X, SSID: %s, channel: %d\n"
+
+static const uint8_t g_bssid[6] = { 0x24, 0x4b, 0xfe, 0x01, 0xa2, 0x7c };
+
+struct Variant {
+	const char *m_name;
+	void (*m_call)(LogRing &ring, const int &sample, const int &i);
+};
+
+static void callTimeText(LogRing &ring, const int &sample, const int &i)
+{
+	switch (sample) {
+	case 0: logTimeText(ring, SAMPLE_PLAIN); break;
+	case 1: logTimeText(ring, SAMPLE_INT, (unsigned)i); break;
+	case 2: logTimeText(ring, SAMPLE_DOUBLE, 400 + i % 100, 21.5 + i % 7, 45.25); break;
+	default: logTimeText(ring, SAMPLE_STRING, g_bssid[0], g_bssid[1], g_bssid[2], g_bssid[3], g_bssid[4], g_bssid[5], "office-2.4GHz", 6); break;
+	}
+}
+
+static void callText(LogRing &ring, const int &sample, const int &i)
+{
+	switch (sample) {
+	case 0: logText(ring, SAMPLE_PLAIN); break;
+	case 1: logText(ring, SAMPLE_INT, (unsigned)i); break;
+	case 2: logText(ring, SAMPLE_DOUBLE, 400 + i % 100, 21.5 + i % 7, 45.25); break;
+	default: logText(ring, SAMPLE_STRING, g_bssid[0], g_bssid[1], g_bssid[2], g_bssid[3], g_bssid[4], g_bssid[5], "office-2.4GHz", 6); break;
+	}
+}
+
+static void callBinaryAt(LogRing &ring, const int &sample, const int &i, const uint8_t &level)
+{
+	switch (sample) {
+	case 0: logBinary(ring, level, SAMPLE_PLAIN); break;
+	case 1: logBinary(ring, level, SAMPLE_INT, (unsigned)i); break;
+	case 2: logBinary(ring, level, SAMPLE_DOUBLE, 400 + i % 100, 21.5 + i % 7, 45.25); break;
+	default: logBinary(ring, level, SAMPLE_STRING, g_bssid[0], g_bssid[1], g_bssid[2], g_bssid[3], g_bssid[4], g_bssid[5], "office-2.4GHz", 6); break;
+	}
+}
+
+static void callBinary(LogRing &ring, const int &sample, const int &i)
+{
+	callBinaryAt(ring, sample, i, eLogInfo);
+}
+
+static void callFiltered(LogRing &ring, const int &sample, const int &i)
+{
+	callBinaryAt(ring, sample, i, eLogDebug);
+}
+
+static void drain(LogRing &ring, const bool &format)
+{
+	size_t len;
+	const char *data;
+	while ((data = ring.peek(len)) != NULL) {
+		if (format) {
+			LogRecordHeader header;
+			char text[LOG_SIZE_MAX];
+			char time[32];
+			if (logRecordHeader((const uint8_t *)data, len, sizeof(void *), header)) {
+				timeStr(header.m_timeMs, time, sizeof(time));
+				logRecordFormat((const uint8_t *)data, len, sizeof(void *), (const char *)(uintptr_t)header.m_format, text, sizeof(text));
+			}
+		}
+		ring.release();
+	}
+}
+
+// ns per call of one sample, the ring is drained between batches
+static double measure(const Variant &variant, const int &sample, const int &calls)
+{
+	LogRing ring(RING_SIZE);
+	int64_t total = 0;
+	for (int done = 0; done < calls; done += BATCH) {
+		int64_t start = nowNs();
+		for (int i = done; i < done + BATCH; i++) {
+			variant.m_call(ring, sample, i);
+		}
+		total += nowNs() - start;
+		drain(ring, false);
+	}
+
+	LogRing::Stats stats;
+	ring.stats(stats);
+	check(stats.m_dropped == 0, "no message dropped while measuring", stats.m_dropped);
+	return (double)total / calls;
+}
+
+// ns per record formatted by the drain task
+static double measureDrain(const int &sample, const int &calls)
+{
+	LogRing ring(RING_SIZE);
+	int64_t total = 0;
+	for (int done = 0; done < calls; done += BATCH) {
+		for (int i = done; i < done + BATCH; i++) {
+			callBinary(ring, sample, i);
+		}
+		int64_t start = nowNs();
+		drain(ring, true);
+		total += nowNs() - start;
+	}
+	return (double)total / calls;
+}
+
+//
+// checks
+//
+
+static void roundTrip(const char *what, const char *expected, const uint8_t *record, const size_t &len)
+{
+	char text[LOG_SIZE_MAX];
+	LogRecordHeader header;
+	bool parsed = logRecordHeader(record, len, sizeof(void *), header);
+	check(parsed, what);
+	logRecordFormat(record, len, sizeof(void *), (const char *)(uintptr_t)header.m_format, text, sizeof(text));
+	if (strcmp(text, expected)) {
+		printf("     expected \"%s\"\n     got      \"%s\"\n", expected, text);
+	}
+	check(!strcmp(text, expected), what);
+}
+
+// encodes and formats fmt with the arguments, compares to snprintf()
+#define CHECK_FORMAT(fmt, ...) do { \
+	char expected[LOG_SIZE_MAX]; \
+	uint8_t record[LOG_RECORD_MAX]; \
+	snprintf(expected, sizeof(expected), fmt, ##__VA_ARGS__); \
+	size_t len = logRecordEncode(record, 1234, eLogModuleMain, eLogInfo, fmt, ##__VA_ARGS__); \
+	roundTrip(fmt, expected, record, len); \
+} while (0)
+
+static void checkFormats()
+{
+	int32_t negative = -42;
+	int64_t big = -1234567890123LL;
+	uint64_t ubig = 18446744073709551615ULL;
+	uint8_t byte = 0xfe;
+	uint16_t word = 0xbeef;
+	size_t size = 123456;
+	long rssi = -67;
+	char name[16] = "sensor";
+	const char *null = NULL;
+	(void)null;
+
+	CHECK_FORMAT("plain text\n");
+	CHECK_FORMAT("100%% done %d%%\n", 7);
+	CHECK_FORMAT("%d %i %u %x %X %o\n", negative, negative, (unsigned)negative, (unsigned)negative, (unsigned)negative, (unsigned)negative);
+	CHECK_FORMAT("%lld %llu %llx\n", (long long)big, (unsigned long long)ubig, (unsigned long long)ubig);
+	CHECK_FORMAT("%02X:%02x %04x\n", byte, byte, word);
+	CHECK_FORMAT("%zu bytes, rssi %ld dBm\n", size, rssi);
+	CHECK_FORMAT("[%5d] [%-5d] [%+d] [% d] [%05d]\n", 42, 42, 42, 42, -42);
+	CHECK_FORMAT("[%*d] [%-*d] [%.*f]\n", 6, 42, 6, 42, 2, 3.14159);
+	CHECK_FORMAT("%f %.3f %e %g %10.2f\n", 21.5, 0.0005, 12345.678, 1e-7, -3.25);
+	CHECK_FORMAT("%f %f\n", 21.5f, -0.125f);
+	CHECK_FORMAT("%s, %10s, %-10s|, %.3s\n", "abc", name, name, "abcdef");
+	CHECK_FORMAT("%c%c%c\n", 'a', 'b', 'c');
+	CHECK_FORMAT("'%s' is %s\n", name, true ? "true" : "false");
+	CHECK_FORMAT("%s(%d): request from %s\n", __FUNCTION__, __LINE__, "192.168.1.17");
+	CHECK_FORMAT(SAMPLE_STRING, g_bssid[0], g_bssid[1], g_bssid[2], g_bssid[3], g_bssid[4], g_bssid[5], "office-2.4GHz", 6);
+
+	// pointers print as 0x<hex> on every platform
+	uint8_t record[LOG_RECORD_MAX];
+	char expected[64];
+	snprintf(expected, sizeof(expected), "at 0x%llx\n", (unsigned long long)(uintptr_t)&negative);
+	roundTrip("%p", expected, record, logRecordEncode(record, 0, eLogModuleMain, eLogInfo, "at %p\n", &negative));
+
+	// strings are cut at LOG_RECORD_STRING_MAX
+	std::string longString(300, 'x');
+	std::string cut = std::string(LOG_RECORD_STRING_MAX, 'x') + "\n";
+	roundTrip("long string", cut.c_str(), record, logRecordEncode(record, 0, eLogModuleMain, eLogInfo, "%s\n", longString.c_str()));
+
+	// arguments beyond the record are left out and print as "?"
+	std::string s150(150, 'a');
+	size_t len = logRecordEncode(record, 0, eLogModuleMain, eLogInfo, "%s %s %d\n", s150.c_str(), s150.c_str(), 5);
+	LogRecordHeader header;
+	logRecordHeader(record, len, sizeof(void *), header);
+	check(len <= LOG_RECORD_MAX, "record within LOG_RECORD_MAX", len);
+	check(header.m_args == 1, "count of the arguments that fit", header.m_args);
+	std::string truncated = s150 + " ? ?\n";
+	roundTrip("truncated arguments", truncated.c_str(), record, len);
+
+	// header fields
+	len = logRecordEncode(record, 1700000000123ULL, eLogModuleWifi, eLogWarning, "%d\n", 1);
+	check(logRecordHeader(record, len, sizeof(void *), header), "header parses");
+	check(header.m_timeMs == 1700000000123ULL, "header time");
+	check(header.m_module == eLogModuleWifi && header.m_level == eLogWarning, "header module and level", header.m_module, header.m_level);
+	check(!logRecordHeader(record, 10, sizeof(void *), header), "short record rejected");
+	check(!logRecordHeader(record, len, 2, header), "pointer size rejected");
+
+	// a record of a 32 bit device
+	uint8_t record32[64];
+	uint64_t time = 5000;
+	uint32_t format32 = 0x3f401234;
+	int32_t value = -7;
+	double temperature = 23.75;
+	size_t pos = 0;
+	memcpy(record32 + pos, &time, 8); pos += 8;
+	memcpy(record32 + pos, &format32, 4); pos += 4;
+	record32[pos++] = eLogModuleNtp;
+	record32[pos++] = eLogInfo;
+	record32[pos++] = 2;
+	record32[pos++] = eLogArgInt32;
+	memcpy(record32 + pos, &value, 4); pos += 4;
+	record32[pos++] = eLogArgDouble;
+	memcpy(record32 + pos, &temperature, 8); pos += 8;
+	check(logRecordHeader(record32, pos, 4, header) && header.m_format == format32 && header.m_module == eLogModuleNtp, "32 bit header");
+	char text[64];
+	logRecordFormat(record32, pos, 4, "%d %.2f %s\n", text, sizeof(text));
+	check(!strcmp(text, "-7 23.75 ?\n"), "32 bit record");
+
+	// malformed argument tags stop the formatting
+	record32[8 + 4 + 3] = 0x77;
+	logRecordFormat(record32, pos, 4, "%d %.2f\n", text, sizeof(text));
+	check(!strcmp(text, "? ?\n"), "unknown tag");
+
+	// the output is cut and terminated
+	logRecordFormat(record, len, sizeof(void *), "0123456789%d", text, 8);
+	check(!strcmp(text, "0123456"), "output cut");
+
+	// names
+	LogModule module;
+	LogLevel level;
+	check(logModuleFromName("display", module) && module == eLogModuleDisplay, "module by name");
+	check(logLevelFromName("debug", level) && level == eLogDebug, "level by name");
+	check(!logModuleFromName("nope", module) && !logLevelFromName("loud", level), "unknown names");
+	check(!strcmp(logModuleName(eLogModuleCount), "unknown"), "unknown module name");
+}
+
+//
+// dump for tools/log_decode
+//
+
+static bool dump(const char *path)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		return false;
+	}
+
+	uint8_t header[LOG_DUMP_HEADER_LEN] = { 0 };
+	memcpy(header, LOG_DUMP_MAGIC, 4);
+	header[4] = LOG_DUMP_VERSION;
+	header[5] = sizeof(void *);
+	fwrite(header, 1, sizeof(header), file);
+
+	LogRing ring(RING_SIZE);
+	for (int sample = 0; sample < 4; sample++) {
+		callBinary(ring, sample, sample);
+	}
+	uint8_t record[LOG_RECORD_MAX];
+	ring.write((const char *)record, logRecordEncode(record, 1000, eLogModuleWifi, eLogWarning, "uptime record, %d%% %s\n", 50, "done"));
+
+	size_t len;
+	const char *data;
+	while ((data = ring.peek(len)) != NULL) {
+		uint16_t len16 = len;
+		fwrite(&len16, 1, sizeof(len16), file);
+		fwrite(data, 1, len, file);
+
+		char text[LOG_SIZE_MAX];
+		LogRecordHeader recordHeader;
+		logRecordHeader((const uint8_t *)data, len, sizeof(void *), recordHeader);
+		logRecordFormat((const uint8_t *)data, len, sizeof(void *), (const char *)(uintptr_t)recordHeader.m_format, text, sizeof(text));
+		printf("dump: %s", text);
+		ring.release();
+	}
+
+	fclose(file);
+	return true;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [--calls <n>] [--dump <file>]\n", name);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int calls = 200000;
+	const char *dumpPath = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--calls") && i + 1 < argc) {
+			calls = std::max(BATCH, atoi(argv[++i]) / BATCH * BATCH);
+		} else if (!strcmp(argv[i], "--dump") && i + 1 < argc) {
+			dumpPath = argv[++i];
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	checkFormats();
+
+	if (dumpPath && !dump(dumpPath)) {
+		fprintf(stderr, "unable to write %s\n", dumpPath);
+		return 1;
+	}
+
+	static const Variant variants[] = {
+		{ "time+text", callTimeText },
+		{ "text", callText },
+		{ "binary", callBinary },
+		{ "filtered", callFiltered },
+	};
+	static const char *sampleNames[] = { "plain", "int", "3 numbers", "8 args+string" };
+
+	printf("\nns per call, %d calls each\n", calls);
+	printf("%-14s", "");
+	for (const Variant &variant : variants) {
+		printf("%12s", variant.m_name);
+	}
+	printf("%12s\n", "drain fmt");
+
+	for (int sample = 0; sample < 4; sample++) {
+		printf("%-14s", sampleNames[sample]);
+		for (const Variant &variant : variants) {
+			printf("%12.1f", measure(variant, sample, calls));
+		}
+		printf("%12.1f\n", measureDrain(sample, calls));
+	}
+
+	printf("\n%d checks, %d failures\n", g_checks, g_failures);
+	return g_failures ? 1 : 0;
+}
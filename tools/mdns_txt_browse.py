@@ -0,0 +1,142 @@
+#
+# One-shot mDNS browse for _http._tcp that prints the readings each unit
+# advertises in its TXT records (MDNS_TXT_ENABLED), without opening any
+# TCP connection.
+#
+#   python3 tools/mdns_txt_browse.py [--timeout 3] [--prefix Vindriktning]
+#
+# Only the Python standard library is needed.
+#
+
+import argparse
+import socket
+import struct
+import time
+
+MDNS_GROUP = "224.0.0.251"
+MDNS_PORT = 5353
+SERVICE = "_http._tcp.local"
+
+TYPE_A = 1
+TYPE_PTR = 12
+TYPE_TXT = 16
+TYPE_SRV = 33
+
+
+def encode_name(name):
+	out = b""
+	for label in name.rstrip(".").split("."):
+		out += bytes([len(label)]) + label.encode()
+	return out + b"\0"
+
+
+def decode_name(data, pos):
+	labels = []
+	jumped = False
+	end = pos
+	while True:
+		length = data[pos]
+		if length & 0xc0 == 0xc0:
+			# compression pointer
+			if not jumped:
+				end = pos + 2
+			pos = ((length & 0x3f) << 8) | data[pos + 1]
+			jumped = True
+			continue
+		pos += 1
+		if not length:
+			break
+		labels.append(data[pos:pos + length].decode(errors="replace"))
+		pos += length
+	return ".".join(labels), (end if jumped else pos)
+
+
+def decode_txt(rdata):
+	# sequence of <length><key=value> strings
+	records = {}
+	pos = 0
+	while pos < len(rdata):
+		length = rdata[pos]
+		entry = rdata[pos + 1:pos + 1 + length].decode(errors="replace")
+		pos += 1 + length
+		if entry:
+			key, _, value = entry.partition("=")
+			records[key] = value
+	return records
+
+
+def parse(data):
+	qd, an, ns, ar = struct.unpack(">HHHH", data[4:12])
+	pos = 12
+	for _ in range(qd):
+		_, pos = decode_name(data, pos)
+		pos += 4
+
+	records = []
+	for _ in range(an + ns + ar):
+		name, pos = decode_name(data, pos)
+		rtype, _, _, rdlength = struct.unpack(">HHIH", data[pos:pos + 10])
+		pos += 10
+		rdata = data[pos:pos + rdlength]
+		if rtype == TYPE_PTR:
+			value, _ = decode_name(data, pos)
+		elif rtype == TYPE_SRV:
+			port = struct.unpack(">H", rdata[4:6])[0]
+			target, _ = decode_name(data, pos + 6)
+			value = (target, port)
+		elif rtype == TYPE_TXT:
+			value = decode_txt(rdata)
+		elif rtype == TYPE_A:
+			value = socket.inet_ntoa(rdata)
+		else:
+			value = rdata
+		records.append((name, rtype, value))
+		pos += rdlength
+	return records
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Browse mDNS TXT readings")
+	parser.add_argument("--timeout", type=float, default=3.0)
+	parser.add_argument("--prefix", default="Vindriktning", help="instance name prefix (case insensitive)")
+	args = parser.parse_args()
+
+	sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+	sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+	sock.bind(("", MDNS_PORT))
+	sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, socket.inet_aton(MDNS_GROUP) + socket.inet_aton("0.0.0.0"))
+	sock.settimeout(0.2)
+
+	# PTR query, QU bit clear so answers go to the group
+	query = struct.pack(">HHHHHH", 0, 0, 1, 0, 0, 0) + encode_name(SERVICE) + struct.pack(">HH", TYPE_PTR, 1)
+	sock.sendto(query, (MDNS_GROUP, MDNS_PORT))
+
+	instances = {}
+	deadline = time.time() + args.timeout
+	while time.time() < deadline:
+		try:
+			data, addr = sock.recvfrom(9000)
+		except socket.timeout:
+			continue
+		try:
+			records = parse(data)
+		except (IndexError, struct.error):
+			continue
+
+		for name, rtype, value in records:
+			if rtype == TYPE_TXT and name.lower().startswith(args.prefix.lower()):
+				instances[name] = (addr[0], value)
+
+	for name, (ip, txt) in sorted(instances.items()):
+		age = ""
+		if "ts" in txt:
+			age = " (%ds old)" % (time.time() - int(txt["ts"]))
+		values = " ".join("%s=%s" % (k, v) for k, v in txt.items() if k not in ("v",))
+		print("%-40s %-15s %s%s" % (name, ip, values, age))
+
+	if not instances:
+		print("no units found")
+
+
+if __name__ == "__main__":
+	main()
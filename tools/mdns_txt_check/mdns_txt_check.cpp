@@ -0,0 +1,212 @@
+//
+// Host check of src/utils/mdnsTxt.cpp (mdnsTxtEncode), the TXT records of
+// the _http._tcp service. For every sensor build and for typical, zero and
+// extreme samples it checks the limits of RFC 6763: keys of 1 to 9
+// printable characters without '=', unique keys, key=value strings of at
+// most 255 bytes and the whole set within 200 bytes. Values have to read
+// back as the sample's numbers, values too long for a record are left out
+// instead of cut, and small maxRecords drop records without writing past
+// the array.
+//
+// Build and run (one line):
+//   g++ -O2 -std=c++11 -Wall -Wextra -Isrc/utils -o mdns_txt_check tools/mdns_txt_check/mdns_txt_check.cpp src/utils/mdnsTxt.cpp
+//   ./mdns_txt_check
+//
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mdnsTxt.h"
+
+#define TXT_KEY_MAX		9		// RFC 6763 6.4
+#define TXT_STRING_MAX	255		// one length byte per string
+#define TXT_SET_MAX		200		// RFC 6763 6.2, typical record set
+#define GUARD			0xa5
+
+static int g_failures = 0;
+static int g_checks = 0;
+
+static void check(const bool &condition, const char *what, const long long &a = 0, const long long &b = 0)
+{
+	g_checks++;
+	if (!condition) {
+		g_failures++;
+		printf("FAIL: %s (%lld, %lld)\n", what, a, b);
+	}
+}
+
+static const char *const g_sensorNames[] = { "pm2.5 only", "CO2 sensor", "env sensor" };
+static const size_t g_recordCounts[] = { 4, 7, 7 };
+
+static const char *find(const MdnsTxtRecord *records, const size_t &count, const char *key)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (!strcmp(records[i].m_key, key)) {
+			return records[i].m_value;
+		}
+	}
+	return NULL;
+}
+
+// value of the record reads back as 'expected' within 'tolerance', or the
+// record is missing when the number needs more room than a record has
+static void readBack(const MdnsTxtRecord *records, const size_t &count, const char *key, const double &expected, const double &tolerance)
+{
+	const char *value = find(records, count, key);
+	char full[64];
+	int len = snprintf(full, sizeof(full), "%.2f", expected);
+	bool fits = isfinite(expected) ? len < (int)sizeof(records[0].m_value) - 1 : true;
+
+	if (!value) {
+		check(!fits, key, (long long)expected, len);
+		return;
+	}
+	if (!isfinite(expected)) {
+		check(!strcmp(value, isnan(expected) ? "nan" : (expected > 0 ? "inf" : "-inf")), key);
+		return;
+	}
+	char *end;
+	double parsed = strtod(value, &end);
+	check(*value && !*end, key, (long long)strlen(value));
+	check(fabs(parsed - expected) <= tolerance, key, (long long)parsed, (long long)expected);
+}
+
+static void checkSample(const SensorSample &sample, const MdnsTxtSensors &sensors, const char *what)
+{
+	MdnsTxtRecord records[MDNS_TXT_MAX_RECORDS + 2];
+	memset((void *)records, GUARD, sizeof(records));
+	size_t count = mdnsTxtEncode(sample, sensors, records, MDNS_TXT_MAX_RECORDS);
+
+	if (count > MDNS_TXT_MAX_RECORDS) {
+		printf("  %s, %s\n", g_sensorNames[sensors], what);
+	}
+	check(count <= MDNS_TXT_MAX_RECORDS, "record count", count, MDNS_TXT_MAX_RECORDS);
+	count = (count > MDNS_TXT_MAX_RECORDS) ? MDNS_TXT_MAX_RECORDS : count;
+
+	size_t setSize = 0;
+	for (size_t i = 0; i < count; i++) {
+		const MdnsTxtRecord &record = records[i];
+		size_t keyLen = strnlen(record.m_key, sizeof(record.m_key));
+		size_t valueLen = strnlen(record.m_value, sizeof(record.m_value));
+		check(keyLen < sizeof(record.m_key), "key terminated", i);
+		check(valueLen < sizeof(record.m_value), "value terminated", i);
+		if (keyLen >= sizeof(record.m_key) || valueLen >= sizeof(record.m_value)) {
+			continue;
+		}
+
+		check(keyLen >= 1 && keyLen <= TXT_KEY_MAX, "key length", keyLen, TXT_KEY_MAX);
+		bool printable = true;
+		for (size_t c = 0; c < keyLen; c++) {
+			printable = printable && record.m_key[c] >= 0x20 && record.m_key[c] <= 0x7e && record.m_key[c] != '=';
+		}
+		check(printable, "key printable without '='", i);
+		for (size_t j = 0; j < i; j++) {
+			check(strcmp(records[j].m_key, record.m_key) != 0, "unique keys", i, j);
+		}
+
+		size_t stringLen = keyLen + 1 + valueLen;
+		check(stringLen <= TXT_STRING_MAX, "key=value length", stringLen, TXT_STRING_MAX);
+		setSize += 1 + stringLen;
+	}
+	check(setSize <= TXT_SET_MAX, "record set size", setSize, TXT_SET_MAX);
+
+	// nothing behind the returned records
+	const uint8_t *guard = (const uint8_t *)&records[MDNS_TXT_MAX_RECORDS];
+	bool intact = true;
+	for (size_t i = 0; i < 2 * sizeof(MdnsTxtRecord); i++) {
+		intact = intact && guard[i] == GUARD;
+	}
+	check(intact, "no records past maxRecords");
+
+	check(find(records, count, "v") && !strcmp(find(records, count, "v"), "1"), "version record");
+	readBack(records, count, "seq", sample.m_sequence, 0);
+	readBack(records, count, "ts", (double)(sample.m_timestampMs / 1000), 0);
+	readBack(records, count, "pm2_5", sample.m_pm2_5, 0);
+	if (sensors == eMdnsTxtCo2) {
+		readBack(records, count, "co2", sample.m_co2, 0);
+	}
+	if (sensors != eMdnsTxtPm2_5Only) {
+		readBack(records, count, "temp", sample.m_temperature, 0.05 + fabs(sample.m_temperature) * 1e-6);
+		readBack(records, count, "hum", sample.m_humidity, 0.05 + fabs(sample.m_humidity) * 1e-6);
+	}
+	if (sensors == eMdnsTxtEnv) {
+		readBack(records, count, "pres", sample.m_pressure, 0.005 + fabs(sample.m_pressure) * 1e-6);
+	} else {
+		check(!find(records, count, "pres"), "no pressure without the env sensor");
+	}
+	if (sensors != eMdnsTxtCo2) {
+		check(!find(records, count, "co2"), "no co2 without the CO2 sensor");
+	}
+}
+
+static void checkMaxRecords(const SensorSample &sample, const MdnsTxtSensors &sensors)
+{
+	for (size_t max = 0; max <= MDNS_TXT_MAX_RECORDS; max++) {
+		MdnsTxtRecord records[MDNS_TXT_MAX_RECORDS + 1];
+		memset((void *)records, GUARD, sizeof(records));
+		size_t count = mdnsTxtEncode(sample, sensors, records, max);
+
+		size_t expected = (max < g_recordCounts[sensors]) ? max : g_recordCounts[sensors];
+		check(count == expected, "records limited by maxRecords", count, expected);
+
+		const uint8_t *guard = (const uint8_t *)&records[max];
+		bool intact = true;
+		for (size_t i = 0; i < (MDNS_TXT_MAX_RECORDS + 1 - max) * sizeof(MdnsTxtRecord); i++) {
+			intact = intact && guard[i] == GUARD;
+		}
+		check(intact, "nothing written past maxRecords", max);
+
+		// the first records stay the same, the tail is dropped
+		check(!max || !strcmp(records[0].m_key, "v"), "version comes first", max);
+	}
+}
+
+int main()
+{
+	const SensorSample typical = { 1760000000000ull, 8640, 12, 650, 21.5f, 45.25f, 101.33f };
+	const SensorSample zero = { 0, 0, 0, 0, 0, 0, 0 };
+	const SensorSample limits = { UINT64_MAX, UINT32_MAX, UINT16_MAX, UINT16_MAX, -40.05f, 100, 110.0f };
+	const SensorSample negative = { 1760000000000ull, 1, 500, 5000, -9.96f, 0.04f, 89.99f };
+	const SensorSample huge = { 1760000000000ull, 2, 3, 4, FLT_MAX, -FLT_MAX, 1e30f };
+	const SensorSample invalid = { 1760000000000ull, 3, 5, 6, NAN, INFINITY, -INFINITY };
+
+	for (int sensors = eMdnsTxtPm2_5Only; sensors <= eMdnsTxtEnv; sensors++) {
+		MdnsTxtSensors s = (MdnsTxtSensors)sensors;
+		checkSample(typical, s, "typical");
+		checkSample(zero, s, "zero");
+		checkSample(limits, s, "limits");
+		checkSample(negative, s, "negative");
+		checkSample(huge, s, "huge");
+		checkSample(invalid, s, "invalid");
+		checkMaxRecords(typical, s);
+
+		// a full set of records fits the responder's table
+		MdnsTxtRecord records[MDNS_TXT_MAX_RECORDS];
+		check(mdnsTxtEncode(typical, s, records, MDNS_TXT_MAX_RECORDS) == g_recordCounts[sensors], "full record set", sensors);
+
+		// out of range floats are left out, everything else stays
+		size_t hugeCount = mdnsTxtEncode(huge, s, records, MDNS_TXT_MAX_RECORDS);
+		size_t dropped = (s == eMdnsTxtCo2) ? 2 : ((s == eMdnsTxtEnv) ? 3 : 0);
+		check(hugeCount == g_recordCounts[sensors] - dropped, "too long values left out", hugeCount, g_recordCounts[sensors] - dropped);
+	}
+
+	// what a browse shows for the typical sample
+	for (int sensors = eMdnsTxtPm2_5Only; sensors <= eMdnsTxtEnv; sensors++) {
+		MdnsTxtRecord records[MDNS_TXT_MAX_RECORDS];
+		size_t count = mdnsTxtEncode(typical, (MdnsTxtSensors)sensors, records, MDNS_TXT_MAX_RECORDS);
+		size_t setSize = 0;
+		printf("%-12s", g_sensorNames[sensors]);
+		for (size_t i = 0; i < count; i++) {
+			printf(" %s=%s", records[i].m_key, records[i].m_value);
+			setSize += 1 + strlen(records[i].m_key) + 1 + strlen(records[i].m_value);
+		}
+		printf(" (%zu bytes)\n", setSize);
+	}
+
+	printf("%d checks, %d failures\n", g_checks, g_failures);
+	return g_failures ? 1 : 0;
+}
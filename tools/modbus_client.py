@@ -0,0 +1,202 @@
+#
+# Minimal Modbus TCP client for the register map in src/tasks/modbusTask.h
+# (MODBUS_ENABLED), enough to check a unit before wiring it into a BMS.
+#
+#   python3 tools/modbus_client.py <device>                   # dump all registers
+#   python3 tools/modbus_client.py <device> --fan 0           # write holding registers
+#   python3 tools/modbus_client.py <device> --brightness 40
+#   python3 tools/modbus_client.py <device> --check           # protocol conformance checks
+#
+# Only the Python standard library is needed.
+#
+
+import argparse
+import socket
+import struct
+import sys
+import time
+
+MODBUS_PORT = 502
+
+READ_HOLDING = 0x03
+READ_INPUT = 0x04
+WRITE_SINGLE = 0x06
+WRITE_MULTIPLE = 0x10
+
+EXCEPTIONS = {
+	0x01: "illegal function",
+	0x02: "illegal data address",
+	0x03: "illegal data value",
+	0x04: "server device failure",
+	0x06: "server device busy",
+}
+
+INPUT_REGISTERS = (
+	("pm2_5", "ug/m3", 1, False),
+	("co2", "ppm", 1, False),
+	("temperature", "C", 100, True),
+	("humidity", "%", 100, False),
+	("pressure", "kPa", 100, False),
+	("sequence_high", "", 1, False),
+	("sequence_low", "", 1, False),
+	("age", "s", 1, False),
+	("channels", "", 1, False),
+)
+
+HOLDING_REGISTERS = (
+	("fan", ""),
+	("led_brightness", ""),
+)
+
+
+class ModbusError(Exception):
+	def __init__(self, function, code):
+		self.code = code
+		super().__init__("function 0x%02x: %s" % (function, EXCEPTIONS.get(code, "exception 0x%02x" % code)))
+
+
+class Client:
+	def __init__(self, host, port=MODBUS_PORT, unit=1, timeout=5):
+		self.sock = socket.create_connection((host, port), timeout=timeout)
+		self.unit = unit
+		self.transaction = 0
+
+	def recv_exact(self, size):
+		data = b""
+		while len(data) < size:
+			chunk = self.sock.recv(size - len(data))
+			if not chunk:
+				raise ConnectionError("connection closed")
+			data += chunk
+		return data
+
+	def frame(self, pdu):
+		self.transaction = (self.transaction + 1) & 0xffff
+		return struct.pack(">HHHB", self.transaction, 0, len(pdu) + 1, self.unit) + pdu
+
+	def reply(self):
+		transaction, protocol, length, unit = struct.unpack(">HHHB", self.recv_exact(7))
+		pdu = self.recv_exact(length - 1)
+		return transaction, pdu
+
+	def request(self, pdu):
+		self.sock.sendall(self.frame(pdu))
+		transaction, reply = self.reply()
+		if transaction != self.transaction:
+			raise ValueError("transaction id mismatch (%d != %d)" % (transaction, self.transaction))
+		if reply[0] & 0x80:
+			raise ModbusError(reply[0] & 0x7f, reply[1])
+		return reply
+
+	def read(self, function, address, count):
+		reply = self.request(struct.pack(">BHH", function, address, count))
+		return list(struct.unpack(">%dH" % count, reply[2:2 + reply[1]]))
+
+	def write_single(self, address, value):
+		self.request(struct.pack(">BHH", WRITE_SINGLE, address, value))
+
+	def write_multiple(self, address, values):
+		self.request(struct.pack(">BHHB", WRITE_MULTIPLE, address, len(values), len(values) * 2) + struct.pack(">%dH" % len(values), *values))
+
+
+def dump(client):
+	values = client.read(READ_INPUT, 0, len(INPUT_REGISTERS))
+	print("input registers:")
+	for address, ((name, unit, scale, signed), raw) in enumerate(zip(INPUT_REGISTERS, values)):
+		value = raw - 0x10000 if signed and raw & 0x8000 else raw
+		text = ("%.2f" % (value / scale)) if scale != 1 else str(value)
+		print("  %2d %-14s %8s %s" % (address, name, text, unit))
+	print("  sequence %d" % ((values[5] << 16) | values[6]))
+
+	print("holding registers:")
+	for address, ((name, unit), value) in enumerate(zip(HOLDING_REGISTERS, client.read(READ_HOLDING, 0, len(HOLDING_REGISTERS)))):
+		print("  %2d %-14s %8d" % (address, name, value))
+
+
+def expect_exception(name, code, fn):
+	try:
+		fn()
+	except ModbusError as e:
+		ok = e.code == code
+		print("%-4s %s -> %s" % ("ok" if ok else "FAIL", name, e))
+		return ok
+	print("FAIL %s -> no exception" % name)
+	return False
+
+
+def check(client):
+	ok = True
+
+	# reads
+	start = time.perf_counter()
+	for _ in range(50):
+		client.read(READ_INPUT, 0, len(INPUT_REGISTERS))
+	print("ok   50 input register reads, %.2f ms per request" % ((time.perf_counter() - start) / 50 * 1000))
+
+	# exceptions
+	ok &= expect_exception("unknown function", 0x01, lambda: client.request(b"\x2b\x0e\x01\x00"))
+	ok &= expect_exception("read past the end", 0x02, lambda: client.read(READ_INPUT, len(INPUT_REGISTERS) - 1, 2))
+	ok &= expect_exception("read 0 registers", 0x03, lambda: client.read(READ_HOLDING, 0, 0))
+	ok &= expect_exception("write input range", 0x02, lambda: client.write_single(5, 1))
+	ok &= expect_exception("fan = 2", 0x03, lambda: client.write_single(0, 2))
+	ok &= expect_exception("brightness = 101", 0x03, lambda: client.write_multiple(0, [1, 101]))
+
+	# write and read back
+	fan, brightness = client.read(READ_HOLDING, 0, 2)
+	client.write_multiple(0, [fan, brightness])
+	time.sleep(0.5)
+	readback = client.read(READ_HOLDING, 0, 2)
+	print("%-4s write multiple + read back %s" % ("ok" if readback == [fan, brightness] else "FAIL", readback))
+	ok &= readback == [fan, brightness]
+
+	# pipelined requests in one segment, split frames
+	frames = b"".join(client.frame(struct.pack(">BHH", READ_INPUT, 0, 1)) for _ in range(10))
+	last = client.transaction
+	client.sock.sendall(frames[:3])
+	time.sleep(0.1)
+	client.sock.sendall(frames[3:])
+	ids = [client.reply()[0] for _ in range(10)]
+	pipelined = ids == [(last - 9 + i) & 0xffff for i in range(10)]
+	print("%-4s 10 pipelined requests, split header" % ("ok" if pipelined else "FAIL"))
+	ok &= pipelined
+
+	# garbage closes the connection
+	client.sock.sendall(b"\x00\x01\x12\x34\x00\x06\x01\x04\x00\x00\x00\x01")
+	try:
+		closed = client.sock.recv(16) == b""
+	except OSError:
+		closed = True
+	print("%-4s wrong protocol id closes the connection" % ("ok" if closed else "FAIL"))
+	ok &= closed
+
+	return ok
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Modbus TCP client")
+	parser.add_argument("host")
+	parser.add_argument("--port", type=int, default=MODBUS_PORT)
+	parser.add_argument("--unit", type=int, default=1)
+	parser.add_argument("--fan", type=int, choices=(0, 1))
+	parser.add_argument("--brightness", type=int)
+	parser.add_argument("--check", action="store_true", help="run protocol checks against the unit")
+	args = parser.parse_args()
+
+	client = Client(args.host, args.port, args.unit)
+
+	if args.check:
+		sys.exit(0 if check(client) else 1)
+
+	if args.fan is not None:
+		client.write_single(0, args.fan)
+	if args.brightness is not None:
+		client.write_single(1, args.brightness)
+	if args.fan is not None or args.brightness is not None:
+		# writes are applied asynchronously
+		time.sleep(0.5)
+
+	dump(client)
+
+
+if __name__ == "__main__":
+	main()
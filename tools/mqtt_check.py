@@ -0,0 +1,307 @@
+#
+# Broker test for the MQTT publisher (MQTT_ENABLED) against a local
+# mosquitto. The device publishes through a TCP proxy in this script, which
+# cuts the connection and refuses new ones during scheduled outages, so
+# the RAM queue, the flash spool and the backfill on reconnect are
+# exercised. A subscriber connected directly to the broker collects every
+# message and checks, per channel (or per batch with MQTT_BATCH_SIZE > 0):
+#
+#   - no sample is missing between the first and the last one received
+#   - no channel of a sample arrives twice (a failed publish must not
+#     repeat channels that already went out)
+#   - samples of one boot arrive in order
+#   - the retained status topic reads "online"
+#
+# It reports how many messages were backfilled after each outage, how long
+# draining the backlog took, and the delivery delay (sample time to
+# arrival) of live samples. Both use the sample timestamps, which are
+# epoch milliseconds, so the device and this host need synced clocks.
+#
+#   mosquitto -p 1883 &
+#   python3 tools/mqtt_check.py <hostname> [--broker localhost:1883] [--proxy-port 1884]
+#       [--seconds 900] [--outage-every 300] [--outage-seconds 120]
+#
+# Build the device with MQTT_HOST pointing at this host and MQTT_PORT at
+# the proxy port. <hostname> is the device host name (the topic level
+# after MQTT_TOPIC_PREFIX). Start the script before the device connects.
+#
+
+import argparse
+import json
+import socket
+import struct
+import threading
+import time
+
+TOPIC_PREFIX = "vindriktning"
+
+
+#
+# minimal MQTT 3.1.1 subscriber
+#
+
+def encode_length(length):
+	out = b""
+	while True:
+		byte = length % 128
+		length //= 128
+		out += bytes([byte | (0x80 if length else 0)])
+		if not length:
+			return out
+
+
+def encode_string(value):
+	data = value.encode("utf-8")
+	return struct.pack(">H", len(data)) + data
+
+
+def packet(kind, body):
+	return bytes([kind]) + encode_length(len(body)) + body
+
+
+def read_exact(sock, length):
+	data = b""
+	while len(data) < length:
+		chunk = sock.recv(length - len(data))
+		if not chunk:
+			raise ConnectionError("broker closed the connection")
+		data += chunk
+	return data
+
+
+def read_packet(sock):
+	kind = read_exact(sock, 1)[0]
+	length = 0
+	shift = 0
+	while True:
+		byte = read_exact(sock, 1)[0]
+		length |= (byte & 0x7f) << shift
+		shift += 7
+		if not byte & 0x80:
+			break
+	return kind, read_exact(sock, length)
+
+
+class Subscriber:
+	def __init__(self, broker, topic):
+		host, port = broker.rsplit(":", 1)
+		self.sock = socket.create_connection((host, int(port)), timeout=5.0)
+		self.lock = threading.Lock()
+
+		connect = encode_string("MQTT") + bytes([4, 0x02]) + struct.pack(">H", 60) + encode_string("mqtt-check-%d" % int(time.time()))
+		self.sock.sendall(packet(0x10, connect))
+		kind, body = read_packet(self.sock)
+		if kind >> 4 != 2 or body[1] != 0:
+			raise ConnectionError("connection refused by the broker (%r)" % body)
+
+		self.sock.sendall(packet(0x82, struct.pack(">H", 1) + encode_string(topic) + bytes([1])))
+		self.sock.settimeout(1.0)
+
+	def ping(self):
+		with self.lock:
+			self.sock.sendall(packet(0xc0, b""))
+
+	def receive(self):
+		# returns (topic, payload, retained) of the next PUBLISH, None on timeout
+		try:
+			kind, body = read_packet(self.sock)
+		except socket.timeout:
+			return None
+		if kind >> 4 != 3:
+			return None
+
+		qos = (kind >> 1) & 3
+		length = struct.unpack(">H", body[:2])[0]
+		topic = body[2:2 + length].decode("utf-8")
+		pos = 2 + length
+		if qos:
+			packet_id = body[pos:pos + 2]
+			pos += 2
+			with self.lock:
+				self.sock.sendall(packet(0x40 if qos == 1 else 0x50, packet_id))
+		return topic, body[pos:], bool(kind & 1)
+
+
+#
+# proxy with scheduled outages
+#
+
+class Proxy:
+	def __init__(self, broker, port):
+		self.broker = broker.rsplit(":", 1)
+		self.outage = False
+		self.lock = threading.Lock()
+		self.sockets = []
+		self.connections = 0
+		self.listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+		self.listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+		self.listener.bind(("", port))
+		self.listener.listen(4)
+		threading.Thread(target=self.accept, daemon=True).start()
+
+	def accept(self):
+		while True:
+			client, _ = self.listener.accept()
+			if self.outage:
+				client.close()
+				continue
+			try:
+				upstream = socket.create_connection((self.broker[0], int(self.broker[1])), timeout=5.0)
+			except OSError:
+				client.close()
+				continue
+			upstream.settimeout(None)
+			with self.lock:
+				self.sockets += [client, upstream]
+				self.connections += 1
+			threading.Thread(target=self.pipe, args=(client, upstream), daemon=True).start()
+			threading.Thread(target=self.pipe, args=(upstream, client), daemon=True).start()
+
+	def pipe(self, source, target):
+		try:
+			while True:
+				data = source.recv(4096)
+				if not data:
+					break
+				target.sendall(data)
+		except OSError:
+			pass
+		for sock in (source, target):
+			try:
+				sock.shutdown(socket.SHUT_RDWR)
+			except OSError:
+				pass
+
+	def set_outage(self, outage):
+		self.outage = outage
+		if outage:
+			with self.lock:
+				for sock in self.sockets:
+					try:
+						sock.shutdown(socket.SHUT_RDWR)
+					except OSError:
+						pass
+					sock.close()
+				self.sockets = []
+
+
+#
+# checks
+#
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument("hostname")
+	parser.add_argument("--broker", default="localhost:1883")
+	parser.add_argument("--proxy-port", type=int, default=1884)
+	parser.add_argument("--seconds", type=float, default=900.0)
+	parser.add_argument("--outage-every", type=float, default=300.0)
+	parser.add_argument("--outage-seconds", type=float, default=120.0)
+	parser.add_argument("--prefix", default=TOPIC_PREFIX)
+	args = parser.parse_args()
+
+	base = "%s/%s" % (args.prefix, args.hostname)
+	subscriber = Subscriber(args.broker, base + "/#")
+	proxy = Proxy(args.broker, args.proxy_port)
+
+	# channel -> list of (t, seq) in arrival order
+	received = {}
+	delays = []
+	status = None
+	outages = []		# [start, end (epoch s), drained (epoch s), messages after reconnect]
+	start = time.time()
+	last_ping = start
+	next_outage = start + args.outage_every if args.outage_seconds > 0 else None
+
+	while time.time() - start < args.seconds:
+		now = time.time()
+		if next_outage and now >= next_outage and not proxy.outage:
+			print("%7.1f s outage for %.0f s" % (now - start, args.outage_seconds))
+			proxy.set_outage(True)
+			outages.append([now, now + args.outage_seconds, None, 0])
+		if proxy.outage and now >= outages[-1][1]:
+			print("%7.1f s broker reachable again" % (now - start))
+			proxy.set_outage(False)
+			next_outage = now + args.outage_every
+		if now - last_ping > 30:
+			subscriber.ping()
+			last_ping = now
+
+		message = subscriber.receive()
+		if not message:
+			continue
+		topic, payload, retained = message
+		channel = topic[len(base) + 1:]
+		arrival = time.time()
+
+		if channel == "status":
+			status = payload.decode("utf-8")
+			continue
+
+		samples = json.loads(payload)
+		if isinstance(samples, dict):
+			samples = [samples]
+		for sample in samples:
+			received.setdefault(channel, []).append((sample["t"], sample["seq"]))
+
+		newest = max(sample["t"] for sample in samples) / 1000.0
+		outage = outages[-1] if outages else None
+		if outage and not proxy.outage and outage[2] is None:
+			# samples arrive in order, so the first one taken after the
+			# broker came back ends the backlog
+			outage[3] += 1
+			if newest >= outage[1]:
+				outage[2] = arrival
+		elif not proxy.outage:
+			delays.append(arrival - newest)
+
+	proxy.set_outage(False)
+
+	failures = 0
+	checks = 0
+
+	def check(condition, what):
+		nonlocal failures, checks
+		checks += 1
+		if not condition:
+			failures += 1
+			print("FAIL: %s" % what)
+
+	check(status == "online", "retained status is %r" % status)
+	check(received, "no samples received on %s/#" % base)
+
+	print("%-12s %8s %8s %8s %8s" % ("channel", "samples", "missing", "dupes", "reorder"))
+	for channel, samples in sorted(received.items()):
+		unique = sorted(set(samples))
+		duplicates = len(samples) - len(unique)
+
+		# sequence numbers restart at a reboot, gaps within a boot are losses
+		missing = 0
+		for (t0, seq0), (t1, seq1) in zip(unique, unique[1:]):
+			if seq1 > seq0:
+				missing += seq1 - seq0 - 1
+
+		# arrival order within a boot
+		reorder = sum(1 for a, b in zip(samples, samples[1:]) if b[0] < a[0] and b[1] < a[1])
+
+		print("%-12s %8d %8d %8d %8d" % (channel, len(unique), missing, duplicates, reorder))
+		check(not missing, "%s: %d samples missing" % (channel, missing))
+		check(not duplicates, "%s: %d samples received more than once" % (channel, duplicates))
+		check(not reorder, "%s: %d samples out of order" % (channel, reorder))
+
+	for begin, end, drained, backlog in outages:
+		if drained:
+			print("outage at %.0f s: %d messages after reconnect, backlog drained %.1f s after the broker came back" % (begin - start, backlog, drained - end))
+		else:
+			print("outage at %.0f s: backlog not drained before the end of the run" % (begin - start))
+	if delays:
+		delays.sort()
+		print("live delivery delay p50 %.0f ms, p95 %.0f ms" % (1000 * delays[len(delays) // 2], 1000 * delays[int(0.95 * (len(delays) - 1))]))
+	print("device connections through the proxy: %d" % proxy.connections)
+
+	print("%d checks, %d failures" % (checks, failures))
+	return 1 if failures else 0
+
+
+if __name__ == "__main__":
+	raise SystemExit(main())
@@ -0,0 +1,144 @@
+#
+# Inbound request latency per WiFi power save profile, measured from
+# outside the device. Selects each profile through /power?profile=<name>,
+# then opens connections to the device at random times, so requests land
+# at random points of the beacon interval. A sleeping station only sees
+# frames the AP buffered for it at its next wake up, which is what this
+# measures: the TCP connect time (SYN in, SYN-ACK out) and the time for a
+# whole GET /get, both from the client's side.
+#
+# The gateway round trip on /diag/power can't show this. The device sends
+# that echo itself, so its radio is awake when the reply arrives.
+#
+#   python3 tools/power_probe.py <device> [--probes 200] [--settle 5]
+#       [--profiles latency,balanced,power] [--min-gap 0.2] [--max-gap 1.5]
+#
+# The profile that was selected before the run is restored at the end.
+# Boost leases (OTA, uploads, /fleet/events subscribers) keep the radio on,
+# such runs are reported and not compared. Only the Python standard library
+# is needed.
+#
+
+import argparse
+import http.client
+import json
+import random
+import socket
+import time
+
+PROFILES = ("latency", "balanced", "power")
+
+
+def get(host, path, timeout=5.0):
+	conn = http.client.HTTPConnection(host, 80, timeout=timeout)
+	try:
+		conn.request("GET", path, headers={"Connection": "close"})
+		response = conn.getresponse()
+		return response.status, response.read()
+	finally:
+		conn.close()
+
+
+def diag(host):
+	status, body = get(host, "/diag/power")
+	if status != 200:
+		raise RuntimeError("/diag/power answered %d" % status)
+	return json.loads(body)
+
+
+def probe(host, timeout):
+	# returns (connect s, request s), None for the parts that failed
+	start = time.monotonic()
+	try:
+		sock = socket.create_connection((host, 80), timeout=timeout)
+	except OSError:
+		return None, None
+	connected = time.monotonic()
+
+	try:
+		sock.sendall(b"GET /get HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n" % host.encode())
+		response = b""
+		while True:
+			chunk = sock.recv(4096)
+			if not chunk:
+				break
+			response += chunk
+	except OSError:
+		return connected - start, None
+	finally:
+		sock.close()
+
+	if not (response.startswith(b"HTTP/1.") and response[8:12] == b" 200"):
+		return connected - start, None
+	return connected - start, time.monotonic() - start
+
+
+def percentile(values, fraction):
+	if not values:
+		return 0.0
+	values = sorted(values)
+	return values[min(len(values) - 1, int(fraction * len(values)))]
+
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument("device")
+	parser.add_argument("--probes", type=int, default=200)
+	parser.add_argument("--settle", type=float, default=5.0)
+	parser.add_argument("--min-gap", type=float, default=0.2)
+	parser.add_argument("--max-gap", type=float, default=1.5)
+	parser.add_argument("--timeout", type=float, default=5.0)
+	parser.add_argument("--profiles", default=",".join(PROFILES))
+	args = parser.parse_args()
+
+	profiles = args.profiles.split(",")
+	for profile in profiles:
+		if profile not in PROFILES:
+			parser.error("unknown profile %r" % profile)
+
+	selected = diag(args.device)["selected"]
+	results = {}
+	failures = 0
+
+	try:
+		for profile in profiles:
+			get(args.device, "/power?profile=%s" % profile)
+			time.sleep(args.settle)
+
+			state = diag(args.device)
+			if state["effective"] != profile:
+				print("FAIL: %s selected, but %s is in effect (boosts %s)" % (profile, state["effective"], state.get("boosts")))
+				failures += 1
+				continue
+
+			connects = []
+			requests = []
+			lost = 0
+			for _ in range(args.probes):
+				time.sleep(random.uniform(args.min_gap, args.max_gap))
+				connect, request = probe(args.device, args.timeout)
+				if connect is not None:
+					connects.append(connect)
+				if request is None:
+					lost += 1
+				else:
+					requests.append(request)
+			results[profile] = (connects, requests, lost)
+			if not requests:
+				print("FAIL: no request answered with %s" % profile)
+				failures += 1
+	finally:
+		get(args.device, "/power?profile=%s" % selected)
+
+	print("%-10s %6s %6s %28s %28s" % ("profile", "probes", "failed", "connect p50/p90/p99 ms", "GET /get p50/p90/p99 ms"))
+	for profile, (connects, requests, lost) in results.items():
+		print("%-10s %6d %6d %28s %28s" % (profile, args.probes, lost,
+			"%.1f / %.1f / %.1f" % tuple(1000 * percentile(connects, f) for f in (0.5, 0.9, 0.99)),
+			"%.1f / %.1f / %.1f" % tuple(1000 * percentile(requests, f) for f in (0.5, 0.9, 0.99))))
+	print("profile %s restored" % selected)
+
+	return 1 if failures else 0
+
+
+if __name__ == "__main__":
+	raise SystemExit(main())
@@ -0,0 +1,454 @@
+//
+// Host simulation of the WiFi reconnection policy (src/utils/wifiReconnect)
+// with fault injection. Every trial loses the link at t = 0 under one of the
+// scenarios below. It then runs the real policy against a simulated AP
+// environment until it is connected again, and reports time-to-recover.
+// The previous behaviour (1 s status polling, fixed retries, reboot after
+// failure) runs as a baseline on the same faults.
+//
+// Build and run (one line):
+//   g++ -O2 -std=c++11 -Wall -Wextra -Isrc/utils -o reconnect_sim tools/reconnect_sim/reconnect_sim.cpp src/utils/wifiReconnect.cpp
+//   ./reconnect_sim [--trials 1000] [--seed 1] [--loss 0.1] [--fast-retries 2]
+//                   [--min-backoff 1000] [--max-backoff 30000] [--max-scan-backoff 3000] [--scenario roam]
+//
+// --loss injects random failures into attempts that would otherwise succeed.
+//
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "wifiReconnect.h"
+
+// attempt durations, roughly what the device shows in its log
+#define CONNECT_MS			1500	// association + 4-way handshake + DHCP
+#define PROBE_FAIL_MS		1500	// BSSID not found on its channel
+#define AUTH_FAIL_MS		3500	// 4-way handshake timeout
+#define FULL_FAIL_MS		300		// association refused
+#define SCAN_MS				2500	// all channel scan
+
+// legacy connectMultiWiFi() parameters (config.h)
+#define LEGACY_POLL_MS		1000
+#define LEGACY_RETRIES		3
+#define LEGACY_TIMEOUT_MS	10000
+#define LEGACY_REBOOT_MS	9000	// delay(5000) + boot until the wifi task connects
+
+// give up a trial after this long
+#define SIM_LIMIT_MS		(2 * 3600 * 1000)
+
+// disconnect reasons (wifi_err_reason_t)
+#define REASON_ASSOC_EXPIRE				4
+#define REASON_ASSOC_TOOMANY			5
+#define REASON_4WAY_HANDSHAKE_TIMEOUT	15
+#define REASON_BEACON_TIMEOUT			200
+#define REASON_NO_AP_FOUND				201
+#define REASON_AUTH_FAIL				202
+#define REASON_ASSOC_FAIL				203
+
+enum ApState {
+	eApUp,
+	eApDown,		// not on air
+	eApAuthFail,	// on air, authentication fails (e.g. RADIUS down)
+	eApFull,		// on air, refuses association
+};
+
+struct Window {
+	uint32_t m_startMs;
+	uint32_t m_endMs;
+	ApState m_state;
+};
+
+struct Ap {
+	int m_rssi;
+	std::vector<Window> m_windows;
+
+	ApState state(const uint32_t &t) const
+	{
+		for (const Window &w : m_windows) {
+			if (t >= w.m_startMs && t < w.m_endMs) {
+				return w.m_state;
+			}
+		}
+		return eApUp;
+	}
+};
+
+struct Env {
+	std::vector<Ap> m_aps;		// [0] is the AP we were connected to
+	uint8_t m_reason;			// disconnect reason at t = 0
+};
+
+struct Attempt {
+	bool m_connected;
+	uint8_t m_reason;
+	uint32_t m_durationMs;
+	int m_ap;
+};
+
+typedef std::mt19937 Rng;
+
+static uint32_t uniform(Rng &rng, const uint32_t &lo, const uint32_t &hi)
+{
+	return std::uniform_int_distribution<uint32_t>(lo, hi)(rng);
+}
+
+//
+// fault scenarios
+//
+
+struct Scenario {
+	const char *m_name;
+	const char *m_description;
+	Env (*m_make)(Rng &rng);
+};
+
+static Env beaconLoss(Rng &rng)
+{
+	// interference, the AP is back after a moment
+	Env env;
+	env.m_reason = REASON_BEACON_TIMEOUT;
+	env.m_aps.push_back({-60, {{0, uniform(rng, 300, 3000), eApDown}}});
+	return env;
+}
+
+static Env apReboot(Rng &rng)
+{
+	// the only AP reboots
+	Env env;
+	env.m_reason = REASON_BEACON_TIMEOUT;
+	env.m_aps.push_back({-60, {{0, uniform(rng, 30000, 120000), eApDown}}});
+	return env;
+}
+
+static Env roam(Rng &rng)
+{
+	// the AP is gone for good, another one of the same network is in range
+	Env env;
+	env.m_reason = uniform(rng, 0, 1) ? REASON_BEACON_TIMEOUT : REASON_NO_AP_FOUND;
+	env.m_aps.push_back({-55, {{0, SIM_LIMIT_MS, eApDown}}});
+	env.m_aps.push_back({-72, {}});
+	return env;
+}
+
+static Env apFull(Rng &rng)
+{
+	// the AP drops us and refuses new stations for a while
+	Env env;
+	env.m_reason = REASON_ASSOC_EXPIRE;
+	env.m_aps.push_back({-55, {{0, uniform(rng, 30000, 90000), eApFull}}});
+	env.m_aps.push_back({-75, {}});
+	return env;
+}
+
+static Env radiusDown(Rng &rng)
+{
+	// authentication fails on all APs until the backend is back
+	uint32_t end = uniform(rng, 60000, 300000);
+	Env env;
+	env.m_reason = REASON_4WAY_HANDSHAKE_TIMEOUT;
+	env.m_aps.push_back({-55, {{0, end, eApAuthFail}}});
+	env.m_aps.push_back({-70, {{0, end, eApAuthFail}}});
+	return env;
+}
+
+static Env routerFlap(Rng &rng)
+{
+	// the AP goes up and down for a few minutes before it settles
+	Env env;
+	env.m_reason = REASON_BEACON_TIMEOUT;
+	Ap ap = {-60, {}};
+	uint32_t t = 0;
+	uint32_t flaps = uniform(rng, 3, 8);
+	for (uint32_t i = 0; i < flaps; i++) {
+		uint32_t down = uniform(rng, 5000, 20000);
+		ap.m_windows.push_back({t, t + down, eApDown});
+		t += down + uniform(rng, 2000, 8000);
+	}
+	env.m_aps.push_back(ap);
+	return env;
+}
+
+static const Scenario g_scenarios[] = {
+	{ "beacon-loss", "short link loss, AP back within 3 s", beaconLoss },
+	{ "ap-reboot", "single AP off air for 30-120 s", apReboot },
+	{ "roam", "AP gone, another BSSID of the network in range", roam },
+	{ "ap-full", "AP refuses stations for 30-90 s, another BSSID in range", apFull },
+	{ "radius-down", "authentication fails everywhere for 1-5 min", radiusDown },
+	{ "router-flap", "AP flaps 3-8 times before it settles", routerFlap },
+};
+
+//
+// attempt models
+//
+
+static Attempt connectTo(const Env &env, const int &ap, const uint32_t &t, Rng &rng, const double &loss)
+{
+	switch (env.m_aps[ap].state(t)) {
+	case eApDown:
+		return {false, REASON_NO_AP_FOUND, PROBE_FAIL_MS, ap};
+	case eApAuthFail:
+		return {false, (uint8_t)(uniform(rng, 0, 1) ? REASON_4WAY_HANDSHAKE_TIMEOUT : REASON_AUTH_FAIL), AUTH_FAIL_MS, ap};
+	case eApFull:
+		return {false, REASON_ASSOC_TOOMANY, FULL_FAIL_MS, ap};
+	default:
+		break;
+	}
+
+	if (std::uniform_real_distribution<double>(0, 1)(rng) < loss) {
+		return {false, REASON_ASSOC_FAIL, CONNECT_MS, ap};
+	}
+	return {true, 0, CONNECT_MS, ap};
+}
+
+// same BSSID and channel as before
+static Attempt fastAttempt(const Env &env, const int &ap, const uint32_t &t, Rng &rng, const double &loss)
+{
+	return connectTo(env, ap, t, rng, loss);
+}
+
+// scan all channels, then connect to the strongest AP that is on air
+static Attempt scanAttempt(const Env &env, const uint32_t &t, Rng &rng, const double &loss)
+{
+	int best = -1;
+	for (size_t i = 0; i < env.m_aps.size(); i++) {
+		if (env.m_aps[i].state(t) != eApDown && (best < 0 || env.m_aps[i].m_rssi > env.m_aps[best].m_rssi)) {
+			best = i;
+		}
+	}
+
+	if (best < 0) {
+		return {false, REASON_NO_AP_FOUND, SCAN_MS, -1};
+	}
+
+	Attempt attempt = connectTo(env, best, t + SCAN_MS, rng, loss);
+	attempt.m_durationMs += SCAN_MS;
+	return attempt;
+}
+
+//
+// policies under test
+//
+
+struct Result {
+	uint32_t m_recoverMs;
+	uint32_t m_attempts;
+	uint32_t m_reboots;
+	bool m_recovered;
+};
+
+static Result runPolicy(const Env &env, const WiFiReconnect::Config &config, const uint32_t &seed, Rng &rng, const double &loss)
+{
+	// start well above 0 so the policy's wrap-safe arithmetic is exercised too
+	const uint32_t base = 0xfff00000;
+	WiFiReconnect reconnect(config, seed);
+	reconnect.attemptFinished(true, 0, base);
+	reconnect.disconnected(env.m_reason, base);
+
+	Result result = {0, 0, 0, false};
+	uint32_t t = 0;
+	int ap = 0;
+
+	while (t < SIM_LIMIT_MS) {
+		t += reconnect.msToNextAttempt(base + t);
+		WiFiReconnect::Action action = reconnect.poll(base + t);
+		if (action == WiFiReconnect::eActionNone) {
+			fprintf(stderr, "policy returned no action when due\n");
+			exit(1);
+		}
+
+		Attempt attempt = (action == WiFiReconnect::eActionFast) ? fastAttempt(env, ap, t, rng, loss) : scanAttempt(env, t, rng, loss);
+		t += attempt.m_durationMs;
+		result.m_attempts++;
+
+		reconnect.attemptFinished(attempt.m_connected, attempt.m_reason, base + t);
+		if (attempt.m_connected) {
+			result.m_recoverMs = reconnect.lastOutageMs();
+			result.m_recovered = true;
+			break;
+		}
+	}
+	return result;
+}
+
+static Result runLegacy(const Env &env, Rng &rng, const double &loss)
+{
+	Result result = {0, 0, 0, false};
+
+	// the loss is noticed by the next status poll
+	uint32_t t = uniform(rng, 0, LEGACY_POLL_MS);
+	int ap = 0;
+
+	while (t < SIM_LIMIT_MS) {
+		// fastReconnect(): repeats only on WL_CONNECT_FAILED, AP not found is final
+		for (int i = 0; i < LEGACY_RETRIES; i++) {
+			Attempt attempt = fastAttempt(env, ap, t, rng, loss);
+			result.m_attempts++;
+			if (attempt.m_reason == REASON_ASSOC_TOOMANY) {
+				// stays in WL_DISCONNECTED until the timeout
+				attempt.m_durationMs = LEGACY_TIMEOUT_MS;
+			}
+			t += attempt.m_durationMs;
+			if (attempt.m_connected) {
+				result.m_recoverMs = t;
+				result.m_recovered = true;
+				return result;
+			}
+			if (attempt.m_reason == REASON_NO_AP_FOUND) {
+				break;
+			}
+		}
+
+		// connect(): scan, then fastReconnect() to the best one
+		Attempt attempt = scanAttempt(env, t, rng, loss);
+		result.m_attempts++;
+		t += attempt.m_durationMs;
+		for (int i = 1; i < LEGACY_RETRIES && !attempt.m_connected && attempt.m_ap >= 0 && attempt.m_reason != REASON_NO_AP_FOUND; i++) {
+			attempt = connectTo(env, attempt.m_ap, t, rng, loss);
+			result.m_attempts++;
+			t += attempt.m_durationMs;
+		}
+		if (attempt.m_connected) {
+			result.m_recoverMs = t;
+			result.m_recovered = true;
+			return result;
+		}
+
+		// ESP.restart(), sensor state is lost
+		result.m_reboots++;
+		t += LEGACY_REBOOT_MS;
+	}
+	return result;
+}
+
+//
+// reporting
+//
+
+static uint32_t percentile(std::vector<uint32_t> &values, const double &p)
+{
+	if (values.empty()) {
+		return 0;
+	}
+	std::sort(values.begin(), values.end());
+	size_t index = (size_t)(p * (values.size() - 1) + 0.5);
+	return values[index];
+}
+
+static void report(const char *name, const std::vector<Result> &results)
+{
+	std::vector<uint32_t> recover;
+	uint64_t attempts = 0;
+	uint64_t reboots = 0;
+	uint32_t failed = 0;
+
+	for (const Result &r : results) {
+		if (r.m_recovered) {
+			recover.push_back(r.m_recoverMs);
+		} else {
+			failed++;
+		}
+		attempts += r.m_attempts;
+		reboots += r.m_reboots;
+	}
+
+	printf("  %-7s recover p50 %7.1f s  p95 %7.1f s  max %7.1f s  attempts %5.1f  reboots %5.2f",
+		name,
+		percentile(recover, 0.5) / 1000.0,
+		percentile(recover, 0.95) / 1000.0,
+		percentile(recover, 1.0) / 1000.0,
+		(double)attempts / results.size(),
+		(double)reboots / results.size());
+	if (failed) {
+		printf("  not recovered %u", failed);
+	}
+	printf("\n");
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [--trials N] [--seed N] [--loss P] [--fast-retries N] [--min-backoff MS] [--max-backoff MS] [--max-scan-backoff MS] [--scenario NAME]\n", argv0);
+	fprintf(stderr, "scenarios:\n");
+	for (const Scenario &s : g_scenarios) {
+		fprintf(stderr, "  %-12s %s\n", s.m_name, s.m_description);
+	}
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t trials = 1000;
+	uint32_t seed = 1;
+	double loss = 0.0;
+	std::string only;
+
+	// defaults of config.h
+	WiFiReconnect::Config config = {1000, 30000, 3000, 2};
+
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 >= argc) {
+			usage(argv[0]);
+		}
+		if (!strcmp(argv[i], "--trials")) {
+			trials = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--seed")) {
+			seed = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--loss")) {
+			loss = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--fast-retries")) {
+			config.m_fastRetries = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--min-backoff")) {
+			config.m_minBackoffMs = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--max-backoff")) {
+			config.m_maxBackoffMs = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--max-scan-backoff")) {
+			config.m_maxScanBackoffMs = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--scenario")) {
+			only = argv[++i];
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	if (!trials || config.m_minBackoffMs < 2 || config.m_maxBackoffMs < config.m_minBackoffMs || config.m_maxScanBackoffMs < config.m_minBackoffMs) {
+		usage(argv[0]);
+	}
+
+	printf("%u trials per scenario, attempt loss %.2f, backoff %u..%u ms (scans %u ms), %u fast retries\n\n",
+		trials, loss, config.m_minBackoffMs, config.m_maxBackoffMs, config.m_maxScanBackoffMs, config.m_fastRetries);
+
+	bool found = false;
+	for (const Scenario &s : g_scenarios) {
+		if (!only.empty() && only != s.m_name) {
+			continue;
+		}
+		found = true;
+
+		std::vector<Result> policy;
+		std::vector<Result> legacy;
+
+		// both variants see the same environments
+		Rng rng(seed);
+		for (uint32_t i = 0; i < trials; i++) {
+			Env env = s.m_make(rng);
+			Rng attemptRng(seed * 7919 + i);
+			policy.push_back(runPolicy(env, config, seed + i, attemptRng, loss));
+			Rng legacyRng(seed * 7919 + i);
+			legacy.push_back(runLegacy(env, legacyRng, loss));
+		}
+
+		printf("%s: %s\n", s.m_name, s.m_description);
+		report("policy", policy);
+		report("legacy", legacy);
+		printf("\n");
+	}
+
+	if (!found) {
+		usage(argv[0]);
+	}
+	return 0;
+}
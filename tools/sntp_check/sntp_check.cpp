@@ -0,0 +1,503 @@
+//
+// Host check of src/utils/sntpClient.cpp against a local NTP stand-in.
+// Every configured server is a thread answering real UDP packets on
+// 127.0.0.1. Time is virtual: the harness decides the true time a packet
+// leaves, its path delays and the server's clock error. The device clock
+// runs with a crystal drift, and the estimates go through the real
+// WallClock. Each scenario runs a day of virtual time. The clock error is
+// sampled every 10 s after the first hour.
+//
+// The previous implementation runs as a baseline on the same network: one
+// server every 300 s, whole seconds, no delay compensation, no drift.
+//
+// Build and run (one line):
+//   g++ -O2 -std=c++11 -Wall -Wextra -pthread -Isrc/utils -o sntp_check tools/sntp_check/sntp_check.cpp src/utils/sntpClient.cpp src/utils/wallClock.cpp
+//   ./sntp_check [--seed 1] [--hours 24] [--scenario lossy]
+//
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "sntpClient.h"
+#include "wallClock.h"
+
+// defaults of config.h
+#define MIN_POLL_S			64
+#define MAX_POLL_S			1024
+#define STEP_US				128000
+#define STABLE_US			1000
+#define AGREE_US			5000
+#define MAX_DRIFT_PPM		500
+#define BURST				4
+#define BURST_GAP_US		2000000
+#define RETRY_S				16
+#define SLEW_MAX_PPM		500
+
+// previous implementation
+#define LEGACY_INTERVAL_S	300
+#define LEGACY_STEP_US		1000000
+
+// the device boots 2023-11-14 with its clock at zero
+#define BOOT_EPOCH_US		1700000000000000LL
+
+// real time to wait for a dropped answer
+#define LOSS_WAIT_MS		5
+
+static int g_failures = 0;
+static int g_checks = 0;
+
+static void check(const bool &condition, const char *what, const double &a = 0, const double &b = 0)
+{
+	g_checks++;
+	if (!condition) {
+		g_failures++;
+		printf("FAIL: %s (%g, %g)\n", what, a, b);
+	}
+}
+
+//
+// NTP stand-in: answers with timestamps of the virtual time the harness set up for the packet
+//
+
+class StandIn {
+public:
+	StandIn()
+	{
+		m_socket = socket(AF_INET, SOCK_DGRAM, 0);
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0;
+		bind(m_socket, (struct sockaddr *)&addr, sizeof(addr));
+
+		socklen_t len = sizeof(m_addr);
+		getsockname(m_socket, (struct sockaddr *)&m_addr, &len);
+
+		struct timeval timeout = { 0, 50000 };
+		setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		m_thread = std::thread([this] { run(); });
+	}
+
+	~StandIn()
+	{
+		m_stop = true;
+		m_thread.join();
+		close(m_socket);
+	}
+
+	// the next request arrives at receiveUs (true time) and is answered processUs later
+	void expect(const int64_t &receiveUs, const int64_t &processUs, const int64_t &clockErrorUs, const bool &drop)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_receiveUs = receiveUs;
+		m_processUs = processUs;
+		m_clockErrorUs = clockErrorUs;
+		m_drop = drop;
+	}
+
+	const struct sockaddr_in &address() const { return m_addr; }
+
+private:
+	void run()
+	{
+		while (!m_stop) {
+			uint8_t packet[128];
+			struct sockaddr_in from;
+			socklen_t fromLen = sizeof(from);
+			ssize_t len = recvfrom(m_socket, packet, sizeof(packet), 0, (struct sockaddr *)&from, &fromLen);
+			if (len < SNTP_PACKET_LEN) {
+				continue;
+			}
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_drop) {
+				continue;
+			}
+
+			uint8_t reply[SNTP_PACKET_LEN];
+			memset(reply, 0, sizeof(reply));
+			reply[0] = (4 << 3) | 4;				// LI 0, version 4, server
+			reply[1] = 2;							// stratum
+			reply[3] = 0xEC;						// precision
+			put32(reply + 4, 0x00000100);			// root delay 3.9 ms
+			put32(reply + 8, 0x00000080);			// root dispersion 2 ms
+			memcpy(reply + 24, packet + 40, 8);		// origin = client transmit
+			put64(reply + 32, SntpClient::fromEpochUs(m_receiveUs + m_clockErrorUs));
+			put64(reply + 40, SntpClient::fromEpochUs(m_receiveUs + m_processUs + m_clockErrorUs));
+			sendto(m_socket, reply, sizeof(reply), 0, (struct sockaddr *)&from, fromLen);
+		}
+	}
+
+	static void put32(uint8_t *data, const uint32_t &value)
+	{
+		for (int i = 0; i < 4; i++) {
+			data[i] = (value >> (24 - 8 * i)) & 0xff;
+		}
+	}
+
+	static void put64(uint8_t *data, const uint64_t &value)
+	{
+		put32(data, value >> 32);
+		put32(data + 4, value & 0xffffffff);
+	}
+
+	int m_socket;
+	struct sockaddr_in m_addr;
+	std::thread m_thread;
+	std::atomic<bool> m_stop{false};
+
+	std::mutex m_mutex;
+	int64_t m_receiveUs = 0;
+	int64_t m_processUs = 0;
+	int64_t m_clockErrorUs = 0;
+	bool m_drop = false;
+};
+
+//
+// scenario: network paths, server clocks and the device crystal
+//
+
+struct Scenario {
+	const char *m_name;
+	const char *m_description;
+	int m_servers;
+	double m_baseDelayMs;		// one way, each direction
+	double m_spikeProbability;	// queueing delay on a packet
+	double m_spikeMeanMs;
+	double m_uplinkSpikeFactor;	// asymmetry: uplink queues more
+	double m_loss;
+	int m_deadServers;			// never answer
+	int64_t m_falsetickerUs;	// clock error of the last server
+	double m_driftPpm;
+	double m_driftSwingPpm;		// daily temperature cycle
+};
+
+static const Scenario g_scenarios[] = {
+	{ "lan", "3 servers, 2 ms paths, occasional queueing", 3, 2.0, 0.1, 20.0, 1.0, 0.0, 0, 0, 35.0, 0.0 },
+	{ "wifi", "busy WiFi: uplink queueing spikes on a third of the packets", 3, 4.0, 0.33, 40.0, 3.0, 0.02, 0, 0, -22.0, 0.0 },
+	{ "falseticker", "one of 3 servers 300 ms off", 3, 3.0, 0.1, 20.0, 1.0, 0.0, 0, 300000, 35.0, 0.0 },
+	{ "lossy", "30% loss, one of 3 servers down", 3, 3.0, 0.1, 20.0, 1.0, 0.3, 1, 0, 35.0, 0.0 },
+	{ "temperature", "drift swinging +-8 ppm around 20 ppm every 6 hours", 3, 3.0, 0.1, 20.0, 1.0, 0.0, 0, 0, 20.0, 8.0 },
+};
+
+class Network {
+public:
+	Network(const Scenario &scenario, const uint32_t &seed)
+		: m_scenario(scenario)
+		, m_random(seed)
+		, m_standIns(scenario.m_servers)
+	{
+		m_socket = socket(AF_INET, SOCK_DGRAM, 0);
+		struct timeval timeout = { 0, LOSS_WAIT_MS * 1000 };
+		setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		// good servers are within half a millisecond
+		std::uniform_int_distribution<int> error(-500, 500);
+		for (int i = 0; i < scenario.m_servers; i++) {
+			m_serverErrorUs.push_back(error(m_random));
+		}
+		if (scenario.m_falsetickerUs) {
+			m_serverErrorUs.back() = scenario.m_falsetickerUs;
+		}
+	}
+
+	~Network()
+	{
+		close(m_socket);
+	}
+
+	// true time to device monotonic time
+	int64_t monotonicUs(const int64_t &trueUs) const
+	{
+		// integral of driftPpm()
+		double t = trueUs - BOOT_EPOCH_US;
+		double swing = m_scenario.m_driftSwingPpm * 21600e6 / (2 * M_PI) * (1 - cos(2 * M_PI * t / 21600e6));
+		return (int64_t)(t + (m_scenario.m_driftPpm * t + swing) * 1e-6);
+	}
+
+	double driftPpm(const int64_t &trueUs) const
+	{
+		double t = trueUs - BOOT_EPOCH_US;
+		return m_scenario.m_driftPpm + m_scenario.m_driftSwingPpm * sin(2 * M_PI * t / 21600e6);
+	}
+
+	// sends the request at trueUs over UDP, returns false if lost, otherwise the answer and its arrival time
+	bool exchange(const int &server, const uint8_t *request, const int64_t &trueUs, uint8_t *reply, int64_t &arrivalUs)
+	{
+		int64_t upUs = pathDelayUs(m_scenario.m_uplinkSpikeFactor);
+		int64_t downUs = pathDelayUs(1.0);
+		int64_t processUs = 50 + m_random() % 200;
+
+		bool drop = server < m_scenario.m_deadServers || m_loss(m_random) < m_scenario.m_loss;
+		m_standIns[server].expect(trueUs + upUs, processUs, m_serverErrorUs[server], drop);
+
+		const struct sockaddr_in &to = m_standIns[server].address();
+		sendto(m_socket, request, SNTP_PACKET_LEN, 0, (const struct sockaddr *)&to, sizeof(to));
+		m_packets++;
+
+		ssize_t len = recv(m_socket, reply, SNTP_PACKET_LEN, 0);
+		arrivalUs = trueUs + upUs + processUs + downUs;
+		return len == SNTP_PACKET_LEN;
+	}
+
+	uint64_t packets() const { return m_packets; }
+	int64_t serverErrorUs(const int &server) const { return m_serverErrorUs[server]; }
+
+private:
+	int64_t pathDelayUs(const double &spikeFactor)
+	{
+		double delayMs = m_scenario.m_baseDelayMs * (0.8 + 0.4 * m_loss(m_random));
+		if (m_loss(m_random) < m_scenario.m_spikeProbability) {
+			std::exponential_distribution<double> spike(1.0 / (m_scenario.m_spikeMeanMs * spikeFactor));
+			delayMs += spike(m_random);
+		}
+		return (int64_t)(delayMs * 1000);
+	}
+
+	const Scenario &m_scenario;
+	std::mt19937 m_random;
+	std::uniform_real_distribution<double> m_loss{0.0, 1.0};
+	std::vector<StandIn> m_standIns;
+	std::vector<int64_t> m_serverErrorUs;
+	int m_socket;
+	uint64_t m_packets = 0;
+};
+
+struct Result {
+	std::vector<double> m_errorsMs;		// absolute clock error after the first hour
+	double m_driftErrorPpm;
+	double m_uncertaintyMs;
+	double m_packetsPerHour;
+	double m_meanPollS;
+	bool m_covered;						// |error| within the reported uncertainty most of the time
+};
+
+static double percentile(std::vector<double> values, const double &fraction)
+{
+	if (values.empty()) {
+		return 0;
+	}
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size() - 1, (size_t)(fraction * values.size()))];
+}
+
+static Result runSntp(const Scenario &scenario, const uint32_t &seed, const int &hours)
+{
+	Network network(scenario, seed);
+	SntpClient::Config config = {MIN_POLL_S, MAX_POLL_S, STEP_US, STABLE_US, AGREE_US, MAX_DRIFT_PPM};
+	SntpClient client(config, scenario.m_servers);
+	WallClock clock(STEP_US, SLEW_MAX_PPM);
+
+	Result result = {};
+	int64_t trueUs = BOOT_EPOCH_US + 5000000;
+	int64_t endUs = BOOT_EPOCH_US + hours * 3600000000LL;
+	int64_t nextSampleUs = BOOT_EPOCH_US + 3600000000LL;
+	int64_t uncertaintyUs = 0;
+	uint32_t rounds = 0;
+	uint64_t pollSum = 0;
+	uint32_t covered = 0;
+
+	while (trueUs < endUs) {
+		// one round: bursts to all servers, interleaved
+		client.startRound();
+		for (int burst = 0; burst < BURST; burst++) {
+			for (int server = 0; server < scenario.m_servers; server++) {
+				uint8_t request[SNTP_PACKET_LEN];
+				uint8_t reply[SNTP_PACKET_LEN];
+				int64_t arrivalUs;
+
+				client.request(server, network.monotonicUs(trueUs), request);
+				if (network.exchange(server, request, trueUs, reply, arrivalUs)) {
+					client.response(server, reply, sizeof(reply), network.monotonicUs(arrivalUs));
+					trueUs = arrivalUs;
+				} else {
+					trueUs += 1000000;
+				}
+			}
+			if (burst + 1 < BURST) {
+				trueUs += BURST_GAP_US;
+			}
+		}
+
+		SntpClient::Estimate estimate;
+		uint32_t waitS = RETRY_S;
+		if (client.finishRound(network.monotonicUs(trueUs), estimate)) {
+			clock.sync(estimate.m_epochUs, estimate.m_monotonicUs, estimate.m_ratePpb);
+			uncertaintyUs = estimate.m_uncertaintyUs;
+			waitS = client.pollIntervalS();
+			pollSum += waitS;
+			rounds++;
+		}
+
+		// the clock error until the next round
+		int64_t nextRoundUs = trueUs + waitS * 1000000LL;
+		for (; nextSampleUs < nextRoundUs && nextSampleUs < endUs; nextSampleUs += 10000000) {
+			double errorMs = (clock.epochUs(network.monotonicUs(nextSampleUs)) - nextSampleUs) / 1000.0;
+			result.m_errorsMs.push_back(fabs(errorMs));
+			covered += fabs(errorMs) * 1000 <= uncertaintyUs;
+		}
+		trueUs = nextRoundUs;
+	}
+
+	SntpClient::Status status;
+	client.status(status);
+	result.m_driftErrorPpm = status.m_driftPpm - network.driftPpm(trueUs);
+	result.m_uncertaintyMs = uncertaintyUs / 1000.0;
+	result.m_packetsPerHour = network.packets() / (double)hours;
+	result.m_meanPollS = rounds ? pollSum / (double)rounds : 0;
+	result.m_covered = covered >= 0.9 * result.m_errorsMs.size();
+	return result;
+}
+
+static Result runLegacy(const Scenario &scenario, const uint32_t &seed, const int &hours)
+{
+	Network network(scenario, seed);
+	WallClock clock(LEGACY_STEP_US, SLEW_MAX_PPM);
+
+	Result result = {};
+	int64_t trueUs = BOOT_EPOCH_US + 5000000;
+	int64_t endUs = BOOT_EPOCH_US + hours * 3600000000LL;
+	int64_t nextSampleUs = BOOT_EPOCH_US + 3600000000LL;
+
+	// NTP_SERVER resolves to the first server
+	SntpClient parser(SntpClient::Config{MIN_POLL_S, MAX_POLL_S, STEP_US, STABLE_US, AGREE_US, MAX_DRIFT_PPM}, 1);
+	while (trueUs < endUs) {
+		uint8_t request[SNTP_PACKET_LEN];
+		uint8_t reply[SNTP_PACKET_LEN];
+		int64_t arrivalUs;
+
+		parser.startRound();
+		parser.request(0, 0, request);
+		int server = scenario.m_deadServers ? scenario.m_servers - 1 : 0;
+		if (network.exchange(server, request, trueUs, reply, arrivalUs)) {
+			// NTPClient keeps the whole seconds of the transmit timestamp, the sync adds half a second
+			uint32_t seconds = ((uint32_t)reply[40] << 24) | ((uint32_t)reply[41] << 16) | ((uint32_t)reply[42] << 8) | reply[43];
+			int64_t epochUs = SntpClient::toEpochUs((uint64_t)seconds << 32) + 500000;
+			clock.sync(epochUs, network.monotonicUs(arrivalUs));
+			trueUs = arrivalUs;
+		}
+
+		int64_t nextRoundUs = trueUs + LEGACY_INTERVAL_S * 1000000LL;
+		for (; nextSampleUs < nextRoundUs && nextSampleUs < endUs; nextSampleUs += 10000000) {
+			double errorMs = (clock.epochUs(network.monotonicUs(nextSampleUs)) - nextSampleUs) / 1000.0;
+			result.m_errorsMs.push_back(fabs(errorMs));
+		}
+		trueUs = nextRoundUs;
+	}
+
+	result.m_packetsPerHour = network.packets() / (double)hours;
+	return result;
+}
+
+static void checkTimestamps()
+{
+	// 2023-11-14 22:13:20 UTC and a fraction
+	int64_t epochUs = 1700000000123456LL;
+	check(SntpClient::toEpochUs(SntpClient::fromEpochUs(epochUs)) == epochUs, "timestamp round trip");
+	check((SntpClient::fromEpochUs(0) >> 32) == 2208988800ULL, "unix epoch in NTP seconds");
+
+	// era 1: 2040-01-01 is 0x0F8DB880 seconds into it
+	int64_t era1Us = 2208988800LL * 1000000;
+	check(SntpClient::toEpochUs(SntpClient::fromEpochUs(era1Us)) == era1Us, "2040 round trip");
+
+	// malformed answers are rejected
+	SntpClient client(SntpClient::Config{MIN_POLL_S, MAX_POLL_S, STEP_US, STABLE_US, AGREE_US, MAX_DRIFT_PPM}, 1);
+	uint8_t request[SNTP_PACKET_LEN];
+	uint8_t reply[SNTP_PACKET_LEN];
+	client.startRound();
+	client.request(0, 1000, request);
+
+	memset(reply, 0, sizeof(reply));
+	reply[0] = (4 << 3) | 4;
+	reply[1] = 2;
+	memcpy(reply + 24, request + 40, 8);
+	memcpy(reply + 32, request + 40, 8);
+	memcpy(reply + 40, request + 40, 8);
+
+	uint8_t bad[SNTP_PACKET_LEN];
+	memcpy(bad, reply, sizeof(bad));
+	bad[1] = 0;
+	check(!client.response(0, bad, sizeof(bad), 2000), "kiss-o'-death rejected");
+	memcpy(bad, reply, sizeof(bad));
+	bad[0] |= 0xC0;
+	check(!client.response(0, bad, sizeof(bad), 2000), "unsynchronized server rejected");
+	memcpy(bad, reply, sizeof(bad));
+	bad[31] ^= 1;
+	check(!client.response(0, bad, sizeof(bad), 2000), "wrong origin rejected");
+	check(!client.response(0, reply, sizeof(reply) - 1, 2000), "short packet rejected");
+	check(client.response(0, reply, sizeof(reply), 2000), "valid answer accepted");
+	check(!client.response(0, reply, sizeof(reply), 2000), "duplicate answer rejected");
+}
+
+static void usage(const char *name)
+{
+	printf("usage: %s [--seed n] [--hours n] [--scenario name]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t seed = 1;
+	int hours = 24;
+	std::string only;
+
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 >= argc) {
+			usage(argv[0]);
+		}
+		if (!strcmp(argv[i], "--seed")) {
+			seed = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--hours")) {
+			hours = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--scenario")) {
+			only = argv[++i];
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	if (hours < 2) {
+		usage(argv[0]);
+	}
+
+	checkTimestamps();
+	printf("%d hours per scenario, clock error sampled every 10 s after the first hour\n\n", hours);
+
+	for (const Scenario &scenario : g_scenarios) {
+		if (only.length() && only != scenario.m_name) {
+			continue;
+		}
+
+		Result sntp = runSntp(scenario, seed, hours);
+		Result legacy = runLegacy(scenario, seed, hours);
+
+		printf("%s: %s\n", scenario.m_name, scenario.m_description);
+		printf("  legacy   |error| p50 %7.2f ms  p95 %7.2f ms  max %7.2f ms  %5.1f packets/h\n",
+			percentile(legacy.m_errorsMs, 0.5), percentile(legacy.m_errorsMs, 0.95), percentile(legacy.m_errorsMs, 1.0), legacy.m_packetsPerHour);
+		printf("  sntp     |error| p50 %7.2f ms  p95 %7.2f ms  max %7.2f ms  %5.1f packets/h  poll %4.0f s  drift error %+.2f ppm  uncertainty %.2f ms\n\n",
+			percentile(sntp.m_errorsMs, 0.5), percentile(sntp.m_errorsMs, 0.95), percentile(sntp.m_errorsMs, 1.0), sntp.m_packetsPerHour,
+			sntp.m_meanPollS, sntp.m_driftErrorPpm, sntp.m_uncertaintyMs);
+
+		check(percentile(sntp.m_errorsMs, 0.95) < 5.0, "p95 clock error below 5 ms", percentile(sntp.m_errorsMs, 0.95));
+		// a changing drift is estimated as its mean over the fit, some hours for the 1024 s poll interval
+		check(fabs(sntp.m_driftErrorPpm) < 1.0 + scenario.m_driftSwingPpm / 2, "drift estimated", sntp.m_driftErrorPpm);
+		check(sntp.m_covered, "errors within the reported uncertainty");
+	}
+
+	printf("%d checks, %d failures\n", g_checks, g_failures);
+	return g_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
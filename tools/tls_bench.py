@@ -0,0 +1,126 @@
+#
+# Measures full versus resumed TLS handshakes against the HTTPS listener
+# (TLS_ENABLED) using the local OpenSSL through Python's ssl module, then
+# prints the device side handshake histograms from /metrics.
+#
+#   python3 tools/tls_bench.py <device> [--count 20] [--cafile tls_cert.pem]
+#   python3 tools/tls_bench.py <device> --no-tickets    # session ID cache only
+#
+# Without --cafile the certificate is not verified (the generated one is
+# self-signed). The same comparison with the openssl binary:
+#
+#   openssl s_time -connect <device>:443 -new -time 10
+#   openssl s_time -connect <device>:443 -reuse -time 10
+#
+
+import argparse
+import re
+import socket
+import ssl
+import statistics
+import time
+
+
+def context(args):
+	ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+	# the device speaks TLS 1.2, resumption behaves differently with 1.3
+	ctx.maximum_version = ssl.TLSVersion.TLSv1_2
+	if args.cafile:
+		ctx.load_verify_locations(args.cafile)
+		ctx.check_hostname = False
+	else:
+		ctx.check_hostname = False
+		ctx.verify_mode = ssl.CERT_NONE
+	if args.no_tickets:
+		ctx.options |= ssl.OP_NO_TICKET
+	return ctx
+
+
+def request(ctx, args, path, session=None):
+	sock = socket.create_connection((args.host, args.port), timeout=10)
+	start = time.perf_counter()
+	tls = ctx.wrap_socket(sock, server_hostname=args.host, session=session)
+	handshake = (time.perf_counter() - start) * 1000
+
+	tls.sendall(("GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n" % (path, args.host)).encode())
+	response = b""
+	while True:
+		data = tls.recv(4096)
+		if not data:
+			break
+		response += data
+
+	reused = tls.session_reused
+	session = tls.session
+	tls.close()
+	return handshake, reused, session, response.partition(b"\r\n\r\n")[2]
+
+
+def summary(name, samples):
+	if not samples:
+		print("%-8s no samples" % name)
+		return
+	print("%-8s %3d handshakes  min %7.1f  median %7.1f  max %7.1f ms" % (
+		name, len(samples), min(samples), statistics.median(samples), max(samples)))
+
+
+def device_histograms(ctx, args):
+	_, _, _, body = request(ctx, args, "/metrics")
+	values = {}
+	for line in body.decode().splitlines():
+		m = re.match(r"\w+_tls_handshake_(full|resumed)_duration_seconds_(sum|count) (\S+)", line)
+		if m:
+			values[m.group(1), m.group(2)] = float(m.group(3))
+		m = re.match(r"\w+_tls_handshake_failures_total (\S+)", line)
+		if m:
+			values["failures"] = float(m.group(1))
+
+	print("device:")
+	for kind in ("full", "resumed"):
+		count = values.get((kind, "count"), 0)
+		if count:
+			print("  %-8s %5d handshakes, %.1f ms average" % (kind, count, values[kind, "sum"] / count * 1000))
+	print("  failures %5d" % values.get("failures", 0))
+
+
+def main():
+	parser = argparse.ArgumentParser(description="TLS full vs resumed handshake benchmark")
+	parser.add_argument("host")
+	parser.add_argument("--port", type=int, default=443)
+	parser.add_argument("--count", type=int, default=20)
+	parser.add_argument("--path", default="/get")
+	parser.add_argument("--cafile", help="verify against this certificate (e.g. the device's tls_cert.pem)")
+	parser.add_argument("--no-tickets", action="store_true", help="disable session tickets, exercises the session ID cache")
+	args = parser.parse_args()
+
+	ctx = context(args)
+
+	full = []
+	for _ in range(args.count):
+		handshake, _, session, _ = request(ctx, args, args.path)
+		full.append(handshake)
+
+	# every connection resumes the session of the previous one
+	resumed = []
+	misses = 0
+	for _ in range(args.count):
+		handshake, reused, session, body = request(ctx, args, args.path, session)
+		if reused:
+			resumed.append(handshake)
+		else:
+			misses += 1
+
+	print("%s:%d %s, %s" % (args.host, args.port, args.path, "session IDs only" if args.no_tickets else "tickets + session IDs"))
+	summary("full", full)
+	summary("resumed", resumed)
+	if misses:
+		print("%d of %d resumption attempts fell back to a full handshake" % (misses, args.count))
+	if full and resumed:
+		print("resumed handshakes take %.0f%% of a full one" % (statistics.median(resumed) / statistics.median(full) * 100))
+	print("last body: %s" % body[:200].decode(errors="replace"))
+
+	device_histograms(ctx, args)
+
+
+if __name__ == "__main__":
+	main()